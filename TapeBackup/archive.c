@@ -1,4 +1,7 @@
 ﻿#include "archive.h"
+#include "session.h"
+#include "mam.h"
+#include "checkpoint.h"
 
 unsigned TarChecksum(const TAR_HDR *h)
 {
@@ -104,47 +107,137 @@ void TarInitHeader(TAR_HDR_FULL *hdr, const char *name, ULONGLONG size)
     U64ToOctal(sum, hdr->chksum, sizeof(hdr->chksum));
 }
 
+BOOL IsTarHeaderLikely(const TAR_HDR *h) 
+{
+    /* header must be non-zero */
+    const unsigned char *p = (const unsigned char*)h;
+    size_t              i; 
+    int                 allZero = 1;
+    unsigned            stored;
+    unsigned            calc;
+
+    for (i = 0; i < 512; i++) 
+        if (p[i] != 0) 
+        { 
+            allZero = 0;
+            break; 
+        }
+    
+    if (allZero) return FALSE;
+
+    /* parse stored checksum (octal, may be NUL/space padded) */
+    stored = (unsigned)OctalToULL(h->chksum, sizeof(h->chksum));
+    calc = TarChecksum(h);
+    if ((stored == calc) && (stored != 0)) 
+        return TRUE;
+
+    /* Some tools write with signed char sum quirks; allow small tolerance */
+    if ((calc == stored + (' ' * 8)) || 
+        (calc + (' ' * 8) == stored)) 
+        return TRUE;
+
+    /* As a fallback, accept common magic values if present */
+    if (memcmp(h->magic, "ustar", 5) == 0) 
+        return TRUE;
+
+    return FALSE;
+}
+
+BOOL IsLikelyTarFile(LPCWSTR path)
+{
+    HANDLE      h; 
+    BYTE        b[1024]; 
+    DWORD       rd = 0; 
+    BOOL        result;
+    int         zero1, zero2;
+    size_t      i;
+
+    h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return FALSE;
+    result = ReadFile(h, b, sizeof(b), &rd, NULL);
+    CloseHandle(h);
+    
+    if (!result || rd < 512) return FALSE;
+
+    /* empty tar: two zero 512 byte blocks */
+    if (rd >= 1024) 
+    {
+        zero1 = 1;
+        zero2 = 1;
+
+        for (i = 0; i < 512; i++) 
+            if (b[i]) { 
+                zero1 = 0; 
+                break; 
+            } 
+        
+        for (i = 512; i < 1024; i++) 
+            if (b[i]) { 
+                zero2 = 0; 
+                break; 
+            }
+        
+        if (zero1 && zero2) return TRUE;
+    }
+
+    /* usual case: validate first header by checksum */
+    result = IsTarHeaderLikely((const TAR_HDR*)b);
+    
+    return result;
+}
+
+/* in early warning zone writes still succeed but report end of media:
+   trailer of spanned volume is written there */
+static BOOL MetaWrite(HANDLE ht, const void *buf, DWORD n)
+{
+    DWORD wr = 0;
+
+    if (TapeWrite(ht, buf, n, &wr) && wr == n) return TRUE;
+    return GetLastError() == ERROR_END_OF_MEDIA && wr == n;
+}
+
 BOOL WriteMetadataSection(HANDLE ht, const ZEROTAPE_HEADER* zh)
 {
     TAR_HDR_FULL    th;
-    DWORD           wr = 0;
     BYTE            pad[512] = { 0 };
     DWORD           padneed = 512 - 128;
 
+    TRACE_BEGIN("write metadata", 2048);
     TarInitHeader(&th, "metadata", 128);
-    if (!WriteFile(ht, &th, 512, &wr, NULL) || wr != 512)
+    if (!MetaWrite(ht, &th, 512))
     {
         PrintLastErrorW(L"Failed to write metadata tar header", 0);
         return FALSE;
     }
 
-    if (!WriteFile(ht, zh, 128, &wr, NULL) || wr != 128)
+    if (!MetaWrite(ht, zh, 128))
     {
         PrintLastErrorW(L"Failed to write metadata payload", 0);
         return FALSE;
     }
 
-    if (!WriteFile(ht, pad, padneed, &wr, NULL) ||
-        wr != padneed)
+    if (!MetaWrite(ht, pad, padneed))
     {
         PrintLastErrorW(L"Failed to write metadata padding", 0);
         return FALSE;
     }
 
-    if (!WriteFile(ht, pad, 512, &wr, NULL) ||
-        wr != 512)
+    if (!MetaWrite(ht, pad, 512))
     {
         PrintLastErrorW(L"Failed to write TAR zero block 1", 0);
         return FALSE;
     }
 
-    if (!WriteFile(ht, pad, 512, &wr, NULL) || wr != 512)
+    if (!MetaWrite(ht, pad, 512))
     {
         PrintLastErrorW(L"Failed to write TAR zero block 2", 0);
         return FALSE;
     }
 
-    if (!TapeWriteFilemark(ht))
+    TRACE_END("write metadata", 2048);
+    METRIC_ADD(ht, METRIC_BYTES_WRITTEN, 2048);
+    if (!TapeWriteFilemark(ht) && GetLastError() != ERROR_END_OF_MEDIA)
     {
         PrintLastErrorW(L"Failed to write filemark after metadata", 0);
         return FALSE;
@@ -154,6 +247,36 @@ BOOL WriteMetadataSection(HANDLE ht, const ZEROTAPE_HEADER* zh)
 }
 
 BOOL ReadMetadataFromTape(HANDLE ht, ZEROTAPE_HEADER* out)
+{
+    return ReadArchiveMetadata(ht, 0, out);
+}
+
+/* archive 'index' (from 0) of tape with appended archives; served from
+   session cache, or for the first archive from cartridge memory, without
+   moving tape when known (position then unspecified) */
+BOOL ReadArchiveMetadata(HANDLE ht, DWORD index, ZEROTAPE_HEADER* out)
+{
+    MAM_RECORD rec;
+
+    if (SessionGetHeader(ht, index, out)) return TRUE;
+
+    if (index == 0 && MamRead(ht, &rec) && (rec.flags & MAM_FLAG_BOT) &&
+        memcmp(rec.zh.magic, "ZEROTAPE", 8) == 0)
+    {
+        memcpy(out, &rec.zh, sizeof(*out));
+        SessionPutHeader(ht, 0, out);
+        return TRUE;
+    }
+
+    if (!PositionToArchive(ht, index) || !ReadMetadataSection(ht, out)) return FALSE;
+
+    SessionNoteFile(ht, 2 * index);
+    SessionPutHeader(ht, index, out);
+    return TRUE;
+}
+
+/* at current position: volume header or trailer of spanned volume */
+BOOL ReadMetadataSection(HANDLE ht, ZEROTAPE_HEADER* out)
 {
     TAR_HDR_FULL    th;
     DWORD           retbytecount = 0;
@@ -161,21 +284,19 @@ BOOL ReadMetadataFromTape(HANDLE ht, ZEROTAPE_HEADER* out)
     DWORD           skip;
     BYTE            tmp[512];
 
-    wprintf(L"Please wait until tape rewound...\r\n");
-    if (!TapeRewind(ht))
-    {
-        PrintLastErrorW(L"Failed to rewind", 0);
-        return FALSE;
-    }
-
-    if (!ReadFile(ht, &th, 512, &retbytecount, NULL) || retbytecount != 512)
+    TRACE_BEGIN("read metadata", 0);
+    if (!TapeRead(ht, &th, 512, &retbytecount) || retbytecount != 512)
     {
-        PrintLastErrorW(L"Failed to read first TAR header", 0);
+        TRACE_END("read metadata", 0);
+        /* end of data after last archive is not an error for callers walking the tape */
+        if (GetLastError() != ERROR_NO_DATA_DETECTED)
+            PrintLastErrorW(L"Failed to read first TAR header", 0);
         return FALSE;
     }
 
     if (memcmp(th.magic, "ustar ", 6) != 0)
     {
+        TRACE_END("read metadata", 512);
         wprintf(L"First section is not a TAR archive.\r\n");
         return FALSE;
     }
@@ -184,32 +305,61 @@ BOOL ReadMetadataFromTape(HANDLE ht, ZEROTAPE_HEADER* out)
     if (fsz != 128ULL)
         wprintf(L"Metadata size unexpected: %I64u (expected 128)\r\n", fsz);
 
-    if (!ReadFile(ht, out, 128, &retbytecount, NULL) || retbytecount != 128)
+    if (!TapeRead(ht, out, 128, &retbytecount) || retbytecount != 128)
     {
+        TRACE_END("read metadata", 512);
         PrintLastErrorW(L"Failed to read metadata payload", 0);
         return FALSE;
     }
 
     skip = (DWORD)((512 - (fsz % 512)) % 512);
-    if (skip) ReadFile(ht, tmp, skip, &retbytecount, NULL);
+    if (skip) TapeRead(ht, tmp, skip, &retbytecount);
 
-    ReadFile(ht, tmp, 512, &retbytecount, NULL);
-    ReadFile(ht, tmp, 512, &retbytecount, NULL); /* end of tar */
+    TapeRead(ht, tmp, 512, &retbytecount);
+    TapeRead(ht, tmp, 512, &retbytecount); /* end of tar */
+    TRACE_END("read metadata", 2048);
+    METRIC_ADD(ht, METRIC_BYTES_READ, 2048);
     return TRUE;
 }
 
 BOOL PositionToSecondSection(HANDLE ht)
 {
-    DWORD result;
+    return PositionToArchiveData(ht, 0);
+}
+
+/* every archive is two filemarked sections: archive N starts after 2N
+   filemarks, reached with one space operation from BOT, no header scan;
+   session handle gets there from where the tape is (see session.h) */
+BOOL PositionToArchive(HANDLE ht, DWORD index)
+{
+    if (SessionOwns(ht)) return SessionSeekFile(ht, 2 * index);
+
+    wprintf(L"Please wait until tape rewound...\r\n");
+    if (!TapeRewind(ht))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        return FALSE;
+    }
+
+    if (index > 0 && !TapeSpaceFilemarks(ht, (LONG)(2 * index)))
+    {
+        PrintLastErrorW(L"Failed to position to archive", 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL PositionToArchiveData(HANDLE ht, DWORD index)
+{
+    if (SessionOwns(ht)) return SessionSeekFile(ht, 2 * index + 1);
 
     wprintf(L"Please wait until tape rewound...\r\n");
     if (!TapeRewind(ht)) return FALSE;
 
-    result = SetTapePosition(ht, TAPE_SPACE_FILEMARKS, 0, 1, 0, FALSE);
-    if (result != NO_ERROR)
+    if (!TapeSpaceFilemarks(ht, (LONG)(2 * index + 1)))
     {
-        SetLastError(result);
-        PrintLastErrorW(L"Failed to position to second section", result);
+        PrintLastErrorW(L"Failed to position to second section", 0);
         return FALSE;
     }
 
@@ -222,7 +372,7 @@ BOOL ParsePaxAndGet(const BYTE* buf, DWORD len, const char* key,
     /* Format: <len> <key>=<value>\n, where len includes entire string */
 
     size_t      i, lnum, pos = 0;
-    size_t      recStart, recLen;
+    size_t      recStart, recLen, fieldLen;
     const char  *rec, *eq;
     size_t      keyLen, valLen;
 
@@ -242,20 +392,21 @@ BOOL ParsePaxAndGet(const BYTE* buf, DWORD len, const char* key,
 
         recStart = pos;
         recLen = lnum;
-        if (recLen == 0 || recStart + recLen > len) break;
+        if (recLen == 0 || recStart + recLen > len || i + 1 >= recStart + recLen) break;
 
-        /* record string in buf[recStart .. recStart+recLen-1] */
-        rec = (const char*)(buf + recStart);
-        eq = memchr(rec, '=', recLen);
+        /* "key=value\n" in buf[i+1 .. recStart+recLen-1], after the length */
+        rec = (const char*)(buf + i + 1);
+        fieldLen = recStart + recLen - (i + 1);
+        eq = memchr(rec, '=', fieldLen);
         if (eq)
         {
             keyLen = (size_t)(eq - rec);
             /* rec ends; cut the value carefully */
-            if (keyLen > 0 && keyLen < 128)
+            if (keyLen > 0 && keyLen < 128 && keyLen + 2 <= fieldLen)
             {
                 if ((size_t)keyLen == strlen(key) && memcmp(rec, key, keyLen) == 0)
                 {
-                    valLen = recLen - (size_t)(eq - rec) - 1 /* '=' */ - 1 /* '\n' */;
+                    valLen = fieldLen - keyLen - 1 /* '=' */ - 1 /* '\n' */;
                     if (valLen >= outsz) valLen = outsz - 1;
                     memcpy(out, eq + 1, valLen);
                     out[valLen] = 0;
@@ -286,7 +437,151 @@ void AnsiOrUtf8ToWide(const char* s, size_t n, WCHAR* out, size_t cch)
     }
 }
 
-BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
+/* PAX keys of the member that follows, besides path and linkpath */
+typedef struct _TAR_PAX {
+    BOOL        seen;
+    BOOL        haveSize;
+    BOOL        haveMtime;
+    BOOL        haveUid;
+    BOOL        haveGid;
+    ULONGLONG   size;
+    LONGLONG    mtime;
+    DWORD       uid;
+    DWORD       gid;
+    char        uname[256];     /* UTF-8, "" - from header */
+    char        gname[256];
+} TAR_PAX;
+
+/* decimal, optional sign; a fraction ("mtime=1700000000.25") is dropped */
+static BOOL TarPaxNumber(const BYTE *buf, DWORD len, const char *key, LONGLONG *out)
+{
+    char        v[64];
+    const char  *p;
+    BOOL        neg;
+    ULONGLONG   n = 0;
+
+    if (!ParsePaxAndGet(buf, len, key, v, sizeof(v))) return FALSE;
+
+    p = v;
+    neg = (*p == '-');
+    if (neg) p++;
+    if (*p < '0' || *p > '9') return FALSE;
+    for (; *p >= '0' && *p <= '9'; p++)
+        n = n * 10 + (ULONGLONG)(*p - '0');
+    *out = neg ? -(LONGLONG)n : (LONGLONG)n;
+    return TRUE;
+}
+
+static void TarParsePax(const BYTE *buf, DWORD len, TAR_PAX *pax)
+{
+    LONGLONG v;
+
+    pax->seen = TRUE;
+    if (TarPaxNumber(buf, len, "size", &v) && v >= 0)
+    {
+        pax->size = (ULONGLONG)v;
+        pax->haveSize = TRUE;
+    }
+    if (TarPaxNumber(buf, len, "mtime", &v))
+    {
+        pax->mtime = v;
+        pax->haveMtime = TRUE;
+    }
+    if (TarPaxNumber(buf, len, "uid", &v))
+    {
+        pax->uid = (DWORD)v;
+        pax->haveUid = TRUE;
+    }
+    if (TarPaxNumber(buf, len, "gid", &v))
+    {
+        pax->gid = (DWORD)v;
+        pax->haveGid = TRUE;
+    }
+    ParsePaxAndGet(buf, len, "uname", pax->uname, sizeof(pax->uname));
+    ParsePaxAndGet(buf, len, "gname", pax->gname, sizeof(pax->gname));
+}
+
+/* ustar text field, ANSI or UTF-8, NUL-terminated only when shorter */
+static void TarFieldToUtf8(const char *s, size_t n, char *out, int cb)
+{
+    WCHAR w[256];
+
+    AnsiOrUtf8ToWide(s, a_strnlen(s, n), w, 256);
+    if (!WideCharToMultiByte(CP_UTF8, 0, w, -1, out, cb, NULL, NULL))
+        out[0] = 0;
+}
+
+/* wlink - GNU longlink or PAX linkpath, NULL or "" - header's linkname;
+   pax - NULL or overrides from the member's PAX header; size is the
+   walker's, PAX size already applied since it also skips the data */
+static void TarEmitMember(TAR_MEMBER_SINK sink, void *ctx, const TAR_HDR *hdr, LPCWSTR wname,
+    LPCWSTR wlink, const TAR_PAX *pax, ULONGLONG offset, ULONGLONG dataOffset, ULONGLONG size)
+{
+    TAR_MEMBER  m;
+    char        name[4096 * 3];
+    char        link[4096 * 3];
+    char        uname[256];
+    char        gname[256];
+
+    if (!WideCharToMultiByte(CP_UTF8, 0, wname, -1, name, sizeof(name), NULL, NULL))
+        return;
+
+    if (wlink && wlink[0])
+    {
+        if (!WideCharToMultiByte(CP_UTF8, 0, wlink, -1, link, sizeof(link), NULL, NULL))
+            link[0] = 0;
+    }
+    else
+        TarFieldToUtf8(hdr->linkname, sizeof(hdr->linkname), link, sizeof(link));
+
+    m.name = name;
+    m.offset = offset;
+    m.dataOffset = dataOffset;
+    m.size = size;
+    m.mtime = (LONGLONG)OctalToULL(hdr->mtime, sizeof(hdr->mtime));
+    m.mode = (DWORD)OctalToULL(hdr->mode, sizeof(hdr->mode));
+    m.type = hdr->typeflag ? hdr->typeflag : '0';
+    m.link = link;
+    m.uid = (DWORD)OctalToULL(hdr->uid, sizeof(hdr->uid));
+    m.gid = (DWORD)OctalToULL(hdr->gid, sizeof(hdr->gid));
+    m.devmajor = (DWORD)OctalToULL(hdr->devmajor, sizeof(hdr->devmajor));
+    m.devminor = (DWORD)OctalToULL(hdr->devminor, sizeof(hdr->devminor));
+    m.chksum = (DWORD)OctalToULL(hdr->chksum, sizeof(hdr->chksum));
+
+    if (memcmp(hdr->magic, "ustar", 5) != 0)
+        m.format = TAR_FORMAT_V7;
+    else if (hdr->magic[5] == ' ')
+        m.format = TAR_FORMAT_GNU;
+    else
+        m.format = TAR_FORMAT_USTAR;
+
+    /* v7 headers carry no names */
+    if (m.format == TAR_FORMAT_V7)
+    {
+        uname[0] = 0;
+        gname[0] = 0;
+    }
+    else
+    {
+        TarFieldToUtf8(hdr->uname, sizeof(hdr->uname), uname, sizeof(uname));
+        TarFieldToUtf8(hdr->gname, sizeof(hdr->gname), gname, sizeof(gname));
+    }
+
+    if (pax && pax->seen)
+    {
+        m.format = TAR_FORMAT_PAX;
+        if (pax->haveMtime) m.mtime = pax->mtime;
+        if (pax->haveUid) m.uid = pax->uid;
+        if (pax->haveGid) m.gid = pax->gid;
+        if (pax->uname[0]) strcpy(uname, pax->uname);
+        if (pax->gname[0]) strcpy(gname, pax->gname);
+    }
+    m.uname = uname;
+    m.gname = gname;
+    sink(ctx, &m);
+}
+
+BOOL VerifyTarOnTape(HANDLE h, FILE* flog, TAR_MEMBER_SINK sink, void *ctx)
 {
     TAPE_READER         tr;
     DWORD               tick = 0;
@@ -315,6 +610,10 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
     WCHAR               line[1024];
     BYTE                discard[2048];
     WCHAR               sum[256];
+    ULONGLONG           hdrOffset;
+    ULONGLONG           memberOffset = TAR_NO_OFFSET;
+
+    TAR_PAX             pax;
 
     /***NEW:*/
     WCHAR               pendingLongNameW[4096];
@@ -324,13 +623,23 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
     pendingLongLinkW[0] = 0;
     /*WEN***/
 
-    TapeReaderInit(&tr, h);
+    ZeroMemory(&pax, sizeof(pax));
+
+    if (!TapeReaderInit(&tr, h)) return FALSE;
     ZeroMemory(&st, sizeof(st));
     pendingLongName[0] = 0;
     pendingLongLink[0] = 0;
 
     for (;;)
     {
+        if (ProgressCancelled())
+        {
+            PrintLastErrorW(L"Stopped", 0);
+            TapeReaderFree(&tr);
+            return FALSE;
+        }
+
+        hdrOffset = tr.offset;
         got = TapeReaderGet(&tr, (BYTE*)&hdr, 512);
 
         if (got == 0) {
@@ -341,6 +650,7 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
         if (got < 512) {
             wprintf(L"Short header.\r\n");
             st.filesBad++;
+            METRIC_ADD(h, METRIC_BAD_HEADERS, 1);
             break;
         }
 
@@ -389,10 +699,12 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
             DWORD       step;
             ULONGLONG   pad;
 
+            if (memberOffset == TAR_NO_OFFSET) memberOffset = hdrOffset;
             payload = (BYTE*)malloc((size_t)left);
             if (!payload)
             {
                 wprintf(L"\nOOM\n");
+                TapeReaderFree(&tr);
                 return FALSE;
             }
 
@@ -439,12 +751,16 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
                     Utf8ToWide(tmp, strlen(tmp), pendingLongNameW, 4096);
                 if (ParsePaxAndGet(payload, off, "linkpath", tmp, sizeof(tmp)))
                     Utf8ToWide(tmp, strlen(tmp), pendingLongLinkW, 4096);
+                TarParsePax(payload, off, &pax);
             }
 
             free(payload);
             continue; /* reading next usual header */
         }
 
+        /* PAX size wins over the header's, for the data skipped below too */
+        if (pax.haveSize) fsize = pax.size;
+
         //building correct filename
         if (pendingLongNameW[0])
         {
@@ -460,6 +776,22 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
         //reset for next iterations
         pendingLongNameW[0] = 0;
 
+        if (sink)
+            TarEmitMember(sink, ctx, &hdr, wname, pendingLongLinkW, &pax,
+                (memberOffset == TAR_NO_OFFSET) ? hdrOffset : memberOffset, tr.offset, fsize);
+        memberOffset = TAR_NO_OFFSET;
+        pendingLongLinkW[0] = 0;
+        ZeroMemory(&pax, sizeof(pax));
+
+        TRACE_BEGIN("tar member", fsize);
+        st.filesTotal++;
+        METRIC_ADD(h, METRIC_FILES_VERIFIED, 1);
+        if (bad)
+        {
+            st.filesBad++;
+            METRIC_ADD(h, METRIC_BAD_HEADERS, 1);
+        }
+
         wprintf(L"[%ws] size=%I64u bytes checksum=%ws\r\n", wname, fsize, bad ? L"FAIL" : L"OK");
         fflush(stdout);
         if (flog)
@@ -484,6 +816,7 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
             g = TapeReaderGet(&tr, discard, step);
             if (g == 0) break; pad -= g; st.bytesProcessed += g;
         }
+        TRACE_END("tar member", fsize);
         pendingLongName[0] = 0;
         pendingLongLink[0] = 0;
     }
@@ -498,10 +831,11 @@ BOOL VerifyTarOnTape(HANDLE h, FILE* flog)
         FPrintLineUtf8(flog, sum);
     }
 
+    TapeReaderFree(&tr);
     return (st.filesBad == 0);
 }
 
-BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
+BOOL ListTarTOCToFile(HANDLE h, FILE* fout, TAR_MEMBER_SINK sink, void *ctx)
 {
     TAPE_READER         tr;
     DWORD               tick = 0;
@@ -522,6 +856,10 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
     char                fullname[4096];
     WCHAR               wname[1024];
     BYTE                discard[2048];
+    ULONGLONG           hdrOffset;
+    ULONGLONG           memberOffset = TAR_NO_OFFSET;
+
+    TAR_PAX             pax;
 
     /***NEW:*/
     WCHAR               pendingLongNameW[4096];
@@ -531,11 +869,14 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
     pendingLongLinkW[0] = 0;
     /*WEN***/
 
-    TapeReaderInit(&tr, h);
+    ZeroMemory(&pax, sizeof(pax));
+
+    if (!TapeReaderInit(&tr, h)) return FALSE;
     pendingLongName[0] = 0;
     pendingLongLink[0] = 0;
     for (;;)
     {
+        hdrOffset = tr.offset;
         retbytes = TapeReaderGet(&tr, (BYTE*)&hdr, 512);
         if (retbytes == 0)
         {
@@ -591,10 +932,12 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
             DWORD       step;
             ULONGLONG   pad;
 
+            if (memberOffset == TAR_NO_OFFSET) memberOffset = hdrOffset;
             payload = (BYTE*)malloc((size_t)left);
             if (!payload)
             {
                 wprintf(L"\nOOM\n");
+                TapeReaderFree(&tr);
                 return FALSE;
             }
 
@@ -641,12 +984,16 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
                     Utf8ToWide(tmp, strlen(tmp), pendingLongNameW, 4096);
                 if (ParsePaxAndGet(payload, off, "linkpath", tmp, sizeof(tmp)))
                     Utf8ToWide(tmp, strlen(tmp), pendingLongLinkW, 4096);
+                TarParsePax(payload, off, &pax);
             }
 
             free(payload);
             continue; /* reading next usual header */
         }
 
+        /* PAX size wins over the header's, for the data skipped below too */
+        if (pax.haveSize) fsize = pax.size;
+
         //building correct filename
         if (pendingLongNameW[0])
         {
@@ -662,6 +1009,7 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
         //reset for next iterations
         pendingLongNameW[0] = 0;
 
+        TRACE_BEGIN("tar member", fsize);
         //some two empty strings defeat fix
         n = wcsnlen(wname, 1024);
         if (n > 0)
@@ -671,7 +1019,13 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
                 wprintf(L"%ws\r\n", wname);
                 if (fout)
                     FPrintLineUtf8(fout, wname);
+                if (sink)
+                    TarEmitMember(sink, ctx, &hdr, wname, pendingLongLinkW, &pax,
+                        (memberOffset == TAR_NO_OFFSET) ? hdrOffset : memberOffset, tr.offset, fsize);
             }
+        memberOffset = TAR_NO_OFFSET;
+        pendingLongLinkW[0] = 0;
+        ZeroMemory(&pax, sizeof(pax));
 
         left = fsize;
         while (left > 0)
@@ -696,6 +1050,107 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
             if (retbytes == 0) break;
             pad -= retbytes;
         }
+        TRACE_END("tar member", fsize);
+    }
+
+    TapeReaderFree(&tr);
+    return TRUE;
+}
+
+/* plain TAR file, header to header: data is skipped by seeking */
+BOOL ScanTarFile(HANDLE hf, TAR_MEMBER_SINK sink, void *ctx)
+{
+    TAR_HDR         hdr;
+    LARGE_INTEGER   li;
+    ULONGLONG       pos = 0, member = 0;
+    ULONGLONG       fsize, span;
+    BYTE            *ext;
+    const BYTE      *ph;
+    char            name[4096];
+    char            longName[4096];
+    char            longLink[4096];
+    char            *dst;
+    WCHAR           wname[4096];
+    WCHAR           wlink[4096];
+    DWORD           got = 0, len;
+    size_t          i;
+    BOOL            zero;
+    TAR_PAX         pax;
+
+    longName[0] = 0;
+    longLink[0] = 0;
+    ZeroMemory(&pax, sizeof(pax));
+    for (;;)
+    {
+        li.QuadPart = (LONGLONG)pos;
+        if (!SetFilePointerEx(hf, li, NULL, FILE_BEGIN) || !ReadFile(hf, &hdr, 512, &got, NULL))
+        {
+            PrintLastErrorW(L"Failed to read TAR file", 0);
+            return FALSE;
+        }
+        if (got < 512) break;
+
+        ph = (const BYTE*)&hdr;
+        zero = TRUE;
+        for (i = 0; i < 512 && zero; i++)
+            if (ph[i] != 0) zero = FALSE;
+        if (zero) break;
+
+        fsize = OctalToULL(hdr.size, sizeof(hdr.size));
+        span = 512 + ((fsize + 511ULL) & ~511ULL);
+
+        if (hdr.typeflag == 'L' || hdr.typeflag == 'K' || hdr.typeflag == 'x')
+        {
+            /* GNU longname/longlink or PAX header of the member that follows */
+            if (fsize > 0 && fsize < 1024 * 1024)
+            {
+                ext = (BYTE*)malloc((size_t)fsize);
+                if (!ext)
+                {
+                    wprintf(L"Out of memory.\r\n");
+                    return FALSE;
+                }
+
+                if (ReadFile(hf, ext, (DWORD)fsize, &got, NULL))
+                {
+                    if (hdr.typeflag != 'x')
+                    {
+                        dst = (hdr.typeflag == 'L') ? longName : longLink;
+                        len = (DWORD)a_strnlen((const char*)ext, got);
+                        if (len >= sizeof(longName)) len = sizeof(longName) - 1;
+                        memcpy(dst, ext, len);
+                        dst[len] = 0;
+                    }
+                    else
+                    {
+                        ParsePaxAndGet(ext, got, "path", longName, sizeof(longName));
+                        ParsePaxAndGet(ext, got, "linkpath", longLink, sizeof(longLink));
+                        TarParsePax(ext, got, &pax);
+                    }
+                }
+                free(ext);
+            }
+        }
+        else if (hdr.typeflag == 'g')
+            member = pos + span;
+        else
+        {
+            if (pax.haveSize)
+            {
+                fsize = pax.size;
+                span = 512 + ((fsize + 511ULL) & ~511ULL);
+            }
+            TarBuildName(&hdr, name, sizeof(name), longName);
+            AnsiOrUtf8ToWide(name, a_strnlen(name, sizeof(name)), wname, 4096);
+            AnsiOrUtf8ToWide(longLink, a_strnlen(longLink, sizeof(longLink)), wlink, 4096);
+            TarEmitMember(sink, ctx, &hdr, wname, wlink, &pax, member, pos + 512, fsize);
+            longName[0] = 0;
+            longLink[0] = 0;
+            ZeroMemory(&pax, sizeof(pax));
+            member = pos + span;
+        }
+
+        pos += span;
     }
 
     return TRUE;
@@ -703,113 +1158,547 @@ BOOL ListTarTOCToFile(HANDLE h, FILE* fout)
 
 /* --------------------------------------
 Section #2 I/O
+Both directions run through a BUF_RING: a worker thread feeds it
+(source file or tape), the calling thread drains it.
+-------------------------------------- */
+DWORD ZeroTapeBlockSize(const ZEROTAPE_HEADER *zh)
+{
+    DWORD bs = GetLE32(zh->blocksize);
+
+    return (bs == 0 || bs > TAPE_MAX_BLOCK) ? TAPE_IO_BUF : bs;
+}
+
+BOOL ZeroTapeIsStriped(const ZEROTAPE_HEADER *zh)
+{
+    return GetLE32(zh->stripeunit) != 0 && zh->stripedata > 0;
+}
+
+/* --------------------------------------
+Directory archive: section #2 is an array of ZEROTAPE headers,
+entry i is the archive starting after 2*i filemarks
 -------------------------------------- */
-BOOL WriteArchiveToSecondSection(HANDLE ht,
-    HANDLE hf, ULONGLONG totalSize)
-{
-    BYTE        *buf;
-    ULONGLONG   done = 0;
-    BOOL        ok = TRUE;
-    DWORD       toRead;
-    DWORD       retbytes = 0;
+BOOL WriteDirectorySection(HANDLE ht, const ZEROTAPE_HEADER *entries, DWORD count,
+    DWORD blockSize)
+{
+    const BYTE  *p = (const BYTE*)entries;
+    DWORD       total = count * sizeof(ZEROTAPE_HEADER);
+    DWORD       off, n;
     DWORD       written = 0;
-    unsigned    pct;
+    BOOL        result;
 
-    buf = (BYTE*)malloc(TAPE_IO_BUF);
-    if (!buf)
+    TRACE_BEGIN("write directory", total);
+    for (off = 0; off < total; off += n)
     {
-        wprintf(L"Out of memory.\r\n");
+        n = (total - off > blockSize) ? blockSize : total - off;
+        result = TapeWrite(ht, p + off, n, &written);
+        METRIC_ADD(ht, METRIC_BYTES_WRITTEN, written);
+        if (written != n || (!result && GetLastError() != ERROR_END_OF_MEDIA))
+        {
+            TRACE_END("write directory", off);
+            PrintLastErrorW(L"Failed to write directory", 0);
+            return FALSE;
+        }
+    }
+    TRACE_END("write directory", total);
+
+    return TRUE;
+}
+
+/* at section #2 of directory archive zh, checks its SHA-1 */
+BOOL ReadDirectorySection(HANDLE ht, const ZEROTAPE_HEADER *zh,
+    ZEROTAPE_HEADER *entries, DWORD maxCount, DWORD *count)
+{
+    BYTE            *p = (BYTE*)entries;
+    ULONGLONG       total = GetLE64(zh->sizeofarchive);
+    DWORD           bs = ZeroTapeBlockSize(zh);
+    DWORD           off, n;
+    DWORD           got = 0;
+    SHA1_CTX        ctx;
+    unsigned char   digest[20];
+
+    *count = 0;
+    if (zh->format != ZEROTAPE_FORMAT_DIRECTORY || total % sizeof(ZEROTAPE_HEADER) != 0 ||
+        total / sizeof(ZEROTAPE_HEADER) > maxCount)
+    {
+        wprintf(L"Invalid directory archive.\r\n");
         return FALSE;
     }
 
-    while (done < totalSize)
+    TRACE_BEGIN("read directory", 0);
+    for (off = 0; off < (DWORD)total; off += got)
+    {
+        n = ((DWORD)total - off > bs) ? bs : (DWORD)total - off;
+        if (!TapeRead(ht, p + off, n, &got) || got == 0)
+        {
+            TRACE_END("read directory", off);
+            PrintLastErrorW(L"Failed to read directory", 0);
+            return FALSE;
+        }
+        METRIC_ADD(ht, METRIC_BYTES_READ, got);
+    }
+    TRACE_END("read directory", total);
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, p, (DWORD)total);
+    sha1_final(&ctx, digest);
+    if (memcmp(digest, zh->sha1, 20) != 0)
     {
-        toRead = (DWORD)((totalSize - done) > TAPE_IO_BUF ?
-            TAPE_IO_BUF :
-            (totalSize - done));
+        wprintf(L"Directory SHA-1 mismatch.\r\n");
+        return FALSE;
+    }
 
-        if (!ReadFile(hf, buf, toRead, &retbytes, NULL))
+    *count = (DWORD)(total / sizeof(ZEROTAPE_HEADER));
+    return TRUE;
+}
+
+WORD ZeroTapeVolume(const ZEROTAPE_HEADER *zh)
+{
+    return (WORD)(zh->volseq[0] | (zh->volseq[1] << 8));
+}
+
+void ZeroTapeSetVolume(ZEROTAPE_HEADER *zh, WORD volume)
+{
+    zh->volseq[0] = (unsigned char)(volume & 0xFF);
+    zh->volseq[1] = (unsigned char)(volume >> 8);
+}
+
+typedef struct _SECTION_PRODUCER {
+    BUF_RING    *ring;
+    AUTOTUNE    *tune;
+    TAPE_SPAN   *span;
+    SPOOL       *spool;         /* staged source instead of h */
+    HANDLE      h;              /* source file or tape */
+    ULONGLONG   totalSize;
+    DWORD       blockSize;      /* tape block size */
+    BOOL        failed;
+    DWORD       error;
+} SECTION_PRODUCER;
+
+/* fills whole chunk: the consumer cuts it into tape blocks */
+static DWORD WINAPI SourceReaderThread(LPVOID param)
+{
+    SECTION_PRODUCER    *p = (SECTION_PRODUCER*)param;
+    ULONGLONG           done = 0;
+    BYTE                *buf;
+    DWORD               toRead;
+    DWORD               retbytes = 0;
+    BOOL                result;
+
+    TraceThreadName("source reader");
+    while (done < p->totalSize)
+    {
+        buf = RingGetFree(p->ring);
+        if (!buf) return 0;
+
+        toRead = (DWORD)((p->totalSize - done) > p->ring->prodSize ?
+            p->ring->prodSize :
+            (p->totalSize - done));
+
+        if (p->spool)
+            result = SpoolRead(p->spool, buf, toRead, &retbytes);
+        else
         {
-            PrintLastErrorW(L"Failed to read source file", 0);
-            ok = FALSE;
-            break;
+            TRACE_BEGIN("source read", 0);
+            result = ReadFile(p->h, buf, toRead, &retbytes, NULL);
+            TRACE_END("source read", retbytes);
+        }
+        if (!result)
+        {
+            p->failed = TRUE;
+            p->error = GetLastError();
+            RingPut(p->ring, 0);
+            return 1;
         }
 
-        if (retbytes == 0) break;
+        RingPut(p->ring, retbytes);
+        if (retbytes == 0) return 0;
+        done += retbytes;
+    }
+
+    if (RingGetFree(p->ring)) RingPut(p->ring, 0);
+    return 0;
+}
+
+/* one chunk - as many tape blocks as fit */
+static DWORD WINAPI TapeReaderThread(LPVOID param)
+{
+    SECTION_PRODUCER    *p = (SECTION_PRODUCER*)param;
+    ULONGLONG           done = 0;
+    BYTE                *buf;
+    DWORD               fill;
+    DWORD               toRead;
+    DWORD               retbytes = 0;
+    BOOL                result;
+    double              t0;
+
+    TraceThreadName("tape reader");
+    while (done < p->totalSize)
+    {
+        buf = RingGetFree(p->ring);
+        if (!buf) return 0;
 
-        if (!WriteFile(ht, buf, retbytes, &written, NULL) || written != retbytes)
+        fill = 0;
+        while (done < p->totalSize && p->ring->prodSize - fill >= p->blockSize)
         {
+            toRead = (DWORD)((p->totalSize - done) > p->blockSize ?
+                p->blockSize :
+                (p->totalSize - done));
+
+            t0 = TimerSeconds();
+            TRACE_BEGIN("tape read", 0);
+            result = TapeRead(p->h, buf + fill, toRead, &retbytes);
+            TRACE_END("tape read", retbytes);
+            AutoTuneTapeOp(p->tune, TimerSeconds() - t0);
+            METRIC_ADD(p->h, METRIC_BYTES_READ, retbytes);
+            if (!result && p->span && GetLastError() == ERROR_FILEMARK_DETECTED)
+            {
+                /* end of this volume's data */
+                p->h = p->span->next(p->span, p->h, done);
+                if (p->h != INVALID_HANDLE_VALUE) continue;
+                result = FALSE;
+                retbytes = 0;
+            }
+            if (!result || retbytes == 0)
+            {
+                METRIC_ADD(p->h, METRIC_DEVICE_ERRORS, 1);
+                p->failed = TRUE;
+                p->error = GetLastError();
+                if (fill) RingPut(p->ring, fill);
+                if (!fill || RingGetFree(p->ring)) RingPut(p->ring, 0);
+                return 1;
+            }
+
+            fill += retbytes;
+            done += retbytes;
+        }
+
+        RingPut(p->ring, fill);
+    }
+
+    if (RingGetFree(p->ring)) RingPut(p->ring, 0);
+    return 0;
+}
+
+static HANDLE StartProducer(SECTION_PRODUCER *p, BUF_RING *ring, AUTOTUNE *tune,
+    TAPE_SPAN *span, SPOOL *spool, const TAPE_IO_PROFILE *prof, DWORD blockSize,
+    HANDLE h, ULONGLONG totalSize, LPTHREAD_START_ROUTINE proc)
+{
+    TAPE_IO_PROFILE io;
+    HANDLE          thread;
+    DWORD           count, chunk;
+
+    io = *prof;
+    io.blockSize = blockSize;
+    AutoTuneInit(tune, &io, proc == SourceReaderThread, &count, &chunk);
+    if (!RingCreate(ring, count, chunk))
+    {
+        wprintf(L"Out of memory.\r\n");
+        return NULL;
+    }
+    AutoTuneStart(tune, ring);
+
+    ZeroMemory(p, sizeof(*p));
+    p->ring = ring;
+    p->tune = tune;
+    p->span = span;
+    p->spool = spool;
+    p->h = h;
+    p->totalSize = totalSize;
+    p->blockSize = blockSize;
+
+    thread = CreateThread(NULL, 0, proc, p, 0, NULL);
+    if (!thread)
+    {
+        PrintLastErrorW(L"Failed to start I/O thread", 0);
+        RingDestroy(ring);
+    }
+
+    return thread;
+}
+
+static void StopProducer(HANDLE thread, BUF_RING *ring, BOOL abort)
+{
+    if (abort) RingAbort(ring);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    RingDestroy(ring);
+}
+
+/* source is hf or, if set, spool */
+static BOOL WriteSection(HANDLE ht, HANDLE hf, SPOOL *spool,
+    ULONGLONG totalSize, const TAPE_IO_PROFILE *prof, TAPE_SPAN *span, CHECKPOINT *cp)
+{
+    TAPE_IO_PROFILE     def;
+    BUF_RING            ring;
+    AUTOTUNE            tune;
+    SECTION_PRODUCER    prod;
+    HANDLE              thread;
+    BYTE                *buf;
+    ULONGLONG           done = 0;
+    BOOL                ok = TRUE;
+    DWORD               len = 0;
+    DWORD               off, n;
+    DWORD               written = 0;
+    BOOL                result;
+    double              t0;
+    unsigned            pct;
+    DWORD               part;
+    ULONGLONG           block;
+
+    if (!prof)
+    {
+        TapeDefaultProfile(&def);
+        prof = &def;
+    }
+
+    if (cp)
+    {
+        CheckpointStart(cp, ht);
+        done = cp->rec.done;
+    }
+
+    thread = StartProducer(&prod, &ring, &tune, NULL, spool, prof, prof->blockSize,
+        hf, totalSize - done, SourceReaderThread);
+    if (!thread) return FALSE;
+
+    for (;;)
+    {
+        buf = RingGetFull(&ring, &len);
+        if (!buf || len == 0) break;
+
+        /* chunk may hold several blocks, block size on tape stays the same */
+        for (off = 0; ok && off < len; off += written)
+        {
+            n = (len - off > prof->blockSize) ? prof->blockSize : len - off;
+
+            t0 = TimerSeconds();
+            TRACE_BEGIN("tape write", 0);
+            result = TapeWrite(ht, buf + off, n, &written);
+            TRACE_END("tape write", written);
+            AutoTuneTapeOp(&tune, TimerSeconds() - t0);
+            METRIC_ADD(ht, METRIC_BYTES_WRITTEN, written);
+            if (result && written == n) continue;
+
+            if (span && GetLastError() == ERROR_END_OF_MEDIA)
+            {
+                /* early warning: what was written stays, the rest goes to next volume */
+                if (done + off + written == totalSize) continue;
+
+                ht = span->next(span, ht, done + off + written);
+                if (ht != INVALID_HANDLE_VALUE) continue;
+                ok = FALSE;
+                break;
+            }
+
+            METRIC_ADD(ht, METRIC_DEVICE_ERRORS, 1);
             PrintLastErrorW(L"Failed to write to tape", 0);
             ok = FALSE;
-            break;
         }
+        if (!ok) break;
+        RingRelease(&ring);
 
-        done += retbytes;
+        done += len;
         pct = (unsigned)((done * 100ULL) / totalSize);
         DrawProgressBar(pct, done, totalSize);
+        AutoTuneTick(&tune);
+
+        /* drive buffer goes to tape first, so position covers all of done */
+        if (CheckpointDue(cp) && TapeFlush(ht) && TapeGetPosition(ht, &part, &block))
+            CheckpointSave(cp, done, block, NULL);
     }
 
-    //wprintf(L"");
-    free(buf);
+    StopProducer(thread, &ring, !ok);
+    if (prod.failed)
+    {
+        PrintLastErrorW(L"Failed to read source file", prod.error);
+        ok = FALSE;
+    }
 
     return ok;
 }
 
-BOOL CopySecondSectionToFileAndOrHash(HANDLE ht, ULONGLONG totalSize,
-    HANDLE hf, unsigned char outSha1[20])
-{
-    BYTE        *buf;
-    SHA1_CTX    ctx;
-    ULONGLONG   done = 0;
-    BOOL        ok = TRUE;
-    DWORD       toRead;
-    DWORD       retbytes = 0;
-    BOOL        result;
-    DWORD       written = 0;
-    unsigned    pct;
+BOOL WriteArchiveToSecondSection(HANDLE ht, HANDLE hf, ULONGLONG totalSize,
+    const TAPE_IO_PROFILE *prof, TAPE_SPAN *span, CHECKPOINT *cp)
+{
+    return WriteSection(ht, hf, NULL, totalSize, prof, span, cp);
+}
 
-    buf = (BYTE*)malloc(TAPE_IO_BUF);
-    if (!buf)
+BOOL WriteSpoolToSecondSection(HANDLE ht, SPOOL *spool, ULONGLONG totalSize,
+    const TAPE_IO_PROFILE *prof, TAPE_SPAN *span, CHECKPOINT *cp)
+{
+    return WriteSection(ht, NULL, spool, totalSize, prof, span, cp);
+}
+
+BOOL CopySecondSectionToFileAndOrHash(HANDLE ht, ULONGLONG totalSize,
+    HANDLE hf, unsigned char outSha1[20], const TAPE_IO_PROFILE *prof, TAPE_SPAN *span,
+    CHECKPOINT *cp)
+{
+    TAPE_IO_PROFILE     def;
+    BUF_RING            ring;
+    AUTOTUNE            tune;
+    SECTION_PRODUCER    prod;
+    HANDLE              thread;
+    BYTE                *buf;
+    SHA1_CTX            ctx;
+    ULONGLONG           done = 0;
+    BOOL                ok = TRUE;
+    DWORD               len = 0;
+    BOOL                result;
+    DWORD               written = 0;
+    unsigned            pct;
+
+    if (!prof)
     {
-        wprintf(L"Out of memory.\r\n");
-        return FALSE;
+        TapeDefaultProfile(&def);
+        prof = &def;
     }
 
-    if (outSha1) sha1_init(&ctx);
-    while (done < totalSize)
+    if (cp)
     {
-        toRead = (DWORD)((totalSize - done) > TAPE_IO_BUF ?
-            TAPE_IO_BUF :
-            (totalSize - done));
+        CheckpointStart(cp, ht);
+        done = cp->rec.done;
+    }
 
-        result = ReadFile(ht, buf, toRead, &retbytes, NULL);
-        if (!result || retbytes == 0)
-        {
-            PrintLastErrorW(L"Read from tape failed before reaching expected size", 0);
-            ok = FALSE;
-            break;
-        }
+    /* read requests must not be shorter than blocks on tape */
+    thread = StartProducer(&prod, &ring, &tune, span, NULL, prof,
+        (prof->blockSize > TAPE_IO_BUF) ? prof->blockSize : TAPE_IO_BUF,
+        ht, totalSize - done, TapeReaderThread);
+    if (!thread) return FALSE;
+
+    if (outSha1)
+    {
+        if (cp)
+            ctx = cp->rec.sha;
+        else
+            sha1_init(&ctx);
+    }
+    for (;;)
+    {
+        buf = RingGetFull(&ring, &len);
+        if (!buf || len == 0) break;
 
         if (hf)
-            if (!WriteFile(hf, buf, retbytes, &written, NULL) ||
-                written != retbytes)
+        {
+            TRACE_BEGIN("file write", 0);
+            result = WriteFile(hf, buf, len, &written, NULL);
+            TRACE_END("file write", written);
+            if (!result || written != len)
             {
                 PrintLastErrorW(L"Failed to write destination file", 0);
                 ok = FALSE;
                 break;
             }
+        }
 
-        if (outSha1) sha1_update(&ctx, buf, retbytes);
-        done += retbytes;
+        if (outSha1)
+        {
+            TRACE_BEGIN("sha1", len);
+            sha1_update(&ctx, buf, len);
+            TRACE_END("sha1", len);
+        }
+        RingRelease(&ring);
+        done += len;
 
         pct = (unsigned)((done * 100ULL) / totalSize);
 
         DrawProgressBar(pct, done, totalSize);
+        AutoTuneTick(&tune);
+
+        /* reader thread is ahead: block is counted from where this copy started */
+        if (CheckpointDue(cp) && (!hf || FlushFileBuffers(hf)))
+            CheckpointSave(cp, done, CheckpointReadBlock(cp, done, prof->blockSize),
+                outSha1 ? &ctx : NULL);
+
+        if (ProgressCancelled())
+        {
+            PrintLastErrorW(L"\r\nStopped", 0);
+            ok = FALSE;
+            break;
+        }
+    }
+
+    StopProducer(thread, &ring, !ok);
+    if (prod.failed)
+    {
+        PrintLastErrorW(L"Read from tape failed before reaching expected size", prod.error);
+        ok = FALSE;
     }
 
     if (outSha1 && ok) sha1_final(&ctx, outSha1);
 
     wprintf(L"\r\n");
-    free(buf);
+    return ok;
+}
+
+/* tape -> tape, section #2 goes out with block size of the source archive */
+BOOL CloneSecondSection(HANDLE hsrc, HANDLE hdst, ULONGLONG totalSize,
+    unsigned char outSha1[20], const TAPE_IO_PROFILE *prof)
+{
+    BUF_RING            ring;
+    AUTOTUNE            tune;
+    SECTION_PRODUCER    prod;
+    HANDLE              thread;
+    BYTE                *buf;
+    SHA1_CTX            ctx;
+    ULONGLONG           done = 0;
+    BOOL                ok = TRUE;
+    DWORD               len = 0;
+    DWORD               off, n;
+    DWORD               written = 0;
+    BOOL                result;
+    unsigned            pct;
+
+    thread = StartProducer(&prod, &ring, &tune, NULL, NULL, prof,
+        (prof->blockSize > TAPE_IO_BUF) ? prof->blockSize : TAPE_IO_BUF,
+        hsrc, totalSize, TapeReaderThread);
+    if (!thread) return FALSE;
+
+    sha1_init(&ctx);
+    for (;;)
+    {
+        buf = RingGetFull(&ring, &len);
+        if (!buf || len == 0) break;
+
+        for (off = 0; off < len; off += n)
+        {
+            n = (len - off > prof->blockSize) ? prof->blockSize : len - off;
+
+            TRACE_BEGIN("tape write", 0);
+            result = TapeWrite(hdst, buf + off, n, &written);
+            TRACE_END("tape write", written);
+            METRIC_ADD(hdst, METRIC_BYTES_WRITTEN, written);
+
+            /* early warning still leaves room to finish the copy */
+            if (written == n && (result || GetLastError() == ERROR_END_OF_MEDIA)) continue;
+
+            METRIC_ADD(hdst, METRIC_DEVICE_ERRORS, 1);
+            PrintLastErrorW(L"Failed to write to destination tape", 0);
+            ok = FALSE;
+            break;
+        }
+        if (!ok) break;
+
+        /* hashed as it passes, source tape is never read twice */
+        TRACE_BEGIN("sha1", len);
+        sha1_update(&ctx, buf, len);
+        TRACE_END("sha1", len);
+        RingRelease(&ring);
+        done += len;
+
+        pct = (unsigned)((done * 100ULL) / totalSize);
+        DrawProgressBar(pct, done, totalSize);
+        AutoTuneTick(&tune);
+    }
+
+    StopProducer(thread, &ring, !ok);
+    if (prod.failed)
+    {
+        PrintLastErrorW(L"Read from source tape failed before reaching expected size", prod.error);
+        ok = FALSE;
+    }
+
+    if (ok) sha1_final(&ctx, outSha1);
+
+    wprintf(L"\r\n");
     return ok;
 }
@@ -4,6 +4,9 @@
 #include "common.h"
 #include "utils.h"
 #include "tape.h"
+#include "ring.h"
+#include "autotune.h"
+#include "spool.h"
 
 /* ---- ZEROTAPE metadata header (128 bytes) ---- */
 #pragma pack(push,1)
@@ -13,12 +16,28 @@ typedef struct _ZEROTAPE_HEADER {
     char          name[32];         /* ASCII NUL-terminated, max 31 chars */
     unsigned char sizeofarchive[8]; /* little-endian 64-bit, section #2 size */
     unsigned char sha1[20];         /* SHA-1 of section #2 */
-    unsigned char format;           /* 0=raw, 1=tar */
+    unsigned char format;           /* 0=raw, 1=tar, 2=directory of archives on tape, 3=index partition */
     unsigned char creationdate[16]; /* SYSTEMTIME (16 bytes), local time */
-    unsigned char reserved[42];     /* must be zero */
+    unsigned char blocksize[4];     /* little-endian 32-bit, section #2 block size, 0 = 64 KiB */
+    unsigned char stripeunit[4];    /* little-endian 32-bit, stripe unit size, 0 = not striped */
+    unsigned char stripedata;       /* data tapes in stripe set */
+    unsigned char stripeparity;     /* XOR parity tapes in stripe set: 0 or 1 */
+    unsigned char stripeindex;      /* this tape in stripe set, parity tape is last */
+    unsigned char setid[8];         /* same on all tapes of the set */
+    unsigned char volseq[2];        /* little-endian 16-bit, volume of spanned set from 1, 0 = single volume */
+    unsigned char volstart[8];      /* little-endian 64-bit, offset of this volume's data in section #2 */
+    unsigned char volbytes[8];      /* little-endian 64-bit, data bytes on this volume, in trailer only */
+    unsigned char reserved[5];      /* must be zero */
 } ZEROTAPE_HEADER;                  /* total 128 */
 #pragma pack(pop)
 
+/* section #2 of a directory archive: headers of archives 0..n-1 on tape */
+#define ZEROTAPE_FORMAT_DIRECTORY   2
+#define ZEROTAPE_DIRECTORY_MAX      1024
+
+/* section #2 of first partition on partitioned tape (see partition.h) */
+#define ZEROTAPE_FORMAT_INDEX       3
+
 /* --------------------------------------
 TAR structures & helpers (POSIX ustar + GNU longname/longlink)
 -------------------------------------- */
@@ -72,13 +91,61 @@ typedef struct _TAR_HDR_FULL {
  unsigned TarChecksum512(const void* hdr);
  void U64ToOctal(ULONGLONG v, char* out, size_t n);
  void TarInitHeader(TAR_HDR_FULL *hdr, const char *name, ULONGLONG size);
+ BOOL IsTarHeaderLikely(const TAR_HDR *h);
+ BOOL IsLikelyTarFile(LPCWSTR path);
  BOOL WriteMetadataSection(HANDLE ht, const ZEROTAPE_HEADER* zh);
+ BOOL ReadMetadataSection(HANDLE ht, ZEROTAPE_HEADER* out);
  BOOL ReadMetadataFromTape(HANDLE ht, ZEROTAPE_HEADER* out);
  BOOL PositionToSecondSection(HANDLE ht);
+ BOOL ReadArchiveMetadata(HANDLE ht, DWORD index, ZEROTAPE_HEADER* out);
+ BOOL PositionToArchive(HANDLE ht, DWORD index);
+ BOOL PositionToArchiveData(HANDLE ht, DWORD index);
+ BOOL WriteDirectorySection(HANDLE ht, const ZEROTAPE_HEADER *entries, DWORD count,
+    DWORD blockSize);
+ BOOL ReadDirectorySection(HANDLE ht, const ZEROTAPE_HEADER *zh,
+    ZEROTAPE_HEADER *entries, DWORD maxCount, DWORD *count);
+ DWORD ZeroTapeBlockSize(const ZEROTAPE_HEADER *zh);
+ BOOL ZeroTapeIsStriped(const ZEROTAPE_HEADER *zh);
+ WORD ZeroTapeVolume(const ZEROTAPE_HEADER *zh);
+ void ZeroTapeSetVolume(ZEROTAPE_HEADER *zh, WORD volume);
 
 /* --------------------------------------
 TAR verification & TOC (only when format==1)
 -------------------------------------- */
+/* member as listed: name after GNU longname / PAX path, offsets in
+   section #2 (plain TAR file: from its start); PAX size, mtime, uid,
+   gid, uname, gname and linkpath win over the ustar fields */
+typedef struct _TAR_MEMBER {
+    const char      *name;          /* UTF-8 */
+    ULONGLONG       offset;         /* first header, longname/PAX ones included */
+    ULONGLONG       dataOffset;     /* its data, 0 - unknown */
+    ULONGLONG       size;
+    LONGLONG        mtime;          /* seconds since 1970 */
+    DWORD           mode;
+    char            type;           /* typeflag, '0' for NUL, TAR_TYPE_UNKNOWN */
+    const char      *link;          /* UTF-8, "" - none */
+    DWORD           uid;
+    DWORD           gid;
+    const char      *uname;         /* UTF-8, "" - none */
+    const char      *gname;
+    DWORD           devmajor;
+    DWORD           devminor;
+    DWORD           chksum;         /* as stored */
+    char            format;         /* TAR_FORMAT_* */
+} TAR_MEMBER;
+
+/* TAR_MEMBER.format: what the header says about its writer */
+#define TAR_FORMAT_V7           0   /* no magic */
+#define TAR_FORMAT_USTAR        1   /* "ustar\0" "00" */
+#define TAR_FORMAT_GNU          2   /* "ustar " " \0" */
+#define TAR_FORMAT_PAX          3   /* member had a PAX header */
+#define TAR_FORMAT_UNKNOWN      0xFF    /* source keeps no header, e.g. partition index */
+
+typedef void (*TAR_MEMBER_SINK)(void *ctx, const TAR_MEMBER *m);
+
+#define TAR_NO_OFFSET           ((ULONGLONG)-1)
+#define TAR_TYPE_UNKNOWN        0   /* TAR_MEMBER.type: source keeps no typeflag */
+
 typedef struct _VERIFY_STATS {
     ULONGLONG filesTotal;
     ULONGLONG filesBad;
@@ -88,15 +155,37 @@ typedef struct _VERIFY_STATS {
  BOOL ParsePaxAndGet(const BYTE* buf, DWORD len, const char* key,
     char* out, size_t outsz);
  void AnsiOrUtf8ToWide(const char* s, size_t n, WCHAR* out, size_t cch);
- BOOL VerifyTarOnTape(HANDLE h, FILE* flog);
- BOOL ListTarTOCToFile(HANDLE h, FILE* fout);
+ BOOL VerifyTarOnTape(HANDLE h, FILE* flog, TAR_MEMBER_SINK sink, void *ctx);
+ BOOL ListTarTOCToFile(HANDLE h, FILE* fout, TAR_MEMBER_SINK sink, void *ctx);
+ BOOL ScanTarFile(HANDLE hf, TAR_MEMBER_SINK sink, void *ctx);
 
 /* --------------------------------------
 Section #2 I/O
+span - NULL for single volume; otherwise called by the thread doing
+tape I/O at end of media (write) or filemark (read) with number of
+section #2 bytes done so far; it closes current volume and returns
+next one positioned for data, INVALID_HANDLE_VALUE stops the job
 -------------------------------------- */
- BOOL WriteArchiveToSecondSection(HANDLE ht,
-    HANDLE hf, ULONGLONG totalSize);
+typedef struct _TAPE_SPAN TAPE_SPAN;
+typedef HANDLE (*TAPE_SPAN_NEXT)(TAPE_SPAN *span, HANDLE current, ULONGLONG offset);
+
+struct _TAPE_SPAN {
+    TAPE_SPAN_NEXT  next;
+    void            *ctx;
+};
+
+/* cp - NULL, or progress journal of a single-volume job (see checkpoint.h);
+   a copy starts at cp->rec.done bytes, tape and source already there */
+typedef struct _CHECKPOINT CHECKPOINT;
+
+ BOOL WriteArchiveToSecondSection(HANDLE ht, HANDLE hf, ULONGLONG totalSize,
+    const TAPE_IO_PROFILE *prof, TAPE_SPAN *span, CHECKPOINT *cp);
+ BOOL WriteSpoolToSecondSection(HANDLE ht, SPOOL *spool, ULONGLONG totalSize,
+    const TAPE_IO_PROFILE *prof, TAPE_SPAN *span, CHECKPOINT *cp);
  BOOL CopySecondSectionToFileAndOrHash(HANDLE ht, ULONGLONG totalSize,
-    HANDLE hf, unsigned char outSha1[20]);
+    HANDLE hf, unsigned char outSha1[20], const TAPE_IO_PROFILE *prof, TAPE_SPAN *span,
+    CHECKPOINT *cp);
+ BOOL CloneSecondSection(HANDLE hsrc, HANDLE hdst, ULONGLONG totalSize,
+    unsigned char outSha1[20], const TAPE_IO_PROFILE *prof);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "autotune.h"
+
+/* --------------------------------------
+Pipeline auto-tuning
+-------------------------------------- */
+/* starting ring geometry from profile, clamped to budget */
+void AutoTuneInit(AUTOTUNE *t, const TAPE_IO_PROFILE *prof, BOOL tapeIsConsumer,
+    DWORD *count, DWORD *chunk)
+{
+    DWORD n;
+
+    ZeroMemory(t, sizeof(*t));
+    t->enabled = prof->autoTune;
+    t->tapeIsConsumer = tapeIsConsumer;
+    t->unit = prof->blockSize;
+    t->budget = (prof->memBudget < prof->blockSize) ? prof->blockSize : prof->memBudget;
+
+    t->maxChunk = t->budget / AUTOTUNE_MIN_BUFFERS;
+    if (t->maxChunk > AUTOTUNE_MAX_CHUNK) t->maxChunk = AUTOTUNE_MAX_CHUNK;
+    t->maxChunk -= t->maxChunk % t->unit;
+    if (t->maxChunk < t->unit) t->maxChunk = t->unit;
+
+    n = prof->depth;
+    if (t->enabled && n < AUTOTUNE_MIN_BUFFERS) n = AUTOTUNE_MIN_BUFFERS;
+    if (n > t->budget / t->unit) n = t->budget / t->unit;
+    if (n > RING_MAX_BUFFERS) n = RING_MAX_BUFFERS;
+    if (n < 1) n = 1;
+
+    *count = n;
+    *chunk = t->unit;
+}
+
+void AutoTuneStart(AUTOTUNE *t, BUF_RING *ring)
+{
+    t->ring = ring;
+    t->lastTime = TimerSeconds();
+}
+
+/* called by whichever thread talks to tape */
+void AutoTuneTapeOp(AUTOTUNE *t, double seconds)
+{
+    if (!t->enabled) return;
+
+    if (t->opAvg > 0.0 && seconds > 0.05 && seconds > t->opAvg * 4.0)
+        InterlockedIncrement(&t->stalls);
+    t->opAvg = (t->opAvg > 0.0) ? t->opAvg * 0.9 + seconds * 0.1 : seconds;
+}
+
+/* called by consumer thread after every buffer */
+void AutoTuneTick(AUTOTUNE *t)
+{
+    BUF_RING    *r = t->ring;
+    double      now, dt, tapeWait, otherWait;
+    ULONGLONG   bytes;
+    DWORD       count, chunk, newCount, newChunk, step;
+    LONG        stalls;
+
+    if (!t->enabled) return;
+
+    now = TimerSeconds();
+    dt = now - t->lastTime;
+    if (dt < AUTOTUNE_INTERVAL) return;
+
+    tapeWait = t->tapeIsConsumer ? r->consWait - t->lastConsWait : r->prodWait - t->lastProdWait;
+    otherWait = t->tapeIsConsumer ? r->prodWait - t->lastProdWait : r->consWait - t->lastConsWait;
+    tapeWait /= dt;
+    otherWait /= dt;
+    bytes = r->consBytes - t->lastBytes;
+    stalls = InterlockedExchange(&t->stalls, 0);
+
+    t->lastTime = now;
+    t->lastProdWait = r->prodWait;
+    t->lastConsWait = r->consWait;
+    t->lastBytes = r->consBytes;
+
+    count = newCount = r->target;
+    chunk = newChunk = r->bufSize;
+
+    if (tapeWait > 0.05 || stalls > 0)
+    {
+        t->calm = 0;
+        step = (count / 2 > 1) ? count / 2 : 1;
+        if (chunk < t->maxChunk && (ULONGLONG)chunk * 2 * count <= t->budget)
+            newChunk = chunk * 2;
+        else if (count + step <= RING_MAX_BUFFERS && (ULONGLONG)chunk * (count + step) <= t->budget)
+            newCount = count + step;
+    }
+    else if (otherWait > 0.5 && tapeWait < 0.01)
+    {
+        if (++t->calm >= 3 && count > AUTOTUNE_MIN_BUFFERS)
+        {
+            newCount = count - 1;
+            t->calm = 0;
+        }
+    }
+    else
+        t->calm = 0;
+
+    if (newCount == count && newChunk == chunk) return;
+
+    TRACE_BEGIN("autotune", 0);
+    RingResize(r, newCount, newChunk);
+    TRACE_END("autotune", (ULONGLONG)newCount * newChunk);
+
+    wprintf(L"\r\nAuto-tune: buffers %lu -> %lu, chunk %lu -> %lu KiB "
+        L"(tape waited %.0f%%, %s waited %.0f%%, %ld stalls, %.1f MB/s)\r\n",
+        (unsigned long)count, (unsigned long)newCount,
+        (unsigned long)(chunk / 1024), (unsigned long)(newChunk / 1024),
+        tapeWait * 100.0, t->tapeIsConsumer ? L"source" : L"destination",
+        otherWait * 100.0, stalls, (double)bytes / dt / 1e6);
+}
@@ -0,0 +1,44 @@
+#ifndef __TAPE_BACKUP_AUTOTUNE
+#define __TAPE_BACKUP_AUTOTUNE
+
+#include "common.h"
+#include "tape.h"
+#include "ring.h"
+
+/* --------------------------------------
+Runtime tuning of section #2 pipelines.
+Every AUTOTUNE_INTERVAL seconds consumer thread looks at how long each side
+of the ring waited for the other and at tape operations much slower than
+usual (drive repositioning). When tape side starves - chunk size grows
+first (fewer, larger requests to slow or remote sources), then number of
+buffers; when tape is the bottleneck and ring stays full - buffers
+are given back one by one. Both stay within profile memory budget.
+Chunk is a multiple of tape block size, blocks on tape never change.
+-------------------------------------- */
+#define AUTOTUNE_INTERVAL       2.0
+#define AUTOTUNE_MIN_BUFFERS    2
+#define AUTOTUNE_MAX_CHUNK      (8 * 1024 * 1024)
+
+typedef struct _AUTOTUNE {
+    BUF_RING        *ring;
+    BOOL            enabled;
+    BOOL            tapeIsConsumer;     /* backup: tape drains ring */
+    DWORD           unit;               /* tape block size */
+    DWORD           maxChunk;
+    DWORD           budget;
+    double          lastTime;
+    double          lastProdWait;
+    double          lastConsWait;
+    ULONGLONG       lastBytes;
+    double          opAvg;              /* tape op latency, moving average */
+    volatile LONG   stalls;             /* slow tape ops since last decision */
+    int             calm;               /* intervals in a row with ring full */
+} AUTOTUNE;
+
+void AutoTuneInit(AUTOTUNE *t, const TAPE_IO_PROFILE *prof, BOOL tapeIsConsumer,
+    DWORD *count, DWORD *chunk);
+void AutoTuneStart(AUTOTUNE *t, BUF_RING *ring);
+void AutoTuneTapeOp(AUTOTUNE *t, double seconds);
+void AutoTuneTick(AUTOTUNE *t);
+
+#endif
@@ -0,0 +1,445 @@
+#include "calib.h"
+
+static const DWORD g_calibBlocks[] = {
+    64 * 1024, 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024
+};
+static const DWORD g_calibDepths[] = { 1, 2, 4, 8 };
+
+#define CALIB_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/* --------------------------------------
+Calibration I/O threads
+-------------------------------------- */
+typedef struct _CALIB_IO {
+    BUF_RING    *ring;
+    HANDLE      h;
+    ULONGLONG   total;      /* write phase: bytes to feed */
+    const BYTE  *pattern;   /* write phase: 2 * TAPE_MAX_BLOCK random bytes */
+    DWORD       ops;        /* read phase stats, filled by reader thread */
+    double      latSum;
+    double      latMax;
+    BOOL        failed;
+    DWORD       error;
+} CALIB_IO;
+
+/* memory source: no file system in the way, only drive and ring are measured */
+static DWORD WINAPI CalibFeedThread(LPVOID param)
+{
+    CALIB_IO    *io = (CALIB_IO*)param;
+    ULONGLONG   done = 0;
+    ULONGLONG   n = 0;
+    BYTE        *buf;
+    DWORD       len;
+
+    TraceThreadName("calib feed");
+    while (done < io->total)
+    {
+        buf = RingGetFree(io->ring);
+        if (!buf) return 0;
+
+        len = (io->total - done > io->ring->prodSize) ?
+            io->ring->prodSize : (DWORD)(io->total - done);
+        memcpy(buf, io->pattern + (size_t)((n++ * 4099ULL) % TAPE_MAX_BLOCK), len);
+        RingPut(io->ring, len);
+        done += len;
+    }
+
+    if (RingGetFree(io->ring)) RingPut(io->ring, 0);
+    return 0;
+}
+
+static DWORD WINAPI CalibReadThread(LPVOID param)
+{
+    CALIB_IO    *io = (CALIB_IO*)param;
+    BYTE        *buf;
+    DWORD       got = 0;
+    BOOL        result;
+    double      t0, lat;
+
+    TraceThreadName("calib reader");
+    for (;;)
+    {
+        buf = RingGetFree(io->ring);
+        if (!buf) return 0;
+
+        t0 = TimerSeconds();
+        result = TapeRead(io->h, buf, io->ring->prodSize, &got);
+        lat = TimerSeconds() - t0;
+        if (!result || got == 0)
+        {
+            if (GetLastError() != ERROR_FILEMARK_DETECTED)
+            {
+                io->failed = TRUE;
+                io->error = GetLastError();
+            }
+            RingPut(io->ring, 0);
+            return 0;
+        }
+
+        io->ops++;
+        io->latSum += lat;
+        if (lat > io->latMax) io->latMax = lat;
+        RingPut(io->ring, got);
+    }
+}
+
+/* --------------------------------------
+One matrix cell: filemark, data, filemark, then read data back
+-------------------------------------- */
+static BOOL CalibCell(HANDLE h, DWORD blockSize, DWORD depth,
+    ULONGLONG cellBytes, const BYTE *pattern, DWORD *marks, CALIB_RESULT *r)
+{
+    BUF_RING        ring;
+    CALIB_IO        io;
+    HANDLE          thread;
+    BYTE            *buf;
+    DWORD           len = 0;
+    DWORD           written = 0;
+    ULONGLONG       bytes = 0;
+    DWORD           ops = 0;
+    double          t0, t1, tw, lat;
+    double          latSum = 0.0, latMax = 0.0;
+    BOOL            ok = TRUE;
+    SHA1_CTX        ctx;
+    unsigned char   digest[20];
+
+    ZeroMemory(r, sizeof(*r));
+    r->blockSize = blockSize;
+    r->depth = depth;
+
+    if (!TapeWriteFilemark(h))
+    {
+        PrintLastErrorW(L"Failed to write filemark", 0);
+        return FALSE;
+    }
+    (*marks)++;
+
+    /* write phase */
+    if (!RingCreate(&ring, depth, blockSize))
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    ZeroMemory(&io, sizeof(io));
+    io.ring = &ring;
+    io.h = h;
+    io.total = cellBytes;
+    io.pattern = pattern;
+    thread = CreateThread(NULL, 0, CalibFeedThread, &io, 0, NULL);
+    if (!thread)
+    {
+        PrintLastErrorW(L"Failed to start I/O thread", 0);
+        RingDestroy(&ring);
+        return FALSE;
+    }
+
+    t0 = TimerSeconds();
+    for (;;)
+    {
+        buf = RingGetFull(&ring, &len);
+        if (!buf || len == 0) break;
+
+        tw = TimerSeconds();
+        if (!TapeWrite(h, buf, len, &written) || written != len)
+        {
+            PrintLastErrorW(L"Failed to write to tape", 0);
+            ok = FALSE;
+            break;
+        }
+        lat = TimerSeconds() - tw;
+        RingRelease(&ring);
+
+        ops++;
+        latSum += lat;
+        if (lat > latMax) latMax = lat;
+        bytes += len;
+    }
+    t1 = TimerSeconds();
+
+    if (!ok) RingAbort(&ring);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    RingDestroy(&ring);
+    if (!ok) return FALSE;
+
+    METRIC_ADD(h, METRIC_BYTES_WRITTEN, bytes);
+    r->writeMBps = (t1 > t0) ? (double)bytes / (t1 - t0) / 1e6 : 0.0;
+    r->writeLatAvgMs = ops ? latSum / ops * 1000.0 : 0.0;
+    r->writeLatMaxMs = latMax * 1000.0;
+
+    if (!TapeWriteFilemark(h))
+    {
+        PrintLastErrorW(L"Failed to write filemark", 0);
+        return FALSE;
+    }
+    (*marks)++;
+
+    /* back over both filemarks, then forward over the first one */
+    if (!TapeSpaceFilemarks(h, -2) || !TapeSpaceFilemarks(h, 1))
+    {
+        PrintLastErrorW(L"Failed to position to calibration data", 0);
+        return FALSE;
+    }
+
+    /* read phase: tape reader thread, sha1 on this thread as in verify */
+    if (!RingCreate(&ring, depth, blockSize))
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    ZeroMemory(&io, sizeof(io));
+    io.ring = &ring;
+    io.h = h;
+    thread = CreateThread(NULL, 0, CalibReadThread, &io, 0, NULL);
+    if (!thread)
+    {
+        PrintLastErrorW(L"Failed to start I/O thread", 0);
+        RingDestroy(&ring);
+        return FALSE;
+    }
+
+    bytes = 0;
+    sha1_init(&ctx);
+    t0 = TimerSeconds();
+    for (;;)
+    {
+        buf = RingGetFull(&ring, &len);
+        if (!buf || len == 0) break;
+
+        sha1_update(&ctx, buf, len);
+        RingRelease(&ring);
+        bytes += len;
+    }
+    t1 = TimerSeconds();
+    sha1_final(&ctx, digest);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    RingDestroy(&ring);
+    if (io.failed)
+    {
+        PrintLastErrorW(L"Failed to read calibration data", io.error);
+        return FALSE;
+    }
+
+    METRIC_ADD(h, METRIC_BYTES_READ, bytes);
+    r->readMBps = (t1 > t0) ? (double)bytes / (t1 - t0) / 1e6 : 0.0;
+    r->readLatAvgMs = io.ops ? io.latSum / io.ops * 1000.0 : 0.0;
+    r->readLatMaxMs = io.latMax * 1000.0;
+    return TRUE;
+}
+
+/* MB/s of writing and then reading the same data */
+static double CalibScore(const CALIB_RESULT *r)
+{
+    if (r->writeMBps <= 0.0 || r->readMBps <= 0.0) return 0.0;
+    return 2.0 / (1.0 / r->writeMBps + 1.0 / r->readMBps);
+}
+
+BOOL CalibrateDrive(HANDLE h, DWORD cellMiB, CALIB_RESULT *best)
+{
+    TAPE_GET_DRIVE_PARAMETERS   dp;
+    CALIB_RESULT                cells[CALIB_MAX_CELLS];
+    int                         count = 0;
+    DWORD                       maxBlock, minBlock;
+    DWORD                       marks = 0;
+    BYTE                        *pattern;
+    ULONGLONG                   rng = 0x9E3779B97F4A7C15ULL;
+    size_t                      i, j;
+    int                         k, pick;
+    double                      top = 0.0;
+    BOOL                        ok = TRUE;
+
+    ZeroMemory(&dp, sizeof(dp));
+    if (!TapeGetDriveInfo(h, &dp))
+    {
+        PrintLastErrorW(L"Failed to get drive parameters", 0);
+        return FALSE;
+    }
+
+    maxBlock = (dp.MaximumBlockSize && dp.MaximumBlockSize < TAPE_MAX_BLOCK) ?
+        dp.MaximumBlockSize : TAPE_MAX_BLOCK;
+    minBlock = dp.MinimumBlockSize;
+
+    if (!TapeSetVariableBlockSize(h))
+    {
+        PrintLastErrorW(L"Failed to set variable block size", 0);
+        return FALSE;
+    }
+    TapeSetCompression(h, FALSE);
+
+    pattern = (BYTE*)malloc(2 * TAPE_MAX_BLOCK);
+    if (!pattern)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    /* incompressible data */
+    for (i = 0; i + 8 <= 2 * TAPE_MAX_BLOCK; i += 8)
+    {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        memcpy(pattern + i, &rng, 8);
+    }
+
+    /* existing data stays intact: scratch region starts at end of data */
+    wprintf(L"Please wait until tape positioned to end of data...\r\n");
+    if (!TapeSpaceEndOfData(h))
+    {
+        PrintLastErrorW(L"Failed to position to end of data", 0);
+        free(pattern);
+        return FALSE;
+    }
+
+    wprintf(L"Block KiB  Depth  Write MB/s  Lat avg/max ms   Read MB/s  Lat avg/max ms\r\n");
+    for (i = 0; ok && i < CALIB_COUNT(g_calibBlocks); i++)
+    {
+        if (g_calibBlocks[i] > maxBlock || g_calibBlocks[i] < minBlock)
+            continue;
+
+        for (j = 0; ok && j < CALIB_COUNT(g_calibDepths) && count < CALIB_MAX_CELLS; j++)
+        {
+            TRACE_BEGIN("calibrate cell", (ULONGLONG)cellMiB * 1024 * 1024);
+            ok = CalibCell(h, g_calibBlocks[i], g_calibDepths[j],
+                (ULONGLONG)cellMiB * 1024 * 1024, pattern, &marks, &cells[count]);
+            TRACE_END("calibrate cell", (ULONGLONG)cellMiB * 1024 * 1024);
+            if (!ok) break;
+
+            wprintf(L"%9lu  %5lu  %10.1f  %6.2f/%-7.2f  %10.1f  %6.2f/%-7.2f\r\n",
+                (unsigned long)(cells[count].blockSize / 1024),
+                (unsigned long)cells[count].depth,
+                cells[count].writeMBps, cells[count].writeLatAvgMs, cells[count].writeLatMaxMs,
+                cells[count].readMBps, cells[count].readLatAvgMs, cells[count].readLatMaxMs);
+            count++;
+        }
+    }
+    free(pattern);
+
+    /* drop scratch region: back to old end of data and mark it again */
+    if (marks)
+    {
+        wprintf(L"Please wait until calibration data discarded...\r\n");
+        if (!TapeSpaceEndOfData(h) ||
+            !TapeSpaceFilemarks(h, -(LONG)marks) ||
+            !TapeEraseShort(h))
+            PrintLastErrorW(L"Failed to discard calibration data", 0);
+    }
+
+    if (count == 0) return FALSE;
+
+    /* best score; within 3% prefer the cell that needs less memory */
+    for (k = 0; k < count; k++)
+        if (CalibScore(&cells[k]) > top) top = CalibScore(&cells[k]);
+
+    pick = -1;
+    for (k = 0; k < count; k++)
+    {
+        if (CalibScore(&cells[k]) < top * 0.97) continue;
+        if (pick < 0 ||
+            (ULONGLONG)cells[k].blockSize * cells[k].depth <
+            (ULONGLONG)cells[pick].blockSize * cells[pick].depth)
+            pick = k;
+    }
+
+    *best = cells[pick];
+    if (!ok) wprintf(L"Calibration stopped early, best of %d measured cells is used.\r\n", count);
+    return TRUE;
+}
+
+/* --------------------------------------
+Per-drive profiles (drives.ini, section = drive serial)
+-------------------------------------- */
+static BOOL ProfilePath(WCHAR *out, size_t cch)
+{
+    WCHAR dir[MAX_PATH];
+
+    if (!GetExeDirectoryW(dir, MAX_PATH)) return FALSE;
+    JoinPath2W(out, cch, dir, CALIB_PROFILE_FILE);
+    return TRUE;
+}
+
+static BOOL ProfileSection(LPCWSTR serial, WCHAR *out, size_t cch)
+{
+    size_t n = 0;
+
+    while (*serial == L' ') serial++;
+    while (serial[n] && n + 1 < cch)
+    {
+        out[n] = (serial[n] == L'[' || serial[n] == L']') ? L'_' : serial[n];
+        n++;
+    }
+    while (n > 0 && out[n - 1] == L' ') n--;
+    out[n] = 0;
+
+    return (n > 0);
+}
+
+BOOL ProfileSave(LPCWSTR serial, LPCWSTR vendor, LPCWSTR model,
+    const CALIB_RESULT *r)
+{
+    WCHAR       path[MAX_PATH * 2];
+    WCHAR       section[128];
+    WCHAR       val[64];
+    SYSTEMTIME  st;
+    BOOL        ok;
+
+    if (!ProfilePath(path, MAX_PATH * 2) || !ProfileSection(serial, section, 128))
+        return FALSE;
+
+    _snwprintf(val, 64, L"%lu", (unsigned long)r->blockSize);
+    ok = WritePrivateProfileStringW(section, L"BlockSize", val, path);
+    _snwprintf(val, 64, L"%lu", (unsigned long)r->depth);
+    ok = ok && WritePrivateProfileStringW(section, L"Depth", val, path);
+    _snwprintf(val, 64, L"%.1f", r->writeMBps);
+    ok = ok && WritePrivateProfileStringW(section, L"WriteMBps", val, path);
+    _snwprintf(val, 64, L"%.1f", r->readMBps);
+    ok = ok && WritePrivateProfileStringW(section, L"ReadMBps", val, path);
+    ok = ok && WritePrivateProfileStringW(section, L"Vendor", vendor, path);
+    ok = ok && WritePrivateProfileStringW(section, L"Model", model, path);
+    GetLocalTime(&st);
+    _snwprintf(val, 64, L"%04u-%02u-%02u %02u:%02u", st.wYear, st.wMonth,
+        st.wDay, st.wHour, st.wMinute);
+    ok = ok && WritePrivateProfileStringW(section, L"Calibrated", val, path);
+
+    return ok;
+}
+
+BOOL ProfileLoad(LPCWSTR serial, TAPE_IO_PROFILE *p)
+{
+    WCHAR   path[MAX_PATH * 2];
+    WCHAR   section[128];
+    UINT    bs, depth;
+
+    if (!ProfilePath(path, MAX_PATH * 2) || !ProfileSection(serial, section, 128))
+        return FALSE;
+
+    bs = GetPrivateProfileIntW(section, L"BlockSize", 0, path);
+    depth = GetPrivateProfileIntW(section, L"Depth", 0, path);
+    if (bs < 512 || bs > TAPE_MAX_BLOCK || depth < 1 || depth > RING_MAX_BUFFERS)
+        return FALSE;
+
+    p->blockSize = bs;
+    p->depth = depth;
+    return TRUE;
+}
+
+/* default profile, overridden by calibrated one if drive has it */
+BOOL ProfileLoadForTape(HANDLE h, TAPE_IO_PROFILE *p)
+{
+    WCHAR vendor[64], model[64], serial[128];
+
+    TapeDefaultProfile(p);
+    if (VTapeFromHandle(h)) return FALSE;
+    if (!QueryStorageStrings(h, vendor, 64, model, 64, serial, 128) || !serial[0])
+        return FALSE;
+
+    if (!ProfileLoad(serial, p)) return FALSE;
+
+    wprintf(L"Using calibrated profile of drive %s: block %lu KiB, depth %lu\r\n",
+        serial, (unsigned long)(p->blockSize / 1024), (unsigned long)p->depth);
+    return TRUE;
+}
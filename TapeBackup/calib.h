@@ -0,0 +1,36 @@
+#ifndef __TAPE_BACKUP_CALIB
+#define __TAPE_BACKUP_CALIB
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "ring.h"
+
+/* --------------------------------------
+Drive calibration: block size x buffer depth matrix written and read back
+after end of data, best cell is stored per drive serial in drives.ini
+(exe directory) and applied by jobs automatically.
+-------------------------------------- */
+#define CALIB_PROFILE_FILE      L"drives.ini"
+#define CALIB_DEFAULT_CELL_MIB  256
+#define CALIB_MAX_CELLS         32
+
+typedef struct _CALIB_RESULT {
+    DWORD   blockSize;
+    DWORD   depth;
+    double  writeMBps;
+    double  readMBps;
+    double  writeLatAvgMs;
+    double  writeLatMaxMs;
+    double  readLatAvgMs;
+    double  readLatMaxMs;
+} CALIB_RESULT;
+
+BOOL CalibrateDrive(HANDLE h, DWORD cellMiB, CALIB_RESULT *best);
+
+BOOL ProfileSave(LPCWSTR serial, LPCWSTR vendor, LPCWSTR model,
+    const CALIB_RESULT *r);
+BOOL ProfileLoad(LPCWSTR serial, TAPE_IO_PROFILE *p);
+BOOL ProfileLoadForTape(HANDLE h, TAPE_IO_PROFILE *p);
+
+#endif
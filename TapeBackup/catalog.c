@@ -0,0 +1,1884 @@
+#include "catalog.h"
+
+/* --------------------------------------
+Catalog settings (command line)
+-------------------------------------- */
+static WCHAR        g_catalogDir[MAX_PATH];
+static BOOL         g_catalogOff = FALSE;
+
+static void CatalogCompact(LPCWSTR dir);
+
+/* NULL - no catalog; "" - CATALOG_DIR next to exe */
+void CatalogSetDir(LPCWSTR dir)
+{
+    g_catalogOff = (dir == NULL);
+    _snwprintf(g_catalogDir, MAX_PATH, L"%s", dir ? dir : L"");
+    g_catalogDir[MAX_PATH - 1] = 0;
+}
+
+BOOL CatalogEnabled(void)
+{
+    return !g_catalogOff;
+}
+
+static BOOL CatalogDir(WCHAR *out, size_t cch)
+{
+    WCHAR dir[MAX_PATH];
+
+    if (g_catalogOff) return FALSE;
+    if (g_catalogDir[0])
+    {
+        _snwprintf(out, cch, L"%s", g_catalogDir);
+        out[cch - 1] = 0;
+        return TRUE;
+    }
+
+    if (!GetExeDirectoryW(dir, MAX_PATH)) return FALSE;
+    JoinPath2W(out, cch, dir, CATALOG_DIR);
+    return TRUE;
+}
+
+static void CatalogPartPath(const CATALOG_BUILDER *b, LPCWSTR dir, DWORD part, BOOL temp,
+    WCHAR *out, size_t cch)
+{
+    WCHAR name[96];
+
+    if (temp)
+        _snwprintf(name, 96, L"%s.%lu.%lu.tmp", b->id, (unsigned long)part, (unsigned long)b->thread);
+    else
+        _snwprintf(name, 96, L"%s.%lu%s", b->id, (unsigned long)part, b->run ? CATALOG_RUN_EXT : CATALOG_EXT);
+    name[95] = 0;
+    JoinPath2W(out, cch, dir, name);
+}
+
+static void CatalogRunPath(LPCWSTR dir, DWORD generation, DWORD run, WCHAR *out, size_t cch)
+{
+    WCHAR name[64];
+
+    _snwprintf(name, 64, L"%08lx.%lu%s", (unsigned long)generation, (unsigned long)run, CATALOG_RUN_EXT);
+    name[63] = 0;
+    JoinPath2W(out, cch, dir, name);
+}
+
+/* <id>.<part>.zcat: id is the first 40 characters; FALSE - not a segment name */
+static BOOL CatalogSegmentId(LPCWSTR fileName, char id[40])
+{
+    DWORD i;
+
+    for (i = 0; i < 40; i++)
+    {
+        if (fileName[i] == 0 || fileName[i] == L'.' || fileName[i] > 0x7F) return FALSE;
+        id[i] = (char)fileName[i];
+    }
+    return fileName[40] == L'.';
+}
+
+/* run name: generation in hex before the first dot */
+static DWORD CatalogRunGeneration(LPCWSTR fileName)
+{
+    return (DWORD)wcstoul(fileName, NULL, 16);
+}
+
+/* held lock: handle of a file nobody else may open, deleted on close;
+   waits up to wait ms for another thread or process to release it */
+static HANDLE CatalogLock(LPCWSTR dir, LPCWSTR name, DWORD wait)
+{
+    WCHAR   path[MAX_PATH * 2];
+    HANDLE  h;
+    DWORD   waited = 0;
+    DWORD   err;
+
+    JoinPath2W(path, MAX_PATH * 2, dir, name);
+    for (;;)
+    {
+        h = CreateFileW(path, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (h != INVALID_HANDLE_VALUE || waited >= wait) return h;
+
+        /* open elsewhere, or being deleted by its last holder */
+        err = GetLastError();
+        if (err != ERROR_SHARING_VIOLATION && err != ERROR_ACCESS_DENIED) return h;
+        Sleep(50);
+        waited += 50;
+    }
+}
+
+static void CatalogUnlock(HANDLE h)
+{
+    if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+}
+
+/* --------------------------------------
+Paths, folding, trigrams
+-------------------------------------- */
+static unsigned char CatalogFold(char c)
+{
+    unsigned char u = (unsigned char)c;
+
+    return (u >= 'A' && u <= 'Z') ? (unsigned char)(u + 32) : u;
+}
+
+static int CatalogCompare(const char *a, DWORD alen, const char *b, DWORD blen)
+{
+    DWORD   i, n = (alen < blen) ? alen : blen;
+    int     d;
+
+    for (i = 0; i < n; i++)
+    {
+        d = (int)CatalogFold(a[i]) - (int)CatalogFold(b[i]);
+        if (d != 0) return d;
+    }
+
+    if (alen == blen) return 0;
+    return (alen < blen) ? -1 : 1;
+}
+
+/* '/' separators; optionally no leading "./" or "/", no trailing "/" */
+static DWORD CatalogNormalize(const char *in, char *out, DWORD cch, BOOL lead, BOOL trail)
+{
+    DWORD   n = 0, start = 0;
+
+    for (; *in && n + 1 < cch; in++)
+        out[n++] = (*in == '\\') ? '/' : *in;
+    out[n] = 0;
+
+    while (lead && start < n)
+    {
+        if (out[start] == '/') start++;
+        else if (out[start] == '.' && out[start + 1] == '/') start += 2;
+        else break;
+    }
+    if (start > 0)
+    {
+        memmove(out, out + start, n - start + 1);
+        n -= start;
+    }
+
+    while (trail && n > 0 && out[n - 1] == '/')
+        out[--n] = 0;
+    return n;
+}
+
+static DWORD CatalogBucket(const char *p, DWORD bits)
+{
+    DWORD t = (DWORD)CatalogFold(p[0]) | ((DWORD)CatalogFold(p[1]) << 8) |
+        ((DWORD)CatalogFold(p[2]) << 16);
+
+    return ((t * 2654435761u) & 0xFFFFFFFFu) >> (32 - bits);
+}
+
+static DWORD CatalogBucketBits(DWORD entries)
+{
+    DWORD bits = CATALOG_BUCKET_BITS_MIN;
+
+    while (bits < CATALOG_BUCKET_BITS_MAX && ((DWORD)1 << bits) < entries) bits++;
+    return bits;
+}
+
+/* --------------------------------------
+Building an archive's segments
+-------------------------------------- */
+static ULONGLONG CatalogNow(void)
+{
+    FILETIME ft;
+
+    GetSystemTimeAsFileTime(&ft);
+    return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+void CatalogBegin(CATALOG_BUILDER *b, const char *tape, DWORD archive, const ZEROTAPE_HEADER *zh)
+{
+    SHA1_CTX        ctx;
+    unsigned char   digest[20];
+
+    ZeroMemory(b, sizeof(*b));
+    b->enabled = CatalogEnabled();
+    if (!b->enabled) return;
+
+    if (tape) memcpy(b->tape, tape, a_strnlen(tape, sizeof(b->tape) - 1));
+    b->archive = archive;
+    memcpy(&b->zh, zh, sizeof(*zh));
+    b->thread = GetCurrentThreadId();
+    b->ingested = CatalogNow();
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, b->tape, sizeof(b->tape));
+    sha1_update(&ctx, zh->creationdate, sizeof(zh->creationdate));
+    sha1_update(&ctx, zh->sha1, sizeof(zh->sha1));
+    sha1_final(&ctx, digest);
+    BytesToHex(digest, sizeof(digest), b->id, 41);
+}
+
+static int CatalogEntryCompare(const CATALOG_BUILDER *b, DWORD x, DWORD y)
+{
+    const CATALOG_ENTRY *ex = &b->entries[x];
+    const CATALOG_ENTRY *ey = &b->entries[y];
+
+    return CatalogCompare(b->names + GetLE32(ex->name), GetLE32(ex->namelen),
+        b->names + GetLE32(ey->name), GetLE32(ey->namelen));
+}
+
+/* bottom-up merge sort of entry numbers: qsort takes no context */
+static void CatalogSort(const CATALOG_BUILDER *b, DWORD *order, DWORD *tmp, DWORD n)
+{
+    DWORD   width, lo, mid, hi, i, j, k;
+    DWORD   *src = order, *dst = tmp, *t;
+
+    for (width = 1; width < n; width *= 2)
+    {
+        for (lo = 0; lo < n; lo += 2 * width)
+        {
+            mid = (lo + width < n) ? lo + width : n;
+            hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi)
+                dst[k++] = (CatalogEntryCompare(b, src[j], src[i]) < 0) ? src[j++] : src[i++];
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+        t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != order) memcpy(order, src, n * sizeof(DWORD));
+}
+
+static BOOL CatalogWriteAll(HANDLE hf, const void *data, DWORD bytes)
+{
+    DWORD written = 0;
+
+    if (bytes == 0) return TRUE;
+    return WriteFile(hf, data, bytes, &written, NULL) && written == bytes;
+}
+
+/* trigram postings of sorted entries: buckets[(1 << bits) + 1] offsets
+   into postings; caller frees both */
+static BOOL CatalogPostings(const CATALOG_BUILDER *b, const CATALOG_ENTRY *sorted, DWORD n,
+    DWORD bits, unsigned char **bucketsOut, unsigned char **postingsOut, DWORD *bytesOut)
+{
+    DWORD           nb = (DWORD)1 << bits;
+    DWORD           *first, *last, *ids = NULL;
+    unsigned char   *buckets, *postings = NULL;
+    DWORD           total = 0, bytes = 0;
+    DWORD           r, i, h, len, v, prev;
+    const char      *name;
+    BOOL            ok;
+
+    first = (DWORD*)calloc(nb + 1, sizeof(DWORD));
+    last = (DWORD*)malloc(nb * sizeof(DWORD));
+    buckets = (unsigned char*)malloc((nb + 1) * 4);
+    ok = first && last && buckets;
+
+    /* count each trigram once per entry, then lay out entry numbers by bucket */
+    if (ok)
+    {
+        memset(last, 0xFF, nb * sizeof(DWORD));
+        for (r = 0; r < n; r++)
+        {
+            name = b->names + GetLE32(sorted[r].name);
+            len = GetLE32(sorted[r].namelen);
+            for (i = 0; i + 3 <= len; i++)
+            {
+                h = CatalogBucket(name + i, bits);
+                if (last[h] == r) continue;
+                last[h] = r;
+                first[h + 1]++;
+                total++;
+            }
+        }
+        for (h = 0; h < nb; h++) first[h + 1] += first[h];
+
+        ids = (DWORD*)malloc((total + 1) * sizeof(DWORD));
+        postings = (unsigned char*)malloc((size_t)total * 3 + 1);    /* entry numbers < 2^21 */
+        ok = ids && postings;
+    }
+
+    if (ok)
+    {
+        memset(last, 0xFF, nb * sizeof(DWORD));
+        for (r = 0; r < n; r++)
+        {
+            name = b->names + GetLE32(sorted[r].name);
+            len = GetLE32(sorted[r].namelen);
+            for (i = 0; i + 3 <= len; i++)
+            {
+                h = CatalogBucket(name + i, bits);
+                if (last[h] == r) continue;
+                last[h] = r;
+                ids[first[h]++] = r;
+            }
+        }
+
+        /* first[h] is now the end of bucket h, its start the end of h - 1 */
+        for (h = 0; h < nb; h++)
+        {
+            PutLE32(buckets + h * 4, bytes);
+            prev = 0;
+            for (i = (h == 0) ? 0 : first[h - 1]; i < first[h]; i++)
+            {
+                v = ids[i] - prev;
+                prev = ids[i];
+                while (v >= 0x80)
+                {
+                    postings[bytes++] = (unsigned char)(v | 0x80);
+                    v >>= 7;
+                }
+                postings[bytes++] = (unsigned char)v;
+            }
+        }
+        PutLE32(buckets + nb * 4, bytes);
+    }
+
+    free(first);
+    free(last);
+    free(ids);
+    if (!ok)
+    {
+        wprintf(L"Out of memory.\r\n");
+        free(buckets);
+        free(postings);
+        return FALSE;
+    }
+
+    *bucketsOut = buckets;
+    *postingsOut = postings;
+    *bytesOut = bytes;
+    return TRUE;
+}
+
+/* one temp part file; deleted again if it can't be written whole */
+static BOOL CatalogWritePartFile(const CATALOG_BUILDER *b, const CATALOG_HEADER *hdr,
+    const CATALOG_ENTRY *sorted, const unsigned char *buckets, const unsigned char *postings)
+{
+    WCHAR   dir[MAX_PATH];
+    WCHAR   path[MAX_PATH * 2];
+    HANDLE  hf;
+    BOOL    ok;
+
+    if (!CatalogDir(dir, MAX_PATH) || !EnsureDirectoryExistsW(dir))
+    {
+        PrintLastErrorW(L"Failed to create catalog directory", 0);
+        return FALSE;
+    }
+
+    CatalogPartPath(b, dir, b->parts, TRUE, path, MAX_PATH * 2);
+    hf = CreateFileW(path, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to create catalog segment", 0);
+        return FALSE;
+    }
+
+    ok = CatalogWriteAll(hf, hdr, sizeof(*hdr)) &&
+        CatalogWriteAll(hf, sorted, GetLE32(hdr->entries) * (DWORD)sizeof(CATALOG_ENTRY)) &&
+        CatalogWriteAll(hf, b->names, b->namesBytes) &&
+        CatalogWriteAll(hf, buckets, (((DWORD)1 << hdr->bucketBits) + 1) * 4) &&
+        CatalogWriteAll(hf, postings, GetLE32(hdr->postingsBytes)) &&
+        FlushFileBuffers(hf);
+    if (!ok) PrintLastErrorW(L"Failed to write catalog segment", 0);
+    CloseHandle(hf);
+
+    if (!ok) DeleteFileW(path);
+    return ok;
+}
+
+/* entries so far go to the next temp part, sorted and with their trigram postings */
+static BOOL CatalogWritePart(CATALOG_BUILDER *b)
+{
+    CATALOG_HEADER  hdr;
+    CATALOG_ENTRY   *sorted;
+    DWORD           *order, *tmp;
+    unsigned char   *buckets = NULL, *postings = NULL;
+    DWORD           n = b->count, bits, bytes = 0;
+    DWORD           r;
+    BOOL            ok;
+
+    bits = CatalogBucketBits(n);
+    order = (DWORD*)malloc((n + 1) * sizeof(DWORD));
+    tmp = (DWORD*)malloc((n + 1) * sizeof(DWORD));
+    sorted = (CATALOG_ENTRY*)malloc((n + 1) * sizeof(CATALOG_ENTRY));
+    ok = order && tmp && sorted;
+    if (!ok) wprintf(L"Out of memory.\r\n");
+
+    if (ok)
+    {
+        for (r = 0; r < n; r++) order[r] = r;
+        CatalogSort(b, order, tmp, n);
+        for (r = 0; r < n; r++) sorted[r] = b->entries[order[r]];
+        ok = CatalogPostings(b, sorted, n, bits, &buckets, &postings, &bytes);
+    }
+
+    if (ok)
+    {
+        ZeroMemory(&hdr, sizeof(hdr));
+        memcpy(hdr.magic, "ZTCATSEG", 8);
+        hdr.version = b->run ? 1 : 0;
+        hdr.bucketBits = (unsigned char)bits;
+        memcpy(hdr.tape, b->tape, sizeof(hdr.tape));
+        PutLE32(hdr.archive, b->archive);
+        PutLE32(hdr.part, b->parts);
+        PutLE32(hdr.entries, n);
+        memcpy(&hdr.zh, &b->zh, sizeof(hdr.zh));
+        PutLE32(hdr.namesBytes, b->namesBytes);
+        PutLE32(hdr.postingsBytes, bytes);
+        PutLE64(hdr.ingested, b->ingested);
+        ok = CatalogWritePartFile(b, &hdr, sorted, buckets, postings);
+    }
+
+    if (ok)
+    {
+        b->parts++;
+        b->count = 0;
+        b->namesBytes = 0;
+    }
+
+    free(order);
+    free(tmp);
+    free(sorted);
+    free(buckets);
+    free(postings);
+    return ok;
+}
+
+/* next entry with its path copied in, the rest zero; NULL - b->failed */
+static CATALOG_ENTRY* CatalogAddEntry(CATALOG_BUILDER *b, const char *path, DWORD len)
+{
+    CATALOG_ENTRY   *e;
+    char            *names;
+    DWORD           cap;
+
+    if (b->count == CATALOG_SEGMENT_MAX || b->namesBytes + len > CATALOG_NAMES_MAX)
+    {
+        if (!CatalogWritePart(b))
+        {
+            b->failed = TRUE;
+            return NULL;
+        }
+    }
+
+    if (!b->entries)
+    {
+        b->entries = (CATALOG_ENTRY*)malloc(CATALOG_SEGMENT_MAX * sizeof(CATALOG_ENTRY));
+        if (!b->entries)
+        {
+            wprintf(L"Out of memory.\r\n");
+            b->failed = TRUE;
+            return NULL;
+        }
+    }
+
+    if (b->namesBytes + len > b->namesCap)
+    {
+        cap = b->namesCap ? b->namesCap : 1024 * 1024;
+        while (cap < b->namesBytes + len) cap *= 2;
+        if (cap > CATALOG_NAMES_MAX) cap = CATALOG_NAMES_MAX;
+
+        names = (char*)realloc(b->names, cap);
+        if (!names)
+        {
+            wprintf(L"Out of memory.\r\n");
+            b->failed = TRUE;
+            return NULL;
+        }
+        b->names = names;
+        b->namesCap = cap;
+    }
+
+    e = &b->entries[b->count++];
+    ZeroMemory(e, sizeof(*e));
+    PutLE32(e->name, b->namesBytes);
+    PutLE32(e->namelen, len);
+    memcpy(b->names + b->namesBytes, path, len);
+    b->namesBytes += len;
+    return e;
+}
+
+/* TAR_MEMBER_SINK; ctx is a CATALOG_BUILDER */
+void CatalogSink(void *ctx, const TAR_MEMBER *m)
+{
+    CATALOG_BUILDER *b = (CATALOG_BUILDER*)ctx;
+    CATALOG_ENTRY   *e;
+    char            path[4096 * 3];
+    DWORD           len;
+
+    if (!b->enabled || b->failed) return;
+
+    len = CatalogNormalize(m->name, path, sizeof(path), TRUE, TRUE);
+    if (len == 0) return;
+
+    e = CatalogAddEntry(b, path, len);
+    if (!e) return;
+
+    PutLE64(e->offset, m->offset);
+    PutLE64(e->dataOffset, m->dataOffset);
+    PutLE64(e->size, m->size);
+    PutLE64(e->mtime, (ULONGLONG)m->mtime);
+    PutLE32(e->mode, m->mode);
+    e->type = (unsigned char)m->type;
+}
+
+/* complete - every member was seen: segments replace the archive's old
+   ones; otherwise they are dropped and the catalog stays as it was */
+BOOL CatalogEnd(CATALOG_BUILDER *b, BOOL complete)
+{
+    WCHAR   dir[MAX_PATH];
+    WCHAR   tmpPath[MAX_PATH * 2];
+    WCHAR   path[MAX_PATH * 2];
+    DWORD   part;
+    HANDLE  lock = INVALID_HANDLE_VALUE;
+    BOOL    ok;
+    BOOL    moved = TRUE;
+
+    if (!b->enabled) return TRUE;
+
+    TRACE_BEGIN("catalog end", b->count);
+    ok = complete && !b->failed;
+    if (ok && (b->count > 0 || b->parts == 0))
+        ok = CatalogWritePart(b);
+
+    if (b->parts > 0 && CatalogDir(dir, MAX_PATH))
+    {
+        /* a compaction deletes merged segments, never while these are renamed */
+        if (ok) lock = CatalogLock(dir, CATALOG_LOCK_FILE, CATALOG_LOCK_MS);
+        if (ok && lock == INVALID_HANDLE_VALUE)
+        {
+            PrintLastErrorW(L"Failed to lock catalog", 0);
+            ok = FALSE;
+        }
+
+        for (part = 0; part < b->parts; part++)
+        {
+            CatalogPartPath(b, dir, part, TRUE, tmpPath, MAX_PATH * 2);
+            CatalogPartPath(b, dir, part, FALSE, path, MAX_PATH * 2);
+            if (ok && moved &&
+                !MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            {
+                PrintLastErrorW(L"Failed to update catalog", 0);
+                moved = FALSE;
+                part = (DWORD)-1;   /* again from 0 */
+                continue;
+            }
+            if (!ok || !moved)
+            {
+                DeleteFileW(tmpPath);
+                if (ok) DeleteFileW(path);  /* partly replaced: drop the archive */
+            }
+        }
+        ok = ok && moved;
+
+        /* archive had more members the last time */
+        for (part = b->parts; ok; part++)
+        {
+            CatalogPartPath(b, dir, part, FALSE, path, MAX_PATH * 2);
+            if (!DeleteFileW(path)) break;
+        }
+        CatalogUnlock(lock);
+
+        if (ok) CatalogCompact(dir);
+    }
+    TRACE_END("catalog end", b->parts);
+
+    free(b->entries);
+    free(b->names);
+    b->entries = NULL;
+    b->names = NULL;
+    b->enabled = FALSE;
+    return ok;
+}
+
+/* archive about to be or just written from tarPath */
+BOOL CatalogAddTarFile(const char *tape, DWORD archive, const ZEROTAPE_HEADER *zh, LPCWSTR tarPath)
+{
+    CATALOG_BUILDER b;
+    HANDLE          hf;
+    BOOL            ok;
+
+    if (!CatalogEnabled() || zh->format != 1) return TRUE;
+
+    hf = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file for catalog", 0);
+        return FALSE;
+    }
+
+    TRACE_BEGIN("catalog tar", 0);
+    CatalogBegin(&b, tape, archive, zh);
+    ok = ScanTarFile(hf, CatalogSink, &b);
+    CloseHandle(hf);
+    ok = CatalogEnd(&b, ok);
+    TRACE_END("catalog tar", 0);
+    return ok;
+}
+
+/* --------------------------------------
+Queries
+-------------------------------------- */
+typedef struct _CATALOG_SEGMENT {
+    HANDLE                  hf;
+    HANDLE                  hmap;
+    const BYTE              *base;
+    const CATALOG_HEADER    *hdr;
+    const CATALOG_ENTRY     *entries;
+    DWORD                   count;
+    const char              *names;
+    DWORD                   namesBytes;
+    const BYTE              *buckets;
+    DWORD                   bits;
+    const BYTE              *postings;
+    DWORD                   postingsBytes;
+} CATALOG_SEGMENT;
+
+/* mapped CATALOG_MANIFEST_FILE; no file - no runs, no sources */
+typedef struct _CATALOG_MANIFEST_VIEW {
+    HANDLE                  hf;
+    HANDLE                  hmap;
+    const BYTE              *base;
+    DWORD                   generation;
+    DWORD                   runs;
+    DWORD                   sources;
+    const CATALOG_RUN       *run;
+    const CATALOG_SOURCE    *source;    /* sorted by id */
+    const char              *firsts;
+    DWORD                   firstBytes;
+} CATALOG_MANIFEST_VIEW;
+
+typedef struct _CATALOG_SEARCH {
+    DWORD           type;
+    char            pattern[4096];
+    DWORD           len;
+    DWORD           prefixLen;      /* sorted range to look in, 0 - none */
+    const char      *gram;          /* literal whose trigrams give candidates */
+    DWORD           gramLen;
+    DWORD           max;
+    DWORD           found;
+    CATALOG_HIT_FN  fn;
+    void            *ctx;
+    BOOL            stop;
+    const CATALOG_MANIFEST_VIEW *man;
+    DWORD           *replaced;      /* sources with a newer segment, sorted */
+    DWORD           replacedCount;
+    DWORD           replacedCap;
+} CATALOG_SEARCH;
+
+static void CatalogUnmapFile(HANDLE *hf, HANDLE *hmap, const BYTE **base)
+{
+    if (*base) UnmapViewOfFile(*base);
+    if (*hmap) CloseHandle(*hmap);
+    if (*hf != INVALID_HANDLE_VALUE) CloseHandle(*hf);
+    *base = NULL;
+    *hmap = NULL;
+    *hf = INVALID_HANDLE_VALUE;
+}
+
+/* whole file, read only; FALSE - can't be opened, or empty, or over 2 GiB */
+static BOOL CatalogMapFile(LPCWSTR path, HANDLE *hf, HANDLE *hmap, const BYTE **base, DWORD *bytes)
+{
+    LARGE_INTEGER size;
+
+    *hmap = NULL;
+    *base = NULL;
+    *hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (*hf == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (GetFileSizeEx(*hf, &size) && size.QuadPart > 0 && size.QuadPart <= 0x7FFFFFFF)
+    {
+        *hmap = CreateFileMappingW(*hf, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (*hmap) *base = (const BYTE*)MapViewOfFile(*hmap, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!*base)
+    {
+        CatalogUnmapFile(hf, hmap, base);
+        return FALSE;
+    }
+
+    *bytes = (DWORD)size.QuadPart;
+    return TRUE;
+}
+
+static void CatalogUnmap(CATALOG_SEGMENT *s)
+{
+    CatalogUnmapFile(&s->hf, &s->hmap, &s->base);
+}
+
+/* FALSE - not a segment or run of this version, or damaged */
+static BOOL CatalogMap(CATALOG_SEGMENT *s, LPCWSTR path)
+{
+    DWORD           bytes;
+    ULONGLONG       expect;
+
+    ZeroMemory(s, sizeof(*s));
+    if (!CatalogMapFile(path, &s->hf, &s->hmap, &s->base, &bytes)) return FALSE;
+    if (bytes < sizeof(CATALOG_HEADER))
+    {
+        CatalogUnmap(s);
+        return FALSE;
+    }
+
+    s->hdr = (const CATALOG_HEADER*)s->base;
+    s->count = GetLE32(s->hdr->entries);
+    s->namesBytes = GetLE32(s->hdr->namesBytes);
+    s->postingsBytes = GetLE32(s->hdr->postingsBytes);
+    s->bits = s->hdr->bucketBits;
+    if (memcmp(s->hdr->magic, "ZTCATSEG", 8) != 0 || s->hdr->version > 1 ||
+        s->bits < CATALOG_BUCKET_BITS_MIN || s->bits > CATALOG_BUCKET_BITS_MAX ||
+        s->count > CATALOG_SEGMENT_MAX)
+    {
+        CatalogUnmap(s);
+        return FALSE;
+    }
+
+    expect = sizeof(CATALOG_HEADER) + (ULONGLONG)s->count * sizeof(CATALOG_ENTRY) +
+        s->namesBytes + (((ULONGLONG)1 << s->bits) + 1) * 4 + s->postingsBytes;
+    if (expect != bytes)
+    {
+        CatalogUnmap(s);
+        return FALSE;
+    }
+
+    s->entries = (const CATALOG_ENTRY*)(s->base + sizeof(CATALOG_HEADER));
+    s->names = (const char*)(s->entries + s->count);
+    s->buckets = (const BYTE*)(s->names + s->namesBytes);
+    s->postings = s->buckets + (((DWORD)1 << s->bits) + 1) * 4;
+    return TRUE;
+}
+
+static void CatalogUnmapManifest(CATALOG_MANIFEST_VIEW *m)
+{
+    CatalogUnmapFile(&m->hf, &m->hmap, &m->base);
+}
+
+/* FALSE - manifest damaged; a missing one is empty */
+static BOOL CatalogMapManifest(CATALOG_MANIFEST_VIEW *m, LPCWSTR dir)
+{
+    WCHAR                   path[MAX_PATH * 2];
+    const CATALOG_MANIFEST  *hdr;
+    DWORD                   bytes;
+    ULONGLONG               expect;
+
+    ZeroMemory(m, sizeof(*m));
+    m->hf = INVALID_HANDLE_VALUE;
+    JoinPath2W(path, MAX_PATH * 2, dir, CATALOG_MANIFEST_FILE);
+    if (!CatalogMapFile(path, &m->hf, &m->hmap, &m->base, &bytes))
+        return GetFileAttributesW(path) == INVALID_FILE_ATTRIBUTES;
+
+    hdr = (const CATALOG_MANIFEST*)m->base;
+    if (bytes < sizeof(*hdr) || memcmp(hdr->magic, "ZTCATMAN", 8) != 0 || hdr->version != 0)
+    {
+        CatalogUnmapManifest(m);
+        return FALSE;
+    }
+
+    m->generation = GetLE32(hdr->generation);
+    m->runs = GetLE32(hdr->runs);
+    m->sources = GetLE32(hdr->sources);
+    m->firstBytes = GetLE32(hdr->firstBytes);
+    expect = sizeof(*hdr) + (ULONGLONG)m->runs * sizeof(CATALOG_RUN) +
+        (ULONGLONG)m->sources * sizeof(CATALOG_SOURCE) + m->firstBytes;
+    if (expect != bytes || m->sources > CATALOG_MAX_SOURCES)
+    {
+        CatalogUnmapManifest(m);
+        return FALSE;
+    }
+
+    m->run = (const CATALOG_RUN*)(m->base + sizeof(*hdr));
+    m->source = (const CATALOG_SOURCE*)(m->run + m->runs);
+    m->firsts = (const char*)(m->source + m->sources);
+    return TRUE;
+}
+
+static DWORD CatalogFindSource(const CATALOG_SOURCE *source, DWORD count, const char *id)
+{
+    DWORD   lo = 0, hi = count, mid;
+    int     d;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        d = memcmp(source[mid].id, id, sizeof(source[mid].id));
+        if (d == 0) return mid;
+        if (d < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return CATALOG_NO_SOURCE;
+}
+
+static DWORD CatalogSourceOf(const CATALOG_ENTRY *e)
+{
+    return (DWORD)e->source[0] | ((DWORD)e->source[1] << 8) | ((DWORD)e->source[2] << 16);
+}
+
+/* damaged run reads as "" */
+static const char* CatalogRunFirst(const CATALOG_MANIFEST_VIEW *m, DWORD run, DWORD *len)
+{
+    DWORD off = GetLE32(m->run[run].first);
+
+    *len = GetLE32(m->run[run].firstLen);
+    if (off > m->firstBytes || *len > m->firstBytes - off) *len = 0;
+    return m->firsts + ((*len) ? off : 0);
+}
+
+/* runs [*from, *to) that may hold paths starting with prefix; equal
+   paths may end one run and start the next */
+static void CatalogRunRange(const CATALOG_MANIFEST_VIEW *m, const char *prefix, DWORD prefixLen,
+    DWORD *from, DWORD *to)
+{
+    DWORD       lo = 0, hi = m->runs, mid, len;
+    const char  *first;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        first = CatalogRunFirst(m, mid, &len);
+        if (CatalogCompare(first, len, prefix, prefixLen) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    *from = (lo > 0) ? lo - 1 : 0;
+    for (*to = *from; *to < m->runs; (*to)++)
+    {
+        first = CatalogRunFirst(m, *to, &len);
+        if (*to > *from && CatalogCompare(first, (len < prefixLen) ? len : prefixLen, prefix, prefixLen) > 0)
+            break;
+    }
+}
+
+/* damaged entry reads as "" */
+static const char* CatalogName(const CATALOG_SEGMENT *s, DWORD r, DWORD *len)
+{
+    DWORD off = GetLE32(s->entries[r].name);
+
+    *len = GetLE32(s->entries[r].namelen);
+    if (off > s->namesBytes || *len > s->namesBytes - off) *len = 0;
+    return s->names + ((*len) ? off : 0);
+}
+
+/* first entry not before key */
+static DWORD CatalogLowerBound(const CATALOG_SEGMENT *s, const char *key, DWORD keyLen)
+{
+    DWORD       lo = 0, hi = s->count, mid, len;
+    const char  *name;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        name = CatalogName(s, mid, &len);
+        if (CatalogCompare(name, len, key, keyLen) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static DWORD CatalogNextChar(const char *s, DWORD i, DWORD len)
+{
+    for (i++; i < len && ((unsigned char)s[i] & 0xC0) == 0x80; i++) ;
+    return i;
+}
+
+static BOOL CatalogGlob(const char *p, DWORD plen, const char *s, DWORD slen)
+{
+    DWORD pi = 0, si = 0, starP = (DWORD)-1, starS = 0;
+
+    while (si < slen)
+    {
+        if (pi < plen && p[pi] == '*')
+        {
+            starP = ++pi;
+            starS = si;
+        }
+        else if (pi < plen && p[pi] == '?')
+        {
+            pi++;
+            si = CatalogNextChar(s, si, slen);
+        }
+        else if (pi < plen && CatalogFold(p[pi]) == CatalogFold(s[si]))
+        {
+            pi++;
+            si++;
+        }
+        else if (starP != (DWORD)-1)
+        {
+            pi = starP;
+            starS = CatalogNextChar(s, starS, slen);
+            si = starS;
+        }
+        else
+            return FALSE;
+    }
+
+    while (pi < plen && p[pi] == '*') pi++;
+    return (pi == plen);
+}
+
+static BOOL CatalogContains(const char *s, DWORD slen, const char *needle, DWORD nlen)
+{
+    DWORD i;
+
+    for (i = 0; i + nlen <= slen; i++)
+        if (CatalogCompare(s + i, nlen, needle, nlen) == 0) return TRUE;
+    return FALSE;
+}
+
+static BOOL CatalogMatches(const CATALOG_SEARCH *q, const char *name, DWORD len)
+{
+    switch (q->type)
+    {
+    case CATALOG_QUERY_PATH:
+        return CatalogCompare(name, len, q->pattern, q->len) == 0;
+    case CATALOG_QUERY_PREFIX:
+        return len >= q->len && CatalogCompare(name, q->len, q->pattern, q->len) == 0;
+    case CATALOG_QUERY_GLOB:
+        return CatalogGlob(q->pattern, q->len, name, len);
+    default:
+        return CatalogContains(name, len, q->pattern, q->len);
+    }
+}
+
+static BOOL CatalogReplaced(const CATALOG_SEARCH *q, DWORD source)
+{
+    DWORD lo = 0, hi = q->replacedCount, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (q->replaced[mid] == source) return TRUE;
+        if (q->replaced[mid] < source) lo = mid + 1;
+        else hi = mid;
+    }
+    return FALSE;
+}
+
+/* a segment not merged yet has this source's entries */
+static void CatalogReplace(CATALOG_SEARCH *q, DWORD source)
+{
+    DWORD   i, cap;
+    DWORD   *more;
+
+    if (CatalogReplaced(q, source)) return;
+    if (q->replacedCount == q->replacedCap)
+    {
+        cap = q->replacedCap ? q->replacedCap * 2 : 64;
+        more = (DWORD*)realloc(q->replaced, cap * sizeof(DWORD));
+        if (!more) return;
+        q->replaced = more;
+        q->replacedCap = cap;
+    }
+
+    for (i = q->replacedCount; i > 0 && q->replaced[i - 1] > source; i--)
+        q->replaced[i] = q->replaced[i - 1];
+    q->replaced[i] = source;
+    q->replacedCount++;
+}
+
+static void CatalogTry(CATALOG_SEARCH *q, const CATALOG_SEGMENT *s, DWORD r)
+{
+    const CATALOG_ENTRY     *e = &s->entries[r];
+    const CATALOG_SOURCE    *src = NULL;
+    const char              *name;
+    CATALOG_HIT             hit;
+    char                    path[4096 * 3 + 1];
+    char                    tape[33];
+    DWORD                   len, source;
+
+    name = CatalogName(s, r, &len);
+    if (len == 0 || len >= sizeof(path) || !CatalogMatches(q, name, len)) return;
+
+    /* run: archive is in the manifest, unless a newer segment replaced it */
+    if (s->hdr->version == 1)
+    {
+        source = CatalogSourceOf(e);
+        if (source >= q->man->sources || CatalogReplaced(q, source)) return;
+        src = &q->man->source[source];
+    }
+
+    memcpy(path, name, len);
+    path[len] = 0;
+    memcpy(tape, src ? src->tape : s->hdr->tape, 32);
+    tape[32] = 0;
+
+    hit.tape = tape;
+    hit.archive = GetLE32(src ? src->archive : s->hdr->archive);
+    hit.zh = src ? &src->zh : &s->hdr->zh;
+    hit.path = path;
+    hit.offset = GetLE64(e->offset);
+    hit.dataOffset = GetLE64(e->dataOffset);
+    hit.size = GetLE64(e->size);
+    hit.mtime = (LONGLONG)GetLE64(e->mtime);
+    hit.mode = GetLE32(e->mode);
+    hit.type = (char)e->type;
+
+    q->found++;
+    if (!q->fn(q->ctx, &hit) || q->found >= q->max) q->stop = TRUE;
+}
+
+static void CatalogSearchSegment(CATALOG_SEARCH *q, const CATALOG_SEGMENT *s)
+{
+    const BYTE  *p, *end;
+    const char  *name;
+    DWORD       r, i, h, len, start, stop, best = 0, bestLen = (DWORD)-1;
+    DWORD       v, shift;
+    BYTE        c;
+
+    /* sorted range */
+    if (q->prefixLen > 0)
+    {
+        for (r = CatalogLowerBound(s, q->pattern, q->prefixLen); r < s->count && !q->stop; r++)
+        {
+            name = CatalogName(s, r, &len);
+            if (len < q->prefixLen || CatalogCompare(name, q->prefixLen, q->pattern, q->prefixLen) != 0)
+                break;
+            CatalogTry(q, s, r);
+        }
+        return;
+    }
+
+    /* entries of the rarest trigram */
+    if (q->gramLen >= 3)
+    {
+        for (i = 0; i + 3 <= q->gramLen; i++)
+        {
+            h = CatalogBucket(q->gram + i, s->bits);
+            start = GetLE32(s->buckets + h * 4);
+            stop = GetLE32(s->buckets + h * 4 + 4);
+            if (start > stop || stop > s->postingsBytes) stop = start;
+            if (stop - start < bestLen)
+            {
+                best = h;
+                bestLen = stop - start;
+            }
+        }
+        if (bestLen == 0) return;
+
+        p = s->postings + GetLE32(s->buckets + best * 4);
+        end = p + bestLen;
+        r = 0;
+        while (p < end && !q->stop)
+        {
+            v = 0;
+            shift = 0;
+            do
+            {
+                c = *p++;
+                v |= (DWORD)(c & 0x7F) << shift;
+                shift += 7;
+            } while ((c & 0x80) && p < end && shift < 28);
+
+            r += v;
+            if (r >= s->count) break;
+            CatalogTry(q, s, r);
+        }
+        return;
+    }
+
+    for (r = 0; r < s->count && !q->stop; r++)
+        CatalogTry(q, s, r);
+}
+
+/* pattern is UTF-8; found - matches reported, at most max
+   (0 - CATALOG_MAX_RESULTS). FALSE - catalog off or unreadable */
+BOOL CatalogQuery(DWORD type, const char *pattern, DWORD max,
+    CATALOG_HIT_FN fn, void *ctx, DWORD *found)
+{
+    CATALOG_SEARCH          q;
+    CATALOG_SEGMENT         s;
+    CATALOG_MANIFEST_VIEW   man;
+    WIN32_FIND_DATAW        fd;
+    HANDLE                  hfind;
+    WCHAR                   dir[MAX_PATH];
+    WCHAR                   mask[MAX_PATH + 16];
+    WCHAR                   path[MAX_PATH * 2];
+    char                    id[40];
+    DWORD                   i, run, from, to, source;
+    DWORD                   err;
+
+    if (found) *found = 0;
+    if (type < CATALOG_QUERY_PATH || type > CATALOG_QUERY_SUBSTRING)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (!CatalogDir(dir, MAX_PATH))
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+
+    ZeroMemory(&q, sizeof(q));
+    q.type = type;
+    q.len = CatalogNormalize(pattern, q.pattern, sizeof(q.pattern),
+        type != CATALOG_QUERY_SUBSTRING, type == CATALOG_QUERY_PATH);
+    q.max = (max == 0 || max > CATALOG_MAX_RESULTS) ? CATALOG_MAX_RESULTS : max;
+    q.fn = fn;
+    q.ctx = ctx;
+
+    switch (type)
+    {
+    case CATALOG_QUERY_PATH:
+    case CATALOG_QUERY_PREFIX:
+        q.prefixLen = q.len;
+        if (type == CATALOG_QUERY_PATH && q.len == 0) return TRUE;
+        break;
+    case CATALOG_QUERY_GLOB:
+        while (q.prefixLen < q.len && q.pattern[q.prefixLen] != '*' && q.pattern[q.prefixLen] != '?')
+            q.prefixLen++;
+        /* no literal start: longest literal run */
+        for (i = 0; i < q.len; i += run + 1)
+        {
+            for (run = 0; i + run < q.len && q.pattern[i + run] != '*' && q.pattern[i + run] != '?'; run++) ;
+            if (run > q.gramLen)
+            {
+                q.gram = q.pattern + i;
+                q.gramLen = run;
+            }
+        }
+        break;
+    default:
+        q.gram = q.pattern;
+        q.gramLen = q.len;
+        break;
+    }
+
+    if (!CatalogMapManifest(&man, dir))
+    {
+        SetLastError(ERROR_FILE_CORRUPT);
+        return FALSE;
+    }
+    q.man = &man;
+
+    _snwprintf(mask, MAX_PATH + 16, L"%s\\*%s", dir, CATALOG_EXT);
+    mask[MAX_PATH + 15] = 0;
+    hfind = FindFirstFileW(mask, &fd);
+    if (hfind == INVALID_HANDLE_VALUE)
+    {
+        err = GetLastError();
+        if (err != ERROR_FILE_NOT_FOUND && err != ERROR_PATH_NOT_FOUND)
+        {
+            CatalogUnmapManifest(&man);
+            return FALSE;
+        }
+    }
+
+    TRACE_BEGIN("catalog query", type);
+
+    /* segments not merged yet; they replace their archive in the runs */
+    if (hfind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+
+            JoinPath2W(path, MAX_PATH * 2, dir, fd.cFileName);
+            if (!CatalogMap(&s, path)) continue;
+
+            source = CatalogSegmentId(fd.cFileName, id) ?
+                CatalogFindSource(man.source, man.sources, id) : CATALOG_NO_SOURCE;
+            if (s.hdr->version == 0 && (source == CATALOG_NO_SOURCE ||
+                GetLE64(s.hdr->ingested) > GetLE64(man.source[source].ingested)))
+            {
+                if (source != CATALOG_NO_SOURCE) CatalogReplace(&q, source);
+                CatalogSearchSegment(&q, &s);
+            }
+            CatalogUnmap(&s);
+        } while (!q.stop && FindNextFileW(hfind, &fd));
+        FindClose(hfind);
+    }
+
+    /* runs: a path or prefix only where the key falls */
+    if (q.prefixLen > 0)
+        CatalogRunRange(&man, q.pattern, q.prefixLen, &from, &to);
+    else
+    {
+        from = 0;
+        to = man.runs;
+    }
+    for (; from < to && !q.stop; from++)
+    {
+        CatalogRunPath(dir, man.generation, from, path, MAX_PATH * 2);
+        if (!CatalogMap(&s, path)) continue;
+        if (s.hdr->version == 1) CatalogSearchSegment(&q, &s);
+        CatalogUnmap(&s);
+    }
+    TRACE_END("catalog query", q.found);
+
+    CatalogUnmapManifest(&man);
+    free(q.replaced);
+    if (found) *found = q.found;
+    return TRUE;
+}
+
+/* --------------------------------------
+Compaction (see catalog.h)
+-------------------------------------- */
+typedef struct _CATALOG_LOOSE {
+    WCHAR           name[64];       /* segment file */
+    char            id[40];
+    ULONGLONG       bytes;
+    ULONGLONG       ingested;
+    BOOL            pending;        /* not in the runs yet */
+    BOOL            merge;          /* mapped, goes into the new runs */
+    DWORD           source;         /* in the new manifest */
+    CATALOG_SEGMENT seg;
+} CATALOG_LOOSE;
+
+/* walks one segment, or all old runs one after another */
+typedef struct _CATALOG_CURSOR {
+    CATALOG_SEGMENT         *seg;
+    BOOL                    runs;
+    DWORD                   run;            /* next old run to map */
+    DWORD                   r;
+    const CATALOG_ENTRY     *entry;
+    const char              *name;
+    DWORD                   len;
+    DWORD                   source;         /* in the new manifest */
+} CATALOG_CURSOR;
+
+typedef struct _CATALOG_COMPACT {
+    WCHAR                   dir[MAX_PATH];
+    CATALOG_MANIFEST_VIEW   old;
+    DWORD                   generation;     /* of the new runs */
+    CATALOG_LOOSE           *loose;         /* sorted by id */
+    DWORD                   looseCount;
+    DWORD                   archives;       /* merged from segments */
+    CATALOG_SEGMENT         runSeg;         /* old run being read */
+    DWORD                   *remap;         /* old source -> new, CATALOG_NO_SOURCE - replaced */
+    CATALOG_SOURCE          *sources;
+    DWORD                   sourceCount;
+    CATALOG_CURSOR          *cursors;
+    DWORD                   *heap;          /* cursors by current path */
+    DWORD                   heapCount;
+    CATALOG_BUILDER         b;              /* new runs */
+    CATALOG_RUN             *runs;
+    DWORD                   runCap;
+    char                    *firsts;
+    DWORD                   firstBytes;
+    DWORD                   firstCap;
+    BOOL                    installed;
+    BOOL                    failed;
+} CATALOG_COMPACT;
+
+static int CatalogLooseCompare(const void *x, const void *y)
+{
+    const CATALOG_LOOSE *a = (const CATALOG_LOOSE*)x;
+    const CATALOG_LOOSE *b = (const CATALOG_LOOSE*)y;
+    int                 d = memcmp(a->id, b->id, sizeof(a->id));
+
+    return d ? d : wcscmp(a->name, b->name);
+}
+
+static BOOL CatalogReadHeader(LPCWSTR path, CATALOG_HEADER *hdr)
+{
+    HANDLE  hf;
+    DWORD   got = 0;
+    BOOL    ok;
+
+    hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) return FALSE;
+
+    ok = ReadFile(hf, hdr, sizeof(*hdr), &got, NULL) && got == sizeof(*hdr) &&
+        memcmp(hdr->magic, "ZTCATSEG", 8) == 0 && hdr->version == 0;
+    CloseHandle(hf);
+    return ok;
+}
+
+/* TRUE - segment is in the runs of manifest m */
+static BOOL CatalogMerged(const CATALOG_MANIFEST_VIEW *m, const char *id, ULONGLONG ingested)
+{
+    DWORD source = CatalogFindSource(m->source, m->sources, id);
+
+    return source != CATALOG_NO_SOURCE && ingested <= GetLE64(m->source[source].ingested);
+}
+
+/* lists the segments and maps those of the archives to merge, whole
+   archives up to CATALOG_COMPACT_MAP_MAX bytes; FALSE - too few to merge */
+static BOOL CatalogCompactSelect(CATALOG_COMPACT *c)
+{
+    WIN32_FIND_DATAW    fd;
+    HANDLE              hfind;
+    WCHAR               path[MAX_PATH * 2];
+    CATALOG_HEADER      hdr;
+    CATALOG_LOOSE       *l, *more;
+    DWORD               i, j, k, cap = 0, pending = 0;
+    ULONGLONG           bytes = 0, group;
+    char                id[40];
+    BOOL                ok;
+
+    if (!CatalogMapManifest(&c->old, c->dir))
+    {
+        wprintf(L"Catalog manifest is damaged, catalog is not compacted.\r\n");
+        return FALSE;
+    }
+
+    _snwprintf(path, MAX_PATH * 2, L"%s\\*%s", c->dir, CATALOG_EXT);
+    path[MAX_PATH * 2 - 1] = 0;
+    hfind = FindFirstFileW(path, &fd);
+    if (hfind == INVALID_HANDLE_VALUE) return FALSE;
+    do
+    {
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || wcslen(fd.cFileName) >= 64 ||
+            !CatalogSegmentId(fd.cFileName, id))
+            continue;
+
+        if (c->looseCount == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            more = (CATALOG_LOOSE*)realloc(c->loose, cap * sizeof(CATALOG_LOOSE));
+            if (!more)
+            {
+                FindClose(hfind);
+                wprintf(L"Out of memory.\r\n");
+                return FALSE;
+            }
+            c->loose = more;
+        }
+
+        l = &c->loose[c->looseCount++];
+        ZeroMemory(l, sizeof(*l));
+        wcscpy(l->name, fd.cFileName);
+        memcpy(l->id, id, sizeof(l->id));
+        l->bytes = ((ULONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+        l->seg.hf = INVALID_HANDLE_VALUE;
+    } while (FindNextFileW(hfind, &fd));
+    FindClose(hfind);
+
+    if (c->looseCount == 0) return FALSE;
+    qsort(c->loose, c->looseCount, sizeof(CATALOG_LOOSE), CatalogLooseCompare);
+
+    for (i = 0; i < c->looseCount; i++)
+    {
+        l = &c->loose[i];
+        JoinPath2W(path, MAX_PATH * 2, c->dir, l->name);
+        if (!CatalogReadHeader(path, &hdr)) continue;
+        l->ingested = GetLE64(hdr.ingested);
+        l->pending = !CatalogMerged(&c->old, l->id, l->ingested);
+    }
+
+    for (i = 0; i < c->looseCount; i = j)
+    {
+        for (j = i, k = 0; j < c->looseCount && memcmp(c->loose[j].id, c->loose[i].id, 40) == 0; j++)
+            if (c->loose[j].pending) k++;
+        if (k > 0) pending++;
+    }
+    if (pending < CATALOG_COMPACT_ARCHIVES) return FALSE;
+
+    for (i = 0; i < c->looseCount; i = j)
+    {
+        group = 0;
+        for (j = i; j < c->looseCount && memcmp(c->loose[j].id, c->loose[i].id, 40) == 0; j++)
+            if (c->loose[j].pending) group += c->loose[j].bytes;
+        if (group == 0) continue;
+        if (c->archives > 0 && bytes + group > CATALOG_COMPACT_MAP_MAX) break;
+
+        /* all segments of the archive or none */
+        ok = TRUE;
+        for (k = i; ok && k < j; k++)
+        {
+            l = &c->loose[k];
+            if (!l->pending) continue;
+            JoinPath2W(path, MAX_PATH * 2, c->dir, l->name);
+            l->merge = CatalogMap(&l->seg, path) && l->seg.hdr->version == 0 &&
+                GetLE64(l->seg.hdr->ingested) == l->ingested;
+            ok = l->merge;
+            if (l->seg.base && !ok) CatalogUnmap(&l->seg);
+        }
+        if (!ok)
+        {
+            for (k = i; k < j; k++)
+            {
+                if (c->loose[k].merge) CatalogUnmap(&c->loose[k].seg);
+                c->loose[k].merge = FALSE;
+            }
+            continue;
+        }
+
+        bytes += group;
+        c->archives++;
+    }
+
+    return c->archives > 0;
+}
+
+/* new sources: old ones not replaced, and the merged archives; both by id */
+static BOOL CatalogCompactSources(CATALOG_COMPACT *c)
+{
+    CATALOG_SOURCE          *src;
+    const CATALOG_HEADER    *hdr;
+    ULONGLONG               ingested;
+    DWORD                   i = 0, l = 0, n;
+    int                     d;
+
+    n = c->old.sources + c->archives;
+    if (n > CATALOG_MAX_SOURCES)
+    {
+        wprintf(L"Catalog holds too many archives to compact.\r\n");
+        return FALSE;
+    }
+
+    c->sources = (CATALOG_SOURCE*)malloc((n + 1) * sizeof(CATALOG_SOURCE));
+    c->remap = (DWORD*)malloc((c->old.sources + 1) * sizeof(DWORD));
+    if (!c->sources || !c->remap)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        while (l < c->looseCount && !c->loose[l].merge) l++;
+        if (i >= c->old.sources && l >= c->looseCount) break;
+
+        if (i >= c->old.sources) d = 1;
+        else if (l >= c->looseCount) d = -1;
+        else d = memcmp(c->old.source[i].id, c->loose[l].id, 40);
+
+        if (d < 0)
+        {
+            c->sources[c->sourceCount] = c->old.source[i];
+            c->remap[i++] = c->sourceCount++;
+            continue;
+        }
+        if (d == 0) c->remap[i++] = CATALOG_NO_SOURCE;
+
+        /* an archive from its segments */
+        src = &c->sources[c->sourceCount];
+        hdr = c->loose[l].seg.hdr;
+        ZeroMemory(src, sizeof(*src));
+        memcpy(src->id, c->loose[l].id, sizeof(src->id));
+        memcpy(src->tape, hdr->tape, sizeof(src->tape));
+        src->tape[sizeof(src->tape) - 1] = 0;
+        memcpy(src->archive, hdr->archive, sizeof(src->archive));
+        memcpy(&src->zh, &hdr->zh, sizeof(src->zh));
+        ingested = 0;
+        for (; l < c->looseCount && memcmp(c->loose[l].id, src->id, 40) == 0; l++)
+        {
+            if (!c->loose[l].merge) continue;
+            c->loose[l].source = c->sourceCount;
+            if (c->loose[l].ingested > ingested) ingested = c->loose[l].ingested;
+        }
+        PutLE64(src->ingested, ingested);
+        c->sourceCount++;
+    }
+
+    return TRUE;
+}
+
+/* FALSE - done, or c->failed */
+static BOOL CatalogCursorNext(CATALOG_COMPACT *c, CATALOG_CURSOR *k)
+{
+    WCHAR   path[MAX_PATH * 2];
+    DWORD   source;
+
+    for (;;)
+    {
+        while (k->seg->base && k->r < k->seg->count)
+        {
+            k->entry = &k->seg->entries[k->r];
+            k->name = CatalogName(k->seg, k->r, &k->len);
+            k->r++;
+            if (k->len == 0) continue;
+            if (!k->runs) return TRUE;
+
+            source = CatalogSourceOf(k->entry);
+            if (source < c->old.sources && c->remap[source] != CATALOG_NO_SOURCE)
+            {
+                k->source = c->remap[source];
+                return TRUE;
+            }
+        }
+
+        if (!k->runs || k->run >= c->old.runs) return FALSE;
+        if (k->seg->base) CatalogUnmap(k->seg);
+
+        CatalogRunPath(c->dir, c->old.generation, k->run++, path, MAX_PATH * 2);
+        if (!CatalogMap(k->seg, path) || k->seg->hdr->version != 1)
+        {
+            wprintf(L"Catalog run %s is missing or damaged, catalog is not compacted.\r\n", path);
+            if (k->seg->base) CatalogUnmap(k->seg);
+            c->failed = TRUE;
+            return FALSE;
+        }
+        k->r = 0;
+    }
+}
+
+static BOOL CatalogCursorLess(const CATALOG_COMPACT *c, DWORD x, DWORD y)
+{
+    const CATALOG_CURSOR *a = &c->cursors[x];
+    const CATALOG_CURSOR *b = &c->cursors[y];
+
+    return CatalogCompare(a->name, a->len, b->name, b->len) < 0;
+}
+
+static void CatalogHeapDown(CATALOG_COMPACT *c, DWORD i)
+{
+    DWORD child, t;
+
+    for (;;)
+    {
+        child = 2 * i + 1;
+        if (child >= c->heapCount) return;
+        if (child + 1 < c->heapCount && CatalogCursorLess(c, c->heap[child + 1], c->heap[child]))
+            child++;
+        if (!CatalogCursorLess(c, c->heap[child], c->heap[i])) return;
+
+        t = c->heap[i];
+        c->heap[i] = c->heap[child];
+        c->heap[child] = t;
+        i = child;
+    }
+}
+
+static void CatalogHeapPush(CATALOG_COMPACT *c, DWORD cursor)
+{
+    DWORD i = c->heapCount++, parent;
+
+    c->heap[i] = cursor;
+    while (i > 0)
+    {
+        parent = (i - 1) / 2;
+        if (!CatalogCursorLess(c, c->heap[i], c->heap[parent])) return;
+        c->heap[i] = c->heap[parent];
+        c->heap[parent] = cursor;
+        i = parent;
+    }
+}
+
+/* entry of the cursor into the run being built; a new run records its first path */
+static BOOL CatalogCompactAdd(CATALOG_COMPACT *c, const CATALOG_CURSOR *k)
+{
+    CATALOG_ENTRY   *e;
+    CATALOG_RUN     *runs;
+    char            *firsts;
+    DWORD           name, cap;
+
+    e = CatalogAddEntry(&c->b, k->name, k->len);
+    if (!e) return FALSE;
+
+    name = GetLE32(e->name);
+    *e = *k->entry;
+    PutLE32(e->name, name);
+    PutLE32(e->namelen, k->len);
+    e->source[0] = (unsigned char)k->source;
+    e->source[1] = (unsigned char)(k->source >> 8);
+    e->source[2] = (unsigned char)(k->source >> 16);
+
+    if (c->b.count == 1)
+    {
+        if (c->b.parts >= c->runCap)
+        {
+            cap = c->runCap ? c->runCap * 2 : 64;
+            runs = (CATALOG_RUN*)realloc(c->runs, cap * sizeof(CATALOG_RUN));
+            if (!runs)
+            {
+                wprintf(L"Out of memory.\r\n");
+                return FALSE;
+            }
+            c->runs = runs;
+            c->runCap = cap;
+        }
+        if (c->firstBytes + k->len > c->firstCap)
+        {
+            cap = c->firstCap ? c->firstCap : 64 * 1024;
+            while (cap < c->firstBytes + k->len) cap *= 2;
+            firsts = (char*)realloc(c->firsts, cap);
+            if (!firsts)
+            {
+                wprintf(L"Out of memory.\r\n");
+                return FALSE;
+            }
+            c->firsts = firsts;
+            c->firstCap = cap;
+        }
+
+        ZeroMemory(&c->runs[c->b.parts], sizeof(CATALOG_RUN));
+        PutLE32(c->runs[c->b.parts].first, c->firstBytes);
+        PutLE32(c->runs[c->b.parts].firstLen, k->len);
+        memcpy(c->firsts + c->firstBytes, k->name, k->len);
+        c->firstBytes += k->len;
+    }
+    PutLE32(c->runs[c->b.parts].entries, c->b.count);
+    return TRUE;
+}
+
+/* k-way merge of the old runs (one cursor, they are in order) and the
+   segments into temp runs */
+static BOOL CatalogCompactMerge(CATALOG_COMPACT *c)
+{
+    CATALOG_CURSOR  *k;
+    DWORD           i, n = 1;
+
+    c->generation = c->old.generation + 1;
+    c->b.enabled = TRUE;
+    c->b.run = TRUE;
+    c->b.archive = CATALOG_NO_ARCHIVE;
+    c->b.thread = GetCurrentThreadId();
+    c->b.ingested = CatalogNow();
+    _snwprintf(c->b.id, 41, L"%08lx", (unsigned long)c->generation);
+    c->b.id[40] = 0;
+
+    for (i = 0; i < c->looseCount; i++)
+        if (c->loose[i].merge) n++;
+    c->cursors = (CATALOG_CURSOR*)calloc(n, sizeof(CATALOG_CURSOR));
+    c->heap = (DWORD*)malloc(n * sizeof(DWORD));
+    if (!c->cursors || !c->heap)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    c->runSeg.hf = INVALID_HANDLE_VALUE;
+    c->cursors[0].seg = &c->runSeg;
+    c->cursors[0].runs = TRUE;
+    for (i = 0, n = 1; i < c->looseCount; i++)
+    {
+        if (!c->loose[i].merge) continue;
+        c->cursors[n].seg = &c->loose[i].seg;
+        c->cursors[n].source = c->loose[i].source;
+        n++;
+    }
+
+    for (i = 0; i < n; i++)
+        if (CatalogCursorNext(c, &c->cursors[i])) CatalogHeapPush(c, i);
+    if (c->failed) return FALSE;
+
+    while (c->heapCount > 0)
+    {
+        k = &c->cursors[c->heap[0]];
+        if (!CatalogCompactAdd(c, k)) return FALSE;
+        if (!CatalogCursorNext(c, k))
+        {
+            if (c->failed) return FALSE;
+            c->heap[0] = c->heap[--c->heapCount];
+        }
+        CatalogHeapDown(c, 0);
+    }
+
+    if (c->b.failed) return FALSE;
+    return c->b.count == 0 || CatalogWritePart(&c->b);
+}
+
+static BOOL CatalogWriteManifest(CATALOG_COMPACT *c)
+{
+    CATALOG_MANIFEST    hdr;
+    WCHAR               name[64];
+    WCHAR               tmpPath[MAX_PATH * 2];
+    WCHAR               path[MAX_PATH * 2];
+    HANDLE              hf;
+    BOOL                ok;
+
+    ZeroMemory(&hdr, sizeof(hdr));
+    memcpy(hdr.magic, "ZTCATMAN", 8);
+    PutLE32(hdr.generation, c->generation);
+    PutLE32(hdr.runs, c->b.parts);
+    PutLE32(hdr.sources, c->sourceCount);
+    PutLE32(hdr.firstBytes, c->firstBytes);
+    PutLE64(hdr.written, CatalogNow());
+
+    _snwprintf(name, 64, L"catalog.%lu.tmp", (unsigned long)GetCurrentThreadId());
+    name[63] = 0;
+    JoinPath2W(tmpPath, MAX_PATH * 2, c->dir, name);
+    JoinPath2W(path, MAX_PATH * 2, c->dir, CATALOG_MANIFEST_FILE);
+
+    hf = CreateFileW(tmpPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to create catalog manifest", 0);
+        return FALSE;
+    }
+
+    ok = CatalogWriteAll(hf, &hdr, sizeof(hdr)) &&
+        CatalogWriteAll(hf, c->runs, c->b.parts * (DWORD)sizeof(CATALOG_RUN)) &&
+        CatalogWriteAll(hf, c->sources, c->sourceCount * (DWORD)sizeof(CATALOG_SOURCE)) &&
+        CatalogWriteAll(hf, c->firsts, c->firstBytes) &&
+        FlushFileBuffers(hf);
+    CloseHandle(hf);
+
+    if (ok) ok = MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok)
+    {
+        PrintLastErrorW(L"Failed to write catalog manifest", 0);
+        DeleteFileW(tmpPath);
+    }
+    return ok;
+}
+
+/* runs older than the previous generation, and segments the previous
+   runs already held: no query started before the last compaction uses them */
+static void CatalogCompactDelete(CATALOG_COMPACT *c)
+{
+    WIN32_FIND_DATAW    fd;
+    HANDLE              hfind;
+    WCHAR               mask[MAX_PATH * 2];
+    WCHAR               path[MAX_PATH * 2];
+    CATALOG_HEADER      hdr;
+    DWORD               generation;
+    char                id[40];
+
+    _snwprintf(mask, MAX_PATH * 2, L"%s\\*%s", c->dir, CATALOG_RUN_EXT);
+    mask[MAX_PATH * 2 - 1] = 0;
+    hfind = FindFirstFileW(mask, &fd);
+    if (hfind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            generation = CatalogRunGeneration(fd.cFileName);
+            if (generation == c->generation || generation == c->old.generation) continue;
+            JoinPath2W(path, MAX_PATH * 2, c->dir, fd.cFileName);
+            DeleteFileW(path);
+        } while (FindNextFileW(hfind, &fd));
+        FindClose(hfind);
+    }
+
+    if (c->old.sources == 0) return;
+    _snwprintf(mask, MAX_PATH * 2, L"%s\\*%s", c->dir, CATALOG_EXT);
+    mask[MAX_PATH * 2 - 1] = 0;
+    hfind = FindFirstFileW(mask, &fd);
+    if (hfind == INVALID_HANDLE_VALUE) return;
+    do
+    {
+        if (!CatalogSegmentId(fd.cFileName, id)) continue;
+        JoinPath2W(path, MAX_PATH * 2, c->dir, fd.cFileName);
+        if (CatalogReadHeader(path, &hdr) && CatalogMerged(&c->old, id, GetLE64(hdr.ingested)))
+            DeleteFileW(path);
+    } while (FindNextFileW(hfind, &fd));
+    FindClose(hfind);
+}
+
+/* new runs, then the manifest that names them */
+static BOOL CatalogCompactInstall(CATALOG_COMPACT *c)
+{
+    WCHAR   tmpPath[MAX_PATH * 2];
+    WCHAR   path[MAX_PATH * 2];
+    HANDLE  lock;
+    DWORD   run;
+    BOOL    ok = TRUE;
+
+    lock = CatalogLock(c->dir, CATALOG_LOCK_FILE, CATALOG_LOCK_MS);
+    if (lock == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to lock catalog", 0);
+        return FALSE;
+    }
+
+    for (run = 0; ok && run < c->b.parts; run++)
+    {
+        CatalogPartPath(&c->b, c->dir, run, TRUE, tmpPath, MAX_PATH * 2);
+        CatalogPartPath(&c->b, c->dir, run, FALSE, path, MAX_PATH * 2);
+        ok = MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!ok) PrintLastErrorW(L"Failed to update catalog", 0);
+    }
+
+    ok = ok && CatalogWriteManifest(c);
+    if (ok)
+    {
+        c->installed = TRUE;
+        CatalogCompactDelete(c);
+    }
+    else
+    {
+        for (run = 0; run < c->b.parts; run++)
+        {
+            CatalogPartPath(&c->b, c->dir, run, FALSE, path, MAX_PATH * 2);
+            DeleteFileW(path);
+        }
+    }
+
+    CatalogUnlock(lock);
+    return ok;
+}
+
+static void CatalogCompactFree(CATALOG_COMPACT *c)
+{
+    WCHAR   path[MAX_PATH * 2];
+    DWORD   i;
+
+    for (i = 0; i < c->looseCount; i++)
+        if (c->loose[i].seg.base) CatalogUnmap(&c->loose[i].seg);
+    if (c->runSeg.base) CatalogUnmap(&c->runSeg);
+    if (c->old.base) CatalogUnmapManifest(&c->old);
+
+    for (i = 0; !c->installed && i < c->b.parts; i++)
+    {
+        CatalogPartPath(&c->b, c->dir, i, TRUE, path, MAX_PATH * 2);
+        DeleteFileW(path);
+    }
+
+    free(c->b.entries);
+    free(c->b.names);
+    free(c->loose);
+    free(c->remap);
+    free(c->sources);
+    free(c->cursors);
+    free(c->heap);
+    free(c->runs);
+    free(c->firsts);
+    free(c);
+}
+
+/* after an archive went in: merges the segments into new runs once
+   enough archives wait; one compaction at a time, skipped if busy */
+static void CatalogCompact(LPCWSTR dir)
+{
+    CATALOG_COMPACT *c;
+    HANDLE          busy, lock;
+    BOOL            ok;
+
+    busy = CatalogLock(dir, CATALOG_COMPACT_LOCK_FILE, 0);
+    if (busy == INVALID_HANDLE_VALUE) return;
+
+    c = (CATALOG_COMPACT*)calloc(1, sizeof(CATALOG_COMPACT));
+    if (!c)
+    {
+        CatalogUnlock(busy);
+        return;
+    }
+    _snwprintf(c->dir, MAX_PATH, L"%s", dir);
+    c->dir[MAX_PATH - 1] = 0;
+    c->old.hf = INVALID_HANDLE_VALUE;
+
+    TRACE_BEGIN("catalog compact", 0);
+    /* segments are listed and mapped while no archive is renamed in */
+    lock = CatalogLock(dir, CATALOG_LOCK_FILE, CATALOG_LOCK_MS);
+    ok = lock != INVALID_HANDLE_VALUE && CatalogCompactSelect(c);
+    CatalogUnlock(lock);
+
+    if (ok)
+    {
+        wprintf(L"Compacting catalog (%lu archives)...\r\n", (unsigned long)c->archives);
+        ok = CatalogCompactSources(c) && CatalogCompactMerge(c) && CatalogCompactInstall(c);
+        if (ok)
+            wprintf(L"Catalog compacted: %lu archives in %lu runs.\r\n",
+                (unsigned long)c->sourceCount, (unsigned long)c->b.parts);
+        else
+            wprintf(L"Catalog compaction failed, archives stay in their segments.\r\n");
+    }
+    TRACE_END("catalog compact", c->archives);
+
+    CatalogCompactFree(c);
+    CatalogUnlock(busy);
+}
+
+void CatalogPrintHit(const CATALOG_HIT *hit)
+{
+    WCHAR   wpath[4096];
+    WCHAR   size[64];
+    WCHAR   archive[16];
+
+    if (!Utf8ToWide(hit->path, strlen(hit->path), wpath, 4096))
+        AnsiOrUtf8ToWide(hit->path, strlen(hit->path), wpath, 4096);
+    HumanSize(hit->size, size, 64);
+    if (hit->archive == CATALOG_NO_ARCHIVE)
+        wcscpy(archive, L"?");
+    else
+        _snwprintf(archive, 16, L"%lu", (unsigned long)hit->archive + 1);
+    archive[15] = 0;
+
+    wprintf(L"%-12S #%-4s %10s  %s\r\n", hit->tape[0] ? hit->tape : "(no name)", archive, size, wpath);
+}
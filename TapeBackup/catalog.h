@@ -0,0 +1,180 @@
+#ifndef __TAPE_BACKUP_CATALOG
+#define __TAPE_BACKUP_CATALOG
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+#include "trace.h"
+
+/* --------------------------------------
+Catalog: members of every archive written, verified or listed, kept on
+disk so a file is found across tapes without a drive. Default
+directory is "catalog" next to the exe (/catalog, /no-catalog).
+An archive is known by the SHA-1 of its tape name, creation date and
+section #2 SHA-1; the same archive seen again replaces its entries.
+Its entries go to segment files <id>.<part>.zcat of at most
+CATALOG_SEGMENT_MAX members:
+    CATALOG_HEADER
+    CATALOG_ENTRY[entries]      sorted by path, ASCII case folded
+    names                       UTF-8, no NUL
+    buckets[(1 << bucketBits) + 1]  little-endian 32-bit, postings offsets
+    postings                    per bucket: entry numbers, varint deltas
+The sorted table is the path trie flattened: exact path and prefix are
+a binary search. Every trigram (3 folded bytes) of a path is hashed to
+a bucket, so substring and glob queries only look at the entries of
+the rarest trigram they contain. Segments are mapped, not loaded.
+Paths are stored as in TAR without a leading "./" or "/" or trailing
+"/"; queries may use '\'.
+
+Compaction: once CATALOG_COMPACT_ARCHIVES archives have segments not
+yet merged, CatalogEnd merges them with the old runs into a new
+generation of runs <generation>.<run>.zrun (8 hex digits), described
+by CATALOG_MANIFEST_FILE:
+    CATALOG_MANIFEST
+    CATALOG_RUN[runs]
+    CATALOG_SOURCE[sources]     sorted by id
+    first paths                 UTF-8, no NUL
+A run is a segment (version 1) of entries of many archives, each with
+the index of its CATALOG_SOURCE. Runs split one sorted table, so a path
+or prefix query reads the manifest and only the runs its key falls in.
+A query searches the segments not merged yet, then the runs. A segment
+is merged when the manifest holds its id and it was not ingested later;
+otherwise it replaces that source's entries in the runs. Merged
+segments and the runs before are deleted by the next compaction, so a
+query started before one still finds them. CATALOG_LOCK_FILE is held
+while segments are renamed or deleted, CATALOG_COMPACT_LOCK_FILE for
+the whole compaction.
+-------------------------------------- */
+#define CATALOG_DIR             L"catalog"
+#define CATALOG_EXT             L".zcat"
+#define CATALOG_SEGMENT_MAX     (1 << 18)
+#define CATALOG_NAMES_MAX       (16 * 1024 * 1024)
+#define CATALOG_BUCKET_BITS_MIN 8
+#define CATALOG_BUCKET_BITS_MAX 18
+#define CATALOG_MAX_RESULTS     1000
+#define CATALOG_NO_ARCHIVE      0xFFFFFFFF
+#define CATALOG_RUN_EXT         L".zrun"
+#define CATALOG_MANIFEST_FILE   L"catalog.zman"
+#define CATALOG_LOCK_FILE       L"catalog.lock"
+#define CATALOG_COMPACT_LOCK_FILE   L"compact.lock"
+#define CATALOG_LOCK_MS         30000
+#define CATALOG_COMPACT_ARCHIVES    64
+#define CATALOG_COMPACT_MAP_MAX (256 * 1024 * 1024)     /* segment bytes merged at once */
+#define CATALOG_MAX_SOURCES     (1 << 22)     /* manifest stays under 2 GiB */
+#define CATALOG_NO_SOURCE       0xFFFFFFFF
+
+typedef enum _CATALOG_QUERY {
+    CATALOG_QUERY_PATH = 1,
+    CATALOG_QUERY_PREFIX,
+    CATALOG_QUERY_GLOB,         /* '*' any run, '/' included; '?' one character */
+    CATALOG_QUERY_SUBSTRING
+} CATALOG_QUERY;
+
+#pragma pack(push,1)
+typedef struct _CATALOG_HEADER {
+    char            magic[8];       /* "ZTCATSEG" */
+    unsigned char   version;        /* 0 - segment, 1 - run (tape, archive, zh unused) */
+    unsigned char   bucketBits;
+    unsigned char   reserved1[2];   /* must be zero */
+    char            tape[32];       /* NUL-terminated, "" - unknown */
+    unsigned char   archive[4];     /* little-endian 32-bit, from 0, CATALOG_NO_ARCHIVE - unknown */
+    unsigned char   part[4];        /* little-endian 32-bit, segment of archive from 0; run number */
+    unsigned char   entries[4];     /* little-endian 32-bit */
+    ZEROTAPE_HEADER zh;             /* the archive */
+    unsigned char   namesBytes[4];  /* little-endian 32-bit */
+    unsigned char   postingsBytes[4];   /* little-endian 32-bit */
+    unsigned char   ingested[8];    /* little-endian 64-bit, FILETIME (UTC), same in every segment of archive */
+    unsigned char   reserved[56];   /* must be zero */
+} CATALOG_HEADER;                   /* total 256 */
+
+typedef struct _CATALOG_ENTRY {
+    unsigned char   offset[8];      /* little-endian 64-bit, member's first header in section #2 */
+    unsigned char   dataOffset[8];  /* little-endian 64-bit, its data, 0 - unknown */
+    unsigned char   size[8];        /* little-endian 64-bit */
+    unsigned char   mtime[8];       /* little-endian 64-bit, seconds since 1970, 0 - unknown */
+    unsigned char   name[4];        /* little-endian 32-bit, offset in names */
+    unsigned char   namelen[4];     /* little-endian 32-bit */
+    unsigned char   mode[4];        /* little-endian 32-bit */
+    unsigned char   type;           /* TAR typeflag, TAR_TYPE_UNKNOWN */
+    unsigned char   source[3];      /* little-endian 24-bit, run: CATALOG_SOURCE; segment: zero */
+} CATALOG_ENTRY;                    /* total 48 */
+
+typedef struct _CATALOG_MANIFEST {
+    char            magic[8];       /* "ZTCATMAN" */
+    unsigned char   version;        /* 0 */
+    unsigned char   reserved1[3];   /* must be zero */
+    unsigned char   generation[4];  /* little-endian 32-bit, of the runs, from 1 */
+    unsigned char   runs[4];        /* little-endian 32-bit */
+    unsigned char   sources[4];     /* little-endian 32-bit */
+    unsigned char   firstBytes[4];  /* little-endian 32-bit */
+    unsigned char   written[8];     /* little-endian 64-bit, FILETIME (UTC) */
+    unsigned char   reserved[220];  /* must be zero */
+} CATALOG_MANIFEST;                 /* total 256 */
+
+typedef struct _CATALOG_RUN {
+    unsigned char   entries[4];     /* little-endian 32-bit */
+    unsigned char   first[4];       /* little-endian 32-bit, offset of its first path */
+    unsigned char   firstLen[4];    /* little-endian 32-bit */
+    unsigned char   reserved[4];    /* must be zero */
+} CATALOG_RUN;                      /* total 16 */
+
+/* an archive whose entries are in the runs */
+typedef struct _CATALOG_SOURCE {
+    char            id[40];         /* as in its segment names */
+    char            tape[32];       /* NUL-terminated, "" - unknown */
+    unsigned char   archive[4];     /* little-endian 32-bit, CATALOG_NO_ARCHIVE - unknown */
+    ZEROTAPE_HEADER zh;
+    unsigned char   ingested[8];    /* little-endian 64-bit, latest of its merged segments */
+    unsigned char   reserved[44];   /* must be zero */
+} CATALOG_SOURCE;                   /* total 256 */
+#pragma pack(pop)
+
+/* entries of one archive on their way to the catalog; CatalogSink
+   is a TAR_MEMBER_SINK (see archive.h) */
+typedef struct _CATALOG_BUILDER {
+    BOOL            enabled;
+    char            tape[32];
+    DWORD           archive;
+    ZEROTAPE_HEADER zh;
+    WCHAR           id[41];
+    DWORD           thread;         /* temp file names */
+    CATALOG_ENTRY   *entries;
+    DWORD           count;
+    char            *names;
+    DWORD           namesBytes;
+    DWORD           namesCap;
+    DWORD           parts;          /* written to temp files */
+    ULONGLONG       ingested;       /* FILETIME of CatalogBegin */
+    BOOL            run;            /* compaction output: runs, id is the generation */
+    BOOL            failed;
+} CATALOG_BUILDER;
+
+/* one match; pointers valid during the callback only */
+typedef struct _CATALOG_HIT {
+    const char              *tape;
+    DWORD                   archive;
+    const ZEROTAPE_HEADER   *zh;
+    const char              *path;  /* UTF-8 */
+    ULONGLONG               offset;
+    ULONGLONG               dataOffset;
+    ULONGLONG               size;
+    LONGLONG                mtime;
+    DWORD                   mode;
+    char                    type;   /* TAR_TYPE_UNKNOWN - old partition index */
+} CATALOG_HIT;
+
+/* FALSE - stop the query */
+typedef BOOL (*CATALOG_HIT_FN)(void *ctx, const CATALOG_HIT *hit);
+
+void CatalogSetDir(LPCWSTR dir);
+BOOL CatalogEnabled(void);
+void CatalogBegin(CATALOG_BUILDER *b, const char *tape, DWORD archive, const ZEROTAPE_HEADER *zh);
+void CatalogSink(void *ctx, const TAR_MEMBER *m);
+BOOL CatalogEnd(CATALOG_BUILDER *b, BOOL complete);
+BOOL CatalogAddTarFile(const char *tape, DWORD archive, const ZEROTAPE_HEADER *zh, LPCWSTR tarPath);
+BOOL CatalogQuery(DWORD type, const char *pattern, DWORD max,
+    CATALOG_HIT_FN fn, void *ctx, DWORD *found);
+void CatalogPrintHit(const CATALOG_HIT *hit);
+
+#endif
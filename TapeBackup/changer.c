@@ -0,0 +1,657 @@
+#include "changer.h"
+
+/* --------------------------------------
+Virtual changer
+-------------------------------------- */
+static BOOL ChangerIsVirtual(const CHANGER *c)
+{
+    return (c->h == INVALID_HANDLE_VALUE);
+}
+
+/* labels become file names */
+static BOOL ChangerBarcodeValid(const char *barcode)
+{
+    const char *p;
+
+    if (!barcode[0]) return FALSE;
+    for (p = barcode; *p; p++)
+        if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_') return FALSE;
+    return TRUE;
+}
+
+static void ChangerVirtualDrivePath(LPCWSTR dir, DWORD drive, WCHAR *out)
+{
+    WCHAR name[32];
+
+    _snwprintf(name, 32, L"drive%lu.vtape", (unsigned long)(drive + 1));
+    name[31] = 0;
+    JoinPath2W(out, MAX_PATH, dir, name);
+}
+
+static void ChangerVirtualSlotPath(LPCWSTR dir, const char *barcode, WCHAR *out)
+{
+    WCHAR name[CHANGER_BARCODE_MAX + 8];
+
+    _snwprintf(name, CHANGER_BARCODE_MAX + 8, L"%S.vtape", barcode);
+    name[CHANGER_BARCODE_MAX + 7] = 0;
+    JoinPath2W(out, MAX_PATH, dir, name);
+}
+
+/* state file: temp + rename, as checkpoint journal */
+static BOOL ChangerVirtualSave(CHANGER *c)
+{
+    WCHAR   path[MAX_PATH];
+    WCHAR   tmpPath[MAX_PATH + 8];
+    FILE    *f;
+    DWORD   i;
+    BOOL    ok;
+
+    JoinPath2W(path, MAX_PATH, c->path, CHANGER_VIRTUAL_FILE);
+    _snwprintf(tmpPath, MAX_PATH + 8, L"%s.tmp", path);
+    tmpPath[MAX_PATH + 7] = 0;
+    f = _wfopen(tmpPath, L"wb");
+    if (!f) return FALSE;
+
+    fprintf(f, "# TapeBackup virtual changer\n");
+    fprintf(f, "drives %lu\nslots %lu\nmove-ms %lu\n", (unsigned long)c->driveCount,
+        (unsigned long)c->slotCount, (unsigned long)c->moveMs);
+    for (i = 0; i < c->driveCount; i++)
+        if (c->drives[i].full)
+            fprintf(f, "drive %lu %s %d\n", (unsigned long)(i + 1), c->drives[i].barcode,
+                c->drives[i].home + 1);
+    for (i = 0; i < c->slotCount; i++)
+        if (c->slots[i].full)
+            fprintf(f, "slot %lu %s\n", (unsigned long)(i + 1), c->slots[i].barcode);
+
+    ok = (fflush(f) == 0);
+    ok = (fclose(f) == 0) && ok;
+    return ok && MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+static BOOL ChangerVirtualLoad(CHANGER *c)
+{
+    WCHAR           path[MAX_PATH];
+    FILE            *f;
+    char            line[256];
+    char            word[16];
+    char            barcode[CHANGER_BARCODE_MAX];
+    unsigned long   n, home;
+    int             fields;
+    BOOL            ok = TRUE;
+
+    JoinPath2W(path, MAX_PATH, c->path, CHANGER_VIRTUAL_FILE);
+    f = _wfopen(path, L"rb");
+    if (!f) return FALSE;
+
+    c->moveMs = CHANGER_VIRTUAL_MOVE_MS;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '#' || line[0] == '\r' || line[0] == '\n') continue;
+
+        barcode[0] = 0;
+        home = 0;
+        fields = sscanf(line, "%15s %lu %36s %lu", word, &n, barcode, &home);
+        if (fields < 2)
+            ok = FALSE;
+        else if (strcmp(word, "drives") == 0)
+            c->driveCount = (n > CHANGER_MAX_DRIVES) ? CHANGER_MAX_DRIVES : n;
+        else if (strcmp(word, "slots") == 0)
+            c->slotCount = (n > CHANGER_MAX_SLOTS) ? CHANGER_MAX_SLOTS : n;
+        else if (strcmp(word, "move-ms") == 0)
+            c->moveMs = n;
+        else if (strcmp(word, "drive") == 0 && fields >= 3 && n >= 1 && n <= c->driveCount &&
+            ChangerBarcodeValid(barcode))
+        {
+            c->drives[n - 1].full = TRUE;
+            strcpy(c->drives[n - 1].barcode, barcode);
+            c->drives[n - 1].home = (fields == 4 && home >= 1 && home <= c->slotCount) ?
+                (int)home - 1 : -1;
+        }
+        else if (strcmp(word, "slot") == 0 && fields >= 3 && n >= 1 && n <= c->slotCount &&
+            ChangerBarcodeValid(barcode))
+        {
+            c->slots[n - 1].full = TRUE;
+            strcpy(c->slots[n - 1].barcode, barcode);
+        }
+        else
+            ok = FALSE;
+    }
+    fclose(f);
+
+    if (!ok || c->driveCount == 0)
+    {
+        SetLastError(ERROR_BAD_FORMAT);
+        return FALSE;
+    }
+
+    for (n = 0; n < c->driveCount; n++)
+        ChangerVirtualDrivePath(c->path, n, c->drives[n].devicePath);
+    return TRUE;
+}
+
+/* blank cartridges ZT0001L6.. in every slot, drives empty */
+BOOL ChangerCreateVirtual(LPCWSTR dir, DWORD drives, DWORD slots, ULONGLONG capacity)
+{
+    CHANGER c;
+    WCHAR   path[MAX_PATH];
+    DWORD   i;
+
+    if (drives < 1 || drives > CHANGER_MAX_DRIVES || slots > CHANGER_MAX_SLOTS)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (!EnsureDirectoryExistsW(dir)) return FALSE;
+
+    ZeroMemory(&c, sizeof(c));
+    _snwprintf(c.path, MAX_PATH, L"%s", dir);
+    c.path[MAX_PATH - 1] = 0;
+    c.driveCount = drives;
+    c.slotCount = slots;
+    c.moveMs = CHANGER_VIRTUAL_MOVE_MS;
+    for (i = 0; i < drives; i++)
+    {
+        ChangerVirtualDrivePath(dir, i, path);
+        DeleteFileW(path);
+    }
+
+    for (i = 0; i < slots; i++)
+    {
+        c.slots[i].full = TRUE;
+        _snprintf(c.slots[i].barcode, CHANGER_BARCODE_MAX, "ZT%04luL6", (unsigned long)(i + 1));
+        ChangerVirtualSlotPath(dir, c.slots[i].barcode, path);
+        if (!VTapeCreate(path, capacity)) return FALSE;
+    }
+
+    return ChangerVirtualSave(&c);
+}
+
+/* --------------------------------------
+Medium changer driver
+-------------------------------------- */
+/* volume tags are space padded */
+static void ChangerCopyTag(char *out, const BYTE *tag, size_t n)
+{
+    size_t len = 0;
+
+    while (len < n && tag[len] && tag[len] != ' ') len++;
+    if (len > CHANGER_BARCODE_MAX - 1) len = CHANGER_BARCODE_MAX - 1;
+    memcpy(out, tag, len);
+    out[len] = 0;
+}
+
+static BOOL ChangerReadElements(CHANGER *c, ELEMENT_TYPE type, DWORD count,
+    CHANGER_ELEMENT_INFO *out, BOOL matchDrives)
+{
+    CHANGER_READ_ELEMENT_STATUS req;
+    CHANGER_ELEMENT_STATUS_EX   *st;
+    DWORD                       bytes = 0;
+    DWORD                       i;
+    char                        serial[SERIAL_NUMBER_LENGTH + 1];
+    WCHAR                       wserial[SERIAL_NUMBER_LENGTH + 1];
+    INVENTORY_ENTRY             e;
+    int                         id, k;
+
+    if (count == 0) return TRUE;
+
+    st = (CHANGER_ELEMENT_STATUS_EX*)calloc(count, sizeof(CHANGER_ELEMENT_STATUS_EX));
+    if (!st) return FALSE;
+
+    ZeroMemory(&req, sizeof(req));
+    req.ElementList.Element.ElementType = type;
+    req.ElementList.Element.ElementAddress = 0;
+    req.ElementList.NumberOfElements = count;
+    req.VolumeTagInfo = TRUE;
+    if (!DeviceIoControl(c->h, IOCTL_CHANGER_GET_ELEMENT_STATUS, &req, sizeof(req),
+        st, count * sizeof(CHANGER_ELEMENT_STATUS_EX), &bytes, NULL))
+    {
+        free(st);
+        return FALSE;
+    }
+
+    EnterCriticalSection(&c->lock);
+    for (i = 0; i < count && (i + 1) * sizeof(CHANGER_ELEMENT_STATUS_EX) <= bytes; i++)
+    {
+        out[i].full = (st[i].Flags & ELEMENT_STATUS_FULL) != 0;
+        out[i].barcode[0] = 0;
+        if (out[i].full && (st[i].Flags & ELEMENT_STATUS_PVOLTAG))
+            ChangerCopyTag(out[i].barcode, st[i].PrimaryVolumeID, MAX_VOLUME_ID_SIZE);
+        out[i].home = (out[i].full && (st[i].Flags & ELEMENT_STATUS_SVALID) &&
+            st[i].SrcElementAddress.ElementType == ChangerSlot) ?
+            (int)st[i].SrcElementAddress.ElementAddress : -1;
+
+        if (!matchDrives) continue;
+
+        /* drive serial against \\.\TAPEn serials, element order otherwise */
+        out[i].devicePath[0] = 0;
+        if (st[i].Flags & ELEMENT_STATUS_PRODUCT_DATA)
+        {
+            ChangerCopyTag(serial, st[i].SerialNumber, SERIAL_NUMBER_LENGTH);
+            MultiByteToWideChar(CP_ACP, 0, serial, -1, wserial, SERIAL_NUMBER_LENGTH + 1);
+            for (id = 0; id < INVENTORY_MAX_DRIVES && !out[i].devicePath[0]; id++)
+                if (wserial[0] && InventoryGet(id, &e) && _wcsicmp(e.ts.serial, wserial) == 0)
+                    wcscpy(out[i].devicePath, e.ts.devicePath);
+        }
+
+        for (id = 0, k = 0; id < INVENTORY_MAX_DRIVES && !out[i].devicePath[0]; id++)
+            if (InventoryGet(id, &e) && k++ == (int)i)
+                wcscpy(out[i].devicePath, e.ts.devicePath);
+    }
+    LeaveCriticalSection(&c->lock);
+
+    free(st);
+    return TRUE;
+}
+
+static BOOL ChangerDriverOpen(CHANGER *c)
+{
+    GET_CHANGER_PARAMETERS  params;
+    DWORD                   bytes = 0;
+    DWORD                   age;
+
+    c->h = CreateFileW(c->path, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (c->h == INVALID_HANDLE_VALUE) return FALSE;
+
+    ZeroMemory(&params, sizeof(params));
+    params.Size = sizeof(params);
+    if (!DeviceIoControl(c->h, IOCTL_CHANGER_GET_PARAMETERS, NULL, 0,
+        &params, sizeof(params), &bytes, NULL))
+        return FALSE;
+
+    c->driveCount = (params.NumberDataTransferElements > CHANGER_MAX_DRIVES) ?
+        CHANGER_MAX_DRIVES : params.NumberDataTransferElements;
+    c->slotCount = (params.NumberStorageElements > CHANGER_MAX_SLOTS) ?
+        CHANGER_MAX_SLOTS : params.NumberStorageElements;
+    c->barcodeReader = (params.Features0 & CHANGER_BAR_CODE_SCANNER_INSTALLED) != 0;
+
+    if (!InventoryIsFresh(&age)) InventoryScan(INVENTORY_PROBE_MS);
+    return ChangerReadElements(c, ChangerDrive, c->driveCount, c->drives, TRUE);
+}
+
+/* --------------------------------------
+Moves
+-------------------------------------- */
+static CHANGER_ELEMENT_INFO* ChangerElement(CHANGER *c, DWORD kind, DWORD index)
+{
+    if (kind == CHANGER_DRIVE) return (index < c->driveCount) ? &c->drives[index] : NULL;
+    if (kind == CHANGER_SLOT) return (index < c->slotCount) ? &c->slots[index] : NULL;
+    return NULL;
+}
+
+/* drive gives its cartridge up: session closed, tape ejected */
+static BOOL ChangerReleaseDrive(CHANGER *c, DWORD drive)
+{
+    HANDLE  h;
+    BOOL    ok;
+
+    if (!c->drives[drive].devicePath[0]) return TRUE;
+
+    SessionClose(c->drives[drive].devicePath);
+    if (ChangerIsVirtual(c)) return TRUE;
+
+    h = TapeOpen(c->drives[drive].devicePath);
+    if (h == INVALID_HANDLE_VALUE) return FALSE;
+    ok = TapeUnload(h);
+    TapeClose(h);
+    return ok;
+}
+
+static BOOL ChangerExecute(CHANGER *c, const CHANGER_MOVE *m)
+{
+    CHANGER_ELEMENT_INFO    *src, *dst;
+    CHANGER_MOVE_MEDIUM     mm;
+    WCHAR                   from[MAX_PATH], to[MAX_PATH];
+    DWORD                   bytes = 0;
+    BOOL                    ok;
+
+    EnterCriticalSection(&c->lock);
+    src = ChangerElement(c, m->fromKind, m->from);
+    dst = ChangerElement(c, m->toKind, m->to);
+    ok = (src && dst && src->full && !dst->full);
+    if (ok && ChangerIsVirtual(c))
+    {
+        if (m->fromKind == CHANGER_DRIVE)
+            wcscpy(from, src->devicePath);
+        else
+            ChangerVirtualSlotPath(c->path, src->barcode, from);
+
+        if (m->toKind == CHANGER_DRIVE)
+            wcscpy(to, dst->devicePath);
+        else
+            ChangerVirtualSlotPath(c->path, src->barcode, to);
+    }
+    LeaveCriticalSection(&c->lock);
+
+    if (!ok)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    if (m->fromKind == CHANGER_DRIVE && !ChangerReleaseDrive(c, m->from)) return FALSE;
+
+    if (ChangerIsVirtual(c))
+    {
+        Sleep(c->moveMs);
+        if (!MoveFileExW(from, to, MOVEFILE_WRITE_THROUGH)) return FALSE;
+    }
+    else
+    {
+        ZeroMemory(&mm, sizeof(mm));
+        mm.Transport.ElementType = ChangerTransport;
+        mm.Source.ElementType = (m->fromKind == CHANGER_DRIVE) ? ChangerDrive : ChangerSlot;
+        mm.Source.ElementAddress = m->from;
+        mm.Destination.ElementType = (m->toKind == CHANGER_DRIVE) ? ChangerDrive : ChangerSlot;
+        mm.Destination.ElementAddress = m->to;
+        if (!DeviceIoControl(c->h, IOCTL_CHANGER_MOVE_MEDIUM, &mm, sizeof(mm),
+            NULL, 0, &bytes, NULL))
+            return FALSE;
+    }
+
+    EnterCriticalSection(&c->lock);
+    dst->full = TRUE;
+    strcpy(dst->barcode, src->barcode);
+    dst->home = (m->fromKind == CHANGER_SLOT) ? (int)m->from : -1;
+    src->full = FALSE;
+    src->barcode[0] = 0;
+    src->home = -1;
+    ok = !ChangerIsVirtual(c) || ChangerVirtualSave(c);
+    LeaveCriticalSection(&c->lock);
+    return ok;
+}
+
+static DWORD WINAPI ChangerThread(LPVOID param)
+{
+    CHANGER         *c = (CHANGER*)param;
+    CHANGER_MOVE    m;
+    DWORD           result;
+    BOOL            skip;
+    BOOL            ok;
+
+    TraceThreadName("changer");
+    for (;;)
+    {
+        WaitForSingleObject(c->semPending, INFINITE);
+        if (c->stop) break;
+
+        EnterCriticalSection(&c->lock);
+        m = c->moves[c->head];
+        skip = c->failed;
+        LeaveCriticalSection(&c->lock);
+
+        TRACE_BEGIN("media move", m.from);
+        ok = (!skip && ChangerExecute(c, &m));
+        result = ok ? NO_ERROR : (skip ? ERROR_CANCELLED : GetLastError());
+        if (!ok && result == NO_ERROR) result = ERROR_GEN_FAILURE;
+        TRACE_END("media move", m.to);
+        if (m.done)
+        {
+            SetLastError(result);
+            m.done(m.ctx, ok);
+        }
+
+        EnterCriticalSection(&c->lock);
+        if (!ok) c->failed = TRUE;
+        if (!ok && c->result == NO_ERROR) c->result = result;
+        c->head = (c->head + 1) % CHANGER_MAX_MOVES;
+        if (--c->count == 0)
+        {
+            c->failed = FALSE;
+            SetEvent(c->idle);
+        }
+        LeaveCriticalSection(&c->lock);
+    }
+
+    return 0;
+}
+
+/* --------------------------------------
+Interface
+-------------------------------------- */
+BOOL ChangerOpen(CHANGER *c, LPCWSTR path)
+{
+    DWORD i;
+
+    ZeroMemory(c, sizeof(*c));
+    _snwprintf(c->path, MAX_PATH, L"%s", path);
+    c->path[MAX_PATH - 1] = 0;
+    c->h = INVALID_HANDLE_VALUE;
+    c->result = NO_ERROR;
+    for (i = 0; i < CHANGER_MAX_DRIVES; i++) c->drives[i].home = -1;
+    for (i = 0; i < CHANGER_MAX_SLOTS; i++) c->slots[i].home = -1;
+    InitializeCriticalSection(&c->lock);
+
+    if (wcsncmp(path, L"\\\\.\\", 4) == 0)
+    {
+        if (!ChangerDriverOpen(c) || !ChangerRefresh(c, FALSE))
+        {
+            ChangerClose(c);
+            return FALSE;
+        }
+    }
+    else
+    {
+        c->barcodeReader = TRUE;
+        if (!ChangerVirtualLoad(c))
+        {
+            ChangerClose(c);
+            return FALSE;
+        }
+    }
+
+    c->semPending = CreateSemaphoreW(NULL, 0, CHANGER_MAX_MOVES, NULL);
+    c->idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+    if (c->semPending && c->idle)
+        c->thread = CreateThread(NULL, 0, ChangerThread, c, 0, NULL);
+    if (!c->thread)
+    {
+        ChangerClose(c);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* waits for posted moves, then stops the mover */
+void ChangerClose(CHANGER *c)
+{
+    if (c->thread)
+    {
+        WaitForSingleObject(c->idle, INFINITE);
+        InterlockedExchange(&c->stop, 1);
+        ReleaseSemaphore(c->semPending, 1, NULL);
+        WaitForSingleObject(c->thread, INFINITE);
+        CloseHandle(c->thread);
+        c->thread = NULL;
+    }
+
+    if (c->semPending) CloseHandle(c->semPending);
+    if (c->idle) CloseHandle(c->idle);
+    if (c->h != INVALID_HANDLE_VALUE) CloseHandle(c->h);
+    c->semPending = NULL;
+    c->idle = NULL;
+    c->h = INVALID_HANDLE_VALUE;
+    DeleteCriticalSection(&c->lock);
+}
+
+/* scan - library reads every barcode again (minutes on big libraries) */
+BOOL ChangerRefresh(CHANGER *c, BOOL scan)
+{
+    CHANGER_INITIALIZE_ELEMENT_STATUS   init;
+    DWORD                               bytes = 0;
+
+    if (ChangerIsVirtual(c)) return TRUE;
+
+    if (scan)
+    {
+        ZeroMemory(&init, sizeof(init));
+        init.ElementList.Element.ElementType = AllElements;
+        init.BarCodeScan = (BOOLEAN)c->barcodeReader;
+        if (!DeviceIoControl(c->h, IOCTL_CHANGER_INITIALIZE_ELEMENT_STATUS, &init, sizeof(init),
+            NULL, 0, &bytes, NULL))
+            return FALSE;
+    }
+
+    return ChangerReadElements(c, ChangerDrive, c->driveCount, c->drives, FALSE) &&
+        ChangerReadElements(c, ChangerSlot, c->slotCount, c->slots, FALSE);
+}
+
+/* all or none; moves run in order */
+BOOL ChangerPost(CHANGER *c, const CHANGER_MOVE *moves, DWORD count)
+{
+    DWORD i;
+
+    EnterCriticalSection(&c->lock);
+    if (c->count + count > CHANGER_MAX_MOVES)
+    {
+        LeaveCriticalSection(&c->lock);
+        SetLastError(ERROR_BUSY);
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+        c->moves[(c->head + c->count + i) % CHANGER_MAX_MOVES] = moves[i];
+    c->count += count;
+    if (count) ResetEvent(c->idle);
+    LeaveCriticalSection(&c->lock);
+
+    ReleaseSemaphore(c->semPending, (LONG)count, NULL);
+    return TRUE;
+}
+
+/* TRUE - all posted moves done and succeeded; FALSE - GetLastError has
+   the first failure, or WAIT_TIMEOUT if moves are still running */
+BOOL ChangerWait(CHANGER *c, DWORD timeoutMs)
+{
+    DWORD result;
+
+    if (WaitForSingleObject(c->idle, timeoutMs) != WAIT_OBJECT_0)
+    {
+        SetLastError(WAIT_TIMEOUT);
+        return FALSE;
+    }
+
+    EnterCriticalSection(&c->lock);
+    result = c->result;
+    c->result = NO_ERROR;
+    LeaveCriticalSection(&c->lock);
+
+    SetLastError(result);
+    return (result == NO_ERROR);
+}
+
+/* one move, console shows elapsed time meanwhile */
+BOOL ChangerMoveNow(CHANGER *c, DWORD fromKind, DWORD from, DWORD toKind, DWORD to)
+{
+    CHANGER_MOVE    m;
+    DWORD           start = GetTickCount();
+    BOOL            ok;
+
+    ZeroMemory(&m, sizeof(m));
+    m.fromKind = fromKind;
+    m.from = from;
+    m.toKind = toKind;
+    m.to = to;
+
+    ok = ChangerPost(c, &m, 1);
+    while (ok && !ChangerWait(c, 1000))
+    {
+        if (GetLastError() != WAIT_TIMEOUT)
+        {
+            ok = FALSE;
+            break;
+        }
+        wprintf(L"\rMoving cartridge... %lu s", (unsigned long)((GetTickCount() - start) / 1000));
+    }
+
+    wprintf(L"\rMoving cartridge... %s (%lu s)\r\n", ok ? L"done" : L"failed",
+        (unsigned long)((GetTickCount() - start) / 1000));
+    return ok;
+}
+
+BOOL ChangerFind(CHANGER *c, const char *barcode, DWORD *kind, DWORD *index)
+{
+    DWORD   i;
+    BOOL    found = FALSE;
+
+    EnterCriticalSection(&c->lock);
+    for (i = 0; i < c->driveCount && !found; i++)
+    {
+        if (c->drives[i].full && strcmp(c->drives[i].barcode, barcode) == 0)
+        {
+            *kind = CHANGER_DRIVE;
+            *index = i;
+            found = TRUE;
+        }
+    }
+    for (i = 0; i < c->slotCount && !found; i++)
+    {
+        if (c->slots[i].full && strcmp(c->slots[i].barcode, barcode) == 0)
+        {
+            *kind = CHANGER_SLOT;
+            *index = i;
+            found = TRUE;
+        }
+    }
+    LeaveCriticalSection(&c->lock);
+    return found;
+}
+
+/* prefer (home slot of a cartridge) if empty, else first empty; -1 none */
+int ChangerFreeSlot(CHANGER *c, int prefer)
+{
+    int i, slot = -1;
+
+    EnterCriticalSection(&c->lock);
+    if (prefer >= 0 && (DWORD)prefer < c->slotCount && !c->slots[prefer].full)
+        slot = prefer;
+    for (i = 0; slot < 0 && (DWORD)i < c->slotCount; i++)
+        if (!c->slots[i].full) slot = i;
+    LeaveCriticalSection(&c->lock);
+    return slot;
+}
+
+int ChangerDriveOf(CHANGER *c, LPCWSTR devicePath)
+{
+    DWORD i;
+
+    for (i = 0; i < c->driveCount; i++)
+        if (c->drives[i].devicePath[0] && _wcsicmp(c->drives[i].devicePath, devicePath) == 0)
+            return (int)i;
+    return -1;
+}
+
+void ChangerPrint(CHANGER *c)
+{
+    CHANGER_ELEMENT_INFO    *e;
+    DWORD                   i, empty = 0;
+
+    EnterCriticalSection(&c->lock);
+    wprintf(L"Changer %s - %lu drives, %lu slots%s\r\n", c->path, (unsigned long)c->driveCount,
+        (unsigned long)c->slotCount, c->barcodeReader ? L", barcode reader" : L"");
+    for (i = 0; i < c->driveCount; i++)
+    {
+        e = &c->drives[i];
+        wprintf(L"Drive %lu (%s) - ", (unsigned long)(i + 1),
+            e->devicePath[0] ? e->devicePath : L"device not found");
+        if (!e->full)
+            wprintf(L"empty\r\n");
+        else if (e->home >= 0)
+            wprintf(L"%S from slot %d\r\n", e->barcode[0] ? e->barcode : "no label", e->home + 1);
+        else
+            wprintf(L"%S\r\n", e->barcode[0] ? e->barcode : "no label");
+    }
+
+    for (i = 0; i < c->slotCount; i++)
+    {
+        e = &c->slots[i];
+        if (e->full)
+            wprintf(L"Slot %lu - %S\r\n", (unsigned long)(i + 1), e->barcode[0] ? e->barcode : "no label");
+        else
+            empty++;
+    }
+    if (empty) wprintf(L"Empty slots - %lu\r\n", (unsigned long)empty);
+    wprintf(L"========\r\n");
+    LeaveCriticalSection(&c->lock);
+}
@@ -0,0 +1,92 @@
+#ifndef __TAPE_BACKUP_CHANGER
+#define __TAPE_BACKUP_CHANGER
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "session.h"
+#include "inventory.h"
+#include "trace.h"
+#include "vtape.h"
+
+/* --------------------------------------
+Tape library / autoloader. Two backends behind one interface:
+  \\.\ChangerN      medium changer driver (IOCTL_CHANGER_*); drives are
+                    matched to \\.\TAPEn by serial number, in element
+                    order when the library doesn't report serials
+  any other path    virtual changer: directory with CHANGER_VIRTUAL_FILE,
+                    cartridges are virtual tapes (see vtape.h).
+                    <barcode>.vtape sits in a slot, drive<N>.vtape is the
+                    cartridge in drive N (its device path); a move is a
+                    rename taking CHANGER_VIRTUAL_MOVE_MS
+Moves run on a mover thread in the order posted, so a drive keeps
+writing while the robot fetches the next cartridge. After a failure
+the moves already posted are skipped (done gets FALSE, GetLastError
+ERROR_CANCELLED). A cartridge leaving a drive is unloaded first
+and the drive's tape session (see session.h) is closed; caller doesn't
+use that drive until the move is done.
+Element numbers are from 0, printed from 1.
+-------------------------------------- */
+#define CHANGER_MAX_DRIVES          16
+#define CHANGER_MAX_SLOTS           256
+#define CHANGER_MAX_MOVES           16
+#define CHANGER_BARCODE_MAX         37      /* MAX_VOLUME_ID_SIZE + NUL */
+#define CHANGER_VIRTUAL_FILE        L"changer.txt"
+#define CHANGER_VIRTUAL_MOVE_MS     2000
+
+typedef enum _CHANGER_KIND {
+    CHANGER_DRIVE = 0,
+    CHANGER_SLOT
+} CHANGER_KIND;
+
+typedef struct _CHANGER_ELEMENT_INFO {
+    BOOL            full;
+    char            barcode[CHANGER_BARCODE_MAX];   /* "" - no label or not scanned */
+    int             home;                           /* drives: slot it came from, -1 unknown */
+    WCHAR           devicePath[MAX_PATH];           /* drives: tape device, "" - not found */
+} CHANGER_ELEMENT_INFO;
+
+/* done - called on mover thread after each move, GetLastError set on failure */
+typedef struct _CHANGER_MOVE {
+    DWORD           fromKind, from;
+    DWORD           toKind, to;
+    void            (*done)(void *ctx, BOOL ok);
+    void            *ctx;
+} CHANGER_MOVE;
+
+typedef struct _CHANGER {
+    WCHAR                   path[MAX_PATH];
+    HANDLE                  h;              /* driver handle, INVALID_HANDLE_VALUE - virtual */
+    BOOL                    barcodeReader;
+    DWORD                   moveMs;         /* virtual only */
+    DWORD                   driveCount;
+    DWORD                   slotCount;
+    CHANGER_ELEMENT_INFO    drives[CHANGER_MAX_DRIVES];
+    CHANGER_ELEMENT_INFO    slots[CHANGER_MAX_SLOTS];
+
+    /* mover, as TAPE_CMD_QUEUE (see tapecmd.h) */
+    HANDLE                  thread;
+    HANDLE                  semPending;
+    HANDLE                  idle;           /* manual reset: nothing posted or running */
+    CRITICAL_SECTION        lock;           /* elements and queue */
+    CHANGER_MOVE            moves[CHANGER_MAX_MOVES];
+    DWORD                   head;
+    DWORD                   count;
+    DWORD                   result;         /* first failure since last wait */
+    BOOL                    failed;         /* skip the rest until idle */
+    volatile LONG           stop;
+} CHANGER;
+
+BOOL ChangerCreateVirtual(LPCWSTR dir, DWORD drives, DWORD slots, ULONGLONG capacity);
+BOOL ChangerOpen(CHANGER *c, LPCWSTR path);
+void ChangerClose(CHANGER *c);
+BOOL ChangerRefresh(CHANGER *c, BOOL scan);
+BOOL ChangerPost(CHANGER *c, const CHANGER_MOVE *moves, DWORD count);
+BOOL ChangerWait(CHANGER *c, DWORD timeoutMs);
+BOOL ChangerMoveNow(CHANGER *c, DWORD fromKind, DWORD from, DWORD toKind, DWORD to);
+BOOL ChangerFind(CHANGER *c, const char *barcode, DWORD *kind, DWORD *index);
+int ChangerFreeSlot(CHANGER *c, int prefer);
+int ChangerDriveOf(CHANGER *c, LPCWSTR devicePath);
+void ChangerPrint(CHANGER *c);
+
+#endif
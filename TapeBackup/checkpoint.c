@@ -0,0 +1,179 @@
+#include "checkpoint.h"
+
+static BOOL CheckpointPath(WCHAR *out, size_t cch)
+{
+    WCHAR dir[MAX_PATH];
+
+    if (!GetExeDirectoryW(dir, MAX_PATH)) return FALSE;
+    JoinPath2W(out, cch, dir, CHECKPOINT_FILE);
+    return TRUE;
+}
+
+static void CheckpointSum(const CHECKPOINT_RECORD *rec, unsigned char out[20])
+{
+    SHA1_CTX ctx;
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, rec, FIELD_OFFSET(CHECKPOINT_RECORD, check));
+    sha1_final(&ctx, out);
+}
+
+/* job about to copy section #2 of zh from its start; nothing saved yet */
+void CheckpointBegin(CHECKPOINT *cp, CHECKPOINT_KIND kind, LPCWSTR devicePath,
+    LPCWSTR filePath, DWORD index, const ZEROTAPE_HEADER *zh)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+
+    ZeroMemory(cp, sizeof(*cp));
+    memcpy(cp->rec.magic, "ZTRESUME", 8);
+    cp->rec.size = sizeof(CHECKPOINT_RECORD);
+    cp->rec.kind = kind;
+    wcsncpy(cp->rec.devicePath, devicePath, MAX_PATH - 1);
+    if (filePath) wcsncpy(cp->rec.filePath, filePath, MAX_PATH * 2 - 1);
+    cp->rec.index = index;
+    memcpy(&cp->rec.zh, zh, sizeof(*zh));
+    cp->rec.block = CHECKPOINT_NO_BLOCK;
+    sha1_init(&cp->rec.sha);
+
+    if (kind == CHECKPOINT_BACKUP && filePath &&
+        GetFileAttributesExW(filePath, GetFileExInfoStandard, &fad))
+        cp->rec.fileTime = fad.ftLastWriteTime;
+}
+
+/* FALSE - no journal, or it is damaged or from another build */
+BOOL CheckpointLoad(CHECKPOINT *cp)
+{
+    WCHAR           path[MAX_PATH * 2];
+    HANDLE          hf;
+    DWORD           got = 0;
+    BOOL            ok;
+    unsigned char   sum[20];
+
+    ZeroMemory(cp, sizeof(*cp));
+    if (!CheckpointPath(path, MAX_PATH * 2)) return FALSE;
+
+    hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) return FALSE;
+
+    ok = ReadFile(hf, &cp->rec, sizeof(cp->rec), &got, NULL) && got == sizeof(cp->rec);
+    CloseHandle(hf);
+    if (!ok) return FALSE;
+
+    CheckpointSum(&cp->rec, sum);
+    if (memcmp(cp->rec.magic, "ZTRESUME", 8) != 0 || cp->rec.size != sizeof(CHECKPOINT_RECORD) ||
+        memcmp(cp->rec.check, sum, 20) != 0 ||
+        cp->rec.kind < CHECKPOINT_BACKUP || cp->rec.kind > CHECKPOINT_VERIFY ||
+        cp->rec.block == CHECKPOINT_NO_BLOCK)
+        return FALSE;
+
+    cp->rec.devicePath[MAX_PATH - 1] = 0;
+    cp->rec.filePath[MAX_PATH * 2 - 1] = 0;
+    cp->saved = TRUE;
+    return TRUE;
+}
+
+/* tape is where byte rec.done of section #2 goes or comes from */
+void CheckpointStart(CHECKPOINT *cp, HANDLE ht)
+{
+    DWORD       part;
+    ULONGLONG   block;
+
+    cp->enabled = FALSE;
+    if (!TapeGetPosition(ht, &part, &block))
+    {
+        if (!VTapeFromHandle(ht))
+            wprintf(L"Drive doesn't report tape position, this job can't be resumed.\r\n");
+        return;
+    }
+
+    cp->enabled = TRUE;
+    cp->rec.part = part;
+    cp->baseBlock = block;
+    cp->baseDone = cp->rec.done;
+    cp->last = TimerSeconds();
+}
+
+BOOL CheckpointDue(const CHECKPOINT *cp)
+{
+    return (cp && cp->enabled && TimerSeconds() - cp->last >= CHECKPOINT_SECONDS);
+}
+
+/* caller flushed drive or destination, so done bytes are safe */
+void CheckpointSave(CHECKPOINT *cp, ULONGLONG done, ULONGLONG block, const SHA1_CTX *sha)
+{
+    WCHAR   path[MAX_PATH * 2];
+    WCHAR   tmpPath[MAX_PATH * 2 + 24];
+    HANDLE  hf;
+    DWORD   written = 0;
+    BOOL    ok;
+
+    cp->last = TimerSeconds();
+    cp->rec.done = done;
+    cp->rec.block = block;
+    if (sha) cp->rec.sha = *sha;
+    CheckpointSum(&cp->rec, cp->rec.check);
+
+    if (!CheckpointPath(path, MAX_PATH * 2))
+    {
+        cp->enabled = FALSE;
+        return;
+    }
+
+    /* temp + rename: a crash while saving leaves the previous checkpoint;
+       temp per thread, daemon jobs may save at the same time */
+    _snwprintf(tmpPath, MAX_PATH * 2 + 24, L"%s.%lu.tmp", path, (unsigned long)GetCurrentThreadId());
+    tmpPath[MAX_PATH * 2 + 23] = 0;
+    hf = CreateFileW(tmpPath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    ok = (hf != INVALID_HANDLE_VALUE);
+    if (ok)
+    {
+        ok = WriteFile(hf, &cp->rec, sizeof(cp->rec), &written, NULL) &&
+            written == sizeof(cp->rec) && FlushFileBuffers(hf);
+        CloseHandle(hf);
+    }
+    ok = ok && MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+    if (!ok)
+    {
+        PrintLastErrorW(L"\r\nFailed to save checkpoint, this job can't be resumed", 0);
+        cp->enabled = FALSE;
+        return;
+    }
+
+    cp->saved = TRUE;
+}
+
+/* reads: every block before the last one of section #2 is full size */
+ULONGLONG CheckpointReadBlock(const CHECKPOINT *cp, ULONGLONG done, DWORD blockSize)
+{
+    return cp->baseBlock + (done - cp->baseDone) / blockSize;
+}
+
+/* ok - job's section #2 is complete, its journal goes away unless
+   another job saved over it since */
+void CheckpointEnd(CHECKPOINT *cp, BOOL ok)
+{
+    CHECKPOINT  cur;
+    WCHAR       path[MAX_PATH * 2];
+    WCHAR       done[64], total[64];
+
+    if (!cp->saved) return;
+
+    if (ok)
+    {
+        if (CheckpointLoad(&cur) && cur.rec.kind == cp->rec.kind &&
+            _wcsicmp(cur.rec.devicePath, cp->rec.devicePath) == 0 &&
+            memcmp(&cur.rec.zh, &cp->rec.zh, sizeof(cp->rec.zh)) == 0 &&
+            CheckpointPath(path, MAX_PATH * 2))
+            DeleteFileW(path);
+        cp->saved = FALSE;
+        return;
+    }
+
+    HumanSize(cp->rec.done, done, 64);
+    HumanSize(GetLE64(cp->rec.zh.sizeofarchive), total, 64);
+    wprintf(L"Progress saved at %s of %s. Use Resume Interrupted Job to continue.\r\n",
+        done, total);
+}
@@ -0,0 +1,66 @@
+#ifndef __TAPE_BACKUP_CHECKPOINT
+#define __TAPE_BACKUP_CHECKPOINT
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+
+/* --------------------------------------
+Checkpoint journal: Make Backup, Restore and Verify save their progress
+through section #2 to resume.jnl (exe directory) every
+CHECKPOINT_SECONDS: bytes done, logical block where the next tape block
+is written or read, and for verify the SHA-1 state of those bytes.
+Before saving, the drive (backup) or destination file (restore) is
+flushed, so everything before the checkpoint survives a bus reset or
+reboot. Resume locates to the block and continues from there.
+One journal at a time: the next job that saves replaces it, a job that
+completes deletes its own. Drives without logical positions and virtual
+tapes save nothing.
+-------------------------------------- */
+#define CHECKPOINT_FILE         L"resume.jnl"
+#define CHECKPOINT_SECONDS      30
+#define CHECKPOINT_NO_BLOCK     ((ULONGLONG)-1)
+
+typedef enum _CHECKPOINT_KIND {
+    CHECKPOINT_BACKUP = 1,
+    CHECKPOINT_RESTORE,
+    CHECKPOINT_VERIFY
+} CHECKPOINT_KIND;
+
+/* journal file contents, written as is */
+typedef struct _CHECKPOINT_RECORD {
+    char            magic[8];                   /* "ZTRESUME" */
+    DWORD           size;                       /* sizeof(CHECKPOINT_RECORD) */
+    DWORD           kind;
+    WCHAR           devicePath[MAX_PATH];
+    WCHAR           filePath[MAX_PATH * 2];     /* source TAR, restored file or verify log */
+    FILETIME        fileTime;                   /* backup: last write of source */
+    DWORD           index;                      /* archive, from 0 */
+    ZEROTAPE_HEADER zh;                         /* tape must still hold this archive */
+    DWORD           part;
+    ULONGLONG       block;                      /* next tape block after done bytes */
+    ULONGLONG       done;                       /* section #2 bytes before block */
+    SHA1_CTX        sha;                        /* verify: hash of done bytes */
+    unsigned char   check[20];                  /* SHA-1 of all fields above */
+} CHECKPOINT_RECORD;
+
+struct _CHECKPOINT {
+    CHECKPOINT_RECORD   rec;
+    BOOL                enabled;                /* position known, saving works */
+    BOOL                saved;                  /* journal holds this job */
+    ULONGLONG           baseBlock;              /* reads: block of byte baseDone */
+    ULONGLONG           baseDone;
+    double              last;                   /* TimerSeconds of last save */
+};
+
+void CheckpointBegin(CHECKPOINT *cp, CHECKPOINT_KIND kind, LPCWSTR devicePath,
+    LPCWSTR filePath, DWORD index, const ZEROTAPE_HEADER *zh);
+BOOL CheckpointLoad(CHECKPOINT *cp);
+void CheckpointStart(CHECKPOINT *cp, HANDLE ht);
+BOOL CheckpointDue(const CHECKPOINT *cp);
+void CheckpointSave(CHECKPOINT *cp, ULONGLONG done, ULONGLONG block, const SHA1_CTX *sha);
+ULONGLONG CheckpointReadBlock(const CHECKPOINT *cp, ULONGLONG done, DWORD blockSize);
+void CheckpointEnd(CHECKPOINT *cp, BOOL ok);
+
+#endif
@@ -39,6 +39,7 @@ typedef struct _TAPE_SELECTION {
     BOOL   mediaLoaded;
     ULONGLONG mediaCapacityBytes; /* if known, else 0 */
     DWORD  mediaBlockSize;        /* 0 if variable/unknown */
+    WCHAR  cartridge[32];         /* tape name from cartridge memory, if any */
 } TAPE_SELECTION;
 
 #endif
\ No newline at end of file
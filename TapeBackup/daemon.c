@@ -0,0 +1,788 @@
+#include "daemon.h"
+
+static const char *g_daemonStates[] = { "free", "queued", "running", "done" };
+
+static volatile LONG        g_daemonStop = 0;
+static WCHAR                g_daemonPipe[MAX_PATH];
+static CHANGER              g_daemonChanger;
+static BOOL                 g_daemonHasChanger = FALSE;
+
+/* --------------------------------------
+JSON in and out
+-------------------------------------- */
+static const char* DaemonJsonWs(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+static char* DaemonUtf8Put(char *o, DWORD cp)
+{
+    if (cp < 0x80)
+        *o++ = (char)cp;
+    else if (cp < 0x800)
+    {
+        *o++ = (char)(0xC0 | (cp >> 6));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        *o++ = (char)(0xE0 | (cp >> 12));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        *o++ = (char)(0xF0 | (cp >> 18));
+        *o++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return o;
+}
+
+static BOOL DaemonJsonHex4(const char *p, DWORD *out)
+{
+    int i;
+
+    *out = 0;
+    for (i = 0; i < 4; i++)
+    {
+        if (!isxdigit((unsigned char)p[i])) return FALSE;
+        *out = (*out << 4) | (DWORD)(isdigit((unsigned char)p[i]) ?
+            p[i] - '0' : (tolower((unsigned char)p[i]) - 'a' + 10));
+    }
+    return TRUE;
+}
+
+/* p after opening quote; decoded string goes to *o. Returns past closing
+   quote, NULL on bad input. Decoded text is never longer than source */
+static const char* DaemonJsonString(const char *p, char **o)
+{
+    DWORD cp, lo;
+
+    for (;;)
+    {
+        if (*p == '"') break;
+        if ((unsigned char)*p < 0x20) return NULL;
+        if (*p != '\\')
+        {
+            *(*o)++ = *p++;
+            continue;
+        }
+
+        p++;
+        switch (*p)
+        {
+            case '"': case '\\': case '/': *(*o)++ = *p; break;
+            case 'b': *(*o)++ = '\b'; break;
+            case 'f': *(*o)++ = '\f'; break;
+            case 'n': *(*o)++ = '\n'; break;
+            case 'r': *(*o)++ = '\r'; break;
+            case 't': *(*o)++ = '\t'; break;
+            case 'u':
+                if (!DaemonJsonHex4(p + 1, &cp)) return NULL;
+                p += 4;
+                /* surrogate pair: both halves take 12 chars, 4 bytes out */
+                if (cp >= 0xD800 && cp < 0xDC00 && p[1] == '\\' && p[2] == 'u' &&
+                    DaemonJsonHex4(p + 3, &lo) && lo >= 0xDC00 && lo < 0xE000)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                }
+                *o = DaemonUtf8Put(*o, cp);
+                break;
+            default:
+                return NULL;
+        }
+        p++;
+    }
+
+    *(*o)++ = 0;
+    return p + 1;
+}
+
+/* numbers, true, false, null: kept as their text */
+static const char* DaemonJsonScalar(const char *p, char **o)
+{
+    const char *start = p;
+
+    while (isalnum((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.') *(*o)++ = *p++;
+    *(*o)++ = 0;
+    return (p == start) ? NULL : p;
+}
+
+/* one flat object; nested objects and arrays are refused */
+static BOOL DaemonParse(const char *line, DAEMON_REQUEST *r)
+{
+    const char  *p = DaemonJsonWs(line);
+    char        *o = r->buf;
+
+    r->count = 0;
+    if (*p++ != '{') return FALSE;
+    p = DaemonJsonWs(p);
+    if (*p == '}') return (*DaemonJsonWs(p + 1) == 0);
+
+    for (;;)
+    {
+        if (r->count == DAEMON_MAX_FIELDS || *p++ != '"') return FALSE;
+        r->keys[r->count] = o;
+        p = DaemonJsonString(p, &o);
+        if (!p) return FALSE;
+
+        p = DaemonJsonWs(p);
+        if (*p++ != ':') return FALSE;
+        p = DaemonJsonWs(p);
+        r->values[r->count] = o;
+        p = (*p == '"') ? DaemonJsonString(p + 1, &o) : DaemonJsonScalar(p, &o);
+        if (!p) return FALSE;
+        r->count++;
+
+        p = DaemonJsonWs(p);
+        if (*p == '}') break;
+        if (*p++ != ',') return FALSE;
+        p = DaemonJsonWs(p);
+    }
+
+    return (*DaemonJsonWs(p + 1) == 0);
+}
+
+static const char* DaemonField(const DAEMON_REQUEST *r, const char *key)
+{
+    DWORD i;
+
+    for (i = 0; i < r->count; i++)
+        if (strcmp(r->keys[i], key) == 0) return r->values[i];
+    return NULL;
+}
+
+/* FALSE - missing, empty or too long */
+static BOOL DaemonFieldW(const DAEMON_REQUEST *r, const char *key, WCHAR *out, int cch)
+{
+    const char *v = DaemonField(r, key);
+
+    out[0] = 0;
+    if (!v || !v[0]) return FALSE;
+    return (MultiByteToWideChar(CP_UTF8, 0, v, -1, out, cch) != 0);
+}
+
+static DWORD DaemonFieldNumber(const DAEMON_REQUEST *r, const char *key, DWORD def)
+{
+    const char *v = DaemonField(r, key);
+
+    return v ? (DWORD)strtoul(v, NULL, 10) : def;
+}
+
+/* UTF-8 string as JSON string contents (without quotes) */
+static void DaemonJsonQuoteUtf8(const char *utf8, char *out, size_t cch)
+{
+    const char  *s;
+    size_t      n = 0;
+
+    for (s = utf8; *s && n + 7 < cch; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = *s;
+        }
+        else if ((unsigned char)*s < 0x20)
+            n += _snprintf(out + n, cch - n, "\\u%04x", (unsigned)(unsigned char)*s);
+        else
+            out[n++] = *s;
+    }
+    out[n] = 0;
+}
+
+static void DaemonJsonQuote(LPCWSTR in, char *out, size_t cch)
+{
+    char utf8[MAX_PATH * 8];
+
+    if (!WideCharToMultiByte(CP_UTF8, 0, in, -1, utf8, sizeof(utf8), NULL, NULL))
+        utf8[0] = 0;
+    DaemonJsonQuoteUtf8(utf8, out, cch);
+}
+
+/* --------------------------------------
+Clients
+-------------------------------------- */
+/* waits for overlapped pipe I/O; timeoutMs INFINITE for reads */
+static BOOL DaemonPipeIo(HANDLE pipe, HANDLE ev, BOOL write, void *buf, DWORD n,
+    DWORD *got, DWORD timeoutMs)
+{
+    OVERLAPPED  ov;
+    BOOL        ok;
+
+    *got = 0;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.hEvent = ev;
+    ok = write ? WriteFile(pipe, buf, n, NULL, &ov) : ReadFile(pipe, buf, n, NULL, &ov);
+    if (!ok && GetLastError() != ERROR_IO_PENDING) return FALSE;
+
+    if (WaitForSingleObject(ev, timeoutMs) != WAIT_OBJECT_0)
+    {
+        CancelIo(pipe);
+        GetOverlappedResult(pipe, &ov, got, TRUE);
+        SetLastError(WAIT_TIMEOUT);
+        return FALSE;
+    }
+
+    return GetOverlappedResult(pipe, &ov, got, TRUE);
+}
+
+static void DaemonClientRelease(DAEMON_CLIENT *c)
+{
+    if (InterlockedDecrement(&c->refs) > 0) return;
+
+    DisconnectNamedPipe(c->pipe);
+    CloseHandle(c->pipe);
+    CloseHandle(c->evRead);
+    CloseHandle(c->evWrite);
+    DeleteCriticalSection(&c->lock);
+    free(c);
+}
+
+/* one line; dropped once client is gone */
+static void DaemonSend(DAEMON_CLIENT *c, const char *fmt, ...)
+{
+    char    line[DAEMON_LINE_MAX];
+    va_list args;
+    int     n;
+    DWORD   written;
+
+    if (!c || c->gone) return;
+
+    va_start(args, fmt);
+    n = _vsnprintf(line, DAEMON_LINE_MAX - 1, fmt, args);
+    va_end(args);
+    if (n < 0 || n > DAEMON_LINE_MAX - 2) n = DAEMON_LINE_MAX - 2;
+    line[n++] = '\n';
+
+    EnterCriticalSection(&c->lock);
+    if (!c->gone && !DaemonPipeIo(c->pipe, c->evWrite, TRUE, line, (DWORD)n, &written,
+        DAEMON_WRITE_MS))
+        InterlockedExchange(&c->gone, 1);
+    LeaveCriticalSection(&c->lock);
+}
+
+static void DaemonError(DAEMON_CLIENT *c, DWORD id, const char *message)
+{
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"error\",\"message\":\"%s\"}",
+        (unsigned long)id, message);
+}
+
+/* --------------------------------------
+Jobs (see scheduler.h)
+-------------------------------------- */
+/* from worker threads; c stays valid until FINISHED */
+static void DaemonNotify(const SCHED_JOB *j, SCHED_EVENT event, void *ctx)
+{
+    DAEMON_CLIENT   *c = (DAEMON_CLIENT*)ctx;
+    char            path[MAX_PATH * 8];
+
+    switch (event)
+    {
+        case SCHED_EVENT_QUEUED:
+            DaemonSend(c, "{\"id\":%lu,\"event\":\"accepted\",\"job\":%lu}",
+                (unsigned long)j->tag, (unsigned long)j->id);
+            break;
+        case SCHED_EVENT_STARTED:
+            DaemonJsonQuote(j->drive, path, sizeof(path));
+            DaemonSend(c, "{\"job\":%lu,\"event\":\"started\",\"device\":\"%s\"}",
+                (unsigned long)j->id, path);
+            break;
+        case SCHED_EVENT_PROGRESS:
+            DaemonSend(c, "{\"job\":%lu,\"event\":\"progress\",\"percent\":%u,"
+                "\"done\":%I64u,\"total\":%I64u}", (unsigned long)j->id, j->percent, j->done, j->total);
+            break;
+        case SCHED_EVENT_PREEMPTED:
+            DaemonSend(c, "{\"job\":%lu,\"event\":\"preempted\"}", (unsigned long)j->id);
+            break;
+        case SCHED_EVENT_FINISHED:
+            if (j->ok && j->op == SCHED_OP_RESTORE)
+            {
+                DaemonJsonQuote(j->outPath, path, sizeof(path));
+                DaemonSend(c, "{\"job\":%lu,\"event\":\"finished\",\"ok\":true,\"path\":\"%s\"}",
+                    (unsigned long)j->id, path);
+            }
+            else
+                DaemonSend(c, "{\"job\":%lu,\"event\":\"finished\",\"ok\":%s}",
+                    (unsigned long)j->id, j->ok ? "true" : "false");
+            DaemonClientRelease(c);
+            break;
+    }
+}
+
+/* fields of op into job; FALSE - reply already sent */
+static BOOL DaemonJobFields(DAEMON_CLIENT *c, DWORD id, const DAEMON_REQUEST *r, SCHED_JOB *j)
+{
+    const char  *v;
+    const char  *need = NULL;
+
+    DaemonFieldW(r, "device", j->devicePath, MAX_PATH);
+    v = DaemonField(r, "cartridge");
+    if (v) strncpy(j->cartridge, v, 31);
+
+    v = DaemonField(r, "overwrite");
+    j->flags = (v && strcmp(v, "true") == 0) ? JOB_FLAG_OVERWRITE : 0;
+    v = DaemonField(r, "priority");
+    j->priority = v ? atoi(v) : SchedDefaultPriority(j->op);
+    j->archive = DaemonFieldNumber(r, "archive", 1);
+    if (j->archive < 1)
+    {
+        DaemonError(c, id, "archive numbers start from 1");
+        return FALSE;
+    }
+    j->archive--;
+
+    switch (j->op)
+    {
+        case SCHED_OP_BACKUP:
+        case SCHED_OP_APPEND:
+            if (!DaemonFieldW(r, "tar", j->path, MAX_PATH * 2)) need = "tar";
+            v = DaemonField(r, "name");
+            if (v) strncpy(j->name, v, 31);
+            break;
+        case SCHED_OP_VERIFY:
+            DaemonFieldW(r, "log", j->logPath, MAX_PATH * 2);
+            break;
+        case SCHED_OP_RESTORE:
+            if (!DaemonFieldW(r, "dir", j->path, MAX_PATH * 2)) need = "dir";
+            break;
+        case SCHED_OP_TOC:
+            DaemonFieldW(r, "path", j->path, MAX_PATH * 2);
+            break;
+        case SCHED_OP_CLONE:
+            if (!DaemonFieldW(r, "target", j->target, MAX_PATH)) need = "target";
+            break;
+        case SCHED_OP_VERIFY_IMAGE:
+            if (!DaemonFieldW(r, "image", j->path, MAX_PATH * 2)) need = "image";
+            DaemonFieldW(r, "log", j->logPath, MAX_PATH * 2);
+            break;
+    }
+
+    if (need)
+    {
+        DaemonSend(c, "{\"id\":%lu,\"event\":\"error\",\"message\":\"field %s missing\"}",
+            (unsigned long)id, need);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void DaemonStartJob(DAEMON_CLIENT *c, DWORD id, DWORD op, const DAEMON_REQUEST *r)
+{
+    SCHED_JOB   job;
+    const char  *err;
+
+    ZeroMemory(&job, sizeof(job));
+    job.op = op;
+    if (!DaemonJobFields(c, id, r, &job)) return;
+
+    job.notify = DaemonNotify;
+    job.ctx = c;
+    job.tag = id;
+    InterlockedIncrement(&c->refs);
+    if (!SchedSubmit(&job, &err))
+    {
+        DaemonError(c, id, err);
+        DaemonClientRelease(c);
+    }
+}
+
+static void DaemonListJobs(DAEMON_CLIENT *c, DWORD id)
+{
+    SCHED_JOB_INFO  list[SCHED_MAX_JOBS];
+    DWORD           count;
+    DWORD           i;
+    char            device[MAX_PATH * 8];
+
+    /* copy first: sending may wait for a slow client */
+    count = SchedList(list, SCHED_MAX_JOBS);
+    for (i = 0; i < count; i++)
+    {
+        DaemonJsonQuote(list[i].devicePath, device, sizeof(device));
+        DaemonSend(c, "{\"id\":%lu,\"event\":\"job\",\"job\":%lu,\"op\":\"%s\",\"device\":\"%s\","
+            "\"state\":\"%s\",\"priority\":%d,\"runs\":%lu,\"percent\":%u%s}",
+            (unsigned long)id, (unsigned long)list[i].id, SchedOpName(list[i].op), device,
+            g_daemonStates[list[i].state], list[i].priority, (unsigned long)list[i].runs,
+            list[i].percent,
+            list[i].state != SCHED_DONE ? "" : list[i].ok ? ",\"ok\":true" : ",\"ok\":false");
+    }
+
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"jobs\",\"count\":%lu}",
+        (unsigned long)id, (unsigned long)count);
+}
+
+static void DaemonSendElement(DAEMON_CLIENT *c, DWORD id, const char *kind, DWORD index,
+    const CHANGER_ELEMENT_INFO *e)
+{
+    WCHAR   wbarcode[CHANGER_BARCODE_MAX];
+    char    barcode[CHANGER_BARCODE_MAX * 6];
+    char    device[MAX_PATH * 8];
+
+    MultiByteToWideChar(CP_ACP, 0, e->barcode, -1, wbarcode, CHANGER_BARCODE_MAX);
+    DaemonJsonQuote(wbarcode, barcode, sizeof(barcode));
+    DaemonJsonQuote(e->devicePath, device, sizeof(device));
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"element\",\"kind\":\"%s\",\"index\":%lu,"
+        "\"full\":%s,\"barcode\":\"%s\"%s%s%s}",
+        (unsigned long)id, kind, (unsigned long)(index + 1), e->full ? "true" : "false", barcode,
+        device[0] ? ",\"device\":\"" : "", device, device[0] ? "\"" : "");
+}
+
+static void DaemonListChanger(DAEMON_CLIENT *c, DWORD id)
+{
+    CHANGER                 *ch = &g_daemonChanger;
+    CHANGER_ELEMENT_INFO    e;
+    DWORD                   i;
+
+    if (!g_daemonHasChanger)
+    {
+        DaemonError(c, id, "no changer, start with /changer:<path>");
+        return;
+    }
+
+    /* one element at a time: sending may wait for a slow client */
+    for (i = 0; i < ch->driveCount + ch->slotCount; i++)
+    {
+        EnterCriticalSection(&ch->lock);
+        e = (i < ch->driveCount) ? ch->drives[i] : ch->slots[i - ch->driveCount];
+        LeaveCriticalSection(&ch->lock);
+        if (i < ch->driveCount)
+            DaemonSendElement(c, id, "drive", i, &e);
+        else
+            DaemonSendElement(c, id, "slot", i - ch->driveCount, &e);
+    }
+
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"changer\",\"drives\":%lu,\"slots\":%lu}",
+        (unsigned long)id, (unsigned long)ch->driveCount, (unsigned long)ch->slotCount);
+}
+
+/* --------------------------------------
+Catalog (see catalog.h)
+-------------------------------------- */
+typedef struct _DAEMON_FIND {
+    DAEMON_CLIENT   *c;
+    DWORD           id;
+} DAEMON_FIND;
+
+static BOOL DaemonSendHit(void *ctx, const CATALOG_HIT *hit)
+{
+    DAEMON_FIND *f = (DAEMON_FIND*)ctx;
+    char        path[DAEMON_LINE_MAX / 2];
+    char        tape[32 * 6];
+    char        archive[24];
+
+    DaemonJsonQuoteUtf8(hit->path, path, sizeof(path));
+    DaemonJsonQuoteUtf8(hit->tape, tape, sizeof(tape));
+    archive[0] = 0;
+    if (hit->archive != CATALOG_NO_ARCHIVE)
+        _snprintf(archive, sizeof(archive), ",\"archive\":%lu", (unsigned long)hit->archive + 1);
+    archive[sizeof(archive) - 1] = 0;
+
+    DaemonSend(f->c, "{\"id\":%lu,\"event\":\"file\",\"tape\":\"%s\"%s,\"path\":\"%s\","
+        "\"size\":%I64u,\"offset\":%I64u,\"data\":%I64u,\"mtime\":%I64d}",
+        (unsigned long)f->id, tape, archive, path, hit->size, hit->offset, hit->dataOffset, hit->mtime);
+    return !f->c->gone;
+}
+
+static void DaemonFind(DAEMON_CLIENT *c, DWORD id, const DAEMON_REQUEST *r)
+{
+    static const char   *keys[] = { "", "path", "prefix", "glob", "substring" };
+    DAEMON_FIND         f;
+    const char          *pattern = NULL;
+    DWORD               type, found = 0;
+    double              t0;
+
+    for (type = CATALOG_QUERY_PATH; type <= CATALOG_QUERY_SUBSTRING && !pattern; type++)
+        pattern = DaemonField(r, keys[type]);
+    if (!pattern)
+    {
+        DaemonError(c, id, "field path, prefix, glob or substring missing");
+        return;
+    }
+    if (!CatalogEnabled())
+    {
+        DaemonError(c, id, "catalog is off");
+        return;
+    }
+
+    f.c = c;
+    f.id = id;
+    t0 = TimerSeconds();
+    if (!CatalogQuery(type - 1, pattern, DaemonFieldNumber(r, "max", CATALOG_MAX_RESULTS),
+        DaemonSendHit, &f, &found))
+    {
+        DaemonError(c, id, "catalog can't be read");
+        return;
+    }
+
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"found\",\"count\":%lu,\"ms\":%.1f}",
+        (unsigned long)id, (unsigned long)found, (TimerSeconds() - t0) * 1000.0);
+}
+
+/* main loop waits in ConnectNamedPipe: a connection of our own wakes it */
+static void DaemonShutdown(DAEMON_CLIENT *c, DWORD id)
+{
+    HANDLE  h = INVALID_HANDLE_VALUE;
+    int     tries;
+
+    InterlockedExchange(&g_daemonStop, 1);
+    DaemonSend(c, "{\"id\":%lu,\"event\":\"accepted\"}", (unsigned long)id);
+
+    for (tries = 0; tries < 10 && h == INVALID_HANDLE_VALUE; tries++)
+    {
+        h = CreateFileW(g_daemonPipe, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, 0, NULL);
+        if (h == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY)
+            WaitNamedPipeW(g_daemonPipe, 500);
+    }
+    if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+}
+
+static void DaemonHandle(DAEMON_CLIENT *c, const char *line)
+{
+    DAEMON_REQUEST  r;
+    const char      *op;
+    DWORD           id;
+    DWORD           i;
+
+    if (!DaemonParse(line, &r))
+    {
+        DaemonError(c, 0, "request is not a flat JSON object");
+        return;
+    }
+
+    id = DaemonFieldNumber(&r, "id", 0);
+    op = DaemonField(&r, "op");
+    if (!op)
+    {
+        DaemonError(c, id, "field op missing");
+        return;
+    }
+
+    if (strcmp(op, "jobs") == 0)
+    {
+        DaemonListJobs(c, id);
+        return;
+    }
+
+    if (strcmp(op, "changer") == 0)
+    {
+        DaemonListChanger(c, id);
+        return;
+    }
+
+    if (strcmp(op, "find") == 0)
+    {
+        DaemonFind(c, id, &r);
+        return;
+    }
+
+    if (strcmp(op, "shutdown") == 0)
+    {
+        DaemonShutdown(c, id);
+        return;
+    }
+
+    for (i = 0; i < SCHED_OP_COUNT; i++)
+    {
+        if (strcmp(op, SchedOpName(i)) == 0)
+        {
+            DaemonStartJob(c, id, i, &r);
+            return;
+        }
+    }
+
+    DaemonError(c, id, "unknown op");
+}
+
+/* requests are handled in order; jobs run on their own threads */
+static DWORD WINAPI DaemonClientThread(LPVOID param)
+{
+    DAEMON_CLIENT   *c = (DAEMON_CLIENT*)param;
+    char            buf[512];
+    char            line[DAEMON_LINE_MAX];
+    DWORD           len = 0;
+    DWORD           got, i;
+    BOOL            tooLong = FALSE;
+
+    TraceThreadName("daemon client");
+    while (!c->gone && DaemonPipeIo(c->pipe, c->evRead, FALSE, buf, sizeof(buf), &got, INFINITE) &&
+        got > 0)
+    {
+        for (i = 0; i < got; i++)
+        {
+            if (buf[i] != '\n')
+            {
+                if (len + 1 < DAEMON_LINE_MAX)
+                    line[len++] = buf[i];
+                else
+                    tooLong = TRUE;
+                continue;
+            }
+
+            if (len && line[len - 1] == '\r') len--;
+            line[len] = 0;
+            if (tooLong)
+                DaemonError(c, 0, "request too long");
+            else if (len)
+                DaemonHandle(c, line);
+            len = 0;
+            tooLong = FALSE;
+        }
+    }
+
+    InterlockedExchange(&c->gone, 1);
+    DaemonClientRelease(c);
+    return 0;
+}
+
+/* --------------------------------------
+Main loop
+-------------------------------------- */
+static HANDLE DaemonCreatePipe(void)
+{
+    static DWORD    reject = PIPE_REJECT_REMOTE_CLIENTS;
+    HANDLE          pipe;
+
+    for (;;)
+    {
+        pipe = CreateNamedPipeW(g_daemonPipe, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | reject,
+            PIPE_UNLIMITED_INSTANCES, DAEMON_LINE_MAX, DAEMON_LINE_MAX, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE || !reject || GetLastError() != ERROR_INVALID_PARAMETER)
+            return pipe;
+
+        /* XP: no such flag, default pipe security still keeps writes local to owner */
+        reject = 0;
+    }
+}
+
+static BOOL DaemonConnect(HANDLE pipe, HANDLE ev)
+{
+    OVERLAPPED  ov;
+    DWORD       got;
+
+    ZeroMemory(&ov, sizeof(ov));
+    ov.hEvent = ev;
+    if (ConnectNamedPipe(pipe, &ov)) return TRUE;
+
+    switch (GetLastError())
+    {
+        case ERROR_PIPE_CONNECTED:
+            return TRUE;
+        case ERROR_IO_PENDING:
+            return GetOverlappedResult(pipe, &ov, &got, TRUE);
+        default:
+            return FALSE;
+    }
+}
+
+static DAEMON_CLIENT* DaemonClientNew(HANDLE pipe)
+{
+    DAEMON_CLIENT *c;
+
+    c = (DAEMON_CLIENT*)calloc(1, sizeof(DAEMON_CLIENT));
+    if (!c) return NULL;
+
+    c->pipe = pipe;
+    c->refs = 1;
+    c->evRead = CreateEventW(NULL, TRUE, FALSE, NULL);
+    c->evWrite = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!c->evRead || !c->evWrite)
+    {
+        if (c->evRead) CloseHandle(c->evRead);
+        if (c->evWrite) CloseHandle(c->evWrite);
+        free(c);
+        return NULL;
+    }
+
+    InitializeCriticalSection(&c->lock);
+    return c;
+}
+
+/* changerPath - NULL or "" for none */
+BOOL DaemonRun(LPCWSTR pipeName, LPCWSTR changerPath)
+{
+    HANDLE          pipe;
+    HANDLE          ev;
+    HANDLE          thread;
+    DAEMON_CLIENT   *c;
+    INVENTORY_ENTRY e;
+    BOOL            ok = TRUE;
+    int             i;
+
+    _snwprintf(g_daemonPipe, MAX_PATH, L"\\\\.\\pipe\\%s", pipeName);
+    g_daemonPipe[MAX_PATH - 1] = 0;
+
+    ev = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!ev || !SchedStart())
+    {
+        PrintLastErrorW(L"Failed to start job daemon", 0);
+        return FALSE;
+    }
+
+    /* changer's drives first, so the scheduler knows which ones it can load */
+    if (changerPath && changerPath[0])
+    {
+        if (!ChangerOpen(&g_daemonChanger, changerPath))
+        {
+            PrintLastErrorW(L"Failed to open changer", 0);
+            SchedStop();
+            CloseHandle(ev);
+            return FALSE;
+        }
+
+        g_daemonHasChanger = TRUE;
+        ChangerPrint(&g_daemonChanger);
+        if (!SchedSetChanger(&g_daemonChanger))
+            PrintLastErrorW(L"Failed to start drive worker", 0);
+    }
+
+    /* every drive gets a worker now, idle ones take drive-agnostic jobs */
+    wprintf(L"Scanning for tape drives...\r\n");
+    InventoryScan(INVENTORY_PROBE_MS);
+    for (i = 0; i < INVENTORY_MAX_DRIVES; i++)
+    {
+        if (InventoryGet(i, &e) && e.responding && !SchedAddDrive(e.ts.devicePath))
+            PrintLastErrorW(L"Failed to start drive worker", 0);
+    }
+
+    wprintf(L"Job daemon listening on %s\r\n", g_daemonPipe);
+    while (!g_daemonStop)
+    {
+        pipe = DaemonCreatePipe();
+        if (pipe == INVALID_HANDLE_VALUE)
+        {
+            PrintLastErrorW(L"Failed to create pipe", 0);
+            ok = FALSE;
+            break;
+        }
+
+        ResetEvent(ev);
+        if (!DaemonConnect(pipe, ev) || g_daemonStop)
+        {
+            CloseHandle(pipe);
+            continue;
+        }
+
+        c = DaemonClientNew(pipe);
+        thread = c ? CreateThread(NULL, 0, DaemonClientThread, c, 0, NULL) : NULL;
+        if (thread)
+            CloseHandle(thread);
+        else if (c)
+            DaemonClientRelease(c);
+        else
+            CloseHandle(pipe);
+    }
+
+    wprintf(L"Waiting for running jobs...\r\n");
+    SchedStop();
+    if (g_daemonHasChanger) ChangerClose(&g_daemonChanger);
+
+    CloseHandle(ev);
+    wprintf(L"Job daemon stopped.\r\n");
+    return ok;
+}
@@ -0,0 +1,86 @@
+#ifndef __TAPE_BACKUP_DAEMON
+#define __TAPE_BACKUP_DAEMON
+
+#include <stdarg.h>
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "trace.h"
+#include "inventory.h"
+#include "scheduler.h"
+#include "changer.h"
+#include "catalog.h"
+
+/* --------------------------------------
+Job daemon (/daemon[:name]): no menu, jobs come over the local named
+pipe \\.\pipe\<name> as JSON, one object per line (UTF-8, '\n').
+Jobs go to the scheduler (see scheduler.h): a worker per drive, drives
+found at start and any named in a job. Same job cores as the menu,
+never interactive. With /changer:<path> (see changer.h) the changer's
+drives are loaded as jobs ask for cartridges by barcode.
+
+Requests, "id" is echoed in replies:
+    {"id":1,"op":"backup","device":"\\\\.\\TAPE0","tar":"D:\\x.tar","name":"x"}
+    op              fields
+    backup          device, tar, name, overwrite
+    append          device, tar, name
+    verify          device, archive (from 1, default 1), log
+    restore         device, archive, dir, overwrite
+    toc             device, archive, path (.jsonl, .csv, .ztoc - see toc.h)
+    clone           device, target, overwrite
+    verify-image    image, log (no drive, any idle worker)
+    jobs            -
+    changer         - (drives and slots of the changer)
+    find            path, prefix, glob or substring; max (default and
+                    at most 1000) - catalog search, no drive needed
+    shutdown        - (queued jobs fail, running ones are waited for)
+    Any job: "priority" (default restore 3, backup/append/clone/toc 2,
+    verify 1, verify-image 0); "cartridge" instead of "device" - the
+    drive that has this cartridge (tape name, or barcode with a changer).
+Replies and events:
+    {"id":1,"event":"accepted","job":7}
+    {"id":1,"event":"error","message":"..."}
+    {"job":7,"event":"started","device":"..."}
+    {"job":7,"event":"progress","percent":40,"done":...,"total":...}
+    {"job":7,"event":"preempted"}           verify back in queue, starts again
+    {"job":7,"event":"finished","ok":true[,"path":"..."]}
+    jobs: {"id":1,"event":"job","job":7,"op":"backup","device":"...",
+          "state":"running","priority":2,"runs":1,"percent":40} per job,
+          then {"id":1,"event":"jobs","count":1}
+    changer: {"id":1,"event":"element","kind":"slot","index":3,"full":true,
+          "barcode":"ZT0003L6"} per drive (with "device") and slot, from 1,
+          then {"id":1,"event":"changer","drives":2,"slots":8}
+    find: {"id":1,"event":"file","tape":"x","archive":2,"path":"a/b.txt",
+          "size":...,"offset":...,"data":...,"mtime":...} per match
+          (offsets in section #2, archive left out when unknown),
+          then {"id":1,"event":"found","count":1,"ms":0.4}
+-------------------------------------- */
+#define DAEMON_PIPE_NAME        L"TapeBackup"
+#define DAEMON_MAX_FIELDS       16
+#define DAEMON_LINE_MAX         4096
+#define DAEMON_WRITE_MS         10000   /* client that doesn't read is dropped */
+
+#ifndef PIPE_REJECT_REMOTE_CLIENTS
+#define PIPE_REJECT_REMOTE_CLIENTS  0x00000008  /* Vista+, XP refuses it */
+#endif
+
+typedef struct _DAEMON_CLIENT {
+    HANDLE              pipe;
+    HANDLE              evRead;         /* overlapped: jobs write while reader waits */
+    HANDLE              evWrite;
+    CRITICAL_SECTION    lock;           /* one line at a time */
+    volatile LONG       refs;           /* reader thread + its unfinished jobs */
+    volatile LONG       gone;           /* disconnected, events are dropped */
+} DAEMON_CLIENT;
+
+/* flat JSON object, keys and values decoded to UTF-8 in buf */
+typedef struct _DAEMON_REQUEST {
+    DWORD               count;
+    const char          *keys[DAEMON_MAX_FIELDS];
+    const char          *values[DAEMON_MAX_FIELDS];
+    char                buf[DAEMON_LINE_MAX * 2];
+} DAEMON_REQUEST;
+
+BOOL DaemonRun(LPCWSTR pipeName, LPCWSTR changerPath);
+
+#endif
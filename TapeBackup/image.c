@@ -0,0 +1,497 @@
+#include "image.h"
+
+typedef struct _IMAGE_PIPE {
+    BUF_RING        ring;
+    HANDLE          h;          /* tape for export, image file for import */
+    ULONGLONG       offset;     /* import: file offset of next record */
+    ULONGLONG       size;       /* import: file size */
+    IMAGE_STATS     *st;
+    BOOL            failed;
+    DWORD           error;
+} IMAGE_PIPE;
+
+static BOOL ImagePipeCreate(IMAGE_PIPE *p, DWORD memBudget)
+{
+    DWORD count;
+
+    ZeroMemory(p, sizeof(*p));
+    count = memBudget / IMAGE_CHUNK;
+    if (count < 2) count = 2;
+    if (count > RING_MAX_BUFFERS) count = RING_MAX_BUFFERS;
+
+    if (!RingCreate(&p->ring, count, IMAGE_CHUNK))
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* --------------------------------------
+Whole records from image file: the record cut by end of
+chunk is read again at the start of the next one
+-------------------------------------- */
+static DWORD ImageReadRecords(HANDLE hf, ULONGLONG *offset, ULONGLONG size,
+    BYTE *buf, DWORD cap, DWORD *fill)
+{
+    VTAPE_RECORD    *rec;
+    LARGE_INTEGER   pos;
+    DWORD           want, got = 0;
+    DWORD           type, length;
+
+    *fill = 0;
+    want = (size - *offset > cap) ? cap : (DWORD)(size - *offset);
+    if (want < sizeof(VTAPE_RECORD)) return NO_ERROR;
+
+    pos.QuadPart = (LONGLONG)*offset;
+    if (!SetFilePointerEx(hf, pos, NULL, FILE_BEGIN) ||
+        !ReadFile(hf, buf, want, &got, NULL))
+        return GetLastError();
+
+    while (*fill + sizeof(VTAPE_RECORD) <= got)
+    {
+        rec = (VTAPE_RECORD*)(buf + *fill);
+        type = GetLE32(rec->type);
+        length = GetLE32(rec->length);
+        if ((type != VTAPE_REC_BLOCK && type != VTAPE_REC_FILEMARK) ||
+            (type == VTAPE_REC_FILEMARK && length != 0))
+            return ERROR_BAD_FORMAT;
+        if (*fill + sizeof(VTAPE_RECORD) + length > got) break;
+        *fill += sizeof(VTAPE_RECORD) + length;
+    }
+
+    /* torn record at end of file is end of data, as for virtual tape */
+    if (*fill == 0 && *offset + got < size)
+        return ERROR_INVALID_BLOCK_LENGTH;
+
+    *offset += *fill;
+    return NO_ERROR;
+}
+
+/* --------------------------------------
+Export: tape -> image
+-------------------------------------- */
+static DWORD WINAPI ExportReaderThread(LPVOID param)
+{
+    IMAGE_PIPE      *p = (IMAGE_PIPE*)param;
+    VTAPE_RECORD    *rec;
+    BYTE            *buf;
+    DWORD           fill;
+    DWORD           got = 0;
+    DWORD           err;
+
+    TraceThreadName("tape reader");
+    for (;;)
+    {
+        buf = RingGetFree(&p->ring);
+        if (!buf) return 0;
+
+        for (fill = 0; p->ring.prodSize - fill >= sizeof(VTAPE_RECORD) + TAPE_MAX_BLOCK; )
+        {
+            rec = (VTAPE_RECORD*)(buf + fill);
+
+            TRACE_BEGIN("tape read", 0);
+            err = TapeRead(p->h, buf + fill + sizeof(VTAPE_RECORD), TAPE_MAX_BLOCK, &got) ?
+                NO_ERROR : GetLastError();
+            TRACE_END("tape read", got);
+            METRIC_ADD(p->h, METRIC_BYTES_READ, got);
+
+            if (err == NO_ERROR && got > 0)
+            {
+                PutLE32(rec->type, VTAPE_REC_BLOCK);
+                PutLE32(rec->length, got);
+                fill += sizeof(VTAPE_RECORD) + got;
+                p->st->blocks++;
+                p->st->bytes += got;
+                continue;
+            }
+
+            if (err == ERROR_FILEMARK_DETECTED)
+            {
+                PutLE32(rec->type, VTAPE_REC_FILEMARK);
+                PutLE32(rec->length, 0);
+                fill += sizeof(VTAPE_RECORD);
+                p->st->filemarks++;
+                continue;
+            }
+
+            if (err == NO_ERROR || err == ERROR_NO_DATA_DETECTED || err == ERROR_END_OF_MEDIA)
+            {
+                /* end of data */
+                if (fill) RingPut(&p->ring, fill);
+                if (!fill || RingGetFree(&p->ring)) RingPut(&p->ring, 0);
+                return 0;
+            }
+
+            /* ERROR_MORE_DATA too: block larger than we can keep */
+            METRIC_ADD(p->h, METRIC_DEVICE_ERRORS, 1);
+            p->failed = TRUE;
+            p->error = err;
+            RingPut(&p->ring, 0);
+            return 1;
+        }
+
+        RingPut(&p->ring, fill);
+    }
+}
+
+/* tape must be at the beginning, hf after image file header */
+BOOL ImageExport(HANDLE tape, HANDLE hf, DWORD memBudget, IMAGE_STATS *st)
+{
+    IMAGE_PIPE  p;
+    HANDLE      thread;
+    BYTE        *buf;
+    DWORD       len = 0;
+    DWORD       written = 0;
+    BOOL        ok = TRUE;
+    WCHAR       szW[64];
+
+    ZeroMemory(st, sizeof(*st));
+    if (!ImagePipeCreate(&p, memBudget)) return FALSE;
+    p.h = tape;
+    p.st = st;
+
+    thread = CreateThread(NULL, 0, ExportReaderThread, &p, 0, NULL);
+    if (!thread)
+    {
+        PrintLastErrorW(L"Failed to start I/O thread", 0);
+        RingDestroy(&p.ring);
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        buf = RingGetFull(&p.ring, &len);
+        if (!buf || len == 0) break;
+
+        TRACE_BEGIN("file write", 0);
+        ok = WriteFile(hf, buf, len, &written, NULL) && written == len;
+        TRACE_END("file write", written);
+        RingRelease(&p.ring);
+        if (!ok)
+        {
+            PrintLastErrorW(L"Failed to write image file", 0);
+            break;
+        }
+
+        /* st is only grown by the reader, a stale value is fine here */
+        HumanSize(st->bytes, szW, 64);
+        wprintf(L"\r%I64u blocks, %I64u filemarks, %s   ", st->blocks, st->filemarks, szW);
+    }
+
+    if (!ok) RingAbort(&p.ring);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    RingDestroy(&p.ring);
+    wprintf(L"\r\n");
+
+    if (p.failed)
+    {
+        PrintLastErrorW(L"Failed to read from tape", p.error);
+        ok = FALSE;
+    }
+
+    return ok;
+}
+
+/* --------------------------------------
+Import: image -> tape
+-------------------------------------- */
+static DWORD WINAPI ImportReaderThread(LPVOID param)
+{
+    IMAGE_PIPE  *p = (IMAGE_PIPE*)param;
+    BYTE        *buf;
+    DWORD       fill = 0;
+    DWORD       err;
+
+    TraceThreadName("image reader");
+    for (;;)
+    {
+        buf = RingGetFree(&p->ring);
+        if (!buf) return 0;
+
+        TRACE_BEGIN("file read", 0);
+        err = ImageReadRecords(p->h, &p->offset, p->size, buf, p->ring.prodSize, &fill);
+        TRACE_END("file read", fill);
+        if (err != NO_ERROR)
+        {
+            p->failed = TRUE;
+            p->error = err;
+            RingPut(&p->ring, 0);
+            return 1;
+        }
+
+        RingPut(&p->ring, fill);
+        if (fill == 0) return 0;
+    }
+}
+
+/* hf after image file header, tape at the beginning */
+BOOL ImageImport(HANDLE hf, HANDLE tape, DWORD memBudget, IMAGE_STATS *st)
+{
+    IMAGE_PIPE      p;
+    LARGE_INTEGER   size, zero, pos;
+    HANDLE          thread;
+    BYTE            *buf;
+    VTAPE_RECORD    *rec;
+    DWORD           len = 0;
+    DWORD           off, n;
+    DWORD           written = 0;
+    BOOL            ok = TRUE;
+    BOOL            result;
+    unsigned        pct;
+
+    ZeroMemory(st, sizeof(*st));
+    if (!ImagePipeCreate(&p, memBudget)) return FALSE;
+
+    zero.QuadPart = 0;
+    if (!GetFileSizeEx(hf, &size) || !SetFilePointerEx(hf, zero, &pos, FILE_CURRENT))
+    {
+        PrintLastErrorW(L"Failed to access image file", 0);
+        RingDestroy(&p.ring);
+        return FALSE;
+    }
+    p.h = hf;
+    p.st = st;
+    p.offset = (ULONGLONG)pos.QuadPart;
+    p.size = (ULONGLONG)size.QuadPart;
+
+    thread = CreateThread(NULL, 0, ImportReaderThread, &p, 0, NULL);
+    if (!thread)
+    {
+        PrintLastErrorW(L"Failed to start I/O thread", 0);
+        RingDestroy(&p.ring);
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        buf = RingGetFull(&p.ring, &len);
+        if (!buf || len == 0) break;
+
+        for (off = 0; ok && off < len; off += sizeof(VTAPE_RECORD) + n)
+        {
+            rec = (VTAPE_RECORD*)(buf + off);
+            n = GetLE32(rec->length);
+
+            if (GetLE32(rec->type) == VTAPE_REC_FILEMARK)
+            {
+                TRACE_BEGIN("write filemark", 0);
+                result = TapeWriteFilemark(tape);
+                TRACE_END("write filemark", 0);
+                if (!result && GetLastError() != ERROR_END_OF_MEDIA)
+                {
+                    PrintLastErrorW(L"Failed to write filemark", 0);
+                    ok = FALSE;
+                }
+                st->filemarks++;
+                continue;
+            }
+
+            TRACE_BEGIN("tape write", 0);
+            result = TapeWrite(tape, buf + off + sizeof(VTAPE_RECORD), n, &written);
+            TRACE_END("tape write", written);
+            METRIC_ADD(tape, METRIC_BYTES_WRITTEN, written);
+            if (written != n || (!result && GetLastError() != ERROR_END_OF_MEDIA))
+            {
+                METRIC_ADD(tape, METRIC_DEVICE_ERRORS, 1);
+                PrintLastErrorW(L"Failed to write to tape", 0);
+                ok = FALSE;
+            }
+            st->blocks++;
+            st->bytes += n;
+        }
+        RingRelease(&p.ring);
+        if (!ok) break;
+
+        pct = (unsigned)((p.offset * 100ULL) / p.size);
+        DrawProgressBar(pct, p.offset, p.size);
+    }
+
+    if (!ok) RingAbort(&p.ring);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    RingDestroy(&p.ring);
+    wprintf(L"\r\n");
+
+    if (p.failed)
+    {
+        PrintLastErrorW(L"Failed to read image file", p.error);
+        ok = FALSE;
+    }
+
+    return ok;
+}
+
+/* --------------------------------------
+Offline verify: SHA-1 of one image is a single stream,
+so images are spread over processors
+-------------------------------------- */
+typedef struct _IMAGE_VERIFY_POOL {
+    IMAGE_VERIFY    *items;
+    DWORD           count;
+    volatile LONG   next;
+} IMAGE_VERIFY_POOL;
+
+static void ImageVerifyOne(IMAGE_VERIFY *v, BYTE *buf)
+{
+    HANDLE              hf;
+    VTAPE_FILE_HEADER   fh;
+    VTAPE_RECORD        *rec;
+    LARGE_INTEGER       size;
+    ULONGLONG           offset;
+    BYTE                meta[2048];
+    DWORD               metaLen = 0;
+    DWORD               section = 0;
+    DWORD               fill, off, n, take;
+    DWORD               got = 0;
+    SHA1_CTX            ctx;
+    unsigned char       digest[20];
+
+    v->status = IMAGE_VERIFY_BAD;
+    v->bytes = 0;
+    hf = CreateFileW(v->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        v->error = GetLastError();
+        return;
+    }
+
+    if (!ReadFile(hf, &fh, sizeof(fh), &got, NULL) || got != sizeof(fh) ||
+        memcmp(fh.magic, VTAPE_MAGIC, sizeof(VTAPE_MAGIC)) != 0 ||
+        fh.version != VTAPE_VERSION || !GetFileSizeEx(hf, &size))
+    {
+        v->error = ERROR_BAD_FORMAT;
+        CloseHandle(hf);
+        return;
+    }
+
+    sha1_init(&ctx);
+    offset = sizeof(fh);
+    while (section < 2)
+    {
+        TRACE_BEGIN("file read", 0);
+        v->error = ImageReadRecords(hf, &offset, (ULONGLONG)size.QuadPart,
+            buf, IMAGE_CHUNK, &fill);
+        TRACE_END("file read", fill);
+        if (v->error != NO_ERROR)
+        {
+            CloseHandle(hf);
+            return;
+        }
+        if (fill == 0) break;
+
+        for (off = 0; section < 2 && off < fill; off += sizeof(VTAPE_RECORD) + n)
+        {
+            rec = (VTAPE_RECORD*)(buf + off);
+            n = GetLE32(rec->length);
+
+            if (GetLE32(rec->type) == VTAPE_REC_FILEMARK)
+            {
+                section++;
+                if (section > 1) continue;
+
+                /* metadata tar: 512 bytes header, then ZEROTAPE_HEADER */
+                memcpy(&v->zh, meta + 512, sizeof(v->zh));
+                if (metaLen < 512 + sizeof(v->zh) ||
+                    memcmp(v->zh.magic, "ZEROTAPE", 8) != 0 || v->zh.version != 0)
+                {
+                    v->error = ERROR_BAD_FORMAT;
+                    CloseHandle(hf);
+                    return;
+                }
+
+                if (ZeroTapeIsStriped(&v->zh) || ZeroTapeVolume(&v->zh) != 0)
+                {
+                    v->status = IMAGE_VERIFY_SET_MEMBER;
+                    CloseHandle(hf);
+                    return;
+                }
+                continue;
+            }
+
+            if (section == 0)
+            {
+                take = (n > sizeof(meta) - metaLen) ? sizeof(meta) - metaLen : n;
+                memcpy(meta + metaLen, buf + off + sizeof(VTAPE_RECORD), take);
+                metaLen += take;
+                continue;
+            }
+
+            TRACE_BEGIN("sha1", n);
+            sha1_update(&ctx, buf + off + sizeof(VTAPE_RECORD), n);
+            TRACE_END("sha1", n);
+            v->bytes += n;
+        }
+    }
+    CloseHandle(hf);
+
+    if (section == 0)
+    {
+        v->error = ERROR_BAD_FORMAT;
+        return;
+    }
+
+    sha1_final(&ctx, digest);
+    v->status = (v->bytes == GetLE64(v->zh.sizeofarchive) &&
+        memcmp(digest, v->zh.sha1, 20) == 0) ? IMAGE_VERIFY_OK : IMAGE_VERIFY_MISMATCH;
+}
+
+static DWORD WINAPI ImageVerifyThread(LPVOID param)
+{
+    IMAGE_VERIFY_POOL   *pool = (IMAGE_VERIFY_POOL*)param;
+    BYTE                *buf;
+    LONG                i;
+
+    TraceThreadName("image verify");
+    buf = (BYTE*)VirtualAlloc(NULL, IMAGE_CHUNK, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    while ((i = InterlockedIncrement(&pool->next) - 1) < (LONG)pool->count)
+    {
+        if (!buf)
+        {
+            pool->items[i].status = IMAGE_VERIFY_BAD;
+            pool->items[i].error = ERROR_NOT_ENOUGH_MEMORY;
+            continue;
+        }
+        ImageVerifyOne(&pool->items[i], buf);
+    }
+
+    if (buf) VirtualFree(buf, 0, MEM_RELEASE);
+    return 0;
+}
+
+/* returns number of threads used, 0 if none could start */
+DWORD ImageVerify(IMAGE_VERIFY *v, DWORD count)
+{
+    IMAGE_VERIFY_POOL   pool;
+    HANDLE              threads[IMAGE_MAX_VERIFY];
+    SYSTEM_INFO         si;
+    DWORD               n, i;
+
+    if (count > IMAGE_MAX_VERIFY) count = IMAGE_MAX_VERIFY;
+
+    GetSystemInfo(&si);
+    n = si.dwNumberOfProcessors;
+    if (n > count) n = count;
+    if (n < 1) n = 1;
+
+    pool.items = v;
+    pool.count = count;
+    pool.next = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, ImageVerifyThread, &pool, 0, NULL);
+        if (!threads[i]) break;
+    }
+
+    /* started threads take all images between them */
+    if (i > 0) WaitForMultipleObjects(i, threads, TRUE, INFINITE);
+    n = i;
+    for (i = 0; i < n; i++) CloseHandle(threads[i]);
+
+    return n;
+}
@@ -0,0 +1,45 @@
+#ifndef __TAPE_BACKUP_IMAGE
+#define __TAPE_BACKUP_IMAGE
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "ring.h"
+#include "archive.h"
+
+/* --------------------------------------
+Tape image: every block and filemark of a tape (metadata section,
+section #2) in one file, in virtual tape layout (see vtape.h), so an
+image can also be used as a virtual tape by any action.
+Export and import pass whole records through a buffer ring: the disk
+side does one I/O per IMAGE_CHUNK, the tape side goes block by block.
+Verify reads images directly, one thread per image up to the number
+of processors, and never opens a drive.
+-------------------------------------- */
+#define IMAGE_CHUNK         (8 * 1024 * 1024)
+#define IMAGE_MAX_VERIFY    64
+
+typedef struct _IMAGE_STATS {
+    ULONGLONG   blocks;
+    ULONGLONG   filemarks;
+    ULONGLONG   bytes;          /* block payload */
+} IMAGE_STATS;
+
+#define IMAGE_VERIFY_OK         0
+#define IMAGE_VERIFY_MISMATCH   1   /* size or SHA-1 differs from header */
+#define IMAGE_VERIFY_BAD        2   /* can't read, not a ZEROTAPE image */
+#define IMAGE_VERIFY_SET_MEMBER 3   /* stripe member or spanned volume, SHA-1 covers whole set */
+
+typedef struct _IMAGE_VERIFY {
+    LPCWSTR         path;
+    ZEROTAPE_HEADER zh;
+    ULONGLONG       bytes;      /* section #2 bytes hashed */
+    DWORD           status;     /* IMAGE_VERIFY_* */
+    DWORD           error;
+} IMAGE_VERIFY;
+
+BOOL ImageExport(HANDLE tape, HANDLE hf, DWORD memBudget, IMAGE_STATS *st);
+BOOL ImageImport(HANDLE hf, HANDLE tape, DWORD memBudget, IMAGE_STATS *st);
+DWORD ImageVerify(IMAGE_VERIFY *v, DWORD count);
+
+#endif
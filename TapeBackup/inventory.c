@@ -0,0 +1,227 @@
+#include "inventory.h"
+
+static INVENTORY_ENTRY      g_inventory[INVENTORY_MAX_DRIVES];
+static CRITICAL_SECTION     g_inventoryLock;
+static BOOL                 g_inventoryLockReady = FALSE;
+static BOOL                 g_scanned = FALSE;
+static DWORD                g_scannedAt = 0;
+
+/* first call comes from main thread before any probe thread exists */
+static void InventoryLockInit(void)
+{
+    if (g_inventoryLockReady) return;
+    InitializeCriticalSection(&g_inventoryLock);
+    g_inventoryLockReady = TRUE;
+}
+
+/* opens device, asks for identity and media; may block on a busy drive */
+static BOOL InventoryProbeDevice(int id, TAPE_SELECTION *out)
+{
+    WCHAR           path[32];
+    HANDLE          tape;
+    TAPE_SELECTION  ts;
+    ULONGLONG       cap = 0;
+    DWORD           bs = 0;
+    BOOL            wp = FALSE;
+    MAM_RECORD      rec;
+
+    _snwprintf(path, 32, L"\\\\.\\TAPE%d", id);
+    tape = CreateFileW(path, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_EXISTING, 0, NULL);
+    if (tape == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    ZeroMemory(&ts, sizeof(ts));
+    wcsncpy(ts.devicePath, path, 31);
+    ts.devicePath[31] = 0;
+
+    QueryStorageStrings(tape, ts.vendor, 64, ts.model, 64, ts.serial, 128);
+    ts.mediaLoaded = TapeIsMediaLoaded(tape);
+
+    TapeGetMediaInfo(tape, &cap, &bs, &wp);
+    ts.mediaCapacityBytes = cap;
+    ts.mediaBlockSize = bs;
+
+    /* name without moving media */
+    if (ts.mediaLoaded && MamRead(tape, &rec))
+    {
+        MultiByteToWideChar(CP_ACP, 0, rec.zh.name, -1, ts.cartridge, 32);
+        ts.cartridge[31] = 0;
+    }
+    ts.hasSelection = TRUE;
+
+    if (out) *out = ts;
+    CloseHandle(tape);
+    return TRUE;
+}
+
+/* stores its own result, even after the scanner stopped waiting */
+static DWORD WINAPI InventoryProbeThread(LPVOID param)
+{
+    int             id = (int)(INT_PTR)param;
+    INVENTORY_ENTRY *e = &g_inventory[id];
+    TAPE_SELECTION  ts;
+    BOOL            ok;
+
+    ok = InventoryProbeDevice(id, &ts);
+
+    EnterCriticalSection(&g_inventoryLock);
+    e->replaced = ok && e->present && e->ts.serial[0] && wcscmp(e->ts.serial, ts.serial) != 0;
+    e->present = ok;
+    e->responding = TRUE;
+    e->probedAt = GetTickCount();
+    if (ok) e->ts = ts;
+    e->busy = FALSE;
+    LeaveCriticalSection(&g_inventoryLock);
+    return 0;
+}
+
+/* device name exists: doesn't open or wait for the drive */
+static BOOL InventoryExists(int id)
+{
+    WCHAR   name[16];
+    WCHAR   target[MAX_PATH];
+
+    _snwprintf(name, 16, L"TAPE%d", id);
+    name[15] = 0;
+    return (QueryDosDeviceW(name, target, MAX_PATH) != 0);
+}
+
+/* NULL - not started, probe from earlier scan still running or no thread */
+static HANDLE InventoryStart(int id)
+{
+    INVENTORY_ENTRY *e = &g_inventory[id];
+    HANDLE          thread = NULL;
+
+    EnterCriticalSection(&g_inventoryLock);
+    if (!e->busy)
+    {
+        e->busy = TRUE;
+        thread = CreateThread(NULL, 0, InventoryProbeThread, (LPVOID)(INT_PTR)id, 0, NULL);
+        if (!thread) e->busy = FALSE;
+    }
+    LeaveCriticalSection(&g_inventoryLock);
+    return thread;
+}
+
+/* probe not done by deadline: drive listed as not responding */
+static void InventoryCollect(int id, HANDLE thread, DWORD deadline)
+{
+    INVENTORY_ENTRY *e = &g_inventory[id];
+    DWORD           now = GetTickCount();
+    DWORD           wait = ((LONG)(deadline - now) > 0) ? deadline - now : 0;
+
+    if (!thread || WaitForSingleObject(thread, wait) != WAIT_OBJECT_0)
+    {
+        EnterCriticalSection(&g_inventoryLock);
+        if (!e->present)
+        {
+            ZeroMemory(&e->ts, sizeof(e->ts));
+            _snwprintf(e->ts.devicePath, 32, L"\\\\.\\TAPE%d", id);
+            e->ts.devicePath[31] = 0;
+        }
+        e->present = TRUE;
+        e->responding = FALSE;
+        LeaveCriticalSection(&g_inventoryLock);
+    }
+
+    if (thread) CloseHandle(thread);
+}
+
+/* all drives at once, returns number found */
+DWORD InventoryScan(DWORD timeoutMs)
+{
+    HANDLE  threads[INVENTORY_MAX_DRIVES];
+    BOOL    exists[INVENTORY_MAX_DRIVES];
+    DWORD   deadline;
+    DWORD   found = 0;
+    int     i;
+
+    InventoryLockInit();
+    TRACE_BEGIN("scan drives", 0);
+    deadline = GetTickCount() + timeoutMs;
+    for (i = 0; i < INVENTORY_MAX_DRIVES; i++)
+    {
+        exists[i] = InventoryExists(i);
+        threads[i] = exists[i] ? InventoryStart(i) : NULL;
+    }
+
+    for (i = 0; i < INVENTORY_MAX_DRIVES; i++)
+    {
+        if (exists[i])
+            InventoryCollect(i, threads[i], deadline);
+        else
+        {
+            EnterCriticalSection(&g_inventoryLock);
+            if (!g_inventory[i].busy) g_inventory[i].present = FALSE;
+            LeaveCriticalSection(&g_inventoryLock);
+        }
+    }
+
+    EnterCriticalSection(&g_inventoryLock);
+    for (i = 0; i < INVENTORY_MAX_DRIVES; i++)
+        if (g_inventory[i].present) found++;
+    LeaveCriticalSection(&g_inventoryLock);
+
+    g_scanned = TRUE;
+    g_scannedAt = GetTickCount();
+    TRACE_END("scan drives", found);
+    return found;
+}
+
+/* one drive, e.g. the one just chosen; FALSE if absent or not responding */
+BOOL InventoryProbe(int id, DWORD timeoutMs, TAPE_SELECTION *out)
+{
+    INVENTORY_ENTRY e;
+
+    if (id < 0 || id >= INVENTORY_MAX_DRIVES) return FALSE;
+
+    InventoryLockInit();
+    InventoryCollect(id, InventoryStart(id), GetTickCount() + timeoutMs);
+    if (!InventoryGet(id, &e) || !e.responding) return FALSE;
+
+    if (out) *out = e.ts;
+    return TRUE;
+}
+
+BOOL InventoryGet(int id, INVENTORY_ENTRY *out)
+{
+    BOOL present;
+
+    if (id < 0 || id >= INVENTORY_MAX_DRIVES || !g_inventoryLockReady) return FALSE;
+
+    EnterCriticalSection(&g_inventoryLock);
+    present = g_inventory[id].present;
+    if (present) *out = g_inventory[id];
+    LeaveCriticalSection(&g_inventoryLock);
+    return present;
+}
+
+BOOL InventoryIsFresh(DWORD *ageMs)
+{
+    *ageMs = GetTickCount() - g_scannedAt;
+    return (g_scanned && *ageMs < INVENTORY_TTL_MS);
+}
+
+void InventoryPrintEntry(int id, const INVENTORY_ENTRY *e)
+{
+    WCHAR   cap[64];
+
+    HumanSize(e->ts.mediaCapacityBytes, cap, 64);
+    wprintf(L"ID = %d\r\n", id);
+    wprintf(L"Device Path - %s\r\n", e->ts.devicePath);
+    if (!e->responding)
+        wprintf(L"State - Not responding%s\r\n", e->ts.serial[0] ? L", last known values below" : L"");
+    if (e->ts.serial[0] || e->responding)
+    {
+        wprintf(L"Vendor - %s\r\n", e->ts.vendor);
+        wprintf(L"Model - %s\r\n", e->ts.model);
+        wprintf(L"Serial - %s%s\r\n", e->ts.serial, e->replaced ? L" (another drive than before)" : L"");
+        wprintf(L"Media - %s\r\n", e->ts.mediaLoaded ? L"Loaded" : L"Not loaded");
+        if (e->ts.cartridge[0]) wprintf(L"Cartridge - %s\r\n", e->ts.cartridge);
+        wprintf(L"Capacity - %s\r\n", e->ts.mediaCapacityBytes ? cap : L"Unknown");
+        wprintf(L"Block Size - %lu\r\n", (unsigned long)e->ts.mediaBlockSize);
+    }
+    wprintf(L"========\r\n");
+}
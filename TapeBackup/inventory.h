@@ -0,0 +1,38 @@
+#ifndef __TAPE_BACKUP_INVENTORY
+#define __TAPE_BACKUP_INVENTORY
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "mam.h"
+
+/* --------------------------------------
+Drive inventory: \\.\TAPE0..63 are probed in parallel, one thread per
+device name that exists, with a common deadline. A drive that doesn't
+answer in time is listed as not responding with what the cache had for
+it; its probe stores the result when it finishes. No second probe is
+started while one is running.
+Entries are kept per device path together with the serial number they
+were probed with, so listing again within INVENTORY_TTL_MS needs no
+device I/O, and another drive at the same path is reported as such.
+-------------------------------------- */
+#define INVENTORY_MAX_DRIVES    64
+#define INVENTORY_PROBE_MS      5000
+#define INVENTORY_TTL_MS        60000
+
+typedef struct _INVENTORY_ENTRY {
+    BOOL            present;
+    BOOL            responding;     /* last probe finished in time */
+    BOOL            replaced;       /* last probe found another serial */
+    BOOL            busy;           /* probe running */
+    DWORD           probedAt;       /* GetTickCount of last finished probe */
+    TAPE_SELECTION  ts;
+} INVENTORY_ENTRY;
+
+DWORD InventoryScan(DWORD timeoutMs);
+BOOL InventoryProbe(int id, DWORD timeoutMs, TAPE_SELECTION *out);
+BOOL InventoryGet(int id, INVENTORY_ENTRY *out);
+BOOL InventoryIsFresh(DWORD *ageMs);
+void InventoryPrintEntry(int id, const INVENTORY_ENTRY *e);
+
+#endif
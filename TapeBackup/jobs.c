@@ -0,0 +1,2800 @@
+#include "jobs.h"
+
+/* --------------------------------------
+Job helpers
+-------------------------------------- */
+HANDLE JobOpenTape(LPCWSTR devicePath)
+{
+    HANDLE tape;
+
+    tape = TapeOpen(devicePath);
+    if (tape == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot open tape drive", 0);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (!TapeIsMediaLoaded(tape))
+    {
+        wprintf(L"No media loaded in the selected drive.\r\n");
+        TapeClose(tape);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return tape;
+}
+
+BOOL JobReadHeader(HANDLE tape, ZEROTAPE_HEADER *zh)
+{
+    return JobReadArchiveHeader(tape, 0, zh);
+}
+
+/* zh - index archive header just read at BOT */
+static BOOL JobLoadIndex(HANDLE tape, const ZEROTAPE_HEADER *zh, TAPE_INDEX *idx)
+{
+    IndexInit(idx);
+    /* header may have come from session cache, tape is then elsewhere */
+    if (SessionOwns(tape) ? !PositionToArchiveData(tape, 0) : !TapeSpaceFilemarks(tape, 1))
+    {
+        PrintLastErrorW(L"Failed to position to tape index", 0);
+        return FALSE;
+    }
+
+    return IndexReadSection(tape, zh, idx);
+}
+
+/* header of archive 'index' (from 0). Partitioned tape: header comes from
+   the index, dataBlock is its section #2 and keep (if set) gets the index;
+   otherwise dataBlock is PART_NO_BLOCK and archives are found by filemarks */
+static BOOL JobFindArchive(HANDLE tape, DWORD index, ZEROTAPE_HEADER *zh,
+    ULONGLONG *dataBlock, TAPE_INDEX *keep, char *tapeName)
+{
+    TAPE_INDEX      idx;
+    INDEX_ARCHIVE   *a;
+
+    *dataBlock = PART_NO_BLOCK;
+    if (keep) IndexInit(keep);
+    if (!ReadArchiveMetadata(tape, 0, zh)) return FALSE;
+
+    /* tape is named by its first header, archive 0 or the index */
+    if (tapeName)
+    {
+        memcpy(tapeName, zh->name, sizeof(zh->name));
+        tapeName[sizeof(zh->name) - 1] = 0;
+    }
+
+    if (memcmp(zh->magic, "ZEROTAPE", 8) != 0 || zh->format != ZEROTAPE_FORMAT_INDEX)
+        return index == 0 || ReadArchiveMetadata(tape, index, zh);
+
+    if (!JobLoadIndex(tape, zh, &idx)) return FALSE;
+
+    a = IndexArchive(&idx, index);
+    if (!a)
+    {
+        wprintf(L"Archive %lu is not in tape index (%lu archives).\r\n",
+            (unsigned long)index + 1, (unsigned long)idx.count);
+        IndexFree(&idx);
+        return FALSE;
+    }
+
+    memcpy(zh, &a->zh, sizeof(*zh));
+    *dataBlock = GetLE64(a->datablock);
+    if (keep)
+        *keep = idx;
+    else
+        IndexFree(&idx);
+    return TRUE;
+}
+
+static BOOL JobPositionToData(HANDLE tape, DWORD index, ULONGLONG dataBlock)
+{
+    if (dataBlock == PART_NO_BLOCK) return PositionToArchiveData(tape, index);
+
+    wprintf(L"Please wait until tape positioned...\r\n");
+    if (!TapeLocate(tape, PART_DATA, dataBlock))
+    {
+        PrintLastErrorW(L"Failed to locate archive data", 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL JobLocateHeader(HANDLE tape, DWORD index, ZEROTAPE_HEADER *zh,
+    ULONGLONG *dataBlock, TAPE_INDEX *keep, char *tapeName)
+{
+    if (!JobFindArchive(tape, index, zh, dataBlock, keep, tapeName))
+    {
+        wprintf(L"Failed to read ZEROTAPE metadata.\r\n");
+        return FALSE;
+    }
+
+    if (memcmp(zh->magic, "ZEROTAPE", 8) != 0 || zh->version != 0)
+    {
+        wprintf(L"Invalid ZEROTAPE header.\r\n");
+        if (keep) IndexFree(keep);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL JobReadArchiveHeader(HANDLE tape, DWORD index, ZEROTAPE_HEADER *zh)
+{
+    ULONGLONG dataBlock;
+
+    return JobLocateHeader(tape, index, zh, &dataBlock, NULL, NULL);
+}
+
+/* Prints tape info on screen and, if flog is set, into UTF-8 log */
+void PrintTapeInfo(const ZEROTAPE_HEADER *zh, FILE *flog)
+{
+    WCHAR               nameW[64];
+    ULONGLONG           sz;
+    WCHAR               szW[64];
+    WCHAR               sha1W[64];
+    WCHAR               fmtW[16];
+    WCHAR               timeW[64];
+    WCHAR               tmpbuf[128];
+    DWORD               bs;
+
+    MultiByteToWideChar(CP_ACP, 0, zh->name, -1, nameW, 64);
+    sz = GetLE64(zh->sizeofarchive);
+    HumanSize(sz, szW, 64);
+    BytesToHex(zh->sha1, 20, sha1W, 64);
+    _snwprintf(fmtW, 16, L"%s", (zh->format == 1) ? L"tar" :
+        (zh->format == ZEROTAPE_FORMAT_DIRECTORY) ? L"directory" :
+        (zh->format == ZEROTAPE_FORMAT_INDEX) ? L"index" : L"raw");
+    FormatSystemTimeStr(zh->creationdate, timeW, 64);
+
+    wprintf(L"Tape Name - %ws\r\n", nameW);
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"Tape Name - %ws", nameW);
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    wprintf(L"Size - %ws (%I64u bytes)\r\n", szW, sz);
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"Size - %ws(%I64u bytes)", szW, sz);
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    wprintf(L"SHA1 - %ws\r\n", sha1W);
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"SHA1 - %ws", sha1W);
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    wprintf(L"Format - %ws\r\n", fmtW);
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"Format - %ws", fmtW);
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    wprintf(L"Created - %ws\r\n", timeW);
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"Created - %ws", timeW);
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    bs = ZeroTapeBlockSize(zh);
+    wprintf(L"Block Size - %lu KiB\r\n", (unsigned long)(bs / 1024));
+    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+    _snwprintf(tmpbuf, 128, L"Block Size - %lu KiB", (unsigned long)(bs / 1024));
+    if (flog) FPrintLineUtf8(flog, tmpbuf);
+
+    if (ZeroTapeIsStriped(zh))
+    {
+        BytesToHex(zh->setid, 8, sha1W, 64);
+        memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+        _snwprintf(tmpbuf, 128, L"Stripe Set - %ws, tape %u of %u (%u data + %u parity), unit %lu KiB",
+            sha1W, (unsigned)zh->stripeindex + 1, (unsigned)(zh->stripedata + zh->stripeparity),
+            (unsigned)zh->stripedata, (unsigned)zh->stripeparity,
+            (unsigned long)(GetLE32(zh->stripeunit) / 1024));
+        wprintf(L"%s\r\n", tmpbuf);
+        if (flog) FPrintLineUtf8(flog, tmpbuf);
+    }
+
+    if (ZeroTapeVolume(zh) != 0)
+    {
+        BytesToHex(zh->setid, 8, sha1W, 64);
+        memset(tmpbuf, 0, sizeof(WCHAR) * 128);
+        _snwprintf(tmpbuf, 128, L"Volume - %u of spanned archive %ws, data from %I64u bytes",
+            (unsigned)ZeroTapeVolume(zh), sha1W, GetLE64(zh->volstart));
+        wprintf(L"%s\r\n", tmpbuf);
+        if (flog) FPrintLineUtf8(flog, tmpbuf);
+    }
+}
+
+/* single-tape actions can't read a member of striped or spanned set */
+static BOOL JobRejectSetMember(const ZEROTAPE_HEADER *zh)
+{
+    if (ZeroTapeIsStriped(zh))
+    {
+        wprintf(L"Tape is a member of striped set, use striped actions for it.\r\n");
+        return TRUE;
+    }
+
+    if (ZeroTapeVolume(zh) != 0)
+    {
+        wprintf(L"Tape is volume %u of spanned archive, use spanned actions for it.\r\n",
+            (unsigned)ZeroTapeVolume(zh));
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* summary part of cartridge memory record, header goes through PrintTapeInfo */
+void PrintMamSummary(const MAM_RECORD *rec)
+{
+    WCHAR   usedW[64];
+    DWORD   archives = GetLE32(rec->archives);
+    DWORD   files = GetLE32(rec->files);
+
+    HumanSize(GetLE64(rec->used), usedW, 64);
+    if (archives) wprintf(L"Archives - %lu\r\n", (unsigned long)archives);
+    if (files) wprintf(L"Files - %lu\r\n", (unsigned long)files);
+    wprintf(L"Used - %s\r\n", usedW);
+    wprintf(L"Read from cartridge memory, tape not moved.\r\n");
+}
+
+/* best effort: without MAM support actions read the tape itself */
+void JobStoreMam(HANDLE tape, const ZEROTAPE_HEADER *zh,
+    DWORD archives, DWORD files, ULONGLONG used, DWORD flags)
+{
+    MAM_RECORD rec;
+
+    MamInitRecord(&rec, zh, archives, files, used, flags);
+    MamWrite(tape, &rec);
+}
+
+/* partitioned tape: first archive (or the index while empty) and totals;
+   never MAM_FLAG_BOT, the index is read from BOT after its header */
+static void JobStoreIndexMam(HANDLE tape, const TAPE_INDEX *idx, const ZEROTAPE_HEADER *zhIndex)
+{
+    INDEX_ARCHIVE   *a;
+    DWORD           i, files = 0;
+    ULONGLONG       used = 0;
+
+    for (i = 0; i < idx->count; i++)
+    {
+        a = IndexArchive(idx, i);
+        files += GetLE32(a->files);
+        used += GetLE64(a->zh.sizeofarchive);
+    }
+
+    a = IndexArchive(idx, 0);
+    JobStoreMam(tape, a ? &a->zh : zhIndex, idx->count, files, used, 0);
+    SessionPutHeader(tape, 0, zhIndex);
+}
+
+/* drive ID (\\.\TAPEn) or virtual tape path */
+void JobDevicePathFromInput(LPCWSTR in, LPWSTR out, size_t cch)
+{
+    if (in[0] && wcsspn(in, L"0123456789") == wcslen(in))
+        _snwprintf(out, cch, L"\\\\.\\TAPE%d", _wtoi(in));
+    else
+        _snwprintf(out, cch, L"%s", in);
+    out[cch - 1] = 0;
+}
+
+/* to BOT; if tape holds data asks operator or checks JOB_FLAG_OVERWRITE.
+   Header in session cache means data, no probe read and tape stays at BOT.
+   Cartridge memory is left alone: writers clear it with their first block */
+BOOL JobConfirmOverwrite(HANDLE tape, DWORD flags)
+{
+    BYTE            *b;
+    DWORD           got = 0;
+    BOOL            rok;
+    ZEROTAPE_HEADER zh;
+
+    b = (BYTE*)malloc(TAPE_IO_BUF);
+    if (!b)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    if (!PositionToArchive(tape, 0))
+    {
+        free(b);
+        return FALSE;
+    }
+
+    if (SessionGetHeader(tape, 0, &zh))
+        rok = TRUE;
+    else
+    {
+        rok = TapeRead(tape, b, TAPE_IO_BUF, &got);
+        rok = (rok && got > 0) || GetLastError() == ERROR_MORE_DATA;
+    }
+    free(b);
+    if (rok)
+    {
+        if (flags & JOB_FLAG_INTERACTIVE)
+            rok = AskYesNo(L"Tape seems to contain data. Proceed and overwrite?", FALSE);
+        else
+            rok = (flags & JOB_FLAG_OVERWRITE) != 0;
+
+        if (!rok)
+        {
+            wprintf(L"Tape contains data, not overwriting.\r\n");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* sha1 pre-pass: header goes to tape before the data */
+/* progress - console output, off when hashing beside another job step */
+static BOOL JobHashFileEx(LPCWSTR path, ULONGLONG fsz, unsigned char digest[20],
+    BOOL progress)
+{
+    BYTE        *b;
+    DWORD       rd;
+    SHA1_CTX    c;
+    HANDLE      hf;
+    ULONGLONG   done = 0;
+    unsigned    pct;
+
+    b = (BYTE*)malloc(TAPE_IO_BUF);
+    if (!b)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        free(b);
+        return FALSE;
+    }
+
+    if (progress) wprintf(L"Please wait until sha1 calculated...\r\n");
+    TRACE_BEGIN("sha1 pre-pass", fsz);
+    sha1_init(&c);
+    while (ReadFile(hf, b, TAPE_IO_BUF, &rd, NULL) && rd > 0)
+    {
+        TRACE_BEGIN("sha1", rd);
+        sha1_update(&c, b, rd); done += rd;
+        TRACE_END("sha1", rd);
+        if (!progress) continue;
+        pct = (unsigned)((done * 100ULL) / fsz);
+        DrawProgressBar(pct, done, fsz);
+    }
+    sha1_final(&c, digest);
+    TRACE_END("sha1 pre-pass", done);
+    if (progress) wprintf(L"\r\n");
+    CloseHandle(hf);
+    free(b);
+    return done == fsz;
+}
+
+BOOL JobHashFile(LPCWSTR path, ULONGLONG fsz, unsigned char digest[20])
+{
+    return JobHashFileEx(path, fsz, digest, TRUE);
+}
+
+void JobInitHeader(ZEROTAPE_HEADER *zh, const char *tapeName,
+    ULONGLONG fsz, const unsigned char digest[20], DWORD blockSize)
+{
+    SYSTEMTIME st;
+
+    memset(zh, 0, sizeof(*zh));
+    memcpy(zh->magic, "ZEROTAPE", 8);
+    zh->version = 0;
+    a_strncpyz(zh->name, sizeof(zh->name), tapeName);
+    PutLE64(zh->sizeofarchive, fsz);
+    memcpy(zh->sha1, digest, 20); zh->format = 1;
+    GetLocalTime(&st);
+    memcpy(zh->creationdate, &st, sizeof(SYSTEMTIME));
+    PutLE32(zh->blocksize, blockSize);
+}
+
+/* <destDir>\<tape name>.tar, asks before overwriting existing file */
+BOOL JobRestorePath(const ZEROTAPE_HEADER *zh, LPCWSTR destDir, DWORD flags,
+    LPWSTR outpath, size_t cch)
+{
+    WCHAR           wtitle[64];
+    int             need;
+    const WCHAR     *ext;
+    DWORD           attrs;
+    BOOL            ok;
+
+    need = MultiByteToWideChar(CP_ACP, 0, zh->name, -1, wtitle, 64);
+    if (need == 0) wcscpy(wtitle, L"tape");
+    ext = (zh->format == 1) ? L".tar" : L".bin";
+    _snwprintf(outpath, cch, L"%s\\%s%s", destDir, wtitle, ext);
+    outpath[cch - 1] = 0;
+
+    attrs = GetFileAttributesW(outpath);
+    if (attrs != INVALID_FILE_ATTRIBUTES)
+    {
+        if (flags & JOB_FLAG_INTERACTIVE)
+            ok = AskYesNo(L"File exists. Overwrite?", FALSE);
+        else
+            ok = (flags & JOB_FLAG_OVERWRITE) != 0;
+
+        if (!ok)
+        {
+            wprintf(L"Destination file exists, not overwriting.\r\n");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* --------------------------------------
+Make Backup
+-------------------------------------- */
+/* section #2 from source file, through staging spool if enabled;
+   resumed job: hf is already at cp->rec.done */
+static BOOL JobWriteSource(HANDLE tape, HANDLE hf, ULONGLONG fsz,
+    const TAPE_IO_PROFILE *prof, CHECKPOINT *cp)
+{
+    SPOOL   spool;
+    BOOL    ok;
+
+    TRACE_BEGIN("write section 2", fsz);
+    if (SpoolEnabled())
+    {
+        /* slow source: drive gets data from local staging extents */
+        ok = SpoolOpen(&spool, hf, fsz - (cp ? cp->rec.done : 0));
+        if (ok) ok = WriteSpoolToSecondSection(tape, &spool, fsz, prof, NULL, cp);
+        SpoolClose(&spool);
+    }
+    else
+        ok = WriteArchiveToSecondSection(tape, hf, fsz, prof, NULL, cp);
+    TRACE_END("write section 2", fsz);
+
+    return ok;
+}
+
+/* section #2 written: filemark, cartridge memory, session, catalog */
+static BOOL JobFinishBackup(HANDLE tape, const ZEROTAPE_HEADER *zh, CHECKPOINT *cp, LPCWSTR tarPath)
+{
+    if (!TapeWriteFilemark(tape))
+        PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+
+    CheckpointEnd(cp, TRUE);
+    JobStoreMam(tape, zh, 1, 0, GetLE64(zh->sizeofarchive), MAM_FLAG_BOT);
+    SessionPutHeader(tape, 0, zh);
+    TapeClose(tape);
+    CatalogAddTarFile(zh->name, 0, zh, tarPath);
+    wprintf(L"Make Backup completed.\r\n");
+    return TRUE;
+}
+
+BOOL JobMakeBackup(LPCWSTR devicePath, LPCWSTR tarPath,
+    const char *tapeName, DWORD flags)
+{
+    ULONGLONG       fsz = 0;
+    HANDLE          tape;
+    ULONGLONG       overhead = 2048;
+    ULONGLONG       capacity = 0;
+    BOOL            rok;
+    WCHAR           need[64], have[64];
+    unsigned char   digest[20];
+    HANDLE          hf2;
+    ZEROTAPE_HEADER zh;
+    TAPE_IO_PROFILE prof;
+    TAPE_CMD_QUEUE  rew;
+    BOOL            queued;
+    CHECKPOINT      cp;
+
+    if (!IsLikelyTarFile(tarPath))
+    {
+        if (GetLastError() != NO_ERROR)
+            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
+        else
+            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        return FALSE;
+    }
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return FALSE;
+    }
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    TapeSetCompression(tape, FALSE);
+    if (ProfileLoadForTape(tape, &prof) && !TapeSetVariableBlockSize(tape))
+    {
+        PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+        TapeDefaultProfile(&prof);
+    }
+
+    TapeGetMediaInfo(tape, &capacity, NULL, NULL);
+    if ((capacity > 0) && (fsz + overhead > capacity))
+    {
+        HumanSize(fsz + overhead, need, 64);
+        HumanSize(capacity, have, 64);
+        wprintf(L"Selected TAR (with overhead %s) exceeds media capacity (%s).\r\n", need, have);
+        wprintf(L"Use Make Spanned Backup to write it to several cartridges.\r\n");
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (!JobConfirmOverwrite(tape, flags))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* back to BOT after probe read while operator answers and source is hashed */
+    queued = TapeCmdInit(&rew, tape) && TapeCmdPost(&rew, TAPE_CMD_REWIND);
+
+    rok = !(flags & JOB_FLAG_INTERACTIVE) ||
+        AskYesNo(L"Start writing (metadata + archive) to tape?", TRUE);
+    rok = rok && JobHashFile(tarPath, fsz, digest);
+
+    if (queued && !TapeCmdFinish(&rew, L"Please wait until tape rewound..."))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        rok = FALSE;
+    }
+    TapeCmdFree(&rew);
+
+    if (!rok || (!queued && !PositionToArchive(tape, 0)))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    JobInitHeader(&zh, tapeName, fsz, digest, prof.blockSize);
+
+    /* cartridge memory no longer describes what will be on tape */
+    MamClear(tape);
+    wprintf(L"Writing metadata...\r\n");
+    if (!WriteMetadataSection(tape, &zh))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    hf2 = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf2 == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Writing backup...\r\n");
+    CheckpointBegin(&cp, CHECKPOINT_BACKUP, devicePath, tarPath, 0, &zh);
+    rok = JobWriteSource(tape, hf2, fsz, &prof, &cp);
+    if (!rok)
+    {
+        wprintf(L"Failed to write backup!\r\n");
+        CheckpointEnd(&cp, FALSE);
+        CloseHandle(hf2);
+        TapeClose(tape);
+        return FALSE;
+    }
+    wprintf(L"\r\n");
+    CloseHandle(hf2);
+
+    return JobFinishBackup(tape, &zh, &cp, tarPath);
+}
+
+/* --------------------------------------
+Append Backup: new metadata/data pair after the last one on tape
+-------------------------------------- */
+BOOL JobAppendBackup(LPCWSTR devicePath, LPCWSTR tarPath,
+    const char *tapeName, DWORD flags)
+{
+    ULONGLONG       fsz = 0;
+    HANDLE          tape;
+    ULONGLONG       overhead = 2048;
+    ULONGLONG       remaining = 0;
+    BOOL            rok;
+    WCHAR           need[64], have[64];
+    unsigned char   digest[20];
+    HANDLE          hf2;
+    ZEROTAPE_HEADER zh;
+    ZEROTAPE_HEADER zhIndex;
+    TAPE_IO_PROFILE prof;
+    TAPE_INDEX      idx;
+    BOOL            partitioned;
+    DWORD           part;
+    ULONGLONG       metaBlock = PART_NO_BLOCK;
+    ULONGLONG       dataBlock = PART_NO_BLOCK;
+    MAM_RECORD      rec;
+    DWORD           archive;
+
+    if (!IsLikelyTarFile(tarPath))
+    {
+        if (GetLastError() != NO_ERROR)
+            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
+        else
+            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        return FALSE;
+    }
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return FALSE;
+    }
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    /* only a tape that starts with a single-tape archive or an index takes more */
+    if (!ReadMetadataFromTape(tape, &zhIndex) ||
+        memcmp(zhIndex.magic, "ZEROTAPE", 8) != 0 || zhIndex.version != 0)
+    {
+        wprintf(L"Use Make Backup for a tape without ZEROTAPE archive.\r\n");
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (JobRejectSetMember(&zhIndex))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    partitioned = (zhIndex.format == ZEROTAPE_FORMAT_INDEX);
+    IndexInit(&idx);
+    if (partitioned && !JobLoadIndex(tape, &zhIndex, &idx))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    TapeSetCompression(tape, FALSE);
+    if (ProfileLoadForTape(tape, &prof) && !TapeSetVariableBlockSize(tape))
+    {
+        PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+        TapeDefaultProfile(&prof);
+    }
+
+    wprintf(L"Please wait until tape positioned to end of data...\r\n");
+    TRACE_BEGIN("space to end of data", 0);
+    rok = (!partitioned || TapeLocate(tape, PART_DATA, 0)) && TapeSpaceEndOfData(tape);
+    if (rok && partitioned) rok = TapeGetPosition(tape, &part, &metaBlock);
+    TRACE_END("space to end of data", 0);
+    if (!rok)
+    {
+        PrintLastErrorW(L"Failed to position to end of data", 0);
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* what is left past end of data, not the cartridge size */
+    if (!TapeGetRemaining(tape, &remaining))
+        PrintLastErrorW(L"Failed to query remaining capacity", 0);
+    if ((remaining > 0) && (fsz + overhead > remaining))
+    {
+        HumanSize(fsz + overhead, need, 64);
+        HumanSize(remaining, have, 64);
+        wprintf(L"Selected TAR (with overhead %s) exceeds remaining media capacity (%s).\r\n",
+            need, have);
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start appending (metadata + archive) after the last archive on tape?", TRUE))
+    {
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* tape stays at end of data while the file is hashed */
+    if (!JobHashFile(tarPath, fsz, digest))
+    {
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    JobInitHeader(&zh, tapeName, fsz, digest, prof.blockSize);
+
+    /* file list for the index before anything is written */
+    if (partitioned && !IndexAddArchive(&idx, &zh, tarPath))
+    {
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Writing metadata...\r\n");
+    if (!WriteMetadataSection(tape, &zh) ||
+        (partitioned && !TapeGetPosition(tape, &part, &dataBlock)))
+    {
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    hf2 = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf2 == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Writing backup...\r\n");
+    rok = JobWriteSource(tape, hf2, fsz, &prof, NULL);
+    if (!rok)
+    {
+        wprintf(L"Failed to write backup!\r\n");
+        CloseHandle(hf2);
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+    wprintf(L"\r\n");
+    CloseHandle(hf2);
+
+    if (!TapeWriteFilemark(tape))
+        PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+
+    /* data partition is done, only the index is rewritten */
+    if (partitioned)
+    {
+        IndexSetBlocks(&idx, idx.count - 1, metaBlock, dataBlock);
+        wprintf(L"Updating tape index...\r\n");
+        rok = IndexWrite(tape, &idx, &zhIndex);
+        if (rok)
+        {
+            JobStoreIndexMam(tape, &idx, &zhIndex);
+            wprintf(L"Append Backup completed, archive %lu of tape.\r\n", (unsigned long)idx.count);
+        }
+        TapeClose(tape);
+        if (rok) CatalogAddTarFile(zhIndex.name, idx.count - 1, &zh, tarPath);
+        IndexFree(&idx);
+        return rok;
+    }
+
+    /* first archive is unchanged, only totals grow */
+    archive = CATALOG_NO_ARCHIVE;
+    if (MamRead(tape, &rec))
+    {
+        if (GetLE32(rec.archives))
+        {
+            archive = GetLE32(rec.archives);
+            PutLE32(rec.archives, archive + 1);
+        }
+        PutLE64(rec.used, GetLE64(rec.used) + fsz);
+        MamWrite(tape, &rec);
+    }
+
+    TapeClose(tape);
+    CatalogAddTarFile(zhIndex.name, archive, &zh, tarPath);
+    wprintf(L"Append Backup completed, use List Archives for its number.\r\n");
+    return TRUE;
+}
+
+/* --------------------------------------
+Verify Backup
+-------------------------------------- */
+BOOL JobVerifyBackup(LPCWSTR devicePath, LPCWSTR logPath)
+{
+    return JobVerifyArchive(devicePath, 0, logPath);
+}
+
+/* tape holds the archive of the journal; tape is then at its checkpoint */
+static BOOL JobResumePosition(HANDLE tape, const ZEROTAPE_HEADER *zh, const CHECKPOINT *cp)
+{
+    if (memcmp(zh, &cp->rec.zh, sizeof(*zh)) != 0)
+    {
+        wprintf(L"Tape doesn't hold the archive of the interrupted job.\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"Please wait until tape positioned...\r\n");
+    if (!TapeLocate(tape, cp->rec.part, cp->rec.block))
+    {
+        PrintLastErrorW(L"Failed to locate checkpoint", 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* resume - journal of an interrupted verify, hashing goes on from its checkpoint */
+static BOOL JobVerifyArchiveEx(LPCWSTR devicePath, DWORD index, LPCWSTR logPath,
+    CHECKPOINT *resume)
+{
+    HANDLE              ht;
+    FILE                *flog = NULL;
+    ZEROTAPE_HEADER     zh;
+    ULONGLONG           size2;
+    unsigned char       digest[20];
+    BOOL                okHash;
+    char                tapeName[32];
+    CATALOG_BUILDER     cat;
+    BOOL                match;
+    BOOL                okTar;
+    BOOL                overall;
+    TAPE_IO_PROFILE     prof;
+    ULONGLONG           dataBlock;
+    CHECKPOINT          own;
+    CHECKPOINT          *cp = resume;
+    BOOL                positioned;
+
+    ht = JobOpenTape(devicePath);
+    if (ht == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (!JobFindArchive(ht, index, &zh, &dataBlock, NULL, tapeName))
+    {
+        wprintf(L"Failed to read ZEROTAPE metadata.\r\n");
+        TapeClose(ht);
+        return FALSE;
+    }
+
+    if (logPath) flog = OpenUtf8FileForWrite(logPath);
+
+    //FPrintLineUtf8 already did it (\r\n)!
+    if (flog) FPrintLineUtf8(flog, L"# TapeBackup Verify Log (UTF-8)");
+
+    if (flog) FPrintLineUtf8(flog, L"========");
+
+    PrintTapeInfo(&zh, flog);
+
+    wprintf(L"========\r\n");
+    if (flog) FPrintLineUtf8(flog, L"========");
+
+    if (memcmp(zh.magic, "ZEROTAPE", 8) != 0 || zh.version != 0)
+    {
+        wprintf(L"Invalid ZEROTAPE header.\r\n");
+        if (flog) fclose(flog);
+        TapeClose(ht);
+        return FALSE;
+    }
+
+    if (JobRejectSetMember(&zh))
+    {
+        if (flog) fclose(flog);
+        TapeClose(ht);
+        return FALSE;
+    }
+
+    size2 = GetLE64(zh.sizeofarchive);
+    ProfileLoadForTape(ht, &prof);
+    prof.blockSize = ZeroTapeBlockSize(&zh);
+    if (resume)
+        positioned = JobResumePosition(ht, &zh, resume);
+    else
+    {
+        CheckpointBegin(&own, CHECKPOINT_VERIFY, devicePath, logPath, index, &zh);
+        cp = &own;
+        positioned = JobPositionToData(ht, index, dataBlock);
+    }
+
+    if (!positioned)
+    {
+        if (flog) fclose(flog);
+        TapeClose(ht);
+        return FALSE;
+    }
+
+    wprintf(L"Step 1/2: verifying archive\r\n");
+    TRACE_BEGIN("verify sha1", size2);
+    okHash = CopySecondSectionToFileAndOrHash(ht, size2, NULL, digest, &prof, NULL, cp);
+    TRACE_END("verify sha1", size2);
+    CheckpointEnd(cp, okHash);
+    if (!okHash)
+    {
+        if (flog) fclose(flog);
+        TapeClose(ht);
+        return FALSE;
+    }
+
+    match = (memcmp(digest, zh.sha1, 20) == 0);
+    wprintf(L"SHA1 match: %ws\r\n", match ? L"OK" : L"MISMATCH");
+    //FPrintLineUtf8 already did it (\r\n)!
+    if (flog) FPrintLineUtf8(flog, match ? L"SHA1 OK" : L"SHA1 MISMATCH");
+
+    wprintf(L"Step 2/2: verifying files in archive\r\n");
+    okTar = TRUE;
+    if (zh.format == 1)
+    {
+        if (!JobPositionToData(ht, index, dataBlock))
+            okTar = FALSE;
+        else
+        {
+            TRACE_BEGIN("verify tar", 0);
+            CatalogBegin(&cat, tapeName, index, &zh);
+            okTar = VerifyTarOnTape(ht, flog, CatalogSink, &cat);
+            CatalogEnd(&cat, match && okTar);
+            TRACE_END("verify tar", 0);
+        }
+    }
+
+    if (flog)
+    {
+        fclose(flog);
+        wprintf(L"Log saved: %s\r\n", logPath);
+    }
+
+    TapeClose(ht);
+    overall = match && okTar;
+    wprintf(L"Verify Backup %s.\r\n", overall ? L"completed" : L"found errors");
+    return overall;
+}
+
+BOOL JobVerifyArchive(LPCWSTR devicePath, DWORD index, LPCWSTR logPath)
+{
+    return JobVerifyArchiveEx(devicePath, index, logPath, NULL);
+}
+
+/* --------------------------------------
+Restore Backup
+-------------------------------------- */
+BOOL JobRestoreBackup(LPCWSTR devicePath, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut)
+{
+    return JobRestoreArchive(devicePath, 0, destDir, flags, outPath, cchOut);
+}
+
+/* destination file of a resumed restore, cut to checkpoint and open at its end */
+static HANDLE JobReopenRestored(LPCWSTR path, ULONGLONG done)
+{
+    HANDLE          hf;
+    LARGE_INTEGER   size, pos;
+
+    hf = CreateFileW(path, GENERIC_WRITE, 0, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot open partly restored file", 0);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pos.QuadPart = (LONGLONG)done;
+    if (!GetFileSizeEx(hf, &size) || (ULONGLONG)size.QuadPart < done)
+    {
+        wprintf(L"Partly restored file is shorter than the checkpoint, use Restore Backup.\r\n");
+        CloseHandle(hf);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (!SetFilePointerEx(hf, pos, NULL, FILE_BEGIN) || !SetEndOfFile(hf))
+    {
+        PrintLastErrorW(L"Cannot truncate partly restored file", 0);
+        CloseHandle(hf);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return hf;
+}
+
+/* resume - journal of an interrupted restore: destDir and flags aren't used,
+   its file is appended to from the checkpoint */
+static BOOL JobRestoreArchiveEx(LPCWSTR devicePath, DWORD index, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut, CHECKPOINT *resume)
+{
+    HANDLE              tape;
+    ZEROTAPE_HEADER     zh;
+    ULONGLONG           size2;
+    WCHAR               outpath[MAX_PATH * 2];
+    HANDLE              hf;
+    BOOL                ok;
+    TAPE_IO_PROFILE     prof;
+    ULONGLONG           dataBlock;
+    CHECKPOINT          own;
+    CHECKPOINT          *cp = resume;
+
+    if (!resume && !EnsureDirectoryExistsW(destDir))
+    {
+        wprintf(L"Destination directory not accessible.\r\n");
+        return FALSE;
+    }
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (!JobLocateHeader(tape, index, &zh, &dataBlock, NULL, NULL) || JobRejectSetMember(&zh))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    size2 = GetLE64(zh.sizeofarchive);
+    ProfileLoadForTape(tape, &prof);
+    prof.blockSize = ZeroTapeBlockSize(&zh);
+
+    if (resume)
+    {
+        if (!JobResumePosition(tape, &zh, resume))
+        {
+            TapeClose(tape);
+            return FALSE;
+        }
+
+        hf = JobReopenRestored(resume->rec.filePath, resume->rec.done);
+    }
+    else
+    {
+        if (!JobRestorePath(&zh, destDir, flags, outpath, MAX_PATH * 2))
+        {
+            TapeClose(tape);
+            return FALSE;
+        }
+        if (outPath) _snwprintf(outPath, cchOut, L"%s", outpath);
+
+        if (!JobPositionToData(tape, index, dataBlock))
+        {
+            TapeClose(tape);
+            return FALSE;
+        }
+
+        hf = CreateFileW(outpath, GENERIC_WRITE, 0, NULL,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hf == INVALID_HANDLE_VALUE)
+            PrintLastErrorW(L"Cannot create destination file", 0);
+
+        CheckpointBegin(&own, CHECKPOINT_RESTORE, devicePath, outpath, index, &zh);
+        cp = &own;
+    }
+
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    TRACE_BEGIN("restore section 2", size2);
+    ok = CopySecondSectionToFileAndOrHash(tape, size2, hf, NULL, &prof, NULL, cp);
+    TRACE_END("restore section 2", size2);
+    CheckpointEnd(cp, ok);
+    CloseHandle(hf);
+    TapeClose(tape);
+    wprintf(L"Restore Backup %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
+
+BOOL JobRestoreArchive(LPCWSTR devicePath, DWORD index, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut)
+{
+    return JobRestoreArchiveEx(devicePath, index, destDir, flags, outPath, cchOut, NULL);
+}
+
+/* --------------------------------------
+Resume Interrupted Job (see checkpoint.h)
+-------------------------------------- */
+/* same source TAR, unchanged since the job started */
+static BOOL JobResumeBackup(LPCWSTR devicePath, CHECKPOINT *cp)
+{
+    WIN32_FILE_ATTRIBUTE_DATA   fad;
+    ULONGLONG                   fsz = GetLE64(cp->rec.zh.sizeofarchive);
+    HANDLE                      tape;
+    HANDLE                      hf;
+    ZEROTAPE_HEADER             zh;
+    ULONGLONG                   dataBlock;
+    TAPE_IO_PROFILE             prof;
+    LARGE_INTEGER               pos;
+    BOOL                        rok;
+
+    if (!GetFileAttributesExW(cp->rec.filePath, GetFileExInfoStandard, &fad) ||
+        (((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow) != fsz ||
+        CompareFileTime(&fad.ftLastWriteTime, &cp->rec.fileTime) != 0)
+    {
+        wprintf(L"Source TAR is missing or changed since the job started, use Make Backup.\r\n");
+        return FALSE;
+    }
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    TapeSetCompression(tape, FALSE);
+    if (ProfileLoadForTape(tape, &prof) && !TapeSetVariableBlockSize(tape))
+    {
+        PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+        TapeDefaultProfile(&prof);
+    }
+    prof.blockSize = ZeroTapeBlockSize(&cp->rec.zh);
+
+    if (!JobLocateHeader(tape, 0, &zh, &dataBlock, NULL, NULL) || !JobResumePosition(tape, &zh, cp))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    hf = CreateFileW(cp->rec.filePath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    pos.QuadPart = (LONGLONG)cp->rec.done;
+    if (hf == INVALID_HANDLE_VALUE || !SetFilePointerEx(hf, pos, NULL, FILE_BEGIN))
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        if (hf != INVALID_HANDLE_VALUE) CloseHandle(hf);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Writing backup...\r\n");
+    rok = JobWriteSource(tape, hf, fsz, &prof, cp);
+    CloseHandle(hf);
+    if (!rok)
+    {
+        wprintf(L"Failed to write backup!\r\n");
+        CheckpointEnd(cp, FALSE);
+        TapeClose(tape);
+        return FALSE;
+    }
+    wprintf(L"\r\n");
+
+    return JobFinishBackup(tape, &zh, cp, cp->rec.filePath);
+}
+
+BOOL JobResume(LPCWSTR devicePath, DWORD flags)
+{
+    CHECKPOINT      cp;
+    WCHAR           wname[64];
+    WCHAR           done[64], total[64];
+    static LPCWSTR  kinds[] = { L"", L"Make Backup", L"Restore Backup", L"Verify Backup" };
+
+    if (!CheckpointLoad(&cp))
+    {
+        wprintf(L"No interrupted job to resume.\r\n");
+        return FALSE;
+    }
+
+    if (MultiByteToWideChar(CP_ACP, 0, cp.rec.zh.name, -1, wname, 64) == 0) wname[0] = 0;
+    wname[63] = 0;
+    HumanSize(cp.rec.done, done, 64);
+    HumanSize(GetLE64(cp.rec.zh.sizeofarchive), total, 64);
+
+    wprintf(L"Interrupted job - %s, archive %lu (%s)\r\n", kinds[cp.rec.kind],
+        (unsigned long)cp.rec.index + 1, wname);
+    wprintf(L"Device Path - %s\r\n", cp.rec.devicePath);
+    if (cp.rec.filePath[0]) wprintf(L"File - %s\r\n", cp.rec.filePath);
+    wprintf(L"Checkpoint - %s of %s\r\n", done, total);
+    if (_wcsicmp(cp.rec.devicePath, devicePath) != 0)
+        wprintf(L"Resuming on the selected drive %s.\r\n", devicePath);
+
+    if ((flags & JOB_FLAG_INTERACTIVE) && !AskYesNo(L"Resume this job?", TRUE))
+        return FALSE;
+
+    switch (cp.rec.kind)
+    {
+        case CHECKPOINT_BACKUP:
+            return JobResumeBackup(devicePath, &cp);
+        case CHECKPOINT_RESTORE:
+            return JobRestoreArchiveEx(devicePath, cp.rec.index, NULL, flags, NULL, 0, &cp);
+        default:
+            return JobVerifyArchiveEx(devicePath, cp.rec.index,
+                cp.rec.filePath[0] ? cp.rec.filePath : NULL, &cp);
+    }
+}
+
+/* --------------------------------------
+Read Backup TOC
+-------------------------------------- */
+BOOL JobReadTOC(LPCWSTR devicePath, LPCWSTR tocPath)
+{
+    return JobReadArchiveTOC(devicePath, 0, tocPath);
+}
+
+BOOL JobReadArchiveTOC(LPCWSTR devicePath, DWORD index, LPCWSTR tocPath)
+{
+    HANDLE              tape;
+    ZEROTAPE_HEADER     zh;
+    FILE                *fout = NULL;
+    BOOL                ok;
+    ULONGLONG           dataBlock;
+    TAPE_INDEX          idx;
+    char                tapeName[32];
+    CATALOG_BUILDER     cat;
+    TOC_WRITER          toc;
+    DWORD               format = TocFormatOf(tocPath);
+    TAR_MEMBER_SINK     sink = CatalogSink;
+    void                *sinkCtx = &cat;
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (!JobLocateHeader(tape, index, &zh, &dataBlock, &idx, tapeName))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (JobRejectSetMember(&zh))
+    {
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (zh.format != 1)
+    {
+        wprintf(L"Archive format is not TAR; TOC cannot be read.\r\n");
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* partitioned tape: TOC is in the index, data partition isn't read */
+    if (dataBlock == PART_NO_BLOCK && !PositionToArchiveData(tape, index))
+    {
+        wprintf(L"Can't locate data section on tape; TOC cannot be read.\r\n");
+        IndexFree(&idx);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* JSON Lines, CSV, columns: written by TocSink, then the catalog's */
+    CatalogBegin(&cat, tapeName, index, &zh);
+    if (format != TOC_FORMAT_TEXT)
+    {
+        if (!TocOpen(&toc, tocPath, format, &zh, CatalogSink, &cat))
+        {
+            CatalogEnd(&cat, FALSE);
+            IndexFree(&idx);
+            TapeClose(tape);
+            return FALSE;
+        }
+        sink = TocSink;
+        sinkCtx = &toc;
+    }
+    else if (tocPath)
+        fout = OpenUtf8FileForWrite(tocPath);
+
+    //FPrintLineUtf8 already did it (\r\n)!
+    if (fout) FPrintLineUtf8(fout, L"# TapeBackup TOC (UTF-8)");
+
+    if (fout) FPrintLineUtf8(fout, L"========");
+
+    PrintTapeInfo(&zh, fout);
+
+    wprintf(L"========\r\n");
+    if (fout) FPrintLineUtf8(fout, L"========");
+
+    TRACE_BEGIN("list toc", 0);
+    if (dataBlock != PART_NO_BLOCK)
+    {
+        IndexPrintTOC(&idx, index, fout, sink, sinkCtx);
+        ok = TRUE;
+    }
+    else
+        ok = ListTarTOCToFile(tape, fout, sink, sinkCtx);
+    CatalogEnd(&cat, ok);
+    TRACE_END("list toc", 0);
+    if (format != TOC_FORMAT_TEXT)
+    {
+        if (TocClose(&toc, ok))
+            wprintf(L"TOC saved: %s (%I64u entries)\r\n", tocPath, toc.entries);
+        else
+            ok = FALSE;
+    }
+    if (fout)
+    {
+        fclose(fout);
+        wprintf(L"TOC saved: %s\r\n", tocPath);
+    }
+
+    IndexFree(&idx);
+    TapeClose(tape);
+    return ok;
+}
+
+/* --------------------------------------
+Striped set (see stripe.h)
+-------------------------------------- */
+static void JobCloseTapes(HANDLE *tapes, DWORD count)
+{
+    DWORD i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (tapes[i] != INVALID_HANDLE_VALUE) TapeClose(tapes[i]);
+        tapes[i] = INVALID_HANDLE_VALUE;
+    }
+}
+
+/* buffers per tape from memory budget of the profile */
+static DWORD JobStripeDepth(const TAPE_IO_PROFILE *prof, DWORD tapes, DWORD unit)
+{
+    DWORD depth = prof->memBudget / tapes / unit;
+
+    if (depth < 2) depth = 2;
+    if (depth > RING_MAX_BUFFERS) depth = RING_MAX_BUFFERS;
+    return depth;
+}
+
+void JobNewSetId(unsigned char id[8])
+{
+    FILETIME    ft;
+    ULONGLONG   v;
+
+    GetSystemTimeAsFileTime(&ft);
+    v = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    v ^= ((ULONGLONG)GetCurrentProcessId() << 48) ^ GetTickCount();
+    PutLE64(id, v);
+}
+
+BOOL JobMakeStripedBackup(LPCWSTR *devicePaths, DWORD count, BOOL parity,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags)
+{
+    STRIPE_SET      s;
+    ULONGLONG       fsz = 0;
+    ULONGLONG       overhead = 2048;
+    ULONGLONG       capacity;
+    WCHAR           need[64], have[64];
+    unsigned char   digest[20];
+    unsigned char   setid[8];
+    ZEROTAPE_HEADER zh;
+    TAPE_IO_PROFILE prof, def;
+    HANDLE          hf;
+    DWORD           i;
+    BOOL            ok;
+
+    ZeroMemory(&s, sizeof(s));
+    for (i = 0; i < STRIPE_MAX_TAPES; i++) s.tapes[i] = INVALID_HANDLE_VALUE;
+
+    s.parityTapes = parity ? 1 : 0;
+    if (count < 2 || count > STRIPE_MAX_TAPES || count - s.parityTapes < 1)
+    {
+        wprintf(L"Striped set needs 2 to %d tapes.\r\n", STRIPE_MAX_TAPES);
+        return FALSE;
+    }
+    s.dataTapes = count - s.parityTapes;
+
+    if (!IsLikelyTarFile(tarPath))
+    {
+        if (GetLastError() != NO_ERROR)
+            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
+        else
+            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        return FALSE;
+    }
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return FALSE;
+    }
+
+    /* all tapes use the smallest calibrated block size of the set */
+    TapeDefaultProfile(&def);
+    s.blockSize = 0;
+    for (i = 0; i < count; i++)
+    {
+        wprintf(L"Tape %lu - %s\r\n", (unsigned long)i + 1, devicePaths[i]);
+        s.tapes[i] = JobOpenTape(devicePaths[i]);
+        if (s.tapes[i] == INVALID_HANDLE_VALUE)
+        {
+            JobCloseTapes(s.tapes, count);
+            return FALSE;
+        }
+
+        TapeSetCompression(s.tapes[i], FALSE);
+        if (ProfileLoadForTape(s.tapes[i], &prof) && !TapeSetVariableBlockSize(s.tapes[i]))
+        {
+            PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+            prof = def;
+        }
+        if (s.blockSize == 0 || prof.blockSize < s.blockSize) s.blockSize = prof.blockSize;
+    }
+
+    s.totalSize = fsz;
+    s.unit = StripeUnitForBlock(s.blockSize);
+    s.depth = JobStripeDepth(&def, count, s.unit);
+
+    for (i = 0; i < count; i++)
+    {
+        capacity = 0;
+        TapeGetMediaInfo(s.tapes[i], &capacity, NULL, NULL);
+        if ((capacity > 0) && (StripeTapeSize(&s, i) + overhead > capacity))
+        {
+            HumanSize(StripeTapeSize(&s, i) + overhead, need, 64);
+            HumanSize(capacity, have, 64);
+            wprintf(L"Share of tape %lu (with overhead %s) exceeds media capacity (%s).\r\n",
+                (unsigned long)i + 1, need, have);
+            JobCloseTapes(s.tapes, count);
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        wprintf(L"Tape %lu:\r\n", (unsigned long)i + 1);
+        if (!JobConfirmOverwrite(s.tapes[i], flags))
+        {
+            JobCloseTapes(s.tapes, count);
+            return FALSE;
+        }
+    }
+
+    if ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start writing striped set?", TRUE))
+    {
+        JobCloseTapes(s.tapes, count);
+        return FALSE;
+    }
+
+    if (!JobHashFile(tarPath, fsz, digest))
+    {
+        JobCloseTapes(s.tapes, count);
+        return FALSE;
+    }
+
+    JobInitHeader(&zh, tapeName, fsz, digest, s.blockSize);
+    PutLE32(zh.stripeunit, s.unit);
+    zh.stripedata = (unsigned char)s.dataTapes;
+    zh.stripeparity = (unsigned char)s.parityTapes;
+    JobNewSetId(setid);
+    memcpy(zh.setid, setid, 8);
+
+    wprintf(L"Writing metadata...\r\n");
+    for (i = 0; i < count; i++)
+    {
+        zh.stripeindex = (unsigned char)i;
+        MamClear(s.tapes[i]);
+        if (!TapeRewind(s.tapes[i]) || !WriteMetadataSection(s.tapes[i], &zh))
+        {
+            PrintLastErrorW(L"Failed to write metadata", 0);
+            JobCloseTapes(s.tapes, count);
+            return FALSE;
+        }
+    }
+
+    hf = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        JobCloseTapes(s.tapes, count);
+        return FALSE;
+    }
+
+    wprintf(L"Writing backup to %lu data + %lu parity tapes, unit %lu KiB...\r\n",
+        (unsigned long)s.dataTapes, (unsigned long)s.parityTapes, (unsigned long)(s.unit / 1024));
+    TRACE_BEGIN("write stripe set", fsz);
+    ok = StripeWrite(&s, hf);
+    TRACE_END("write stripe set", fsz);
+    CloseHandle(hf);
+
+    for (i = 0; ok && i < count; i++)
+    {
+        if (!TapeWriteFilemark(s.tapes[i]))
+            PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+        zh.stripeindex = (unsigned char)i;
+        JobStoreMam(s.tapes[i], &zh, 1, 0, StripeTapeSize(&s, i), MAM_FLAG_BOT);
+    }
+
+    JobCloseTapes(s.tapes, count);
+    wprintf(L"Make Striped Backup %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
+
+/* opens available tapes of the set, one data tape may be missing when
+   set has parity; all opened tapes are positioned to section #2 */
+static BOOL JobOpenStripeSet(LPCWSTR *devicePaths, DWORD count,
+    STRIPE_SET *s, ZEROTAPE_HEADER *ref)
+{
+    ZEROTAPE_HEADER zh;
+    TAPE_IO_PROFILE def;
+    HANDLE          tape;
+    DWORD           i, idx, tapes;
+    DWORD           missing = 0;
+    BOOL            haveRef = FALSE;
+
+    ZeroMemory(s, sizeof(*s));
+    for (i = 0; i < STRIPE_MAX_TAPES; i++) s->tapes[i] = INVALID_HANDLE_VALUE;
+
+    for (i = 0; i < count; i++)
+    {
+        wprintf(L"Tape %s:\r\n", devicePaths[i]);
+        tape = JobOpenTape(devicePaths[i]);
+        if (tape == INVALID_HANDLE_VALUE) continue;
+
+        if (!JobReadHeader(tape, &zh) || !ZeroTapeIsStriped(&zh))
+        {
+            wprintf(L"Not a member of striped set, skipped.\r\n");
+            TapeClose(tape);
+            continue;
+        }
+
+        if (!haveRef)
+        {
+            *ref = zh;
+            haveRef = TRUE;
+        }
+        else if (memcmp(zh.setid, ref->setid, 8) != 0 ||
+            memcmp(zh.stripeunit, ref->stripeunit, 4) != 0 ||
+            zh.stripedata != ref->stripedata || zh.stripeparity != ref->stripeparity)
+        {
+            wprintf(L"Tape belongs to another striped set, skipped.\r\n");
+            TapeClose(tape);
+            continue;
+        }
+
+        idx = zh.stripeindex;
+        if (idx >= STRIPE_MAX_TAPES || s->tapes[idx] != INVALID_HANDLE_VALUE)
+        {
+            wprintf(L"Duplicate tape %u of the set, skipped.\r\n", (unsigned)idx + 1);
+            TapeClose(tape);
+            continue;
+        }
+        s->tapes[idx] = tape;
+    }
+
+    if (!haveRef)
+    {
+        wprintf(L"No tapes of striped set found.\r\n");
+        return FALSE;
+    }
+
+    s->dataTapes = ref->stripedata;
+    s->parityTapes = ref->stripeparity ? 1 : 0;
+    tapes = s->dataTapes + s->parityTapes;
+    s->unit = GetLE32(ref->stripeunit);
+    s->blockSize = ZeroTapeBlockSize(ref);
+    s->totalSize = GetLE64(ref->sizeofarchive);
+    TapeDefaultProfile(&def);
+    s->depth = JobStripeDepth(&def, tapes, s->unit);
+
+    if (tapes > STRIPE_MAX_TAPES || s->unit == 0 || s->unit % s->blockSize != 0)
+    {
+        wprintf(L"Invalid stripe geometry.\r\n");
+        JobCloseTapes(s->tapes, STRIPE_MAX_TAPES);
+        return FALSE;
+    }
+
+    for (i = 0; i < s->dataTapes; i++)
+    {
+        if (s->tapes[i] != INVALID_HANDLE_VALUE) continue;
+
+        wprintf(L"Data tape %lu of the set is missing.\r\n", (unsigned long)i + 1);
+        missing++;
+    }
+
+    if (missing > 1 || (missing == 1 && s->tapes[s->dataTapes] == INVALID_HANDLE_VALUE) ||
+        (missing == 1 && !s->parityTapes))
+    {
+        wprintf(L"Not enough tapes to read the set.\r\n");
+        JobCloseTapes(s->tapes, STRIPE_MAX_TAPES);
+        return FALSE;
+    }
+    if (missing) wprintf(L"Missing data will be rebuilt from parity.\r\n");
+
+    for (i = 0; i < tapes; i++)
+    {
+        if (s->tapes[i] == INVALID_HANDLE_VALUE) continue;
+        if (!PositionToSecondSection(s->tapes[i]))
+        {
+            JobCloseTapes(s->tapes, STRIPE_MAX_TAPES);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL JobVerifyStripedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR logPath)
+{
+    STRIPE_SET      s;
+    ZEROTAPE_HEADER zh;
+    FILE            *flog = NULL;
+    unsigned char   digest[20];
+    ULONGLONG       parityErrors = 0;
+    WCHAR           line[64];
+    BOOL            ok, match;
+
+    if (!JobOpenStripeSet(devicePaths, count, &s, &zh)) return FALSE;
+
+    if (logPath) flog = OpenUtf8FileForWrite(logPath);
+    if (flog) FPrintLineUtf8(flog, L"# TapeBackup Verify Log (UTF-8)");
+    if (flog) FPrintLineUtf8(flog, L"========");
+    PrintTapeInfo(&zh, flog);
+    wprintf(L"========\r\n");
+    if (flog) FPrintLineUtf8(flog, L"========");
+
+    wprintf(L"Verifying striped archive\r\n");
+    TRACE_BEGIN("verify stripe set", s.totalSize);
+    ok = StripeRead(&s, NULL, digest, &parityErrors);
+    TRACE_END("verify stripe set", s.totalSize);
+    JobCloseTapes(s.tapes, STRIPE_MAX_TAPES);
+
+    match = ok && memcmp(digest, zh.sha1, 20) == 0;
+    if (ok)
+    {
+        wprintf(L"SHA1 match: %ws\r\n", match ? L"OK" : L"MISMATCH");
+        if (flog) FPrintLineUtf8(flog, match ? L"SHA1 OK" : L"SHA1 MISMATCH");
+
+        if (s.parityTapes)
+        {
+            _snwprintf(line, 64, L"Parity errors: %I64u", parityErrors);
+            line[63] = 0;
+            wprintf(L"%s\r\n", line);
+            if (flog) FPrintLineUtf8(flog, line);
+        }
+    }
+
+    if (flog)
+    {
+        fclose(flog);
+        wprintf(L"Log saved: %s\r\n", logPath);
+    }
+
+    ok = match && parityErrors == 0;
+    wprintf(L"Verify Striped Backup %s.\r\n", ok ? L"completed" : L"found errors");
+    return ok;
+}
+
+BOOL JobRestoreStripedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut)
+{
+    STRIPE_SET      s;
+    ZEROTAPE_HEADER zh;
+    WCHAR           outpath[MAX_PATH * 2];
+    HANDLE          hf;
+    BOOL            ok;
+
+    if (!EnsureDirectoryExistsW(destDir))
+    {
+        wprintf(L"Destination directory not accessible.\r\n");
+        return FALSE;
+    }
+
+    if (!JobOpenStripeSet(devicePaths, count, &s, &zh)) return FALSE;
+
+    if (!JobRestorePath(&zh, destDir, flags, outpath, MAX_PATH * 2))
+    {
+        JobCloseTapes(s.tapes, STRIPE_MAX_TAPES);
+        return FALSE;
+    }
+    if (outPath) _snwprintf(outPath, cchOut, L"%s", outpath);
+
+    hf = CreateFileW(outpath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot create destination file", 0);
+        JobCloseTapes(s.tapes, STRIPE_MAX_TAPES);
+        return FALSE;
+    }
+
+    TRACE_BEGIN("restore stripe set", s.totalSize);
+    ok = StripeRead(&s, hf, NULL, NULL);
+    TRACE_END("restore stripe set", s.totalSize);
+    CloseHandle(hf);
+    JobCloseTapes(s.tapes, STRIPE_MAX_TAPES);
+    wprintf(L"Restore Striped Backup %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
+
+/* --------------------------------------
+Spanned archive (see span.h)
+-------------------------------------- */
+BOOL JobMakeSpannedBackup(LPCWSTR *devicePaths, DWORD count,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags)
+{
+    SPAN_SET        s;
+    ULONGLONG       fsz = 0;
+    unsigned char   digest[20];
+    TAPE_IO_PROFILE prof;
+    HANDLE          hf;
+    BOOL            ok;
+
+    if (!IsLikelyTarFile(tarPath))
+    {
+        if (GetLastError() != NO_ERROR)
+            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
+        else
+            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        return FALSE;
+    }
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return FALSE;
+    }
+
+    if (!SpanOpenForWrite(&s, devicePaths, count, flags, &prof)) return FALSE;
+
+    if ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start writing spanned archive?", TRUE))
+    {
+        SpanClose(&s);
+        return FALSE;
+    }
+
+    if (!JobHashFile(tarPath, fsz, digest))
+    {
+        SpanClose(&s);
+        return FALSE;
+    }
+
+    JobInitHeader(&s.zh, tapeName, fsz, digest, prof.blockSize);
+    JobNewSetId(s.zh.setid);
+    if (!SpanBeginVolume(&s, 0))
+    {
+        SpanClose(&s);
+        return FALSE;
+    }
+
+    hf = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        SpanClose(&s);
+        return FALSE;
+    }
+
+    TRACE_BEGIN("write spanned archive", fsz);
+    ok = WriteArchiveToSecondSection(s.tapes[s.cur], hf, fsz, &prof, &s.span, NULL);
+    TRACE_END("write spanned archive", fsz);
+    CloseHandle(hf);
+
+    if (ok) ok = SpanEndVolume(&s, fsz);
+    if (ok)
+        wprintf(L"\r\nArchive written to %u volume(s).\r\n", (unsigned)ZeroTapeVolume(&s.zh));
+
+    SpanClose(&s);
+    wprintf(L"Make Spanned Backup %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
+
+BOOL JobVerifySpannedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR logPath,
+    DWORD flags)
+{
+    SPAN_SET        s;
+    ZEROTAPE_HEADER zh;
+    FILE            *flog = NULL;
+    unsigned char   digest[20];
+    TAPE_IO_PROFILE prof;
+    BOOL            ok, match;
+
+    if (!SpanOpenForRead(&s, devicePaths, count, flags)) return FALSE;
+    zh = s.zh;
+
+    if (logPath) flog = OpenUtf8FileForWrite(logPath);
+    if (flog) FPrintLineUtf8(flog, L"# TapeBackup Verify Log (UTF-8)");
+    if (flog) FPrintLineUtf8(flog, L"========");
+    PrintTapeInfo(&zh, flog);
+    wprintf(L"========\r\n");
+    if (flog) FPrintLineUtf8(flog, L"========");
+
+    TapeDefaultProfile(&prof);
+    prof.blockSize = ZeroTapeBlockSize(&zh);
+
+    wprintf(L"Verifying spanned archive\r\n");
+    TRACE_BEGIN("verify spanned archive", GetLE64(zh.sizeofarchive));
+    ok = CopySecondSectionToFileAndOrHash(s.tapes[s.cur], GetLE64(zh.sizeofarchive),
+        NULL, digest, &prof, &s.span, NULL);
+    TRACE_END("verify spanned archive", GetLE64(zh.sizeofarchive));
+    SpanClose(&s);
+
+    match = ok && memcmp(digest, zh.sha1, 20) == 0;
+    if (ok)
+    {
+        wprintf(L"SHA1 match: %ws\r\n", match ? L"OK" : L"MISMATCH");
+        if (flog) FPrintLineUtf8(flog, match ? L"SHA1 OK" : L"SHA1 MISMATCH");
+    }
+
+    if (flog)
+    {
+        fclose(flog);
+        wprintf(L"Log saved: %s\r\n", logPath);
+    }
+
+    wprintf(L"Verify Spanned Backup %s.\r\n", match ? L"completed" : L"found errors");
+    return match;
+}
+
+BOOL JobRestoreSpannedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut)
+{
+    SPAN_SET        s;
+    ZEROTAPE_HEADER zh;
+    WCHAR           outpath[MAX_PATH * 2];
+    TAPE_IO_PROFILE prof;
+    HANDLE          hf;
+    BOOL            ok;
+
+    if (!EnsureDirectoryExistsW(destDir))
+    {
+        wprintf(L"Destination directory not accessible.\r\n");
+        return FALSE;
+    }
+
+    if (!SpanOpenForRead(&s, devicePaths, count, flags)) return FALSE;
+    zh = s.zh;
+
+    if (!JobRestorePath(&zh, destDir, flags, outpath, MAX_PATH * 2))
+    {
+        SpanClose(&s);
+        return FALSE;
+    }
+    if (outPath) _snwprintf(outPath, cchOut, L"%s", outpath);
+
+    hf = CreateFileW(outpath, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot create destination file", 0);
+        SpanClose(&s);
+        return FALSE;
+    }
+
+    TapeDefaultProfile(&prof);
+    prof.blockSize = ZeroTapeBlockSize(&zh);
+
+    TRACE_BEGIN("restore spanned archive", GetLE64(zh.sizeofarchive));
+    ok = CopySecondSectionToFileAndOrHash(s.tapes[s.cur], GetLE64(zh.sizeofarchive),
+        hf, NULL, &prof, &s.span, NULL);
+    TRACE_END("restore spanned archive", GetLE64(zh.sizeofarchive));
+    CloseHandle(hf);
+    SpanClose(&s);
+    wprintf(L"Restore Spanned Backup %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
+
+/* --------------------------------------
+Mirrored backup (see mirror.h): every tape is an ordinary
+single-tape backup, readable by Verify/Restore alone
+-------------------------------------- */
+BOOL JobMakeMirroredBackup(LPCWSTR *devicePaths, DWORD count,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags)
+{
+    MIRROR_SET      m;
+    ULONGLONG       fsz = 0;
+    ULONGLONG       overhead = 2048;
+    ULONGLONG       capacity;
+    WCHAR           need[64], have[64];
+    unsigned char   digest[20];
+    ZEROTAPE_HEADER zh;
+    TAPE_IO_PROFILE prof, def;
+    HANDLE          tapes[MIRROR_MAX_TAPES];
+    HANDLE          hf;
+    DWORD           i, good = 0;
+    BOOL            ok;
+
+    if (count < 2 || count > MIRROR_MAX_TAPES)
+    {
+        wprintf(L"Mirror needs 2 to %d tapes.\r\n", MIRROR_MAX_TAPES);
+        return FALSE;
+    }
+
+    if (!IsLikelyTarFile(tarPath))
+    {
+        if (GetLastError() != NO_ERROR)
+            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
+        else
+            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        return FALSE;
+    }
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return FALSE;
+    }
+
+    ZeroMemory(&m, sizeof(m));
+    for (i = 0; i < MIRROR_MAX_TAPES; i++) tapes[i] = INVALID_HANDLE_VALUE;
+    TapeDefaultProfile(&def);
+
+    /* each copy keeps block size of its own drive */
+    for (i = 0; i < count; i++)
+    {
+        wprintf(L"Tape %lu - %s\r\n", (unsigned long)i + 1, devicePaths[i]);
+        tapes[i] = JobOpenTape(devicePaths[i]);
+        if (tapes[i] == INVALID_HANDLE_VALUE)
+        {
+            JobCloseTapes(tapes, count);
+            return FALSE;
+        }
+
+        TapeSetCompression(tapes[i], FALSE);
+        if (ProfileLoadForTape(tapes[i], &prof) && !TapeSetVariableBlockSize(tapes[i]))
+        {
+            PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+            prof = def;
+        }
+        m.tapes[i].h = tapes[i];
+        m.tapes[i].blockSize = prof.blockSize;
+
+        capacity = 0;
+        TapeGetMediaInfo(tapes[i], &capacity, NULL, NULL);
+        if ((capacity > 0) && (fsz + overhead > capacity))
+        {
+            HumanSize(fsz + overhead, need, 64);
+            HumanSize(capacity, have, 64);
+            wprintf(L"Selected TAR (with overhead %s) exceeds media capacity (%s).\r\n", need, have);
+            JobCloseTapes(tapes, count);
+            return FALSE;
+        }
+
+        if (!JobConfirmOverwrite(tapes[i], flags))
+        {
+            JobCloseTapes(tapes, count);
+            return FALSE;
+        }
+    }
+    m.count = count;
+
+    if ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start writing mirrored copies?", TRUE))
+    {
+        JobCloseTapes(tapes, count);
+        return FALSE;
+    }
+
+    if (!JobHashFile(tarPath, fsz, digest))
+    {
+        JobCloseTapes(tapes, count);
+        return FALSE;
+    }
+
+    /* copies differ only in block size */
+    JobInitHeader(&zh, tapeName, fsz, digest, 0);
+    wprintf(L"Writing metadata...\r\n");
+    for (i = 0; i < count; i++)
+    {
+        PutLE32(zh.blocksize, m.tapes[i].blockSize);
+        MamClear(tapes[i]);
+        if (!TapeRewind(tapes[i]) || !WriteMetadataSection(tapes[i], &zh))
+        {
+            PrintLastErrorW(L"Failed to write metadata", 0);
+            JobCloseTapes(tapes, count);
+            return FALSE;
+        }
+    }
+
+    hf = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        JobCloseTapes(tapes, count);
+        return FALSE;
+    }
+
+    wprintf(L"Writing backup to %lu tapes...\r\n", (unsigned long)count);
+    TRACE_BEGIN("write mirror", fsz);
+    ok = MirrorWrite(&m, hf, fsz, def.memBudget);
+    TRACE_END("write mirror", fsz);
+    CloseHandle(hf);
+
+    for (i = 0; i < count; i++)
+    {
+        if (ok && i < m.count && !m.tapes[i].failed)
+        {
+            if (!TapeWriteFilemark(tapes[i]))
+                PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+            PutLE32(zh.blocksize, m.tapes[i].blockSize);
+            JobStoreMam(tapes[i], &zh, 1, 0, fsz, MAM_FLAG_BOT);
+            wprintf(L"Tape %lu - %s: OK\r\n", (unsigned long)i + 1, devicePaths[i]);
+            good++;
+        }
+        else
+        {
+            wprintf(L"Tape %lu - %s: ", (unsigned long)i + 1, devicePaths[i]);
+            PrintLastErrorW(L"FAILED", m.tapes[i].error);
+        }
+    }
+
+    JobCloseTapes(tapes, count);
+    ok = ok && good == count;
+    wprintf(L"Make Mirrored Backup %s (%lu of %lu copies).\r\n",
+        ok ? L"completed" : L"failed", (unsigned long)good, (unsigned long)count);
+    return ok;
+}
+
+/* --------------------------------------
+Clone Tape: source section #2 goes straight to the
+destination drive, header is copied as is
+-------------------------------------- */
+/* only archive 0 is copied: a tape with more (appended, batch with its
+   directory, partitioned with its index) is refused, not cut short */
+static BOOL JobRejectMultiArchive(HANDLE src)
+{
+    ZEROTAPE_HEADER zh;
+
+    if (!ReadArchiveMetadata(src, 0, &zh)) return TRUE;
+    if (zh.format == ZEROTAPE_FORMAT_INDEX || zh.format == ZEROTAPE_FORMAT_DIRECTORY)
+    {
+        wprintf(L"Tape is partitioned or holds a batch directory, Clone Tape copies single-archive tapes only.\r\n");
+        return TRUE;
+    }
+
+    /* anything after the first pair of filemarks but end of data */
+    if (ReadArchiveMetadata(src, 1, &zh) || GetLastError() != ERROR_NO_DATA_DETECTED)
+    {
+        wprintf(L"Tape holds more than one archive, Clone Tape copies single-archive tapes only.\r\n");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL JobCloneTape(LPCWSTR srcPath, LPCWSTR dstPath, DWORD flags)
+{
+    HANDLE                      src, dst;
+    ZEROTAPE_HEADER             zh;
+    ULONGLONG                   size2;
+    ULONGLONG                   overhead = 2048;
+    ULONGLONG                   capacity = 0;
+    WCHAR                       need[64], have[64];
+    unsigned char               digest[20];
+    TAPE_IO_PROFILE             prof;
+    TAPE_GET_DRIVE_PARAMETERS   dp;
+    BOOL                        ok;
+
+    if (_wcsicmp(srcPath, dstPath) == 0)
+    {
+        wprintf(L"Source and destination must be different drives.\r\n");
+        return FALSE;
+    }
+
+    src = JobOpenTape(srcPath);
+    if (src == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (!JobReadHeader(src, &zh) || JobRejectSetMember(&zh) || JobRejectMultiArchive(src))
+    {
+        TapeClose(src);
+        return FALSE;
+    }
+    PrintTapeInfo(&zh, NULL);
+    wprintf(L"========\r\n");
+
+    size2 = GetLE64(zh.sizeofarchive);
+    ProfileLoadForTape(src, &prof);
+    prof.blockSize = ZeroTapeBlockSize(&zh);
+
+    dst = JobOpenTape(dstPath);
+    if (dst == INVALID_HANDLE_VALUE)
+    {
+        TapeClose(src);
+        return FALSE;
+    }
+
+    TapeSetCompression(dst, FALSE);
+    if (!TapeSetVariableBlockSize(dst))
+        PrintLastErrorW(L"Failed to set variable block size on destination", 0);
+
+    /* blocks are copied one to one, destination must take them */
+    if (TapeGetDriveInfo(dst, &dp) && dp.MaximumBlockSize != 0 &&
+        dp.MaximumBlockSize < prof.blockSize)
+    {
+        wprintf(L"Destination drive can't write %lu KiB blocks of this archive.\r\n",
+            (unsigned long)(prof.blockSize / 1024));
+        TapeClose(dst);
+        TapeClose(src);
+        return FALSE;
+    }
+
+    TapeGetMediaInfo(dst, &capacity, NULL, NULL);
+    if ((capacity > 0) && (size2 + overhead > capacity))
+    {
+        HumanSize(size2 + overhead, need, 64);
+        HumanSize(capacity, have, 64);
+        wprintf(L"Archive (with overhead %s) exceeds destination media capacity (%s).\r\n", need, have);
+        TapeClose(dst);
+        TapeClose(src);
+        return FALSE;
+    }
+
+    if (!JobConfirmOverwrite(dst, flags) ||
+        ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start cloning to destination tape?", TRUE)))
+    {
+        TapeClose(dst);
+        TapeClose(src);
+        return FALSE;
+    }
+
+    wprintf(L"Please wait until tapes rewound...\r\n");
+    if (!TapeRewind(dst) || !PositionToSecondSection(src))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        TapeClose(dst);
+        TapeClose(src);
+        return FALSE;
+    }
+
+    MamClear(dst);
+    wprintf(L"Writing metadata...\r\n");
+    if (!WriteMetadataSection(dst, &zh))
+    {
+        TapeClose(dst);
+        TapeClose(src);
+        return FALSE;
+    }
+
+    wprintf(L"Cloning backup...\r\n");
+    TRACE_BEGIN("clone section 2", size2);
+    ok = CloneSecondSection(src, dst, size2, digest, &prof);
+    TRACE_END("clone section 2", size2);
+    TapeClose(src);
+
+    if (ok && !TapeWriteFilemark(dst))
+        PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+    if (ok && memcmp(digest, zh.sha1, 20) == 0) JobStoreMam(dst, &zh, 1, 0, size2, MAM_FLAG_BOT);
+    TapeClose(dst);
+
+    if (!ok)
+    {
+        wprintf(L"Failed to clone backup!\r\n");
+        return FALSE;
+    }
+
+    /* a bad source is copied faithfully, but the clone must not pass for good */
+    if (memcmp(digest, zh.sha1, 20) != 0)
+    {
+        wprintf(L"SHA-1 of source archive does not match header, clone is not valid!\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"SHA-1 OK\r\n");
+    wprintf(L"Clone Tape completed.\r\n");
+    return TRUE;
+}
+
+/* --------------------------------------
+Tape images
+-------------------------------------- */
+BOOL JobExportImage(LPCWSTR devicePath, LPCWSTR imagePath, DWORD flags)
+{
+    HANDLE              tape;
+    HANDLE              hf;
+    ZEROTAPE_HEADER     zh;
+    TAPE_IO_PROFILE     prof;
+    IMAGE_STATS         st;
+    LARGE_INTEGER       zero;
+    WCHAR               szW[64];
+    BOOL                ok;
+
+    if (GetFileAttributesW(imagePath) != INVALID_FILE_ATTRIBUTES)
+    {
+        if (flags & JOB_FLAG_INTERACTIVE)
+            ok = AskYesNo(L"File exists. Overwrite?", FALSE);
+        else
+            ok = (flags & JOB_FLAG_OVERWRITE) != 0;
+
+        if (!ok)
+        {
+            wprintf(L"Destination file exists, not overwriting.\r\n");
+            return FALSE;
+        }
+    }
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    TapeSetVariableBlockSize(tape);
+    if (!JobReadHeader(tape, &zh))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+    PrintTapeInfo(&zh, NULL);
+    wprintf(L"========\r\n");
+
+    if (!VTapeCreate(imagePath, 0))
+    {
+        PrintLastErrorW(L"Failed to create image file", 0);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    hf = CreateFileW(imagePath, GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    zero.QuadPart = 0;
+    if (hf == INVALID_HANDLE_VALUE || !SetFilePointerEx(hf, zero, NULL, FILE_END))
+    {
+        PrintLastErrorW(L"Failed to open image file", 0);
+        if (hf != INVALID_HANDLE_VALUE) CloseHandle(hf);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Please wait until tape rewound...\r\n");
+    if (!TapeRewind(tape))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        CloseHandle(hf);
+        DeleteFileW(imagePath);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    TapeDefaultProfile(&prof);
+    wprintf(L"Exporting tape image...\r\n");
+    TRACE_BEGIN("export image", 0);
+    ok = ImageExport(tape, hf, prof.memBudget, &st);
+    TRACE_END("export image", st.bytes);
+    CloseHandle(hf);
+    TapeClose(tape);
+
+    if (!ok)
+    {
+        DeleteFileW(imagePath);
+        wprintf(L"Failed to export tape image!\r\n");
+        return FALSE;
+    }
+
+    HumanSize(st.bytes, szW, 64);
+    wprintf(L"Image - %s\r\n", imagePath);
+    wprintf(L"%I64u blocks, %I64u filemarks, %s (%I64u bytes)\r\n",
+        st.blocks, st.filemarks, szW, st.bytes);
+    wprintf(L"Export Tape Image completed.\r\n");
+    return TRUE;
+}
+
+BOOL JobImportImage(LPCWSTR imagePath, LPCWSTR devicePath, DWORD flags)
+{
+    HANDLE              img;
+    HANDLE              tape;
+    HANDLE              hf;
+    ZEROTAPE_HEADER     zh;
+    TAPE_IO_PROFILE     prof;
+    IMAGE_STATS         st;
+    LARGE_INTEGER       pos;
+    ULONGLONG           fsz = 0;
+    ULONGLONG           capacity = 0;
+    WCHAR               need[64], have[64];
+    BOOL                ok;
+
+    if (!VTapeIsPath(imagePath))
+    {
+        wprintf(L"Image must be a file, not a drive.\r\n");
+        return FALSE;
+    }
+
+    /* image is a virtual tape: header is read the usual way */
+    img = TapeOpen(imagePath);
+    if (img == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot open image file", 0);
+        return FALSE;
+    }
+    ok = JobReadHeader(img, &zh);
+    TapeClose(img);
+    if (!ok) return FALSE;
+
+    PrintTapeInfo(&zh, NULL);
+    wprintf(L"========\r\n");
+
+    GetFileSize64W(imagePath, &fsz);
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    TapeSetCompression(tape, FALSE);
+    if (!TapeSetVariableBlockSize(tape))
+        PrintLastErrorW(L"Failed to set variable block size", 0);
+
+    /* record headers are counted too, a slight overestimate */
+    TapeGetMediaInfo(tape, &capacity, NULL, NULL);
+    if ((capacity > 0) && (fsz > capacity))
+    {
+        HumanSize(fsz, need, 64);
+        HumanSize(capacity, have, 64);
+        wprintf(L"Image (%s) exceeds media capacity (%s).\r\n", need, have);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (!JobConfirmOverwrite(tape, flags) ||
+        ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(L"Start writing image to tape?", TRUE)))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    hf = CreateFileW(imagePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    pos.QuadPart = sizeof(VTAPE_FILE_HEADER);
+    if (hf == INVALID_HANDLE_VALUE || !SetFilePointerEx(hf, pos, NULL, FILE_BEGIN))
+    {
+        PrintLastErrorW(L"Failed to open image file", 0);
+        if (hf != INVALID_HANDLE_VALUE) CloseHandle(hf);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    wprintf(L"Please wait until tape rewound...\r\n");
+    if (!TapeRewind(tape))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        CloseHandle(hf);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    TapeDefaultProfile(&prof);
+    MamClear(tape);
+    wprintf(L"Importing tape image...\r\n");
+    TRACE_BEGIN("import image", fsz);
+    ok = ImageImport(hf, tape, prof.memBudget, &st);
+    TRACE_END("import image", st.bytes);
+    CloseHandle(hf);
+    TapeClose(tape);
+
+    if (!ok)
+    {
+        wprintf(L"Failed to import tape image!\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"%I64u blocks, %I64u filemarks, %I64u bytes written\r\n",
+        st.blocks, st.filemarks, st.bytes);
+    wprintf(L"Import Tape Image completed.\r\n");
+    return TRUE;
+}
+
+BOOL JobVerifyImages(LPCWSTR *imagePaths, DWORD count, LPCWSTR logPath)
+{
+    IMAGE_VERIFY    v[IMAGE_MAX_VERIFY];
+    FILE            *flog = NULL;
+    WCHAR           line[MAX_PATH + 128];
+    WCHAR           nameW[64];
+    DWORD           i, threads, good = 0, skipped = 0;
+
+    if (count == 0 || count > IMAGE_MAX_VERIFY)
+    {
+        wprintf(L"Verify takes 1 to %d images.\r\n", IMAGE_MAX_VERIFY);
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (!VTapeIsPath(imagePaths[i]))
+        {
+            wprintf(L"%s is a drive, not an image file.\r\n", imagePaths[i]);
+            return FALSE;
+        }
+        ZeroMemory(&v[i], sizeof(v[i]));
+        v[i].path = imagePaths[i];
+    }
+
+    wprintf(L"Verifying %lu image(s)...\r\n", (unsigned long)count);
+    TRACE_BEGIN("verify images", 0);
+    threads = ImageVerify(v, count);
+    TRACE_END("verify images", 0);
+    if (threads == 0)
+    {
+        PrintLastErrorW(L"Failed to start verify threads", 0);
+        return FALSE;
+    }
+
+    if (logPath) flog = OpenUtf8FileForWrite(logPath);
+    if (flog) FPrintLineUtf8(flog, L"# TapeBackup Image Verify Log (UTF-8)");
+
+    for (i = 0; i < count; i++)
+    {
+        MultiByteToWideChar(CP_ACP, 0, v[i].zh.name, -1, nameW, 64);
+        nameW[63] = 0;
+        switch (v[i].status)
+        {
+            case IMAGE_VERIFY_OK:
+                _snwprintf(line, MAX_PATH + 128, L"%s - %s: OK", v[i].path, nameW);
+                good++;
+                break;
+            case IMAGE_VERIFY_MISMATCH:
+                _snwprintf(line, MAX_PATH + 128, L"%s - %s: SHA-1 MISMATCH (%I64u of %I64u bytes)",
+                    v[i].path, nameW, v[i].bytes, GetLE64(v[i].zh.sizeofarchive));
+                break;
+            case IMAGE_VERIFY_SET_MEMBER:
+                _snwprintf(line, MAX_PATH + 128, L"%s - %s: skipped, member of striped or spanned set",
+                    v[i].path, nameW);
+                skipped++;
+                break;
+            default:
+                _snwprintf(line, MAX_PATH + 128, L"%s: BAD IMAGE (error %lu)",
+                    v[i].path, (unsigned long)v[i].error);
+                break;
+        }
+        line[MAX_PATH + 127] = 0;
+        wprintf(L"%s\r\n", line);
+        if (flog) FPrintLineUtf8(flog, line);
+    }
+
+    if (flog) fclose(flog);
+    wprintf(L"Verify Tape Images %s (%lu OK, %lu skipped of %lu images, %lu threads).\r\n",
+        (good + skipped == count) ? L"completed" : L"failed", (unsigned long)good,
+        (unsigned long)skipped, (unsigned long)count, (unsigned long)threads);
+    return good + skipped == count;
+}
+
+/* --------------------------------------
+Batch backup: archives back to back on one tape, closed by
+a directory archive; file k+1 is hashed while file k is written
+-------------------------------------- */
+typedef struct _JOB_BATCH {
+    LPCWSTR         *paths;
+    DWORD           count;
+    ULONGLONG       sizes[JOB_BATCH_MAX];
+    unsigned char   digests[JOB_BATCH_MAX][20];
+    BOOL            hashed[JOB_BATCH_MAX];
+    HANDLE          semHashed;  /* released once per file, in order */
+    HANDLE          semAhead;   /* hasher stays at most one file ahead */
+    volatile LONG   abort;
+} JOB_BATCH;
+
+static DWORD WINAPI JobBatchHasherThread(LPVOID param)
+{
+    JOB_BATCH   *b = (JOB_BATCH*)param;
+    DWORD       i;
+
+    TraceThreadName("batch hasher");
+    for (i = 0; i < b->count; i++)
+    {
+        WaitForSingleObject(b->semAhead, INFINITE);
+        if (b->abort) break;
+
+        b->hashed[i] = JobHashFileEx(b->paths[i], b->sizes[i], b->digests[i], FALSE);
+        ReleaseSemaphore(b->semHashed, 1, NULL);
+    }
+
+    return 0;
+}
+
+/* archive name is file name without directory, ASCII */
+static void JobArchiveName(LPCWSTR path, char *out, int cch)
+{
+    LPCWSTR name = wcsrchr(path, L'\\');
+    int     n;
+
+    name = name ? name + 1 : path;
+    n = WideCharToMultiByte(CP_ACP, 0, name, -1, out, cch - 1, NULL, NULL);
+    out[(n > 0 && n < cch) ? n : cch - 1] = 0;
+}
+
+/* tape rewound, hasher running; done - archives written */
+static BOOL JobBatchWrite(HANDLE tape, JOB_BATCH *b, ZEROTAPE_HEADER *entries,
+    const TAPE_IO_PROFILE *prof, const char *batchName, DWORD *done)
+{
+    ZEROTAPE_HEADER zh;
+    HANDLE          hf;
+    char            name[32];
+    unsigned char   digest[20];
+    SHA1_CTX        ctx;
+    DWORD           i;
+    BOOL            ok;
+
+    for (i = 0; i < b->count; i++)
+    {
+        wprintf(L"Archive %lu of %lu - %s\r\n", (unsigned long)i + 1,
+            (unsigned long)b->count, b->paths[i]);
+        WaitForSingleObject(b->semHashed, INFINITE);
+        if (!b->hashed[i])
+        {
+            wprintf(L"Failed to hash %s (file changed or unreadable).\r\n", b->paths[i]);
+            return FALSE;
+        }
+
+        JobArchiveName(b->paths[i], name, sizeof(name));
+        JobInitHeader(&zh, name, b->sizes[i], b->digests[i], prof->blockSize);
+        if (i == 0) MamClear(tape);
+        if (!WriteMetadataSection(tape, &zh)) return FALSE;
+
+        hf = CreateFileW(b->paths[i], GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hf == INVALID_HANDLE_VALUE)
+        {
+            PrintLastErrorW(L"Failed to open source file", 0);
+            return FALSE;
+        }
+
+        ok = JobWriteSource(tape, hf, b->sizes[i], prof, NULL);
+        CloseHandle(hf);
+        wprintf(L"\r\n");
+        if (!ok)
+        {
+            wprintf(L"Failed to write backup!\r\n");
+            return FALSE;
+        }
+
+        if (!TapeWriteFilemark(tape))
+        {
+            PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+            return FALSE;
+        }
+
+        entries[i] = zh;
+        (*done)++;
+        ReleaseSemaphore(b->semAhead, 1, NULL);
+    }
+
+    /* directory is one more archive: header + array of headers */
+    wprintf(L"Writing directory...\r\n");
+    sha1_init(&ctx);
+    sha1_update(&ctx, entries, b->count * sizeof(ZEROTAPE_HEADER));
+    sha1_final(&ctx, digest);
+    JobInitHeader(&zh, batchName, b->count * sizeof(ZEROTAPE_HEADER), digest, prof->blockSize);
+    zh.format = ZEROTAPE_FORMAT_DIRECTORY;
+    if (!WriteMetadataSection(tape, &zh) ||
+        !WriteDirectorySection(tape, entries, b->count, prof->blockSize))
+        return FALSE;
+
+    if (!TapeWriteFilemark(tape))
+        PrintLastErrorW(L"Failed to write filemark at end of directory", 0);
+
+    return TRUE;
+}
+
+BOOL JobMakeBatchBackup(LPCWSTR *tarPaths, DWORD count,
+    LPCWSTR devicePath, const char *batchName, DWORD flags)
+{
+    JOB_BATCH       *b;
+    ZEROTAPE_HEADER *entries;
+    TAPE_IO_PROFILE prof;
+    HANDLE          tape;
+    HANDLE          hasher = NULL;
+    ULONGLONG       need = 0;
+    ULONGLONG       capacity = 0;
+    WCHAR           needW[64], haveW[64];
+    DWORD           i, done = 0;
+    BOOL            ok = TRUE;
+
+    if (count == 0 || count > JOB_BATCH_MAX)
+    {
+        wprintf(L"Batch takes 1 to %d TAR files.\r\n", JOB_BATCH_MAX);
+        return FALSE;
+    }
+
+    b = (JOB_BATCH*)calloc(1, sizeof(JOB_BATCH));
+    entries = (ZEROTAPE_HEADER*)calloc(count, sizeof(ZEROTAPE_HEADER));
+    if (!b || !entries)
+    {
+        wprintf(L"Out of memory.\r\n");
+        free(b);
+        free(entries);
+        return FALSE;
+    }
+    b->paths = tarPaths;
+    b->count = count;
+
+    for (i = 0; ok && i < count; i++)
+    {
+        ok = IsLikelyTarFile(tarPaths[i]) && GetFileSize64W(tarPaths[i], &b->sizes[i]);
+        if (!ok) wprintf(L"%s does not look like a TAR. Aborting.\r\n", tarPaths[i]);
+        need += b->sizes[i] + 2048;
+    }
+    need += 2048 + count * sizeof(ZEROTAPE_HEADER);
+
+    tape = ok ? JobOpenTape(devicePath) : INVALID_HANDLE_VALUE;
+    if (tape == INVALID_HANDLE_VALUE)
+    {
+        free(b);
+        free(entries);
+        return FALSE;
+    }
+
+    TapeSetCompression(tape, FALSE);
+    if (ProfileLoadForTape(tape, &prof) && !TapeSetVariableBlockSize(tape))
+    {
+        PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+        TapeDefaultProfile(&prof);
+    }
+
+    TapeGetMediaInfo(tape, &capacity, NULL, NULL);
+    if ((capacity > 0) && (need > capacity))
+    {
+        HumanSize(need, needW, 64);
+        HumanSize(capacity, haveW, 64);
+        wprintf(L"Batch (with overhead %s) exceeds media capacity (%s).\r\n", needW, haveW);
+        ok = FALSE;
+    }
+
+    ok = ok && JobConfirmOverwrite(tape, flags) &&
+        (!(flags & JOB_FLAG_INTERACTIVE) || AskYesNo(L"Start writing batch to tape?", TRUE));
+
+    if (ok)
+    {
+        b->semHashed = CreateSemaphoreW(NULL, 0, JOB_BATCH_MAX, NULL);
+        b->semAhead = CreateSemaphoreW(NULL, 2, 2, NULL);
+        if (b->semHashed && b->semAhead)
+            hasher = CreateThread(NULL, 0, JobBatchHasherThread, b, 0, NULL);
+        if (!hasher)
+        {
+            PrintLastErrorW(L"Failed to start hasher thread", 0);
+            ok = FALSE;
+        }
+    }
+
+    if (ok) ok = PositionToArchive(tape, 0);
+    if (ok) ok = JobBatchWrite(tape, b, entries, &prof, batchName, &done);
+    if (ok)
+    {
+        for (i = 0, need = 0; i < count; i++) need += b->sizes[i];
+        JobStoreMam(tape, &entries[0], count + 1, 0, need, MAM_FLAG_BOT);
+        for (i = 0; i < count; i++) SessionPutHeader(tape, i, &entries[i]);
+    }
+
+    if (hasher)
+    {
+        InterlockedExchange(&b->abort, 1);
+        ReleaseSemaphore(b->semAhead, 1, NULL);
+        WaitForSingleObject(hasher, INFINITE);
+        CloseHandle(hasher);
+    }
+    if (b->semHashed) CloseHandle(b->semHashed);
+    if (b->semAhead) CloseHandle(b->semAhead);
+    TapeClose(tape);
+
+    /* tape is named by its first archive */
+    for (i = 0; ok && i < count; i++)
+        CatalogAddTarFile(entries[0].name, i, &entries[i], tarPaths[i]);
+    free(entries);
+    free(b);
+
+    wprintf(L"Make Batch Backup %s (%lu of %lu archives).\r\n",
+        ok ? L"completed" : L"failed", (unsigned long)done, (unsigned long)count);
+    return ok;
+}
+
+/* --------------------------------------
+List archives: from index of partitioned tape, from directory
+archive at end of tape, otherwise header by header from BOT
+-------------------------------------- */
+static void JobPrintArchiveLine(DWORD index, const ZEROTAPE_HEADER *zh)
+{
+    WCHAR   nameW[64];
+    WCHAR   szW[64];
+    WCHAR   timeW[64];
+
+    MultiByteToWideChar(CP_ACP, 0, zh->name, -1, nameW, 64);
+    nameW[63] = 0;
+    HumanSize(GetLE64(zh->sizeofarchive), szW, 64);
+    FormatSystemTimeStr(zh->creationdate, timeW, 64);
+    wprintf(L"%4lu  %-31s  %12s  %s%s\r\n", (unsigned long)index + 1, nameW, szW, timeW,
+        (zh->format == ZEROTAPE_FORMAT_DIRECTORY) ? L"  (directory)" : L"");
+}
+
+BOOL JobListArchives(LPCWSTR devicePath)
+{
+    HANDLE          tape;
+    ZEROTAPE_HEADER zh;
+    ZEROTAPE_HEADER *entries;
+    TAPE_INDEX      idx;
+    DWORD           i, count = 0;
+    BOOL            atDir = FALSE;
+    BOOL            found = FALSE;
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    /* partitioned tape: whole list is in the index at BOT */
+    if (ReadMetadataFromTape(tape, &zh) && memcmp(zh.magic, "ZEROTAPE", 8) == 0 &&
+        zh.format == ZEROTAPE_FORMAT_INDEX)
+    {
+        if (JobLoadIndex(tape, &zh, &idx))
+        {
+            wprintf(L"Index - %S, %lu archives\r\n", zh.name, (unsigned long)idx.count);
+            wprintf(L"========\r\n");
+            for (i = 0; i < idx.count; i++) JobPrintArchiveLine(i, &IndexArchive(&idx, i)->zh);
+            found = TRUE;
+        }
+        IndexFree(&idx);
+        TapeClose(tape);
+        return found;
+    }
+
+    entries = (ZEROTAPE_HEADER*)malloc(ZEROTAPE_DIRECTORY_MAX * sizeof(ZEROTAPE_HEADER));
+    if (!entries)
+    {
+        wprintf(L"Out of memory.\r\n");
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    /* last archive starts after the third filemark back from end of data */
+    wprintf(L"Please wait until tape positioned...\r\n");
+    if (TapeSpaceEndOfData(tape))
+    {
+        if (TapeSpaceFilemarks(tape, -3))
+            atDir = TapeSpaceFilemarks(tape, 1);
+        else
+            atDir = TapeRewind(tape);   /* one archive on tape */
+    }
+
+    if (atDir && ReadMetadataSection(tape, &zh) &&
+        memcmp(zh.magic, "ZEROTAPE", 8) == 0 && zh.format == ZEROTAPE_FORMAT_DIRECTORY &&
+        TapeSpaceFilemarks(tape, 1) &&
+        ReadDirectorySection(tape, &zh, entries, ZEROTAPE_DIRECTORY_MAX, &count))
+    {
+        wprintf(L"Directory - %S, %lu archives\r\n", zh.name, (unsigned long)count);
+        wprintf(L"========\r\n");
+        for (i = 0; i < count; i++) JobPrintArchiveLine(i, &entries[i]);
+        found = TRUE;
+    }
+
+    if (!found)
+    {
+        wprintf(L"No directory at end of tape, reading archive headers...\r\n");
+        wprintf(L"========\r\n");
+        if (TapeRewind(tape))
+        {
+            for (i = 0; ReadMetadataSection(tape, &zh); i++)
+            {
+                if (memcmp(zh.magic, "ZEROTAPE", 8) != 0) break;
+                JobPrintArchiveLine(i, &zh);
+                found = TRUE;
+                if (!TapeSpaceFilemarks(tape, 2)) break;
+            }
+        }
+    }
+
+    free(entries);
+    TapeClose(tape);
+    if (!found) wprintf(L"No ZEROTAPE archives found.\r\n");
+    return found;
+}
+
+/* --------------------------------------
+Partition tape: index partition + data partition, or back to one
+-------------------------------------- */
+BOOL JobPartitionTape(LPCWSTR devicePath, DWORD indexMiB,
+    const char *tapeName, DWORD flags)
+{
+    HANDLE          tape;
+    ZEROTAPE_HEADER zh;
+    TAPE_INDEX      idx;
+    TAPE_IO_PROFILE prof;
+    unsigned char   digest[20];
+    BOOL            ok;
+
+    tape = JobOpenTape(devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    /* new partitions lose everything on tape */
+    if (!JobConfirmOverwrite(tape, flags))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if ((flags & JOB_FLAG_INTERACTIVE) &&
+        !AskYesNo(indexMiB ? L"Create index and data partitions?" : L"Make tape one partition?", TRUE))
+    {
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    MamClear(tape);
+    wprintf(L"Please wait until tape partitioned...\r\n");
+    if (!TapeCreatePartitions(tape, indexMiB))
+    {
+        if (GetLastError() == ERROR_NOT_SUPPORTED)
+            wprintf(L"Drive or media does not support initiator-defined partitions.\r\n");
+        else
+            PrintLastErrorW(L"Failed to partition tape", 0);
+        TapeClose(tape);
+        return FALSE;
+    }
+
+    if (!indexMiB)
+    {
+        TapeClose(tape);
+        wprintf(L"Partition Tape completed, tape has one partition.\r\n");
+        return TRUE;
+    }
+
+    /* empty index: tape is ready for Append Backup */
+    TapeSetCompression(tape, FALSE);
+    if (ProfileLoadForTape(tape, &prof) && !TapeSetVariableBlockSize(tape))
+        TapeDefaultProfile(&prof);
+
+    memset(digest, 0, sizeof(digest));
+    JobInitHeader(&zh, tapeName, 0, digest, prof.blockSize);
+    IndexInit(&idx);
+    ok = IndexWrite(tape, &idx, &zh);
+    if (ok) JobStoreIndexMam(tape, &idx, &zh);
+    TapeClose(tape);
+    wprintf(L"Partition Tape %s.\r\n", ok ? L"completed" : L"failed");
+    return ok;
+}
@@ -0,0 +1,100 @@
+#ifndef __TAPE_BACKUP_JOBS
+#define __TAPE_BACKUP_JOBS
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+#include "calib.h"
+#include "stripe.h"
+#include "span.h"
+#include "mirror.h"
+#include "image.h"
+#include "partition.h"
+#include "mam.h"
+#include "session.h"
+#include "tapecmd.h"
+#include "checkpoint.h"
+#include "catalog.h"
+#include "toc.h"
+
+/* --------------------------------------
+Job cores: whole actions without menu prompts.
+Menu actions collect input and call these; benchmarks and other
+non-interactive callers pass all parameters up front.
+-------------------------------------- */
+#define JOB_FLAG_INTERACTIVE    0x0001  /* operator may be asked questions */
+#define JOB_FLAG_OVERWRITE      0x0002  /* overwrite tape data / destination file */
+#define JOB_BATCH_MAX           256     /* TAR files in one batch */
+
+HANDLE JobOpenTape(LPCWSTR devicePath);
+BOOL JobReadHeader(HANDLE tape, ZEROTAPE_HEADER *zh);
+BOOL JobReadArchiveHeader(HANDLE tape, DWORD index, ZEROTAPE_HEADER *zh);
+void PrintTapeInfo(const ZEROTAPE_HEADER *zh, FILE *flog);
+void PrintMamSummary(const MAM_RECORD *rec);
+void JobStoreMam(HANDLE tape, const ZEROTAPE_HEADER *zh,
+    DWORD archives, DWORD files, ULONGLONG used, DWORD flags);
+void JobDevicePathFromInput(LPCWSTR in, LPWSTR out, size_t cch);
+BOOL JobConfirmOverwrite(HANDLE tape, DWORD flags);
+BOOL JobHashFile(LPCWSTR path, ULONGLONG fsz, unsigned char digest[20]);
+void JobInitHeader(ZEROTAPE_HEADER *zh, const char *tapeName,
+    ULONGLONG fsz, const unsigned char digest[20], DWORD blockSize);
+void JobNewSetId(unsigned char id[8]);
+BOOL JobRestorePath(const ZEROTAPE_HEADER *zh, LPCWSTR destDir, DWORD flags,
+    LPWSTR outpath, size_t cch);
+
+BOOL JobMakeBackup(LPCWSTR devicePath, LPCWSTR tarPath,
+    const char *tapeName, DWORD flags);
+BOOL JobVerifyBackup(LPCWSTR devicePath, LPCWSTR logPath);
+BOOL JobRestoreBackup(LPCWSTR devicePath, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut);
+BOOL JobReadTOC(LPCWSTR devicePath, LPCWSTR tocPath);
+
+/* archive 'index' (from 0) of a tape with appended archives */
+BOOL JobAppendBackup(LPCWSTR devicePath, LPCWSTR tarPath,
+    const char *tapeName, DWORD flags);
+BOOL JobVerifyArchive(LPCWSTR devicePath, DWORD index, LPCWSTR logPath);
+BOOL JobRestoreArchive(LPCWSTR devicePath, DWORD index, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut);
+BOOL JobReadArchiveTOC(LPCWSTR devicePath, DWORD index, LPCWSTR tocPath);
+
+/* continues Make Backup, Restore or Verify from the checkpoint journal */
+BOOL JobResume(LPCWSTR devicePath, DWORD flags);
+
+/* indexMiB 0 - back to one partition; otherwise index + data partitions */
+BOOL JobPartitionTape(LPCWSTR devicePath, DWORD indexMiB,
+    const char *tapeName, DWORD flags);
+
+/* striped set: devicePaths hold data tapes first, parity tape last */
+BOOL JobMakeStripedBackup(LPCWSTR *devicePaths, DWORD count, BOOL parity,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags);
+BOOL JobVerifyStripedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR logPath);
+BOOL JobRestoreStripedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut);
+
+/* spanned archive: devicePaths are used for volumes 1, 2, ... in order */
+BOOL JobMakeSpannedBackup(LPCWSTR *devicePaths, DWORD count,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags);
+BOOL JobVerifySpannedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR logPath,
+    DWORD flags);
+BOOL JobRestoreSpannedBackup(LPCWSTR *devicePaths, DWORD count, LPCWSTR destDir,
+    DWORD flags, LPWSTR outPath, size_t cchOut);
+
+/* same archive to every tape at once, each is a complete single-tape backup */
+BOOL JobMakeMirroredBackup(LPCWSTR *devicePaths, DWORD count,
+    LPCWSTR tarPath, const char *tapeName, DWORD flags);
+
+/* tape to tape through memory, SHA-1 is checked on the way */
+BOOL JobCloneTape(LPCWSTR srcPath, LPCWSTR dstPath, DWORD flags);
+
+/* tape images (see image.h); verify never opens a drive */
+BOOL JobExportImage(LPCWSTR devicePath, LPCWSTR imagePath, DWORD flags);
+BOOL JobImportImage(LPCWSTR imagePath, LPCWSTR devicePath, DWORD flags);
+BOOL JobVerifyImages(LPCWSTR *imagePaths, DWORD count, LPCWSTR logPath);
+
+/* several TAR files back to back on one tape, then a directory archive */
+BOOL JobMakeBatchBackup(LPCWSTR *tarPaths, DWORD count,
+    LPCWSTR devicePath, const char *batchName, DWORD flags);
+BOOL JobListArchives(LPCWSTR devicePath);
+
+#endif
@@ -2,6 +2,12 @@
 #include "utils.h"
 #include "tape.h"
 #include "archive.h"
+#include "trace.h"
+#include "metrics.h"
+#include "jobs.h"
+#include "inventory.h"
+#include "daemon.h"
+#include "changer.h"
 
 TAPE_SELECTION g_state;
 
@@ -26,89 +32,72 @@ void ShowCurrentSelection(void)
     wprintf(L"Model - %s\r\n", g_state.model);
     wprintf(L"Serial - %s\r\n", g_state.serial);
     wprintf(L"Media - %s\r\n", g_state.mediaLoaded ? L"Loaded" : L"Not loaded");
+    if (g_state.cartridge[0]) wprintf(L"Cartridge - %s\r\n", g_state.cartridge);
     wprintf(L"Capacity - %s\r\n", g_state.mediaCapacityBytes ? cap : L"Unknown");
     wprintf(L"Block Size - %lu\r\n", (unsigned long)g_state.mediaBlockSize);
     wprintf(L"========\r\n");
 }
 
-BOOL ProbeTapeDevice(int id, TAPE_SELECTION *out) 
-{ 
-    WCHAR           path[32];
-    HANDLE          tape;
-    TAPE_SELECTION  ts;
-    ULONGLONG       cap = 0;
-    DWORD           bs = 0;
-    BOOL            wp = FALSE;
-    
-    _snwprintf(path, 32, L"\\\\.\\TAPE%d", id);  
-    tape = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, 
-        OPEN_EXISTING, 0, NULL); 
-    if (tape == INVALID_HANDLE_VALUE) 
-        return FALSE;  
-    
-    ZeroMemory(&ts, sizeof(ts)); 
-    wcsncpy(ts.devicePath, path, 31); 
-    ts.devicePath[31] = 0;
-    
-    QueryStorageStrings(tape, ts.vendor, 64, ts.model, 64, ts.serial, 128); 
-    ts.mediaLoaded = TapeIsMediaLoaded(tape);    
-    
-    TapeGetMediaInfo(tape, &cap, &bs, &wp); 
-    ts.mediaCapacityBytes = cap; 
-    ts.mediaBlockSize = bs; 
-    ts.hasSelection = TRUE; 
-    
-    if (out) *out = ts; 
-    CloseHandle(tape); 
-    return TRUE;
-}
-
+/* cached list within INVENTORY_TTL_MS, otherwise all drives probed at once */
 BOOL SelectTapeInteractive(void)
 {
-    int             found = 0;
-    int             ids[64];
-    TAPE_SELECTION  tmp;
+    int             found;
+    int             ids[INVENTORY_MAX_DRIVES];
+    INVENTORY_ENTRY e;
     int             i;
-    WCHAR           cap[64];
     WCHAR           buf[32];
     int             chosen;
     TAPE_SELECTION  tsel;
+    DWORD           age;
+    BOOL            scan = !InventoryIsFresh(&age);
 
-    wprintf(L"Scanning for tape drives...\r\n");
-    wprintf(L"========\r\n");
-    for (i = 0; i < 64; i++)
+    for (;;)
     {
-        if (ProbeTapeDevice(i, &tmp)) 
+        if (scan)
         {
-            HumanSize(tmp.mediaCapacityBytes, cap, 64);
-            wprintf(L"ID = %d\r\n", i);
-            wprintf(L"Device Path - %s\r\n", tmp.devicePath);
-            wprintf(L"Vendor - %s\r\n", tmp.vendor);
-            wprintf(L"Model - %s\r\n", tmp.model);
-            wprintf(L"Serial - %s\r\n", tmp.serial);
-            wprintf(L"Media - %s\r\n", tmp.mediaLoaded ? L"Loaded" : L"Not loaded");
-            wprintf(L"Capacity - %s\r\n", tmp.mediaCapacityBytes ? cap : L"Unknown");
-            wprintf(L"Block Size - %lu\r\n", (unsigned long)tmp.mediaBlockSize);
-            wprintf(L"========\r\n");
-            ids[found++] = i;
+            /* probing opens every drive, the selected one included */
+            SessionClose(g_state.devicePath);
+            wprintf(L"Scanning for tape drives...\r\n");
+            InventoryScan(INVENTORY_PROBE_MS);
         }
-    }
+        else
+            wprintf(L"Tape drives found %lu s ago:\r\n", (unsigned long)(age / 1000));
 
-    if (found == 0) 
-    {
-        wprintf(L"No tape drives available.\r\n");
-        return FALSE;
+        wprintf(L"========\r\n");
+        for (i = 0, found = 0; i < INVENTORY_MAX_DRIVES; i++)
+        {
+            if (InventoryGet(i, &e))
+            {
+                InventoryPrintEntry(i, &e);
+                ids[found++] = i;
+            }
+        }
+
+        if (found == 0 && !scan)
+        {
+            scan = TRUE;
+            continue;
+        }
+
+        if (found == 0)
+        {
+            wprintf(L"No tape drives available.\r\n");
+            return FALSE;
+        }
+
+        wprintf(L"Enter drive ID to select (media must be loaded, R = scan again): ");
+        if (!ReadLineW(buf, 32)) return FALSE;
+        if (buf[0] != L'R' && buf[0] != L'r') break;
+        scan = TRUE;
     }
 
-    wprintf(L"Enter drive ID to select (media must be loaded): ");
-    if (!ReadLineW(buf, 32)) return FALSE;
     chosen = _wtoi(buf);
     for (i = 0; i < found; i++) 
     {
         if (ids[i] == chosen) 
         {
-            if (!ProbeTapeDevice(chosen, &tsel)) 
+            SessionClose(g_state.devicePath);
+            if (!InventoryProbe(chosen, INVENTORY_PROBE_MS, &tsel)) 
             {
                 wprintf(L"Failed to open selected drive.\r\n");
                 return FALSE;
@@ -121,6 +110,8 @@ BOOL SelectTapeInteractive(void)
             }
 
             g_state = tsel;
+            if (!SessionOpen(g_state.devicePath))
+                PrintLastErrorW(L"Cannot keep tape drive open, every action will open it", 0);
             wprintf(L"Selected %ws\r\n", g_state.devicePath); return TRUE;
         }
     }
@@ -132,86 +123,6 @@ BOOL SelectTapeInteractive(void)
 /* --------------------------------------
    High-level actions
    -------------------------------------- */
-BOOL IsTarHeaderLikely(const TAR_HDR *h) 
-{
-    /* header must be non-zero */
-    const unsigned char *p = (const unsigned char*)h;
-    size_t              i; 
-    int                 allZero = 1;
-    unsigned            stored;
-    unsigned            calc;
-
-    for (i = 0; i < 512; i++) 
-        if (p[i] != 0) 
-        { 
-            allZero = 0;
-            break; 
-        }
-    
-    if (allZero) return FALSE;
-
-    /* parse stored checksum (octal, may be NUL/space padded) */
-    stored = (unsigned)OctalToULL(h->chksum, sizeof(h->chksum));
-    calc = TarChecksum(h);
-    if ((stored == calc) && (stored != 0)) 
-        return TRUE;
-
-    /* Some tools write with signed char sum quirks; allow small tolerance */
-    if ((calc == stored + (' ' * 8)) || 
-        (calc + (' ' * 8) == stored)) 
-        return TRUE;
-
-    /* As a fallback, accept common magic values if present */
-    if (memcmp(h->magic, "ustar", 5) == 0) 
-        return TRUE;
-
-    return FALSE;
-}
-
-BOOL IsLikelyTarFile(LPCWSTR path)
-{
-    HANDLE      h; 
-    BYTE        b[1024]; 
-    DWORD       rd = 0; 
-    BOOL        result;
-    int         zero1, zero2;
-    size_t      i;
-
-    h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
-        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (h == INVALID_HANDLE_VALUE) return FALSE;
-    result = ReadFile(h, b, sizeof(b), &rd, NULL);
-    CloseHandle(h);
-    
-    if (!result || rd < 512) return FALSE;
-
-    /* empty tar: two zero 512 byte blocks */
-    if (rd >= 1024) 
-    {
-        zero1 = 1;
-        zero2 = 1;
-
-        for (i = 0; i < 512; i++) 
-            if (b[i]) { 
-                zero1 = 0; 
-                break; 
-            } 
-        
-        for (i = 512; i < 1024; i++) 
-            if (b[i]) { 
-                zero2 = 0; 
-                break; 
-            }
-        
-        if (zero1 && zero2) return TRUE;
-    }
-
-    /* usual case: validate first header by checksum */
-    result = IsTarHeaderLikely((const TAR_HDR*)b);
-    
-    return result;
-}
-
 BOOL ActionRewind(void) 
 { 
     HANDLE  tape;
@@ -223,9 +134,7 @@ BOOL ActionRewind(void)
         return FALSE; 
     }  
     
-    tape = CreateFileW(g_state.devicePath, GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, 
-        NULL, OPEN_EXISTING, 0, NULL); 
+    tape = TapeOpen(g_state.devicePath); 
     
     if (tape == INVALID_HANDLE_VALUE) 
     { 
@@ -233,27 +142,34 @@ BOOL ActionRewind(void)
         return FALSE; 
     } 
     
-    wprintf(L"Please wait until tape rewound...\r\n");
-    ok = TapeRewind(tape); 
+    ok = TapeCmdRun(tape, TAPE_CMD_REWIND, L"Rewinding"); 
     if (!ok) 
         PrintLastErrorW(L"Failed to rewind", 0); 
     else 
         wprintf(L"Rewound to BOT.\r\n"); 
     
-    CloseHandle(tape); 
+    TapeClose(tape); 
     return ok;
 }
 
+/* archive on tape with appended archives, 1-based for operator, 0-based result */
+static BOOL ReadArchiveNumber(DWORD *index)
+{
+    WCHAR   buf[32];
+
+    wprintf(L"Enter archive number on tape (Enter = 1): ");
+    if (!ReadLineW(buf, 32)) return FALSE;
+
+    *index = (_wtoi(buf) > 1) ? (DWORD)(_wtoi(buf) - 1) : 0;
+    return TRUE;
+}
+
 BOOL ActionPrintMetadata(void)
 {
     HANDLE              tape;
     ZEROTAPE_HEADER     zh;
-    WCHAR               nameW[64];
-    ULONGLONG           sz;
-    WCHAR               szW[64];
-    WCHAR               sha1W[64];
-    WCHAR               fmtW[16];
-    WCHAR               timeW[64];
+    DWORD               index;
+    MAM_RECORD          rec;
 
     if (!g_state.hasSelection) 
     {
@@ -261,76 +177,37 @@ BOOL ActionPrintMetadata(void)
         return FALSE;
     }
 
-    tape = CreateFileW(g_state.devicePath,
-        GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
-        OPEN_EXISTING, 0, NULL);
-
-    if (tape == INVALID_HANDLE_VALUE) 
-    {
-        PrintLastErrorW(L"Cannot open tape drive", 0);
-        return FALSE;
-    }
+    if (!ReadArchiveNumber(&index)) return FALSE;
 
-    if (!TapeIsMediaLoaded(tape)) 
-    {
-        wprintf(L"No media loaded in the selected drive.\r\n");
-        CloseHandle(tape);
-        return FALSE;
-    }
+    tape = JobOpenTape(g_state.devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
 
-    if (!ReadMetadataFromTape(tape, &zh)) 
+    /* first archive: cartridge memory first, tape only without it */
+    if (index == 0 && MamRead(tape, &rec))
     {
-        wprintf(L"Failed to read ZEROTAPE metadata.\r\n");
-        CloseHandle(tape);
-        return FALSE;
+        PrintTapeInfo(&rec.zh, NULL);
+        PrintMamSummary(&rec);
+        TapeClose(tape);
+        return TRUE;
     }
 
-    if (memcmp(zh.magic, "ZEROTAPE", 8) != 0 || zh.version != 0) 
+    if (!JobReadArchiveHeader(tape, index, &zh)) 
     {
-        wprintf(L"Invalid ZEROTAPE header.\r\n");
-        CloseHandle(tape);
+        TapeClose(tape);
         return FALSE;
     }
 
-    MultiByteToWideChar(CP_ACP, 0, zh.name, -1, nameW, 64);
-    sz = GetLE64(zh.sizeofarchive);
-    HumanSize(sz, szW, 64);
-    BytesToHex(zh.sha1, 20, sha1W, 64);
-    _snwprintf(fmtW, 16, L"%s", (zh.format == 1) ? L"tar" : L"raw");
-    FormatSystemTimeStr(zh.creationdate, timeW, 64);
-
-    wprintf(L"Tape Name - %s\r\n", nameW);
-    wprintf(L"Size - %s (%I64u bytes)\r\n", szW, sz);
-    wprintf(L"SHA1 - %s\r\n", sha1W);
-    wprintf(L"Format - %s\r\n", fmtW);
-    wprintf(L"Created - %s\r\n", timeW);
-    CloseHandle(tape);
+    PrintTapeInfo(&zh, NULL);
+    TapeClose(tape);
     return TRUE;
 }
 
 BOOL ActionMakeBackup(void)
 {
     WCHAR           path[MAX_PATH];
-    ULONGLONG       fsz = 0;
-    HANDLE          tape;
     WCHAR           wname[64];
     char            tname[32] = { 0 };
     int             n;
-    ULONGLONG       overhead = 2048;
-    BYTE            tiny[256];
-    DWORD           got = 0;
-    BOOL            rok;
-    WCHAR           need[64], have[64];
-    unsigned char   digest[20];
-    BYTE            b[64 * 1024];
-    DWORD           rd;
-    SHA1_CTX        c;
-    HANDLE          hf, hf2;
-    ULONGLONG       done = 0;
-    ZEROTAPE_HEADER zh;
-    SYSTEMTIME      st;
-
 
     if (!g_state.hasSelection) 
     {
@@ -341,612 +218,655 @@ BOOL ActionMakeBackup(void)
     wprintf(L"Enter path to TAR file to write to tape: ");
     if (!ReadLineW(path, MAX_PATH)) return FALSE;
 
-    if (!IsLikelyTarFile(path)) 
+    wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64)) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    return JobMakeBackup(g_state.devicePath, path, tname, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionVerifyBackup(void)
+{
+    WCHAR               dir[MAX_PATH];
+    WCHAR               logPath[MAX_PATH * 2];
+    DWORD               index;
+
+    if (!g_state.hasSelection) 
     {
-        if (GetLastError() != NO_ERROR)
-            PrintLastErrorW(L"Failed to recognize tar file!", GetLastError());
-        else
-            wprintf(L"The selected file does not look like a TAR. Aborting.\r\n");
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
 
-    if (!GetFileSize64W(path, &fsz)) 
+    if (!ReadArchiveNumber(&index)) return FALSE;
+
+    if (!GetExeDirectoryW(dir, MAX_PATH))
+        return JobVerifyArchive(g_state.devicePath, index, NULL);
+
+    JoinPath2W(logPath, MAX_PATH * 2, dir, L"verify_log.txt");
+    return JobVerifyArchive(g_state.devicePath, index, logPath);
+}
+
+BOOL ActionRestoreBackup(void) 
+{
+    WCHAR               dir[MAX_PATH];
+    DWORD               index;
+
+    if (!g_state.hasSelection) 
     {
-        PrintLastErrorW(L"Cannot access TAR file", 0);
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
-    }
+    } 
 
-    tape = CreateFileW(g_state.devicePath, 
-        GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, 
-        OPEN_EXISTING, 0, NULL); 
+    if (!ReadArchiveNumber(&index)) return FALSE;
 
-    if (tape == INVALID_HANDLE_VALUE) 
-    { 
-        PrintLastErrorW(L"Cannot open tape drive", 0); 
-        return FALSE; 
-    } 
-    
-    if (!TapeIsMediaLoaded(tape)) 
+    wprintf(L"Enter destination directory to save the archive: "); 
+    if (!ReadLineW(dir, MAX_PATH)) return FALSE;
+
+    return JobRestoreArchive(g_state.devicePath, index, dir, JOB_FLAG_INTERACTIVE, NULL, 0);
+}
+
+BOOL ActionReadBackupTOC(void) 
+{
+    static const LPCWSTR names[] = { L"toc.txt", L"toc.jsonl", L"toc.csv", L"toc.ztoc" };
+    WCHAR               dir[MAX_PATH];
+    WCHAR               outPath[MAX_PATH * 2];
+    WCHAR               buf[16];
+    DWORD               index;
+    DWORD               format;
+
+    if (!g_state.hasSelection) 
     { 
-        wprintf(L"No media loaded in the selected drive.\r\n"); 
-        CloseHandle(tape); 
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n"); 
         return FALSE; 
-    }
-    
-    TapeSetCompression(tape, FALSE);
-    
-    wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
-    if (!ReadLineW(wname, 64)) 
-    {
-        CloseHandle(tape);
-        return FALSE;
-    }
-
-    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
-    tname[(n > 0 && n < 32) ? n : 31] = 0;
+    }  
 
-    
-    if ((g_state.mediaCapacityBytes > 0) && (fsz + overhead > g_state.mediaCapacityBytes)) 
-    {
-        HumanSize(fsz + overhead, need, 64);
-        HumanSize(g_state.mediaCapacityBytes, have, 64);
-        wprintf(L"Selected TAR (with overhead %s) exceeds media capacity (%s).\r\n", need, have);
-        CloseHandle(tape);
-        return FALSE;
-    }
+    if (!ReadArchiveNumber(&index)) return FALSE;
 
-    wprintf(L"Please wait until tape rewound...\r\n");
-    if (!TapeRewind(tape)) 
+    wprintf(L"1. Text\r\n");
+    wprintf(L"2. JSON Lines\r\n");
+    wprintf(L"3. CSV\r\n");
+    wprintf(L"4. Columns (.ztoc)\r\n");
+    wprintf(L"Enter TOC format (Enter = 1): ");
+    if (!ReadLineW(buf, 16)) return FALSE;
+    format = buf[0] ? (DWORD)_wtoi(buf) : 1;
+    if (format < 1 || format > 4)
     {
-        PrintLastErrorW(L"Failed to rewind tape", 0);
-        CloseHandle(tape); 
+        wprintf(L"Unknown choice.\r\n");
         return FALSE;
     }
 
-    rok = ReadFile(tape, tiny, sizeof(tiny), &got, NULL);
-    if (rok && got > 0) 
-    {
-        if (!AskYesNo(L"Tape seems to contain data. Proceed and overwrite?", FALSE)) 
-        {
-            CloseHandle(tape);
-            return FALSE;
-        }
-    }
+    if (!GetExeDirectoryW(dir, MAX_PATH))
+        return JobReadArchiveTOC(g_state.devicePath, index, NULL);
 
-    if (!AskYesNo(L"Start writing (metadata + archive) to tape?", TRUE))
-    {
-        CloseHandle(tape);
-        return FALSE;
-    }
-    
-     hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hf == INVALID_HANDLE_VALUE) 
-    {
-        PrintLastErrorW(L"Failed to open source file", 0);
-        CloseHandle(tape);
-        return FALSE;
-    }
+    JoinPath2W(outPath, MAX_PATH * 2, dir, names[format - 1]); 
+    return JobReadArchiveTOC(g_state.devicePath, index, outPath);
+}
 
-    wprintf(L"Please wait until sha1 calculated...\r\n");
-    sha1_init(&c);
-    while (ReadFile(hf, b, sizeof(b), &rd, NULL) && rd > 0) 
-    {
-        unsigned pct;
+BOOL ActionCleanTape(void) 
+{ 
+    HANDLE      tape;
 
-        sha1_update(&c, b, rd); done += rd;
-        pct = (unsigned)((done * 100ULL) / fsz);
-        DrawProgressBar(pct, done, fsz);
-    }
-    sha1_final(&c, digest);
-    wprintf(L"\r\n");
-    CloseHandle(hf);
-
-    memset(&zh, 0, sizeof(zh)); 
-    memcpy(zh.magic, "ZEROTAPE", 8); 
-    zh.version = 0; 
-    a_strncpyz(zh.name, sizeof(zh.name), tname); 
-    PutLE64(zh.sizeofarchive, fsz);
-    memcpy(zh.sha1, digest, 20); zh.format = 1; 
-    GetLocalTime(&st); 
-    memcpy(zh.creationdate, &st, sizeof(SYSTEMTIME));
-    
-    wprintf(L"Please wait until tape rewound...\r\n");
-    if (!TapeRewind(tape)) 
+    if (!g_state.hasSelection) 
     { 
-        PrintLastErrorW(L"Failed to rewind", 0); 
-        CloseHandle(tape); 
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n"); 
         return FALSE; 
     } 
     
-    wprintf(L"Writing metadata...\r\n");
-    if (!WriteMetadataSection(tape, &zh)) 
+    tape = TapeOpen(g_state.devicePath);
+
+    if (tape == INVALID_HANDLE_VALUE) 
     { 
-        CloseHandle(tape); 
+        PrintLastErrorW(L"Cannot open tape drive", 0); 
         return FALSE; 
-    }
+    } 
     
-    hf2 = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, 
-        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); 
-    if (hf2 == INVALID_HANDLE_VALUE) 
+    if (!TapeIsMediaLoaded(tape)) 
     { 
-        PrintLastErrorW(L"Failed to open source file", 0); 
-        CloseHandle(tape); 
+        wprintf(L"No media loaded in the selected drive.\r\n"); 
+        TapeClose(tape); 
         return FALSE; 
     } 
     
-    wprintf(L"Writing backup...\r\n");
-    if (!WriteArchiveToSecondSection(tape, hf2, fsz)) 
-    {
-        wprintf(L"Failed to write backup!\r\n");
-        CloseHandle(hf2); 
-        CloseHandle(tape); 
+    if (!AskYesNo(L"WARNING: All data on the tape will be destroyed. Proceed?", FALSE)) 
+    { 
+        TapeClose(tape); 
         return FALSE; 
     } 
-    wprintf(L"\r\n");
-    CloseHandle(hf2);
+
+    //Note that you must rewind tape to beginning before erasing!
+    if (!TapeCmdRun(tape, TAPE_CMD_REWIND, L"Rewinding"))
+    {
+        PrintLastErrorW(L"Failed to rewind tape", 0);
+        TapeClose(tape);
+        return FALSE;
+    }
     
-    if (!TapeWriteFilemark(tape)) 
-        PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+    wprintf(L"Tape erasing. This may take a while...\r\n"); 
+    if (!TapeCmdRun(tape, TAPE_CMD_ERASE_LONG, L"Erasing")) 
+    { 
+        PrintLastErrorW(L"Erase command failed", 0); 
+        TapeClose(tape); 
+        return FALSE; 
+    }
+    MamClear(tape);
+
+    //Prepaing tape to work; This is required by some sequential devices
+    if (AskYesNo(L"Do you want to prepare this tape to work?\r\n\
+Note that this can be required for some tape drives", TRUE))
+    {
+        if (!TapeCmdRun(tape, TAPE_CMD_PREPARE, L"Loading and tensioning"))
+        {
+            PrintLastErrorW(L"Failed to prepare tape to work!", 0);
+            TapeClose(tape);
+            return FALSE;
+        }
+
+        if (!TapeSetVariableBlockSize(tape))
+        {
+            PrintLastErrorW(L"Failed to set variable block size for current tape.\r\n\
+It means, that this tape drive not supported for now!", 0);
+            TapeClose(tape);
+            return FALSE;
+        }
+    }
     
-    CloseHandle(tape); 
-    wprintf(L"Make Backup completed.\r\n"); 
+    TapeClose(tape); 
     return TRUE;
 }
 
-BOOL ActionVerifyBackup(void)
+BOOL ActionPrepareTape(void)
 {
-    HANDLE              ht;
-    WCHAR               dir[MAX_PATH];
-    WCHAR               logPath[MAX_PATH * 2];
-    FILE                *flog = NULL;
-    ZEROTAPE_HEADER     zh;
-    ULONGLONG           size2;
-    unsigned char       digest[20];
-    BOOL                okHash;
-    BOOL                match;
-    BOOL                okTar;
-    BOOL                overall;
-
-    // for getting metadata
-    WCHAR               nameW[64];
-    ULONGLONG           sz;
-    WCHAR               szW[64];
-    WCHAR               sha1W[64];
-    WCHAR               fmtW[16];
-    WCHAR               timeW[64];
-    WCHAR               tmpbuf[128];
+    HANDLE      tape;
 
-    if (!g_state.hasSelection) 
+    if (!g_state.hasSelection)
     {
         wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
 
-    ht = CreateFileW(g_state.devicePath, GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-    if (ht == INVALID_HANDLE_VALUE) 
+    tape = TapeOpen(g_state.devicePath);
+
+    if (tape == INVALID_HANDLE_VALUE)
     {
         PrintLastErrorW(L"Cannot open tape drive", 0);
         return FALSE;
     }
 
-    if (!TapeIsMediaLoaded(ht)) 
+    if (!TapeIsMediaLoaded(tape))
     {
         wprintf(L"No media loaded in the selected drive.\r\n");
-        CloseHandle(ht);
+        TapeClose(tape);
         return FALSE;
     }
 
-    if (!ReadMetadataFromTape(ht, &zh))
+    wprintf(L"Tape is preparing to work now...\r\n");
+
+    if (!TapeCmdRun(tape, TAPE_CMD_PREPARE, L"Loading and tensioning"))
     {
-        wprintf(L"Failed to read ZEROTAPE metadata.\r\n");
-        if (flog) fclose(flog);
-        CloseHandle(ht);
+        PrintLastErrorW(L"Failed to prepare tape to work!", 0);
+        TapeClose(tape);
         return FALSE;
     }
 
-    if (GetExeDirectoryW(dir, MAX_PATH)) 
+    if (!TapeSetVariableBlockSize(tape))
     {
-        JoinPath2W(logPath, MAX_PATH * 2, dir, L"verify_log.txt");
-        flog = OpenUtf8FileForWrite(logPath);
+        PrintLastErrorW(L"Failed to set variable block size for current tape.\r\n\
+It means, that this tape drive not supported for now!", 0);
+        TapeClose(tape);
+        return FALSE;
     }
 
-    //FPrintLineUtf8 already did it (\r\n)!
-    if (flog) FPrintLineUtf8(flog, L"# TapeBackup Verify Log (UTF-8)");
-    
-    if (flog) FPrintLineUtf8(flog, L"========");
-    
-    //NEW: adding to log/printing on screen info about tape;
-    MultiByteToWideChar(CP_ACP, 0, zh.name, -1, nameW, 64);
-    sz = GetLE64(zh.sizeofarchive);
-    HumanSize(sz, szW, 64);
-    BytesToHex(zh.sha1, 20, sha1W, 64);
-    _snwprintf(fmtW, 16, L"%s", (zh.format == 1) ? L"tar" : L"raw");
-    FormatSystemTimeStr(zh.creationdate, timeW, 64);
-
-    wprintf(L"Tape Name - %ws\r\n", nameW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Tape Name - %ws", nameW);
-    if (flog) FPrintLineUtf8(flog, tmpbuf);
-
-    wprintf(L"Size - %ws (%I64u bytes)\r\n", szW, sz);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Size - %ws(%I64u bytes)", szW, sz);
-    if (flog) FPrintLineUtf8(flog, tmpbuf);
-
-    wprintf(L"SHA1 - %ws\r\n", sha1W);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"SHA1 - %ws", sha1W);
-    if (flog) FPrintLineUtf8(flog, tmpbuf);
-
-    wprintf(L"Format - %ws\r\n", fmtW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Format - %ws", fmtW);
-    if (flog) FPrintLineUtf8(flog, tmpbuf);
-
-    wprintf(L"Created - %ws\r\n", timeW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Created - %ws", timeW);
-    if (flog) FPrintLineUtf8(flog, tmpbuf);
+    wprintf(L"Tape successfully prepared to work! Possibly you need to resect it via main menu!\r\n");
+    TapeClose(tape);
+    return TRUE;
+}
 
-    wprintf(L"========\r\n");
-    if (flog) FPrintLineUtf8(flog, L"========");
-   
-    if (memcmp(zh.magic, "ZEROTAPE", 8) != 0 || zh.version != 0) 
-    {
-        wprintf(L"Invalid ZEROTAPE header.\r\n");
-        if (flog) fclose(flog);
-        CloseHandle(ht);
-        return FALSE;
-    }
+BOOL ActionCalibrateDrive(void)
+{
+    HANDLE          tape;
+    WCHAR           buf[32];
+    DWORD           cellMiB = CALIB_DEFAULT_CELL_MIB;
+    CALIB_RESULT    best;
+    BOOL            ok;
 
-    size2 = GetLE64(zh.sizeofarchive);
-    if (!PositionToSecondSection(ht)) 
+    if (!g_state.hasSelection)
     {
-        if (flog) fclose(flog);
-        CloseHandle(ht);
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
 
-    wprintf(L"Step 1/2: verifying archive\r\n");
-    okHash = CopySecondSectionToFileAndOrHash(ht, size2, NULL, digest);
-    if (!okHash) 
+    wprintf(L"Enter MiB to write per measurement (default %lu): ", (unsigned long)cellMiB);
+    if (!ReadLineW(buf, 32)) return FALSE;
+    if (_wtoi(buf) > 0) cellMiB = (DWORD)_wtoi(buf);
+
+    wprintf(L"Calibration writes scratch data after end of data on tape and\r\n\
+discards it when done, existing backup is kept.\r\n");
+    if (!AskYesNo(L"Start calibration?", TRUE)) return FALSE;
+
+    tape = JobOpenTape(g_state.devicePath);
+    if (tape == INVALID_HANDLE_VALUE) return FALSE;
+
+    TRACE_BEGIN("calibrate drive", 0);
+    ok = CalibrateDrive(tape, cellMiB, &best);
+    TRACE_END("calibrate drive", 0);
+    TapeClose(tape);
+    if (!ok)
     {
-        if (flog) fclose(flog);
-        CloseHandle(ht);
+        wprintf(L"Calibration failed.\r\n");
         return FALSE;
     }
 
-    match = (memcmp(digest, zh.sha1, 20) == 0);
-    wprintf(L"SHA1 match: %ws\r\n", match ? L"OK" : L"MISMATCH");
-    //FPrintLineUtf8 already did it (\r\n)!
-    if (flog) FPrintLineUtf8(flog, match ? L"SHA1 OK" : L"SHA1 MISMATCH");
+    wprintf(L"Best: block %lu KiB, depth %lu (write %.1f MB/s, read %.1f MB/s)\r\n",
+        (unsigned long)(best.blockSize / 1024), (unsigned long)best.depth,
+        best.writeMBps, best.readMBps);
 
-    wprintf(L"Step 2/2: verifying files in archive\r\n");
-    okTar = TRUE;
-    if (zh.format == 1) 
+    if (!g_state.serial[0])
     {
-        if (!PositionToSecondSection(ht))
-            okTar = FALSE;
-        else
-            okTar = VerifyTarOnTape(ht, flog);
+        wprintf(L"Drive reports no serial number, profile is not saved.\r\n");
+        return TRUE;
     }
 
-    if (flog) 
+    if (!ProfileSave(g_state.serial, g_state.vendor, g_state.model, &best))
     {
-        fclose(flog);
-        wprintf(L"Log saved: %s\r\n", logPath);
+        PrintLastErrorW(L"Failed to save drive profile", 0);
+        return FALSE;
     }
 
-    CloseHandle(ht);
-    overall = match && okTar;
-    wprintf(L"Verify Backup %s.\r\n", overall ? L"completed" : L"found errors");
-    return overall;
+    wprintf(L"Profile saved for drive %s, it will be used by next jobs.\r\n", g_state.serial);
+    return TRUE;
 }
 
-BOOL ActionRestoreBackup(void) 
+BOOL ActionSelectTape(void) { return SelectTapeInteractive(); }
+
+/* --------------------------------------
+Striped set and spanned archive actions
+-------------------------------------- */
+/* comma separated drive IDs (\\.\TAPEn) or virtual tape paths */
+static DWORD ReadTapeList(LPCWSTR order, WCHAR paths[][MAX_PATH], LPCWSTR *ptrs, DWORD maxCount)
 {
-    HANDLE              tape;
-    ZEROTAPE_HEADER     zh;
-    ULONGLONG           size2;
-    WCHAR               dir[MAX_PATH];
-    WCHAR               outpath[MAX_PATH * 2];
-    WCHAR               wtitle[64];
-    int                 need;
-    const WCHAR         *ext;
-    DWORD               attrs;
-    HANDLE              hf;
-    BOOL                ok;
+    WCHAR   line[1024];
+    WCHAR   *p, *tok, *end;
+    DWORD   count = 0;
 
-    if (!g_state.hasSelection) 
+    wprintf(L"Enter drive IDs or virtual tape paths, separated by commas\r\n(%s): ", order);
+    if (!ReadLineW(line, 1024)) return 0;
+
+    for (p = line; *p && count < maxCount; )
     {
-        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
-        return FALSE;
-    } 
-    
-    tape = CreateFileW(g_state.devicePath, 
-        GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, 
-        OPEN_EXISTING, 0, NULL); 
-    
-    if (tape == INVALID_HANDLE_VALUE) 
-    { 
-        PrintLastErrorW(L"Cannot open tape drive", 0); 
-        return FALSE; 
-    } 
-    
-    if (!TapeIsMediaLoaded(tape)) 
-    { 
-        wprintf(L"No media loaded in the selected drive.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (!ReadMetadataFromTape(tape, &zh)) 
-    { 
-        wprintf(L"Failed to read ZEROTAPE metadata.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (memcmp(zh.magic, "ZEROTAPE", 8) != 0 || zh.version != 0)
-    { 
-        wprintf(L"Invalid ZEROTAPE header.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    size2 = GetLE64(zh.sizeofarchive);
+        tok = p;
+        while (*p && *p != L',') p++;
+        if (*p) *p++ = 0;
+
+        while (*tok == L' ') tok++;
+        end = tok + wcslen(tok);
+        while (end > tok && end[-1] == L' ') *--end = 0;
+        if (!*tok) continue;
+
+        JobDevicePathFromInput(tok, paths[count], MAX_PATH);
+        ptrs[count] = paths[count];
+        count++;
+    }
 
-    wprintf(L"Enter destination directory to save the archive: "); 
-    if (!ReadLineW(dir, MAX_PATH)) 
-    { 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (!EnsureDirectoryExistsW(dir)) 
-    { 
-        wprintf(L"Destination directory not accessible.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    need = MultiByteToWideChar(CP_ACP, 0, zh.name, -1, wtitle, 64); 
-    if (need == 0) wcscpy(wtitle, L"tape");  
-    ext = (zh.format == 1) ? L".tar" : L".bin"; 
-    _snwprintf(outpath, MAX_PATH * 2, L"%s\\%s%s", dir, wtitle, ext);
-    
-    attrs = GetFileAttributesW(outpath); 
-    if (attrs != INVALID_FILE_ATTRIBUTES) 
-        if (!AskYesNo(L"File exists. Overwrite?", FALSE)) 
-        { 
-            CloseHandle(tape); 
-            return FALSE; 
-        }
-    
-    if (!PositionToSecondSection(tape)) 
-    { 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    hf = CreateFileW(outpath, GENERIC_WRITE, 0, NULL, 
-        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL); 
-    if (hf == INVALID_HANDLE_VALUE) 
-    { 
-        PrintLastErrorW(L"Cannot create destination file", 0); 
-        CloseHandle(tape); 
-        return FALSE; 
+    return count;
+}
+
+BOOL ActionMakeStripedBackup(void)
+{
+    WCHAR           paths[STRIPE_MAX_TAPES][MAX_PATH];
+    LPCWSTR         ptrs[STRIPE_MAX_TAPES];
+    DWORD           count;
+    BOOL            parity;
+    WCHAR           path[MAX_PATH];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    int             n;
+
+    count = ReadTapeList(L"data tapes first, parity tape last", paths, ptrs, STRIPE_MAX_TAPES);
+    if (count < 2)
+    {
+        wprintf(L"Striped set needs at least 2 tapes.\r\n");
+        return FALSE;
     }
-    
-    ok = CopySecondSectionToFileAndOrHash(tape, size2, hf, NULL); 
-    CloseHandle(hf); 
-    CloseHandle(tape); 
-    wprintf(L"Restore Backup %s.\r\n", ok ? L"completed" : L"failed"); 
-    return ok;
+    parity = AskYesNo(L"Use last tape for XOR parity?", count < 3);
+
+    wprintf(L"Enter path to TAR file to write to tapes: ");
+    if (!ReadLineW(path, MAX_PATH)) return FALSE;
+
+    wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64)) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    return JobMakeStripedBackup(ptrs, count, parity, path, tname, JOB_FLAG_INTERACTIVE);
 }
 
-BOOL ActionReadBackupTOC(void) 
+BOOL ActionVerifyStripedBackup(void)
 {
-    HANDLE              tape;
-    ZEROTAPE_HEADER     zh;
-    WCHAR               dir[MAX_PATH];
-    WCHAR               outPath[MAX_PATH * 2];
-    FILE                *fout = NULL;
-    BOOL                ok;
-
-    // for getting metadata
-    WCHAR               nameW[64];
-    ULONGLONG           sz;
-    WCHAR               szW[64];
-    WCHAR               sha1W[64];
-    WCHAR               fmtW[16];
-    WCHAR               timeW[64];
-    WCHAR               tmpbuf[128];
+    WCHAR           paths[STRIPE_MAX_TAPES][MAX_PATH];
+    LPCWSTR         ptrs[STRIPE_MAX_TAPES];
+    DWORD           count;
+    WCHAR           dir[MAX_PATH];
+    WCHAR           logPath[MAX_PATH * 2];
 
-    if (!g_state.hasSelection) 
-    { 
-        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n"); 
-        return FALSE; 
-    }  
-    
-    tape = CreateFileW(g_state.devicePath, 
-        GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, 
-        OPEN_EXISTING, 0, NULL); 
-    
-    if (tape == INVALID_HANDLE_VALUE) 
-    { 
-        PrintLastErrorW(L"Cannot open tape drive", 0); 
-        return FALSE; 
-    } 
-    
-    if (!TapeIsMediaLoaded(tape)) 
-    { 
-        wprintf(L"No media loaded in the selected drive.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    }  
-    
-    if (!ReadMetadataFromTape(tape, &zh)) 
-    { 
-        wprintf(L"Failed to read ZEROTAPE metadata.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (zh.format != 1) 
-    { 
-        wprintf(L"Archive format is not TAR; TOC cannot be read.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (!PositionToSecondSection(tape)) 
+    count = ReadTapeList(L"data tapes first, parity tape last", paths, ptrs, STRIPE_MAX_TAPES);
+    if (count == 0) return FALSE;
+
+    if (!GetExeDirectoryW(dir, MAX_PATH))
+        return JobVerifyStripedBackup(ptrs, count, NULL);
+
+    JoinPath2W(logPath, MAX_PATH * 2, dir, L"verify_log.txt");
+    return JobVerifyStripedBackup(ptrs, count, logPath);
+}
+
+BOOL ActionRestoreStripedBackup(void)
+{
+    WCHAR           paths[STRIPE_MAX_TAPES][MAX_PATH];
+    LPCWSTR         ptrs[STRIPE_MAX_TAPES];
+    DWORD           count;
+    WCHAR           dir[MAX_PATH];
+
+    count = ReadTapeList(L"data tapes first, parity tape last", paths, ptrs, STRIPE_MAX_TAPES);
+    if (count == 0) return FALSE;
+
+    wprintf(L"Enter destination directory to save the archive: ");
+    if (!ReadLineW(dir, MAX_PATH)) return FALSE;
+
+    return JobRestoreStripedBackup(ptrs, count, dir, JOB_FLAG_INTERACTIVE, NULL, 0);
+}
+
+BOOL ActionMakeSpannedBackup(void)
+{
+    WCHAR           paths[SPAN_MAX_DRIVES][MAX_PATH];
+    LPCWSTR         ptrs[SPAN_MAX_DRIVES];
+    DWORD           count;
+    WCHAR           path[MAX_PATH];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    int             n;
+
+    count = ReadTapeList(L"in volume order, you will be asked for more when they are full",
+        paths, ptrs, SPAN_MAX_DRIVES);
+    if (count == 0) return FALSE;
+
+    wprintf(L"Enter path to TAR file to write to tapes: ");
+    if (!ReadLineW(path, MAX_PATH)) return FALSE;
+
+    wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64)) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    return JobMakeSpannedBackup(ptrs, count, path, tname, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionVerifySpannedBackup(void)
+{
+    WCHAR           paths[SPAN_MAX_DRIVES][MAX_PATH];
+    LPCWSTR         ptrs[SPAN_MAX_DRIVES];
+    DWORD           count;
+    WCHAR           dir[MAX_PATH];
+    WCHAR           logPath[MAX_PATH * 2];
+
+    count = ReadTapeList(L"drives holding volumes, in any order", paths, ptrs, SPAN_MAX_DRIVES);
+    if (count == 0) return FALSE;
+
+    if (!GetExeDirectoryW(dir, MAX_PATH))
+        return JobVerifySpannedBackup(ptrs, count, NULL, JOB_FLAG_INTERACTIVE);
+
+    JoinPath2W(logPath, MAX_PATH * 2, dir, L"verify_log.txt");
+    return JobVerifySpannedBackup(ptrs, count, logPath, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionRestoreSpannedBackup(void)
+{
+    WCHAR           paths[SPAN_MAX_DRIVES][MAX_PATH];
+    LPCWSTR         ptrs[SPAN_MAX_DRIVES];
+    DWORD           count;
+    WCHAR           dir[MAX_PATH];
+
+    count = ReadTapeList(L"drives holding volumes, in any order", paths, ptrs, SPAN_MAX_DRIVES);
+    if (count == 0) return FALSE;
+
+    wprintf(L"Enter destination directory to save the archive: ");
+    if (!ReadLineW(dir, MAX_PATH)) return FALSE;
+
+    return JobRestoreSpannedBackup(ptrs, count, dir, JOB_FLAG_INTERACTIVE, NULL, 0);
+}
+
+BOOL ActionMakeMirroredBackup(void)
+{
+    WCHAR           paths[MIRROR_MAX_TAPES][MAX_PATH];
+    LPCWSTR         ptrs[MIRROR_MAX_TAPES];
+    DWORD           count;
+    WCHAR           path[MAX_PATH];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    int             n;
+
+    count = ReadTapeList(L"every tape gets a full copy", paths, ptrs, MIRROR_MAX_TAPES);
+    if (count < 2)
     {
-        wprintf(L"Can't locate data section on tape; TOC cannot be read.\r\n");
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (GetExeDirectoryW(dir, MAX_PATH)) 
-    { 
-        JoinPath2W(outPath, MAX_PATH * 2, dir, L"toc.txt"); 
-        fout = OpenUtf8FileForWrite(outPath);
-    } 
-    
-    //FPrintLineUtf8 already did it (\r\n)!
-    if (fout) FPrintLineUtf8(fout, L"# TapeBackup TOC (UTF-8)"); 
-    
-    if (fout) FPrintLineUtf8(fout, L"========");
-
-    //NEW: adding to log/printing on screen info about tape;
-    MultiByteToWideChar(CP_ACP, 0, zh.name, -1, nameW, 64);
-    sz = GetLE64(zh.sizeofarchive);
-    HumanSize(sz, szW, 64);
-    BytesToHex(zh.sha1, 20, sha1W, 64);
-    _snwprintf(fmtW, 16, L"%s", (zh.format == 1) ? L"tar" : L"raw");
-    FormatSystemTimeStr(zh.creationdate, timeW, 64);
-
-    wprintf(L"Tape Name - %ws\r\n", nameW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Tape Name - %ws", nameW);
-    if (fout) FPrintLineUtf8(fout, tmpbuf);
-
-    wprintf(L"Size - %ws (%I64u bytes)\r\n", szW, sz);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Size - %ws(%I64u bytes)", szW, sz);
-    if (fout) FPrintLineUtf8(fout, tmpbuf);
-
-    wprintf(L"SHA1 - %ws\r\n", sha1W);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"SHA1 - %ws", sha1W);
-    if (fout) FPrintLineUtf8(fout, tmpbuf);
-
-    wprintf(L"Format - %ws\r\n", fmtW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Format - %ws", fmtW);
-    if (fout) FPrintLineUtf8(fout, tmpbuf);
-
-    wprintf(L"Created - %ws\r\n", timeW);
-    memset(tmpbuf, 0, sizeof(WCHAR) * 128);
-    _snwprintf(tmpbuf, 128, L"Created - %ws", timeW);
-    if (fout) FPrintLineUtf8(fout, tmpbuf);
+        wprintf(L"Mirror needs at least 2 tapes.\r\n");
+        return FALSE;
+    }
 
-    wprintf(L"========\r\n");
-    if (fout) FPrintLineUtf8(fout, L"========");
+    wprintf(L"Enter path to TAR file to write to tapes: ");
+    if (!ReadLineW(path, MAX_PATH)) return FALSE;
 
-    ok = ListTarTOCToFile(tape, fout); 
-    if (fout) 
-    { 
-        fclose(fout); 
-        wprintf(L"TOC saved: %s\r\n", outPath); 
-    } 
-    
-    CloseHandle(tape); 
-    return ok;
+    wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64)) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    return JobMakeMirroredBackup(ptrs, count, path, tname, JOB_FLAG_INTERACTIVE);
 }
 
-BOOL ActionCleanTape(void) 
-{ 
-    HANDLE      tape;
+/* source is the selected drive */
+BOOL ActionCloneTape(void)
+{
+    WCHAR           line[MAX_PATH];
+    WCHAR           dst[MAX_PATH];
 
-    if (!g_state.hasSelection) 
-    { 
-        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n"); 
-        return FALSE; 
-    } 
-    
-    tape = CreateFileW(g_state.devicePath, 
-        GENERIC_READ | GENERIC_WRITE, 
-        FILE_SHARE_READ | FILE_SHARE_WRITE, 
-        NULL, OPEN_EXISTING, 0, NULL);
+    if (!g_state.hasSelection)
+    {
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
+        return FALSE;
+    }
 
-    if (tape == INVALID_HANDLE_VALUE) 
-    { 
-        PrintLastErrorW(L"Cannot open tape drive", 0); 
-        return FALSE; 
-    } 
-    
-    if (!TapeIsMediaLoaded(tape)) 
-    { 
-        wprintf(L"No media loaded in the selected drive.\r\n"); 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
-    
-    if (!AskYesNo(L"WARNING: All data on the tape will be destroyed. Proceed?", FALSE)) 
-    { 
-        CloseHandle(tape); 
-        return FALSE; 
-    } 
+    wprintf(L"Enter destination drive ID or virtual tape path: ");
+    if (!ReadLineW(line, MAX_PATH) || !line[0]) return FALSE;
 
-    //Note that you must rewind tape to beginning before erasing!
-    wprintf(L"Please wait until tape rewound...\r\n");
-    if (!TapeRewind(tape))
+    JobDevicePathFromInput(line, dst, MAX_PATH);
+    return JobCloneTape(g_state.devicePath, dst, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionExportTapeImage(void)
+{
+    WCHAR           path[MAX_PATH];
+
+    if (!g_state.hasSelection)
     {
-        PrintLastErrorW(L"Failed to rewind tape", 0);
-        CloseHandle(tape);
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
-    
-    wprintf(L"Tape erasing. This may take a while...\r\n"); 
-    if (!TapeEraseLong(tape)) 
-    { 
-        PrintLastErrorW(L"Erase command failed", 0); 
-        CloseHandle(tape); 
-        return FALSE; 
+
+    wprintf(L"Enter path of image file to create: ");
+    if (!ReadLineW(path, MAX_PATH) || !path[0]) return FALSE;
+
+    return JobExportImage(g_state.devicePath, path, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionImportTapeImage(void)
+{
+    WCHAR           path[MAX_PATH];
+
+    if (!g_state.hasSelection)
+    {
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
+        return FALSE;
     }
 
-    //Prepaing tape to work; This is required by some sequential devices
-    if (AskYesNo(L"Do you want to prepare this tape to work?\r\n\
-Note that this can be required for some tape drives", TRUE))
+    wprintf(L"Enter path of image file to write to tape: ");
+    if (!ReadLineW(path, MAX_PATH) || !path[0]) return FALSE;
+
+    return JobImportImage(path, g_state.devicePath, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionVerifyTapeImages(void)
+{
+    WCHAR           paths[IMAGE_MAX_VERIFY][MAX_PATH];
+    LPCWSTR         ptrs[IMAGE_MAX_VERIFY];
+    DWORD           count;
+    WCHAR           dir[MAX_PATH];
+    WCHAR           logPath[MAX_PATH * 2];
+
+    count = ReadTapeList(L"image files, verified in parallel", paths, ptrs, IMAGE_MAX_VERIFY);
+    if (count == 0) return FALSE;
+
+    if (!GetExeDirectoryW(dir, MAX_PATH))
+        return JobVerifyImages(ptrs, count, NULL);
+
+    JoinPath2W(logPath, MAX_PATH * 2, dir, L"verify_log.txt");
+    return JobVerifyImages(ptrs, count, logPath);
+}
+
+/* --------------------------------------
+Batch backup
+-------------------------------------- */
+static int CompareNames(const void *a, const void *b)
+{
+    return _wcsicmp((LPCWSTR)a, (LPCWSTR)b);
+}
+
+/* *.tar in directory, by name: nightly dumps are usually named by date */
+static DWORD ReadTarDirectory(LPCWSTR dir, WCHAR paths[][MAX_PATH], DWORD maxCount)
+{
+    WCHAR               mask[MAX_PATH * 2];
+    WIN32_FIND_DATAW    fd;
+    HANDLE              hfind;
+    DWORD               count = 0;
+
+    JoinPath2W(mask, MAX_PATH * 2, dir, L"*.tar");
+    hfind = FindFirstFileW(mask, &fd);
+    if (hfind == INVALID_HANDLE_VALUE) return 0;
+
+    do
     {
-        if (!TapePrepareToWork(tape))
-        {
-            PrintLastErrorW(L"Failed to prepare tape to work!", 0);
-            CloseHandle(tape);
-            return FALSE;
-        }
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        JoinPath2W(paths[count], MAX_PATH, dir, fd.cFileName);
+        count++;
+    } while (count < maxCount && FindNextFileW(hfind, &fd));
+    FindClose(hfind);
+
+    qsort(paths, count, sizeof(paths[0]), CompareNames);
+    return count;
+}
 
-        if (!TapeSetVariableBlockSize(tape))
+BOOL ActionMakeBatchBackup(void)
+{
+    WCHAR           (*paths)[MAX_PATH];
+    LPCWSTR         ptrs[JOB_BATCH_MAX];
+    WCHAR           line[1024];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    WCHAR           *p, *tok, *end;
+    DWORD           count = 0, i;
+    DWORD           attrs;
+    int             n;
+    BOOL            ok;
+
+    if (!g_state.hasSelection)
+    {
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
+        return FALSE;
+    }
+
+    paths = (WCHAR(*)[MAX_PATH])malloc(JOB_BATCH_MAX * sizeof(*paths));
+    if (!paths)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"Enter directory with TAR files or TAR paths separated by commas: ");
+    if (!ReadLineW(line, 1024))
+    {
+        free(paths);
+        return FALSE;
+    }
+
+    attrs = GetFileAttributesW(line);
+    if (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY))
+        count = ReadTarDirectory(line, paths, JOB_BATCH_MAX);
+    else
+    {
+        for (p = line; *p && count < JOB_BATCH_MAX; )
         {
-            PrintLastErrorW(L"Failed to set variable block size for current tape.\r\n\
-It means, that this tape drive not supported for now!", 0);
-            CloseHandle(tape);
-            return FALSE;
+            tok = p;
+            while (*p && *p != L',') p++;
+            if (*p) *p++ = 0;
+
+            while (*tok == L' ') tok++;
+            end = tok + wcslen(tok);
+            while (end > tok && end[-1] == L' ') *--end = 0;
+            if (!*tok) continue;
+
+            _snwprintf(paths[count], MAX_PATH, L"%s", tok);
+            paths[count][MAX_PATH - 1] = 0;
+            count++;
         }
     }
-    
-    CloseHandle(tape); 
-    return TRUE;
+
+    if (count == 0)
+    {
+        wprintf(L"No TAR files given.\r\n");
+        free(paths);
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        ptrs[i] = paths[i];
+        wprintf(L"%4lu  %s\r\n", (unsigned long)i + 1, paths[i]);
+    }
+
+    wprintf(L"Enter batch name for directory (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64))
+    {
+        free(paths);
+        return FALSE;
+    }
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    ok = JobMakeBatchBackup(ptrs, count, g_state.devicePath, tname, JOB_FLAG_INTERACTIVE);
+    free(paths);
+    return ok;
 }
 
-BOOL ActionPrepareTape(void)
+BOOL ActionListArchives(void)
 {
-    HANDLE      tape;
+    if (!g_state.hasSelection)
+    {
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
+        return FALSE;
+    }
+
+    return JobListArchives(g_state.devicePath);
+}
+
+BOOL ActionAppendBackup(void)
+{
+    WCHAR           path[MAX_PATH];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    int             n;
 
     if (!g_state.hasSelection)
     {
@@ -954,47 +874,271 @@ BOOL ActionPrepareTape(void)
         return FALSE;
     }
 
-    tape = CreateFileW(g_state.devicePath,
-        GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        NULL, OPEN_EXISTING, 0, NULL);
+    wprintf(L"Enter path to TAR file to append to tape: ");
+    if (!ReadLineW(path, MAX_PATH)) return FALSE;
 
-    if (tape == INVALID_HANDLE_VALUE)
+    wprintf(L"Enter archive name (ASCII, up to 31 chars): ");
+    if (!ReadLineW(wname, 64)) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+    tname[(n > 0 && n < 32) ? n : 31] = 0;
+
+    return JobAppendBackup(g_state.devicePath, path, tname, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionPartitionTape(void)
+{
+    WCHAR           buf[32];
+    WCHAR           wname[64];
+    char            tname[32] = { 0 };
+    DWORD           indexMiB = PART_DEFAULT_INDEX_MIB;
+    int             n;
+
+    if (!g_state.hasSelection)
     {
-        PrintLastErrorW(L"Cannot open tape drive", 0);
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
 
-    if (!TapeIsMediaLoaded(tape))
+    wprintf(L"Enter index partition size in MiB (Enter = %lu, 0 = one partition): ",
+        (unsigned long)indexMiB);
+    if (!ReadLineW(buf, 32)) return FALSE;
+    if (buf[0]) indexMiB = (DWORD)_wtoi(buf);
+
+    if (indexMiB)
     {
-        wprintf(L"No media loaded in the selected drive.\r\n");
-        CloseHandle(tape);
+        wprintf(L"Enter tape name (ASCII, up to 31 chars): ");
+        if (!ReadLineW(wname, 64)) return FALSE;
+
+        n = WideCharToMultiByte(CP_ACP, 0, wname, -1, tname, 31, NULL, NULL);
+        tname[(n > 0 && n < 32) ? n : 31] = 0;
+    }
+
+    return JobPartitionTape(g_state.devicePath, indexMiB, tname, JOB_FLAG_INTERACTIVE);
+}
+
+BOOL ActionResumeJob(void)
+{
+    if (!g_state.hasSelection)
+    {
+        wprintf(L"No tape drive selected. Use 'Select Tape' first.\r\n");
         return FALSE;
     }
 
-    wprintf(L"Tape is preparing to work now...\r\n");
+    return JobResume(g_state.devicePath, JOB_FLAG_INTERACTIVE);
+}
+
+/* --------------------------------------
+Tape library
+-------------------------------------- */
+static WCHAR g_changerPath[MAX_PATH];
+
+/* /changer path, else first \\.\ChangerN */
+static BOOL FindChanger(WCHAR *out)
+{
+    WCHAR   name[16];
+    WCHAR   target[MAX_PATH];
+    int     i;
 
-    if (!TapePrepareToWork(tape))
+    if (g_changerPath[0])
     {
-        PrintLastErrorW(L"Failed to prepare tape to work!", 0);
-        CloseHandle(tape);
+        wcscpy(out, g_changerPath);
+        return TRUE;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        _snwprintf(name, 16, L"Changer%d", i);
+        name[15] = 0;
+        if (QueryDosDeviceW(name, target, MAX_PATH))
+        {
+            _snwprintf(out, MAX_PATH, L"\\\\.\\%s", name);
+            out[MAX_PATH - 1] = 0;
+            return TRUE;
+        }
+    }
+
+    out[0] = 0;
+    return FALSE;
+}
+
+/* drive given back to its home slot, or any empty one */
+static BOOL LibraryUnload(CHANGER *c, DWORD drive)
+{
+    int slot;
+
+    if (drive >= c->driveCount || !c->drives[drive].full)
+    {
+        wprintf(L"Drive %lu is empty.\r\n", (unsigned long)(drive + 1));
         return FALSE;
     }
 
-    if (!TapeSetVariableBlockSize(tape))
+    slot = ChangerFreeSlot(c, c->drives[drive].home);
+    if (slot < 0)
     {
-        PrintLastErrorW(L"Failed to set variable block size for current tape.\r\n\
-It means, that this tape drive not supported for now!", 0);
-        CloseHandle(tape);
+        wprintf(L"No empty slot.\r\n");
         return FALSE;
     }
 
-    wprintf(L"Tape successfully prepared to work! Possibly you need to resect it via main menu!\r\n");
-    CloseHandle(tape);
+    wprintf(L"Unloading drive %lu to slot %d...\r\n", (unsigned long)(drive + 1), slot + 1);
+    return ChangerMoveNow(c, CHANGER_DRIVE, drive, CHANGER_SLOT, (DWORD)slot);
+}
+
+static BOOL LibraryLoad(CHANGER *c)
+{
+    WCHAR   buf[64];
+    char    barcode[CHANGER_BARCODE_MAX];
+    DWORD   kind = CHANGER_SLOT;
+    DWORD   slot;
+    DWORD   drive = 0;
+    int     n;
+
+    wprintf(L"Enter barcode or slot number: ");
+    if (!ReadLineW(buf, 64) || !buf[0]) return FALSE;
+
+    n = WideCharToMultiByte(CP_ACP, 0, buf, -1, barcode, CHANGER_BARCODE_MAX - 1, NULL, NULL);
+    barcode[(n > 0 && n < CHANGER_BARCODE_MAX) ? n : CHANGER_BARCODE_MAX - 1] = 0;
+    if (!ChangerFind(c, barcode, &kind, &slot))
+        slot = (DWORD)_wtoi(buf) - 1;
+    if (kind != CHANGER_SLOT || slot >= c->slotCount || !c->slots[slot].full)
+    {
+        wprintf(L"No cartridge in that slot.\r\n");
+        return FALSE;
+    }
+
+    if (c->driveCount > 1)
+    {
+        wprintf(L"Enter drive number (Enter = 1): ");
+        if (!ReadLineW(buf, 64)) return FALSE;
+        if (buf[0]) drive = (DWORD)_wtoi(buf) - 1;
+    }
+    if (drive >= c->driveCount)
+    {
+        wprintf(L"No such drive.\r\n");
+        return FALSE;
+    }
+
+    if (c->drives[drive].full && !LibraryUnload(c, drive)) return FALSE;
+
+    wprintf(L"Loading slot %lu to drive %lu...\r\n", (unsigned long)(slot + 1),
+        (unsigned long)(drive + 1));
+    return ChangerMoveNow(c, CHANGER_SLOT, slot, CHANGER_DRIVE, drive);
+}
+
+BOOL ActionTapeLibrary(void)
+{
+    CHANGER *c;
+    WCHAR   path[MAX_PATH];
+    WCHAR   buf[MAX_PATH];
+    BOOL    ok = TRUE;
+
+    FindChanger(path);
+    if (path[0])
+        wprintf(L"Enter changer path (Enter = %s): ", path);
+    else
+        wprintf(L"Enter changer path (\\\\.\\ChangerN or virtual changer directory): ");
+    if (!ReadLineW(buf, MAX_PATH)) return FALSE;
+    if (buf[0]) wcscpy(path, buf);
+    if (!path[0]) return FALSE;
+
+    c = (CHANGER*)malloc(sizeof(CHANGER));
+    if (!c) return FALSE;
+    if (!ChangerOpen(c, path))
+    {
+        PrintLastErrorW(L"Failed to open changer", 0);
+        free(c);
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        ChangerPrint(c);
+        wprintf(L"1. Load Cartridge\r\n");
+        wprintf(L"2. Unload Drive\r\n");
+        wprintf(L"3. Scan Barcodes\r\n");
+        wprintf(L"Enter choice (Enter = back): ");
+        if (!ReadLineW(buf, 16) || !buf[0]) break;
+
+        switch (_wtoi(buf))
+        {
+            case 1:
+                ok = LibraryLoad(c);
+                break;
+            case 2:
+                wprintf(L"Enter drive number (Enter = 1): ");
+                if (!ReadLineW(buf, 16)) break;
+                ok = LibraryUnload(c, buf[0] ? (DWORD)_wtoi(buf) - 1 : 0);
+                break;
+            case 3:
+                wprintf(L"Please wait until library scanned...\r\n");
+                ok = ChangerRefresh(c, TRUE);
+                if (!ok) PrintLastErrorW(L"Failed to scan library", 0);
+                break;
+            default:
+                wprintf(L"Unknown choice.\r\n");
+                break;
+        }
+        wprintf(L"\r\n");
+    }
+
+    ChangerClose(c);
+    free(c);
+    return ok;
+}
+
+/* --------------------------------------
+Search Catalog (see catalog.h)
+-------------------------------------- */
+static BOOL SearchPrintHit(void *ctx, const CATALOG_HIT *hit)
+{
+    (void)ctx;
+    CatalogPrintHit(hit);
     return TRUE;
 }
 
-BOOL ActionSelectTape(void) { return SelectTapeInteractive(); }
+BOOL ActionSearchCatalog(void)
+{
+    WCHAR   buf[1024];
+    char    pattern[4096];
+    DWORD   type;
+    DWORD   found = 0;
+    double  t0;
+
+    if (!CatalogEnabled())
+    {
+        wprintf(L"Catalog is off (/no-catalog).\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"1. Exact Path\r\n");
+    wprintf(L"2. Path Prefix\r\n");
+    wprintf(L"3. Glob (* and ?)\r\n");
+    wprintf(L"4. Substring\r\n");
+    wprintf(L"Enter query type (Enter = 4): ");
+    if (!ReadLineW(buf, 16)) return FALSE;
+    type = buf[0] ? (DWORD)_wtoi(buf) : CATALOG_QUERY_SUBSTRING;
+    if (type < CATALOG_QUERY_PATH || type > CATALOG_QUERY_SUBSTRING)
+    {
+        wprintf(L"Unknown choice.\r\n");
+        return FALSE;
+    }
+
+    wprintf(L"Enter path or pattern: ");
+    if (!ReadLineW(buf, 1024) || !buf[0]) return FALSE;
+    if (!WideCharToMultiByte(CP_UTF8, 0, buf, -1, pattern, sizeof(pattern), NULL, NULL))
+        return FALSE;
+
+    t0 = TimerSeconds();
+    if (!CatalogQuery(type, pattern, CATALOG_MAX_RESULTS, SearchPrintHit, NULL, &found))
+    {
+        PrintLastErrorW(L"Failed to search catalog", 0);
+        return FALSE;
+    }
+
+    wprintf(L"%lu files found in %.1f ms%s.\r\n", (unsigned long)found,
+        (TimerSeconds() - t0) * 1000.0, (found >= CATALOG_MAX_RESULTS) ? L", first ones only" : L"");
+    return TRUE;
+}
 
 /* --------------------------------------
 Menu and main loop
@@ -1011,11 +1155,176 @@ void PrintMenu(void)
     wprintf(L"7. Clean Tape\r\n");
     wprintf(L"8. Prepare Tape\r\n");
     wprintf(L"9. Select Tape\r\n");
+    wprintf(L"10. Calibrate Drive\r\n");
+    wprintf(L"11. Make Striped Backup\r\n");
+    wprintf(L"12. Verify Striped Backup\r\n");
+    wprintf(L"13. Restore Striped Backup\r\n");
+    wprintf(L"14. Make Spanned Backup\r\n");
+    wprintf(L"15. Verify Spanned Backup\r\n");
+    wprintf(L"16. Restore Spanned Backup\r\n");
+    wprintf(L"17. Make Mirrored Backup\r\n");
+    wprintf(L"18. Clone Tape\r\n");
+    wprintf(L"19. Export Tape Image\r\n");
+    wprintf(L"20. Import Tape Image\r\n");
+    wprintf(L"21. Verify Tape Images\r\n");
+    wprintf(L"22. Make Batch Backup\r\n");
+    wprintf(L"23. List Archives\r\n");
+    wprintf(L"24. Append Backup\r\n");
+    wprintf(L"25. Partition Tape\r\n");
+    wprintf(L"26. Resume Interrupted Job\r\n");
+    wprintf(L"27. Tape Library\r\n");
+    wprintf(L"28. Search Catalog\r\n");
     wprintf(L"0. Exit\r\n");
     wprintf(L"Enter choice: ");
 }
 
-int wmain(int argc, char **argv) 
+/* --------------------------------------
+Command line options
+/trace[:path]           - record pipeline trace (Chrome/Perfetto JSON),
+                          default path is trace.json in exe directory
+/metrics[:path]         - export per-drive counters as Prometheus textfile,
+                          default path is tapebackup.prom in exe directory
+/metrics-period:<sec>   - metrics export period, default 10 seconds
+/io-budget:<MiB>        - buffer memory per backup/restore pipeline, default 64
+/no-autotune            - keep buffer count and chunk size fixed during jobs
+/spool:<dir>            - Make Backup stages source in <dir> before tape
+/spool-hwm:<MiB>        - staged data needed to start the drive, default 2048
+/daemon[:name]          - no menu, run jobs sent to pipe \\.\pipe\<name>,
+                          default name is TapeBackup
+/changer:<path>         - tape library for the daemon and Tape Library menu,
+                          \\.\ChangerN or virtual changer directory
+/catalog:<dir>          - catalog of archive contents, default directory is
+                          catalog in exe directory
+/no-catalog             - don't catalog archives written, verified or listed
+-------------------------------------- */
+static WCHAR g_daemonPipeName[MAX_PATH];
+
+void ParseCommandLine(int argc, WCHAR **argv)
+{
+    int     i;
+    WCHAR   dir[MAX_PATH];
+    WCHAR   tracePath[MAX_PATH * 2];
+    WCHAR   metricsPath[MAX_PATH * 2];
+    DWORD   metricsPeriod = METRICS_DEFAULT_PERIOD;
+    DWORD   budgetMiB = TAPE_DEFAULT_BUDGET / (1024 * 1024);
+    BOOL    autoTune = TRUE;
+    WCHAR   spoolDir[MAX_PATH];
+    DWORD   spoolHwmMiB = (DWORD)(SPOOL_DEFAULT_HWM / (1024 * 1024));
+    WCHAR   catalogDir[MAX_PATH];
+    BOOL    catalog = TRUE;
+
+    metricsPath[0] = 0;
+    spoolDir[0] = 0;
+    catalogDir[0] = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (_wcsnicmp(argv[i], L"/metrics-period:", 16) == 0)
+        {
+            metricsPeriod = (DWORD)_wtoi(argv[i] + 16) * 1000;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/io-budget:", 11) == 0)
+        {
+            budgetMiB = (DWORD)_wtoi(argv[i] + 11);
+            if (budgetMiB < 1) budgetMiB = 1;
+            if (budgetMiB > 1024) budgetMiB = 1024;
+            continue;
+        }
+
+        if (_wcsicmp(argv[i], L"/no-autotune") == 0)
+        {
+            autoTune = FALSE;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/spool-hwm:", 11) == 0)
+        {
+            spoolHwmMiB = (DWORD)_wtoi(argv[i] + 11);
+            if (spoolHwmMiB < 64) spoolHwmMiB = 64;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/spool:", 7) == 0)
+        {
+            _snwprintf(spoolDir, MAX_PATH, L"%s", argv[i] + 7);
+            spoolDir[MAX_PATH - 1] = 0;
+            continue;
+        }
+
+        if (_wcsicmp(argv[i], L"/no-catalog") == 0)
+        {
+            catalog = FALSE;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/catalog:", 9) == 0)
+        {
+            _snwprintf(catalogDir, MAX_PATH, L"%s", argv[i] + 9);
+            catalogDir[MAX_PATH - 1] = 0;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/changer:", 9) == 0)
+        {
+            _snwprintf(g_changerPath, MAX_PATH, L"%s", argv[i] + 9);
+            g_changerPath[MAX_PATH - 1] = 0;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/daemon", 7) == 0 && (argv[i][7] == L':' || !argv[i][7]))
+        {
+            _snwprintf(g_daemonPipeName, MAX_PATH, L"%s",
+                (argv[i][7] == L':' && argv[i][8]) ? argv[i] + 8 : DAEMON_PIPE_NAME);
+            g_daemonPipeName[MAX_PATH - 1] = 0;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/metrics", 8) == 0)
+        {
+            if (argv[i][8] == L':' && argv[i][9])
+                _snwprintf(metricsPath, MAX_PATH * 2, L"%s", argv[i] + 9);
+            else if (GetExeDirectoryW(dir, MAX_PATH))
+                JoinPath2W(metricsPath, MAX_PATH * 2, dir, L"tapebackup.prom");
+            metricsPath[MAX_PATH * 2 - 1] = 0;
+            continue;
+        }
+
+        if (_wcsnicmp(argv[i], L"/trace", 6) == 0)
+        {
+            if (argv[i][6] == L':' && argv[i][7])
+                _snwprintf(tracePath, MAX_PATH * 2, L"%s", argv[i] + 7);
+            else if (GetExeDirectoryW(dir, MAX_PATH))
+                JoinPath2W(tracePath, MAX_PATH * 2, dir, L"trace.json");
+            else
+                continue;
+
+            tracePath[MAX_PATH * 2 - 1] = 0;
+            if (TraceStart(tracePath))
+                wprintf(L"Tracing enabled: %s\r\n", tracePath);
+            else
+                PrintLastErrorW(L"Failed to start tracing", 0);
+        }
+        else
+            wprintf(L"Unknown option: %s\r\n", argv[i]);
+    }
+
+    TapeSetDefaultTuning(budgetMiB * 1024 * 1024, autoTune);
+    SpoolSetDefaults(spoolDir, (ULONGLONG)spoolHwmMiB * 1024 * 1024);
+    if (spoolDir[0])
+        wprintf(L"Staging spool enabled: %s\r\n", spoolDir);
+    CatalogSetDir(catalog ? catalogDir : NULL);
+
+    if (metricsPath[0])
+    {
+        if (MetricsStart(metricsPath, metricsPeriod))
+            wprintf(L"Metrics export enabled: %s\r\n", metricsPath);
+        else
+            PrintLastErrorW(L"Failed to start metrics export", 0);
+    }
+}
+
+int wmain(int argc, WCHAR **argv) 
 {
     WCHAR       in[16];
     int         choice;
@@ -1024,6 +1333,15 @@ int wmain(int argc, char **argv)
     _setmode(_fileno(stderr), _O_U16TEXT);
 
     ZeroMemory(&g_state, sizeof(g_state));
+    ParseCommandLine(argc, argv);
+    if (g_daemonPipeName[0])
+    {
+        choice = DaemonRun(g_daemonPipeName, g_changerPath) ? 0 : 1;
+        TraceStop();
+        MetricsStop();
+        return choice;
+    }
+
     for (;;) 
     {
         HideConsoleCursor();
@@ -1033,23 +1351,139 @@ int wmain(int argc, char **argv)
         choice = _wtoi(in);
         switch (choice) 
         {
-            case 1: ActionMakeBackup(); break;
-            case 2: ActionVerifyBackup(); break;
-            case 3: ActionRestoreBackup(); break; 
-            case 4: ActionReadBackupTOC(); break; 
+            case 1: 
+                TRACE_BEGIN("ActionMakeBackup", 0);
+                ActionMakeBackup(); 
+                TRACE_END("ActionMakeBackup", 0);
+                break;
+            case 2: 
+                TRACE_BEGIN("ActionVerifyBackup", 0);
+                ActionVerifyBackup(); 
+                TRACE_END("ActionVerifyBackup", 0);
+                break;
+            case 3: 
+                TRACE_BEGIN("ActionRestoreBackup", 0);
+                ActionRestoreBackup(); 
+                TRACE_END("ActionRestoreBackup", 0);
+                break; 
+            case 4: 
+                TRACE_BEGIN("ActionReadBackupTOC", 0);
+                ActionReadBackupTOC(); 
+                TRACE_END("ActionReadBackupTOC", 0);
+                break; 
             case 5: ActionPrintMetadata(); break;
             case 6: ActionRewind(); break; 
             case 7: ActionCleanTape(); break;
             case 8: ActionPrepareTape(); break;
             case 9: ActionSelectTape(); break;
-            case 0: wprintf(L"Exiting.\r\n"); return 0;
+            case 10: ActionCalibrateDrive(); break;
+            case 11:
+                TRACE_BEGIN("ActionMakeStripedBackup", 0);
+                ActionMakeStripedBackup();
+                TRACE_END("ActionMakeStripedBackup", 0);
+                break;
+            case 12:
+                TRACE_BEGIN("ActionVerifyStripedBackup", 0);
+                ActionVerifyStripedBackup();
+                TRACE_END("ActionVerifyStripedBackup", 0);
+                break;
+            case 13:
+                TRACE_BEGIN("ActionRestoreStripedBackup", 0);
+                ActionRestoreStripedBackup();
+                TRACE_END("ActionRestoreStripedBackup", 0);
+                break;
+            case 14:
+                TRACE_BEGIN("ActionMakeSpannedBackup", 0);
+                ActionMakeSpannedBackup();
+                TRACE_END("ActionMakeSpannedBackup", 0);
+                break;
+            case 15:
+                TRACE_BEGIN("ActionVerifySpannedBackup", 0);
+                ActionVerifySpannedBackup();
+                TRACE_END("ActionVerifySpannedBackup", 0);
+                break;
+            case 16:
+                TRACE_BEGIN("ActionRestoreSpannedBackup", 0);
+                ActionRestoreSpannedBackup();
+                TRACE_END("ActionRestoreSpannedBackup", 0);
+                break;
+            case 17:
+                TRACE_BEGIN("ActionMakeMirroredBackup", 0);
+                ActionMakeMirroredBackup();
+                TRACE_END("ActionMakeMirroredBackup", 0);
+                break;
+            case 18:
+                TRACE_BEGIN("ActionCloneTape", 0);
+                ActionCloneTape();
+                TRACE_END("ActionCloneTape", 0);
+                break;
+            case 19:
+                TRACE_BEGIN("ActionExportTapeImage", 0);
+                ActionExportTapeImage();
+                TRACE_END("ActionExportTapeImage", 0);
+                break;
+            case 20:
+                TRACE_BEGIN("ActionImportTapeImage", 0);
+                ActionImportTapeImage();
+                TRACE_END("ActionImportTapeImage", 0);
+                break;
+            case 21:
+                TRACE_BEGIN("ActionVerifyTapeImages", 0);
+                ActionVerifyTapeImages();
+                TRACE_END("ActionVerifyTapeImages", 0);
+                break;
+            case 22:
+                TRACE_BEGIN("ActionMakeBatchBackup", 0);
+                ActionMakeBatchBackup();
+                TRACE_END("ActionMakeBatchBackup", 0);
+                break;
+            case 23:
+                TRACE_BEGIN("ActionListArchives", 0);
+                ActionListArchives();
+                TRACE_END("ActionListArchives", 0);
+                break;
+            case 24:
+                TRACE_BEGIN("ActionAppendBackup", 0);
+                ActionAppendBackup();
+                TRACE_END("ActionAppendBackup", 0);
+                break;
+            case 25:
+                TRACE_BEGIN("ActionPartitionTape", 0);
+                ActionPartitionTape();
+                TRACE_END("ActionPartitionTape", 0);
+                break;
+            case 26:
+                TRACE_BEGIN("ActionResumeJob", 0);
+                ActionResumeJob();
+                TRACE_END("ActionResumeJob", 0);
+                break;
+            case 27:
+                TRACE_BEGIN("ActionTapeLibrary", 0);
+                ActionTapeLibrary();
+                TRACE_END("ActionTapeLibrary", 0);
+                break;
+            case 28:
+                TRACE_BEGIN("ActionSearchCatalog", 0);
+                ActionSearchCatalog();
+                TRACE_END("ActionSearchCatalog", 0);
+                break;
+            case 0: 
+                SessionClose(g_state.devicePath);
+                TraceStop();
+                MetricsStop();
+                wprintf(L"Exiting.\r\n"); 
+                return 0;
             default: wprintf(L"Unknown choice.\r\n"); break;
         }
+        if (g_traceEnabled) TraceFlush();
         wprintf(L"\r\n");
         ShowConsoleCursor();
         system("pause");
         system("cls");
     }
     
+    SessionClose(g_state.devicePath);
+    TraceStop();
+    MetricsStop();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include "mam.h"
+#include <ntddscsi.h>
+
+#define MAM_CDB_READ_ATTRIBUTE  0x8C
+#define MAM_CDB_WRITE_ATTRIBUTE 0x8D
+#define MAM_FORMAT_BINARY       0x00
+#define MAM_FORMAT_ASCII        0x01
+#define MAM_FORMAT_TEXT         0x02
+#define MAM_TIMEOUT             60      /* seconds */
+
+static MAM_PASS_THROUGH g_mamPassThrough = NULL;   /* NULL - chosen by handle */
+
+void MamSetPassThrough(MAM_PASS_THROUGH fn)
+{
+    g_mamPassThrough = fn;
+}
+
+static DWORD MamGetBE16(const BYTE *p)
+{
+    return ((DWORD)p[0] << 8) | p[1];
+}
+
+static DWORD MamGetBE32(const BYTE *p)
+{
+    return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3];
+}
+
+static void MamPutBE16(BYTE *p, DWORD v)
+{
+    p[0] = (BYTE)(v >> 8);
+    p[1] = (BYTE)v;
+}
+
+static void MamPutBE32(BYTE *p, DWORD v)
+{
+    p[0] = (BYTE)(v >> 24);
+    p[1] = (BYTE)(v >> 16);
+    p[2] = (BYTE)(v >> 8);
+    p[3] = (BYTE)v;
+}
+
+/* --------------------------------------
+Drive: SCSI pass-through
+-------------------------------------- */
+typedef struct _MAM_SPTD {
+    SCSI_PASS_THROUGH_DIRECT    sptd;
+    ULONG                       filler;     /* sense buffer alignment */
+    UCHAR                       sense[32];
+} MAM_SPTD;
+
+static DWORD MamScsiPassThrough(HANDLE h, const BYTE *cdb, DWORD cdbLen,
+    BOOL dataIn, BYTE *data, DWORD dataLen, DWORD *transferred)
+{
+    MAM_SPTD    s;
+    DWORD       ret = 0;
+
+    *transferred = 0;
+    ZeroMemory(&s, sizeof(s));
+    s.sptd.Length = sizeof(SCSI_PASS_THROUGH_DIRECT);
+    s.sptd.CdbLength = (UCHAR)cdbLen;
+    s.sptd.SenseInfoLength = sizeof(s.sense);
+    s.sptd.SenseInfoOffset = FIELD_OFFSET(MAM_SPTD, sense);
+    s.sptd.DataIn = dataIn ? SCSI_IOCTL_DATA_IN : SCSI_IOCTL_DATA_OUT;
+    s.sptd.DataTransferLength = dataLen;
+    s.sptd.DataBuffer = data;
+    s.sptd.TimeOutValue = MAM_TIMEOUT;
+    memcpy(s.sptd.Cdb, cdb, cdbLen);
+
+    if (!DeviceIoControl(h, IOCTL_SCSI_PASS_THROUGH_DIRECT, &s, sizeof(s),
+        &s, sizeof(s), &ret, NULL))
+        return GetLastError();
+
+    /* CHECK CONDITION, ILLEGAL REQUEST: drive or cartridge has no MAM */
+    if (s.sptd.ScsiStatus != 0)
+        return ((s.sense[2] & 0x0F) == 0x05) ? ERROR_NOT_SUPPORTED : ERROR_IO_DEVICE;
+
+    *transferred = s.sptd.DataTransferLength;
+    return NO_ERROR;
+}
+
+/* --------------------------------------
+Virtual tape: mock pass-through. Answers READ/WRITE ATTRIBUTE like a
+drive; attribute list is kept in <image>.mam in wire format, sorted by id
+-------------------------------------- */
+static DWORD MamMockLoad(LPCWSTR path, BYTE *list, DWORD cap, DWORD *len)
+{
+    HANDLE  hf;
+    DWORD   err = NO_ERROR;
+
+    *len = 0;
+    hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+        return (GetLastError() == ERROR_FILE_NOT_FOUND) ? NO_ERROR : GetLastError();
+
+    if (!ReadFile(hf, list, cap, len, NULL)) err = GetLastError();
+    CloseHandle(hf);
+    return err;
+}
+
+static DWORD MamMockSave(LPCWSTR path, const BYTE *list, DWORD len)
+{
+    HANDLE  hf;
+    DWORD   written = 0;
+    DWORD   err = NO_ERROR;
+
+    hf = CreateFileW(path, GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) return GetLastError();
+
+    if (!WriteFile(hf, list, len, &written, NULL) || written != len)
+        err = GetLastError() ? GetLastError() : ERROR_DISK_FULL;
+    CloseHandle(hf);
+    return err;
+}
+
+/* replaces attribute with same id, zero length deletes it */
+static BOOL MamMockPut(BYTE *list, DWORD *len, DWORD cap, const BYTE *attr)
+{
+    DWORD   id = MamGetBE16(attr);
+    DWORD   size = 5 + MamGetBE16(attr + 3);
+    DWORD   off = 0, cur;
+
+    while (off + 5 <= *len && MamGetBE16(list + off) < id)
+        off += 5 + MamGetBE16(list + off + 3);
+
+    if (off + 5 <= *len && MamGetBE16(list + off) == id)
+    {
+        cur = 5 + MamGetBE16(list + off + 3);
+        memmove(list + off, list + off + cur, *len - off - cur);
+        *len -= cur;
+    }
+
+    if (size == 5) return TRUE;
+    if (*len + size > cap) return FALSE;
+
+    memmove(list + off + size, list + off, *len - off);
+    memcpy(list + off, attr, size);
+    *len += size;
+    return TRUE;
+}
+
+static DWORD MamMockPassThrough(HANDLE h, const BYTE *cdb, DWORD cdbLen,
+    BOOL dataIn, BYTE *data, DWORD dataLen, DWORD *transferred)
+{
+    VTAPE   *vt = VTapeFromHandle(h);
+    WCHAR   path[MAX_PATH + 8];
+    BYTE    list[MAM_BUF];
+    DWORD   len = 0, off, size, out, first, plen;
+    DWORD   err;
+
+    *transferred = 0;
+    if (!vt || cdbLen < 16) return ERROR_INVALID_PARAMETER;
+
+    _snwprintf(path, MAX_PATH + 8, L"%s.mam", vt->path);
+    path[MAX_PATH + 7] = 0;
+    err = MamMockLoad(path, list, sizeof(list), &len);
+    if (err != NO_ERROR) return err;
+
+    if (cdb[0] == MAM_CDB_READ_ATTRIBUTE && dataIn && dataLen >= 4)
+    {
+        /* ATTRIBUTE VALUES from first requested id on */
+        first = MamGetBE16(cdb + 8);
+        out = 4;
+        for (off = 0; off + 5 <= len; off += size)
+        {
+            size = 5 + MamGetBE16(list + off + 3);
+            if (MamGetBE16(list + off) < first) continue;
+            if (out + size <= dataLen) memcpy(data + out, list + off, size);
+            out += size;
+        }
+        MamPutBE32(data, out - 4);
+        *transferred = (out < dataLen) ? out : dataLen;
+        return NO_ERROR;
+    }
+
+    if (cdb[0] == MAM_CDB_WRITE_ATTRIBUTE && !dataIn && dataLen >= 4)
+    {
+        plen = MamGetBE32(data);
+        if (plen > dataLen - 4) return ERROR_INVALID_PARAMETER;
+
+        for (off = 4; off + 5 <= plen + 4; off += size)
+        {
+            size = 5 + MamGetBE16(data + off + 3);
+            if (off + size > plen + 4) return ERROR_INVALID_PARAMETER;
+            if (!MamMockPut(list, &len, sizeof(list), data + off)) return ERROR_DISK_FULL;
+        }
+
+        *transferred = dataLen;
+        return MamMockSave(path, list, len);
+    }
+
+    return ERROR_INVALID_FUNCTION;
+}
+
+/* --------------------------------------
+Attribute I/O
+-------------------------------------- */
+static MAM_PASS_THROUGH MamPassThroughFor(HANDLE h)
+{
+    if (g_mamPassThrough) return g_mamPassThrough;
+    return VTapeFromHandle(h) ? MamMockPassThrough : MamScsiPassThrough;
+}
+
+static DWORD MamWriteAttributes(HANDLE h, BYTE *buf, DWORD len)
+{
+    BYTE    cdb[16];
+    DWORD   done = 0;
+
+    MamPutBE32(buf, len - 4);
+    ZeroMemory(cdb, sizeof(cdb));
+    cdb[0] = MAM_CDB_WRITE_ATTRIBUTE;
+    cdb[1] = 0x01;                  /* write through to cartridge */
+    MamPutBE32(cdb + 10, len);
+
+    return MamPassThroughFor(h)(h, cdb, sizeof(cdb), FALSE, buf, len, &done);
+}
+
+static DWORD MamPutAttribute(BYTE *buf, DWORD off, DWORD id, BYTE format,
+    const void *value, DWORD size)
+{
+    MamPutBE16(buf + off, id);
+    buf[off + 2] = format;
+    MamPutBE16(buf + off + 3, size);
+    if (size) memcpy(buf + off + 5, value, size);
+    return off + 5 + size;
+}
+
+void MamInitRecord(MAM_RECORD *rec, const ZEROTAPE_HEADER *zh,
+    DWORD archives, DWORD files, ULONGLONG used, DWORD flags)
+{
+    ZeroMemory(rec, sizeof(*rec));
+    memcpy(&rec->zh, zh, sizeof(*zh));
+    PutLE32(rec->archives, archives);
+    PutLE32(rec->files, files);
+    PutLE64(rec->used, used);
+    rec->flags = (unsigned char)flags;
+}
+
+BOOL MamRead(HANDLE h, MAM_RECORD *rec)
+{
+    BYTE    cdb[16];
+    BYTE    *buf;
+    DWORD   got = 0, avail, off, size;
+    DWORD   err;
+    BOOL    found = FALSE;
+
+    buf = (BYTE*)VirtualAlloc(NULL, MAM_BUF, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buf) return FALSE;
+
+    ZeroMemory(cdb, sizeof(cdb));
+    cdb[0] = MAM_CDB_READ_ATTRIBUTE;
+    cdb[1] = 0x00;                  /* ATTRIBUTE VALUES */
+    MamPutBE16(cdb + 8, MAM_ATTR_ZEROTAPE);
+    MamPutBE32(cdb + 10, MAM_BUF);
+
+    TRACE_BEGIN("mam read", 0);
+    err = MamPassThroughFor(h)(h, cdb, sizeof(cdb), TRUE, buf, MAM_BUF, &got);
+    TRACE_END("mam read", got);
+
+    if (err == NO_ERROR && got >= 4)
+    {
+        avail = MamGetBE32(buf) + 4;
+        if (avail > got) avail = got;
+        for (off = 4; off + 5 <= avail && !found; off += size)
+        {
+            size = 5 + MamGetBE16(buf + off + 3);
+            if (MamGetBE16(buf + off) == MAM_ATTR_ZEROTAPE &&
+                size == 5 + sizeof(MAM_RECORD) && off + size <= avail)
+            {
+                memcpy(rec, buf + off + 5, sizeof(MAM_RECORD));
+                found = memcmp(rec->zh.magic, "ZEROTAPE", 8) == 0;
+            }
+        }
+    }
+
+    VirtualFree(buf, 0, MEM_RELEASE);
+    SetLastError(found ? NO_ERROR : (err != NO_ERROR ? err : ERROR_NOT_FOUND));
+    return found;
+}
+
+/* record plus standard application and label attributes */
+BOOL MamWrite(HANDLE h, const MAM_RECORD *rec)
+{
+    BYTE    *buf;
+    char    vendor[8];
+    char    app[32];
+    char    label[160];
+    DWORD   len = 4;
+    DWORD   err;
+
+    buf = (BYTE*)VirtualAlloc(NULL, MAM_BUF, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buf) return FALSE;
+
+    /* ASCII attributes are left aligned, padded with spaces */
+    memset(vendor, ' ', sizeof(vendor));
+    memcpy(vendor, "ZEROTAPE", 8);
+    memset(app, ' ', sizeof(app));
+    memcpy(app, "TapeBackup", 10);
+    ZeroMemory(label, sizeof(label));
+    a_strncpyz(label, sizeof(label), rec->zh.name);
+
+    len = MamPutAttribute(buf, len, MAM_ATTR_APP_VENDOR, MAM_FORMAT_ASCII, vendor, sizeof(vendor));
+    len = MamPutAttribute(buf, len, MAM_ATTR_APP_NAME, MAM_FORMAT_ASCII, app, sizeof(app));
+    len = MamPutAttribute(buf, len, MAM_ATTR_USER_LABEL, MAM_FORMAT_TEXT, label, sizeof(label));
+    len = MamPutAttribute(buf, len, MAM_ATTR_ZEROTAPE, MAM_FORMAT_BINARY, rec, sizeof(*rec));
+
+    TRACE_BEGIN("mam write", len);
+    err = MamWriteAttributes(h, buf, len);
+    TRACE_END("mam write", len);
+    VirtualFree(buf, 0, MEM_RELEASE);
+
+    SetLastError(err);
+    return err == NO_ERROR;
+}
+
+/* zero length attribute: drive deletes it */
+BOOL MamClear(HANDLE h)
+{
+    BYTE    *buf;
+    DWORD   len;
+    DWORD   err;
+
+    buf = (BYTE*)VirtualAlloc(NULL, MAM_BUF, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buf) return FALSE;
+
+    len = MamPutAttribute(buf, 4, MAM_ATTR_ZEROTAPE, MAM_FORMAT_BINARY, NULL, 0);
+    err = MamWriteAttributes(h, buf, len);
+    VirtualFree(buf, 0, MEM_RELEASE);
+
+    SetLastError(err);
+    return err == NO_ERROR;
+}
@@ -0,0 +1,49 @@
+#ifndef __TAPE_BACKUP_MAM
+#define __TAPE_BACKUP_MAM
+
+#include "common.h"
+#include "utils.h"
+#include "vtape.h"
+#include "archive.h"
+
+/* --------------------------------------
+Cartridge memory (MAM): ZEROTAPE header of the tape and a short summary
+kept in a host vendor-specific attribute, so a cartridge can be named
+without moving media. Accessed with SCSI READ/WRITE ATTRIBUTE through
+a pass-through function: drives use IOCTL_SCSI_PASS_THROUGH_DIRECT,
+virtual tapes a mock that answers the same CDBs from <image>.mam.
+Tape itself stays the reference: writers clear the record before they
+touch BOT and store a new one when done. A record flagged MAM_FLAG_BOT
+holds the header at BOT, and ReadMetadataFromTape returns it without
+moving the tape.
+-------------------------------------- */
+#define MAM_ATTR_APP_VENDOR     0x0800  /* ASCII 8 */
+#define MAM_ATTR_APP_NAME       0x0801  /* ASCII 32 */
+#define MAM_ATTR_USER_LABEL     0x0803  /* TEXT 160 */
+#define MAM_ATTR_ZEROTAPE       0x1400  /* binary MAM_RECORD */
+#define MAM_BUF                 4096
+#define MAM_FLAG_BOT            0x01    /* zh is the header at BOT */
+
+#pragma pack(push,1)
+typedef struct _MAM_RECORD {
+    ZEROTAPE_HEADER zh;             /* archive 1, or index of empty partitioned tape */
+    unsigned char   archives[4];    /* little-endian 32-bit, archives on tape, 0 = unknown */
+    unsigned char   files[4];       /* little-endian 32-bit, files in them, 0 = not counted */
+    unsigned char   used[8];        /* little-endian 64-bit, section #2 bytes on tape */
+    unsigned char   flags;          /* MAM_FLAG_* */
+    unsigned char   reserved[15];   /* must be zero */
+} MAM_RECORD;                       /* total 160 */
+#pragma pack(pop)
+
+/* one SCSI command; data is page aligned, returns Win32 error */
+typedef DWORD (*MAM_PASS_THROUGH)(HANDLE h, const BYTE *cdb, DWORD cdbLen,
+    BOOL dataIn, BYTE *data, DWORD dataLen, DWORD *transferred);
+
+void MamSetPassThrough(MAM_PASS_THROUGH fn);
+BOOL MamRead(HANDLE h, MAM_RECORD *rec);
+BOOL MamWrite(HANDLE h, const MAM_RECORD *rec);
+BOOL MamClear(HANDLE h);
+void MamInitRecord(MAM_RECORD *rec, const ZEROTAPE_HEADER *zh,
+    DWORD archives, DWORD files, ULONGLONG used, DWORD flags);
+
+#endif
@@ -0,0 +1,253 @@
+#include "metrics.h"
+
+/* --------------------------------------
+Per-drive job metrics (Prometheus textfile export)
+-------------------------------------- */
+volatile BOOL               g_metricsEnabled = FALSE;
+
+static CRITICAL_SECTION     g_metricsLock;      /* never deleted, see MetricsStop */
+static BOOL                 g_metricsLockReady = FALSE;
+static DRIVE_METRICS        g_drives[METRICS_MAX_DRIVES];
+static int                  g_driveCount = 0;
+static METRICS_BINDING      g_bindings[METRICS_MAX_HANDLES];
+static WCHAR                g_metricsPath[MAX_PATH * 2];
+static DWORD                g_metricsPeriod;
+static HANDLE               g_metricsStop = NULL;
+static HANDLE               g_metricsThread = NULL;
+
+static const struct {
+    const char *name;
+    const char *help;
+} g_metricNames[METRIC_COUNT] = {
+    { "tapebackup_bytes_written_total", "Bytes written to tape." },
+    { "tapebackup_bytes_read_total", "Bytes read from tape." },
+    { "tapebackup_files_verified_total", "TAR members verified." },
+    { "tapebackup_bad_headers_total", "TAR headers with bad checksum or truncated." },
+    { "tapebackup_rewinds_total", "Tape rewind operations." },
+    { "tapebackup_filemark_ops_total", "Filemark write and space operations." },
+    { "tapebackup_device_errors_total", "Failed tape device operations." }
+};
+
+static ULONGLONG UnixTimeNow(void)
+{
+    FILETIME        ft;
+    ULARGE_INTEGER  u;
+
+    GetSystemTimeAsFileTime(&ft);
+    u.LowPart = ft.dwLowDateTime;
+    u.HighPart = ft.dwHighDateTime;
+    return (u.QuadPart - 116444736000000000ULL) / 10000000ULL;
+}
+
+static BOOL MetricsWrite(void);
+
+static DWORD WINAPI MetricsThreadProc(LPVOID param)
+{
+    while (WaitForSingleObject(g_metricsStop, g_metricsPeriod) == WAIT_TIMEOUT)
+        MetricsExport();
+
+    return 0;
+}
+
+BOOL MetricsStart(LPCWSTR path, DWORD periodMs)
+{
+    if (g_metricsEnabled) return TRUE;
+
+    if (!g_metricsLockReady)
+    {
+        InitializeCriticalSection(&g_metricsLock);
+        g_metricsLockReady = TRUE;
+    }
+    EnterCriticalSection(&g_metricsLock);
+    ZeroMemory(g_drives, sizeof(g_drives));
+    ZeroMemory(g_bindings, sizeof(g_bindings));
+    g_driveCount = 0;
+    LeaveCriticalSection(&g_metricsLock);
+
+    wcsncpy(g_metricsPath, path, MAX_PATH * 2 - 1);
+    g_metricsPath[MAX_PATH * 2 - 1] = 0;
+    g_metricsPeriod = periodMs ? periodMs : METRICS_DEFAULT_PERIOD;
+
+    g_metricsStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!g_metricsStop) return FALSE;
+
+    g_metricsEnabled = TRUE;
+    g_metricsThread = CreateThread(NULL, 0, MetricsThreadProc, NULL, 0, NULL);
+    if (!g_metricsThread)
+    {
+        g_metricsEnabled = FALSE;
+        CloseHandle(g_metricsStop);
+        return FALSE;
+    }
+
+    MetricsExport();
+    return TRUE;
+}
+
+/* Threads still inside METRIC_ADD may have passed the flag check before
+   it was cleared, so the lock is kept until the process ends */
+void MetricsStop(void)
+{
+    if (!g_metricsEnabled) return;
+
+    g_metricsEnabled = FALSE;
+    SetEvent(g_metricsStop);
+    WaitForSingleObject(g_metricsThread, INFINITE);
+    CloseHandle(g_metricsThread);
+    CloseHandle(g_metricsStop);
+
+    MetricsWrite();
+}
+
+/* Caller must hold g_metricsLock */
+static int MetricsFindDrive(LPCWSTR devicePath)
+{
+    int i;
+
+    for (i = 0; i < g_driveCount; i++)
+        if (_wcsicmp(g_drives[i].devicePath, devicePath) == 0)
+            return i;
+
+    if (g_driveCount >= METRICS_MAX_DRIVES) return -1;
+
+    i = g_driveCount++;
+    ZeroMemory(&g_drives[i], sizeof(g_drives[i]));
+    wcsncpy(g_drives[i].devicePath, devicePath, 31);
+    g_drives[i].devicePath[31] = 0;
+    return i;
+}
+
+void MetricsBindHandle(HANDLE h, LPCWSTR devicePath)
+{
+    int i, drive;
+
+    if (!g_metricsEnabled) return;
+
+    EnterCriticalSection(&g_metricsLock);
+    drive = MetricsFindDrive(devicePath);
+    if (drive >= 0)
+        for (i = 0; i < METRICS_MAX_HANDLES; i++)
+            if (g_bindings[i].h == NULL || g_bindings[i].h == h)
+            {
+                g_bindings[i].h = h;
+                g_bindings[i].drive = drive;
+                break;
+            }
+    LeaveCriticalSection(&g_metricsLock);
+}
+
+void MetricsUnbindHandle(HANDLE h)
+{
+    int i;
+
+    if (!g_metricsEnabled) return;
+
+    EnterCriticalSection(&g_metricsLock);
+    for (i = 0; i < METRICS_MAX_HANDLES; i++)
+        if (g_bindings[i].h == h)
+            g_bindings[i].h = NULL;
+    LeaveCriticalSection(&g_metricsLock);
+}
+
+void MetricsAdd(HANDLE h, METRIC_ID id, ULONGLONG v)
+{
+    int             i;
+    DRIVE_METRICS   *dm;
+
+    EnterCriticalSection(&g_metricsLock);
+    for (i = 0; i < METRICS_MAX_HANDLES; i++)
+        if (g_bindings[i].h == h && h != NULL)
+        {
+            dm = &g_drives[g_bindings[i].drive];
+            dm->counters[id] += v;
+            if (v && (id == METRIC_BYTES_WRITTEN || id == METRIC_BYTES_READ))
+                dm->lastIoUnix = UnixTimeNow();
+            break;
+        }
+    LeaveCriticalSection(&g_metricsLock);
+}
+
+static void LabelEscape(LPCWSTR in, char *out, size_t outsz)
+{
+    char    utf8[128];
+    size_t  i, o = 0;
+
+    if (WideCharToMultiByte(CP_UTF8, 0, in, -1, utf8, sizeof(utf8), NULL, NULL) <= 0)
+        utf8[0] = 0;
+
+    for (i = 0; utf8[i] && o + 2 < outsz; i++)
+    {
+        if (utf8[i] == '\\' || utf8[i] == '"')
+            out[o++] = '\\';
+        out[o++] = utf8[i];
+    }
+    out[o] = 0;
+}
+
+BOOL MetricsExport(void)
+{
+    if (!g_metricsEnabled) return FALSE;
+    return MetricsWrite();
+}
+
+/* Writes textfile atomically (temp + rename) for node_exporter textfile collector */
+static BOOL MetricsWrite(void)
+{
+    WCHAR           tmpPath[MAX_PATH * 2 + 8];
+    FILE            *f;
+    int             d, m;
+    char            label[256];
+    LARGE_INTEGER   now, freq;
+    ULONGLONG       bytes;
+    DRIVE_METRICS   *dm;
+
+    _snwprintf(tmpPath, MAX_PATH * 2 + 8, L"%s.tmp", g_metricsPath);
+    tmpPath[MAX_PATH * 2 + 7] = 0;
+    f = _wfopen(tmpPath, L"wb");
+    if (!f) return FALSE;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    EnterCriticalSection(&g_metricsLock);
+    for (m = 0; m < METRIC_COUNT; m++)
+    {
+        fprintf(f, "# HELP %s %s\n", g_metricNames[m].name, g_metricNames[m].help);
+        fprintf(f, "# TYPE %s counter\n", g_metricNames[m].name);
+        for (d = 0; d < g_driveCount; d++)
+        {
+            LabelEscape(g_drives[d].devicePath, label, sizeof(label));
+            fprintf(f, "%s{device=\"%s\"} %I64u\n", g_metricNames[m].name,
+                label, g_drives[d].counters[m]);
+        }
+    }
+
+    fprintf(f, "# HELP tapebackup_throughput_mbps Tape throughput over last export period, MB/s.\n");
+    fprintf(f, "# TYPE tapebackup_throughput_mbps gauge\n");
+    for (d = 0; d < g_driveCount; d++)
+    {
+        dm = &g_drives[d];
+        bytes = dm->counters[METRIC_BYTES_WRITTEN] + dm->counters[METRIC_BYTES_READ];
+        if (dm->lastExport && now.QuadPart > dm->lastExport)
+            dm->mbps = (double)(bytes - dm->lastBytes) / 1000000.0 /
+                ((double)(now.QuadPart - dm->lastExport) / (double)freq.QuadPart);
+        dm->lastBytes = bytes;
+        dm->lastExport = now.QuadPart;
+
+        LabelEscape(dm->devicePath, label, sizeof(label));
+        fprintf(f, "tapebackup_throughput_mbps{device=\"%s\"} %.3f\n", label, dm->mbps);
+    }
+
+    fprintf(f, "# HELP tapebackup_last_io_timestamp_seconds Unix time of last tape data transfer.\n");
+    fprintf(f, "# TYPE tapebackup_last_io_timestamp_seconds gauge\n");
+    for (d = 0; d < g_driveCount; d++)
+    {
+        LabelEscape(g_drives[d].devicePath, label, sizeof(label));
+        fprintf(f, "tapebackup_last_io_timestamp_seconds{device=\"%s\"} %I64u\n",
+            label, g_drives[d].lastIoUnix);
+    }
+    LeaveCriticalSection(&g_metricsLock);
+
+    fclose(f);
+    return MoveFileExW(tmpPath, g_metricsPath, MOVEFILE_REPLACE_EXISTING);
+}
@@ -0,0 +1,51 @@
+#ifndef __TAPE_BACKUP_METRICS
+#define __TAPE_BACKUP_METRICS
+
+#include "common.h"
+
+/* --------------------------------------
+Per-drive job metrics (Prometheus textfile export)
+-------------------------------------- */
+#define METRICS_MAX_DRIVES      16
+#define METRICS_MAX_HANDLES     64
+#define METRICS_DEFAULT_PERIOD  10000 /* ms */
+
+typedef enum _METRIC_ID {
+    METRIC_BYTES_WRITTEN = 0,
+    METRIC_BYTES_READ,
+    METRIC_FILES_VERIFIED,
+    METRIC_BAD_HEADERS,
+    METRIC_REWINDS,
+    METRIC_FILEMARK_OPS,
+    METRIC_DEVICE_ERRORS,
+    METRIC_COUNT
+} METRIC_ID;
+
+typedef struct _DRIVE_METRICS {
+    WCHAR       devicePath[32];
+    ULONGLONG   counters[METRIC_COUNT];
+    ULONGLONG   lastBytes;      /* read + written at previous export */
+    LONGLONG    lastExport;     /* QueryPerformanceCounter ticks */
+    double      mbps;           /* throughput over previous period */
+    ULONGLONG   lastIoUnix;     /* unix time of last byte moved */
+} DRIVE_METRICS;
+
+typedef struct _METRICS_BINDING {
+    HANDLE      h;
+    int         drive;
+} METRICS_BINDING;
+
+extern volatile BOOL g_metricsEnabled;
+
+BOOL MetricsStart(LPCWSTR path, DWORD periodMs);
+void MetricsStop(void);
+void MetricsBindHandle(HANDLE h, LPCWSTR devicePath);
+void MetricsUnbindHandle(HANDLE h);
+void MetricsAdd(HANDLE h, METRIC_ID id, ULONGLONG v);
+BOOL MetricsExport(void);
+
+/* Cheap when metrics are off: single global flag check */
+#define METRIC_ADD(h, id, v) \
+    do { if (g_metricsEnabled) MetricsAdd((h), (id), (ULONGLONG)(v)); } while (0)
+
+#endif
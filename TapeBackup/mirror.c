@@ -0,0 +1,174 @@
+#include "mirror.h"
+
+/* --------------------------------------
+Mirrored write
+-------------------------------------- */
+static DWORD WINAPI MirrorWriterThread(LPVOID param)
+{
+    MIRROR_TAPE *t = (MIRROR_TAPE*)param;
+    MIRROR_SET  *m = t->set;
+    BYTE        *buf;
+    DWORD       slot, len, off, n;
+    DWORD       written = 0;
+
+    TraceThreadName("mirror writer");
+    for (;;)
+    {
+        WaitForSingleObject(t->semFull, INFINITE);
+        slot = t->tail;
+        buf = m->bufs[slot];
+        len = m->lens[slot];
+        if (len == 0) return 0;
+
+        for (off = 0; !t->failed && off < len; off += n)
+        {
+            n = (len - off > t->blockSize) ? t->blockSize : len - off;
+
+            TRACE_BEGIN("tape write", 0);
+            if (!TapeWrite(t->h, buf + off, n, &written) || written != n)
+            {
+                t->error = GetLastError();
+                InterlockedExchange(&t->failed, 1);
+                METRIC_ADD(t->h, METRIC_DEVICE_ERRORS, 1);
+            }
+            TRACE_END("tape write", written);
+            METRIC_ADD(t->h, METRIC_BYTES_WRITTEN, written);
+        }
+
+        /* last writer done with the slot returns it to the reader */
+        t->tail = (slot + 1) % m->depth;
+        if (InterlockedDecrement(&m->refs[slot]) == 0)
+            ReleaseSemaphore(m->semFree, 1, NULL);
+    }
+}
+
+static void MirrorFree(MIRROR_SET *m)
+{
+    DWORD i;
+
+    for (i = 0; i < m->count; i++)
+    {
+        if (m->tapes[i].semFull) CloseHandle(m->tapes[i].semFull);
+        m->tapes[i].semFull = NULL;
+    }
+
+    for (i = 0; i < MIRROR_MAX_BUFFERS; i++)
+    {
+        if (m->bufs[i]) VirtualFree(m->bufs[i], 0, MEM_RELEASE);
+        m->bufs[i] = NULL;
+    }
+
+    if (m->semFree) CloseHandle(m->semFree);
+    m->semFree = NULL;
+}
+
+/* slot at head goes to every writer */
+static void MirrorPublish(MIRROR_SET *m, DWORD len)
+{
+    DWORD i;
+
+    m->lens[m->head] = len;
+    m->refs[m->head] = (LONG)m->count;
+    m->head = (m->head + 1) % m->depth;
+    for (i = 0; i < m->count; i++)
+        ReleaseSemaphore(m->tapes[i].semFull, 1, NULL);
+}
+
+/* m->tapes[].h and .blockSize are set by caller, tapes positioned for data */
+BOOL MirrorWrite(MIRROR_SET *m, HANDLE hf, ULONGLONG totalSize, DWORD memBudget)
+{
+    ULONGLONG   done = 0;
+    DWORD       i, toRead, got;
+    DWORD       alive;
+    BOOL        ok = TRUE;
+
+    m->bufSize = 0;
+    for (i = 0; i < m->count; i++)
+        if (m->tapes[i].blockSize > m->bufSize) m->bufSize = m->tapes[i].blockSize;
+
+    m->depth = memBudget / m->bufSize;
+    if (m->depth < 2) m->depth = 2;
+    if (m->depth > MIRROR_MAX_BUFFERS) m->depth = MIRROR_MAX_BUFFERS;
+    m->head = 0;
+
+    m->semFree = CreateSemaphoreW(NULL, (LONG)m->depth, (LONG)m->depth, NULL);
+    for (i = 0; m->semFree && i < m->depth; i++)
+    {
+        m->bufs[i] = (BYTE*)VirtualAlloc(NULL, m->bufSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!m->bufs[i]) break;
+    }
+
+    if (!m->semFree || i < m->depth)
+    {
+        wprintf(L"Out of memory.\r\n");
+        MirrorFree(m);
+        return FALSE;
+    }
+
+    for (i = 0; i < m->count; i++)
+    {
+        m->tapes[i].set = m;
+        m->tapes[i].tail = 0;
+        m->tapes[i].failed = 0;
+        m->tapes[i].semFull = CreateSemaphoreW(NULL, 0, (LONG)m->depth, NULL);
+        m->tapes[i].thread = m->tapes[i].semFull ?
+            CreateThread(NULL, 0, MirrorWriterThread, &m->tapes[i], 0, NULL) : NULL;
+        if (!m->tapes[i].thread)
+        {
+            PrintLastErrorW(L"Failed to start I/O thread", 0);
+            if (m->tapes[i].semFull) CloseHandle(m->tapes[i].semFull);
+            m->tapes[i].semFull = NULL;
+            m->count = i;
+            ok = FALSE;
+            break;
+        }
+    }
+
+    while (ok && done < totalSize)
+    {
+        WaitForSingleObject(m->semFree, INFINITE);
+
+        toRead = (totalSize - done > m->bufSize) ? m->bufSize : (DWORD)(totalSize - done);
+        TRACE_BEGIN("source read", 0);
+        if (!ReadFile(hf, m->bufs[m->head], toRead, &got, NULL) || got != toRead)
+        {
+            TRACE_END("source read", 0);
+            PrintLastErrorW(L"Failed to read source file", 0);
+            ReleaseSemaphore(m->semFree, 1, NULL);
+            ok = FALSE;
+            break;
+        }
+        TRACE_END("source read", got);
+
+        MirrorPublish(m, got);
+        done += got;
+
+        for (i = 0, alive = 0; i < m->count; i++)
+            if (!m->tapes[i].failed) alive++;
+        if (alive == 0)
+        {
+            wprintf(L"\r\nAll drives failed.\r\n");
+            ok = FALSE;
+        }
+
+        DrawProgressBar((unsigned)((done * 100ULL) / (totalSize ? totalSize : 1)), done, totalSize);
+    }
+
+    /* end of stream, writers stop at it without touching refs */
+    if (m->count)
+    {
+        WaitForSingleObject(m->semFree, INFINITE);
+        MirrorPublish(m, 0);
+    }
+
+    for (i = 0; i < m->count; i++)
+    {
+        WaitForSingleObject(m->tapes[i].thread, INFINITE);
+        CloseHandle(m->tapes[i].thread);
+        m->tapes[i].thread = NULL;
+    }
+
+    MirrorFree(m);
+    wprintf(L"\r\n");
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef __TAPE_BACKUP_MIRROR
+#define __TAPE_BACKUP_MIRROR
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+
+/* --------------------------------------
+Mirrored write: one reader fills each buffer once, every tape writer
+thread writes the same buffer and drops its reference; buffer is reused
+when the last (slowest) writer is done with it, so the slowest drive
+paces the reader and nothing is copied. A failed drive keeps dropping
+references without writing, the other copies go on.
+-------------------------------------- */
+#define MIRROR_MAX_TAPES    8
+#define MIRROR_MAX_BUFFERS  64
+
+typedef struct _MIRROR_TAPE {
+    HANDLE          h;
+    DWORD           blockSize;
+    HANDLE          thread;
+    HANDLE          semFull;
+    DWORD           tail;
+    volatile LONG   failed;
+    DWORD           error;
+    struct _MIRROR_SET *set;
+} MIRROR_TAPE;
+
+typedef struct _MIRROR_SET {
+    MIRROR_TAPE     tapes[MIRROR_MAX_TAPES];
+    DWORD           count;
+    BYTE            *bufs[MIRROR_MAX_BUFFERS];
+    DWORD           lens[MIRROR_MAX_BUFFERS];   /* 0 - end of stream */
+    volatile LONG   refs[MIRROR_MAX_BUFFERS];
+    DWORD           depth;
+    DWORD           bufSize;
+    DWORD           head;
+    HANDLE          semFree;
+} MIRROR_SET;
+
+BOOL MirrorWrite(MIRROR_SET *m, HANDLE hf, ULONGLONG totalSize, DWORD memBudget);
+
+#endif
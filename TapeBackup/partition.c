@@ -0,0 +1,330 @@
+#include "partition.h"
+
+void IndexInit(TAPE_INDEX *idx)
+{
+    ZeroMemory(idx, sizeof(*idx));
+}
+
+void IndexFree(TAPE_INDEX *idx)
+{
+    if (idx->data) free(idx->data);
+    ZeroMemory(idx, sizeof(*idx));
+}
+
+static BOOL IndexAppend(TAPE_INDEX *idx, const void *p, DWORD n)
+{
+    BYTE    *grown;
+    DWORD   cap;
+
+    if (idx->bytes + n > PART_INDEX_MAX)
+    {
+        wprintf(L"Tape index is full.\r\n");
+        return FALSE;
+    }
+
+    if (idx->bytes + n > idx->cap)
+    {
+        cap = idx->cap ? idx->cap : 64 * 1024;
+        while (cap < idx->bytes + n) cap *= 2;
+        grown = (BYTE*)realloc(idx->data, cap);
+        if (!grown)
+        {
+            wprintf(L"Out of memory.\r\n");
+            return FALSE;
+        }
+        idx->data = grown;
+        idx->cap = cap;
+    }
+
+    memcpy(idx->data + idx->bytes, p, n);
+    idx->bytes += n;
+    return TRUE;
+}
+
+INDEX_ARCHIVE* IndexArchive(const TAPE_INDEX *idx, DWORD index)
+{
+    INDEX_ARCHIVE   *a;
+    DWORD           off = 0;
+    DWORD           i;
+
+    for (i = 0; i < idx->count; i++)
+    {
+        a = (INDEX_ARCHIVE*)(idx->data + off);
+        if (i == index) return a;
+        off += sizeof(INDEX_ARCHIVE) + GetLE32(a->tocbytes);
+    }
+
+    return NULL;
+}
+
+/* --------------------------------------
+Index archive on tape
+-------------------------------------- */
+/* at section #2 of index archive zh, checks its SHA-1 and record layout */
+BOOL IndexReadSection(HANDLE ht, const ZEROTAPE_HEADER *zh, TAPE_INDEX *idx)
+{
+    ULONGLONG       total = GetLE64(zh->sizeofarchive);
+    DWORD           bs = ZeroTapeBlockSize(zh);
+    DWORD           off, n, toc;
+    DWORD           got = 0;
+    SHA1_CTX        ctx;
+    unsigned char   digest[20];
+
+    IndexInit(idx);
+    if (zh->format != ZEROTAPE_FORMAT_INDEX || total > PART_INDEX_MAX)
+    {
+        wprintf(L"Invalid tape index.\r\n");
+        return FALSE;
+    }
+
+    if (total == 0) return TRUE;
+
+    idx->data = (BYTE*)malloc((size_t)total);
+    if (!idx->data)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+    idx->cap = (DWORD)total;
+
+    TRACE_BEGIN("read index", 0);
+    for (off = 0; off < (DWORD)total; off += got)
+    {
+        n = ((DWORD)total - off > bs) ? bs : (DWORD)total - off;
+        if (!TapeRead(ht, idx->data + off, n, &got) || got == 0)
+        {
+            TRACE_END("read index", off);
+            PrintLastErrorW(L"Failed to read tape index", 0);
+            IndexFree(idx);
+            return FALSE;
+        }
+        METRIC_ADD(ht, METRIC_BYTES_READ, got);
+    }
+    TRACE_END("read index", total);
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, idx->data, (DWORD)total);
+    sha1_final(&ctx, digest);
+    if (memcmp(digest, zh->sha1, 20) != 0)
+    {
+        wprintf(L"Tape index SHA-1 mismatch.\r\n");
+        IndexFree(idx);
+        return FALSE;
+    }
+
+    /* archive records with their file lists must fill the section exactly */
+    idx->bytes = (DWORD)total;
+    for (off = 0; off + sizeof(INDEX_ARCHIVE) <= idx->bytes; off += sizeof(INDEX_ARCHIVE) + toc)
+    {
+        toc = GetLE32(((INDEX_ARCHIVE*)(idx->data + off))->tocbytes);
+        if (toc > idx->bytes - off - sizeof(INDEX_ARCHIVE)) break;
+        idx->count++;
+    }
+
+    if (off != idx->bytes)
+    {
+        wprintf(L"Invalid tape index.\r\n");
+        IndexFree(idx);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* zh - index header from JobInitHeader, size, SHA-1 and format are set here;
+   whole index partition is rewritten, data partition isn't touched */
+BOOL IndexWrite(HANDLE ht, const TAPE_INDEX *idx, ZEROTAPE_HEADER *zh)
+{
+    DWORD       bs = ZeroTapeBlockSize(zh);
+    DWORD       off, n;
+    DWORD       written = 0;
+    SHA1_CTX    ctx;
+    BOOL        result;
+
+    sha1_init(&ctx);
+    if (idx->bytes) sha1_update(&ctx, idx->data, idx->bytes);
+    sha1_final(&ctx, zh->sha1);
+    PutLE64(zh->sizeofarchive, idx->bytes);
+    zh->format = ZEROTAPE_FORMAT_INDEX;
+
+    if (!TapeLocate(ht, PART_INDEX, 0))
+    {
+        PrintLastErrorW(L"Failed to locate index partition", 0);
+        return FALSE;
+    }
+
+    if (!WriteMetadataSection(ht, zh)) return FALSE;
+
+    TRACE_BEGIN("write index", idx->bytes);
+    for (off = 0; off < idx->bytes; off += n)
+    {
+        n = (idx->bytes - off > bs) ? bs : idx->bytes - off;
+        result = TapeWrite(ht, idx->data + off, n, &written);
+        METRIC_ADD(ht, METRIC_BYTES_WRITTEN, written);
+        if (written != n || (!result && GetLastError() != ERROR_END_OF_MEDIA))
+        {
+            TRACE_END("write index", off);
+            PrintLastErrorW(L"Failed to write tape index", 0);
+            return FALSE;
+        }
+    }
+    TRACE_END("write index", idx->bytes);
+
+    if (!TapeWriteFilemark(ht) && GetLastError() != ERROR_END_OF_MEDIA)
+    {
+        PrintLastErrorW(L"Failed to write filemark after tape index", 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* --------------------------------------
+TOC of a new archive, from the TAR file before it goes to tape
+-------------------------------------- */
+typedef struct _INDEX_SCAN {
+    TAPE_INDEX      *idx;
+    DWORD           files;
+    BOOL            failed;
+} INDEX_SCAN;
+
+static void IndexScanMember(void *ctx, const TAR_MEMBER *m)
+{
+    INDEX_SCAN      *scan = (INDEX_SCAN*)ctx;
+    INDEX_FILE      f;
+    INDEX_FILE_META meta;
+    DWORD           len = (DWORD)strlen(m->name);
+
+    if (scan->failed) return;
+
+    PutLE64(f.offset, m->offset);
+    PutLE64(f.size, m->size);
+    PutLE32(f.namelen, len);
+    ZeroMemory(&meta, sizeof(meta));
+    PutLE64(meta.dataOffset, m->dataOffset);
+    PutLE64(meta.mtime, (ULONGLONG)m->mtime);
+    PutLE32(meta.mode, m->mode);
+    meta.type = (unsigned char)m->type;
+    if (!IndexAppend(scan->idx, &f, sizeof(f)) || !IndexAppend(scan->idx, &meta, sizeof(meta)) ||
+        !IndexAppend(scan->idx, m->name, len))
+        scan->failed = TRUE;
+    else
+        scan->files++;
+}
+
+/* member names (UTF-8) and offsets from TAR headers */
+static BOOL IndexScanTar(TAPE_INDEX *idx, HANDLE hf, DWORD start)
+{
+    INDEX_SCAN      scan;
+    INDEX_ARCHIVE   *a;
+
+    scan.idx = idx;
+    scan.files = 0;
+    scan.failed = FALSE;
+    if (!ScanTarFile(hf, IndexScanMember, &scan) || scan.failed) return FALSE;
+
+    a = (INDEX_ARCHIVE*)(idx->data + start);
+    PutLE32(a->files, scan.files);
+    PutLE32(a->tocbytes, idx->bytes - start - (DWORD)sizeof(INDEX_ARCHIVE));
+    return TRUE;
+}
+
+/* new archive goes last; its blocks are set by IndexSetBlocks once written */
+BOOL IndexAddArchive(TAPE_INDEX *idx, const ZEROTAPE_HEADER *zh, LPCWSTR tarPath)
+{
+    INDEX_ARCHIVE   a;
+    DWORD           start = idx->bytes;
+    HANDLE          hf;
+    BOOL            ok;
+
+    ZeroMemory(&a, sizeof(a));
+    memcpy(&a.zh, zh, sizeof(*zh));
+    PutLE64(a.metablock, PART_NO_BLOCK);
+    PutLE64(a.datablock, PART_NO_BLOCK);
+    a.filever = INDEX_FILE_VERSION;
+    if (!IndexAppend(idx, &a, sizeof(a))) return FALSE;
+
+    hf = CreateFileW(tarPath, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Failed to open source file", 0);
+        idx->bytes = start;
+        return FALSE;
+    }
+
+    TRACE_BEGIN("index tar", 0);
+    ok = IndexScanTar(idx, hf, start);
+    TRACE_END("index tar", idx->bytes - start);
+    CloseHandle(hf);
+    if (!ok)
+    {
+        idx->bytes = start;
+        return FALSE;
+    }
+
+    idx->count++;
+    return TRUE;
+}
+
+void IndexSetBlocks(TAPE_INDEX *idx, DWORD index, ULONGLONG metaBlock, ULONGLONG dataBlock)
+{
+    INDEX_ARCHIVE *a = IndexArchive(idx, index);
+
+    if (!a) return;
+    PutLE64(a->metablock, metaBlock);
+    PutLE64(a->datablock, dataBlock);
+}
+
+/* sink gets what the index keeps: no owners or links; an index older than
+   filever 1 has no data offsets, dates or modes and its types are
+   TAR_TYPE_UNKNOWN */
+void IndexPrintTOC(const TAPE_INDEX *idx, DWORD index, FILE *fout, TAR_MEMBER_SINK sink, void *ctx)
+{
+    INDEX_ARCHIVE           *a = IndexArchive(idx, index);
+    const INDEX_FILE        *f;
+    const INDEX_FILE_META   *meta;
+    const BYTE              *p, *end;
+    WCHAR                   wname[1024];
+    char                    name[1024 * 3];
+    TAR_MEMBER              m;
+    DWORD                   len, head;
+
+    if (!a) return;
+
+    head = sizeof(INDEX_FILE) + ((a->filever >= 1) ? sizeof(INDEX_FILE_META) : 0);
+    p = (const BYTE*)(a + 1);
+    end = p + GetLE32(a->tocbytes);
+    while (p + head <= end)
+    {
+        f = (const INDEX_FILE*)p;
+        meta = (a->filever >= 1) ? (const INDEX_FILE_META*)(f + 1) : NULL;
+        len = GetLE32(f->namelen);
+        if (len > (DWORD)(end - p) - head) break;
+
+        AnsiOrUtf8ToWide((const char*)p + head, len, wname, 1024);
+        wprintf(L"%ws\r\n", wname);
+        if (fout) FPrintLineUtf8(fout, wname);
+        if (sink && WideCharToMultiByte(CP_UTF8, 0, wname, -1, name, sizeof(name), NULL, NULL))
+        {
+            ZeroMemory(&m, sizeof(m));
+            m.name = name;
+            m.offset = GetLE64(f->offset);
+            m.size = GetLE64(f->size);
+            m.type = TAR_TYPE_UNKNOWN;
+            m.format = (char)TAR_FORMAT_UNKNOWN;
+            if (meta)
+            {
+                m.dataOffset = GetLE64(meta->dataOffset);
+                m.mtime = (LONGLONG)GetLE64(meta->mtime);
+                m.mode = GetLE32(meta->mode);
+                m.type = (char)meta->type;
+            }
+            m.link = "";
+            m.uname = "";
+            m.gname = "";
+            sink(ctx, &m);
+        }
+        p += head + len;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef __TAPE_BACKUP_PARTITION
+#define __TAPE_BACKUP_PARTITION
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+
+/* --------------------------------------
+Partitioned layout: partition 1 (small, first) holds one index archive,
+partition 2 holds metadata/data pairs back to back.
+The index archive is a ZEROTAPE pair of format 3. Its section #2 has,
+for each data archive, an INDEX_ARCHIVE record followed by INDEX_FILE
+records of its TAR members; since filever 1 each one carries an
+INDEX_FILE_META between record and name. Archives and members are found by logical
+block in the data partition, so listing needs only the index at BOT
+and locating is one seek. Adding an archive rewrites only partition 1.
+-------------------------------------- */
+#define PART_INDEX              1       /* Win32 partition numbers start at 1 */
+#define PART_DATA               2
+#define PART_DEFAULT_INDEX_MIB  1024    /* drive rounds up to its own minimum */
+#define PART_INDEX_MAX          (256 * 1024 * 1024)
+#define PART_NO_BLOCK           ((ULONGLONG)-1)
+#define INDEX_FILE_VERSION      1       /* written by IndexAddArchive */
+
+#pragma pack(push,1)
+typedef struct _INDEX_ARCHIVE {
+    ZEROTAPE_HEADER zh;
+    unsigned char   metablock[8];   /* little-endian 64-bit, metadata in data partition */
+    unsigned char   datablock[8];   /* little-endian 64-bit, section #2 in data partition */
+    unsigned char   files[4];       /* little-endian 32-bit, INDEX_FILE records that follow */
+    unsigned char   tocbytes[4];    /* little-endian 32-bit, size of those records */
+    unsigned char   filever;        /* 0 - INDEX_FILE + name, 1 - INDEX_FILE + INDEX_FILE_META + name */
+    unsigned char   reserved[103];  /* must be zero */
+} INDEX_ARCHIVE;                    /* total 256 */
+
+typedef struct _INDEX_FILE {
+    unsigned char   offset[8];      /* little-endian 64-bit, member's first header in section #2 */
+    unsigned char   size[8];        /* little-endian 64-bit, member data */
+    unsigned char   namelen[4];     /* little-endian 32-bit, name bytes that follow, no NUL */
+} INDEX_FILE;                       /* total 20 + name */
+
+typedef struct _INDEX_FILE_META {
+    unsigned char   dataOffset[8];  /* little-endian 64-bit, member data in section #2 */
+    unsigned char   mtime[8];       /* little-endian 64-bit, seconds since 1970 */
+    unsigned char   mode[4];        /* little-endian 32-bit */
+    unsigned char   type;           /* TAR typeflag, '0' for NUL */
+    unsigned char   reserved[3];    /* must be zero */
+} INDEX_FILE_META;                  /* total 24 */
+#pragma pack(pop)
+
+typedef struct _TAPE_INDEX {
+    BYTE        *data;      /* section #2 of index archive */
+    DWORD       bytes;
+    DWORD       cap;
+    DWORD       count;      /* archives */
+} TAPE_INDEX;
+
+void IndexInit(TAPE_INDEX *idx);
+void IndexFree(TAPE_INDEX *idx);
+BOOL IndexReadSection(HANDLE ht, const ZEROTAPE_HEADER *zh, TAPE_INDEX *idx);
+BOOL IndexWrite(HANDLE ht, const TAPE_INDEX *idx, ZEROTAPE_HEADER *zh);
+BOOL IndexAddArchive(TAPE_INDEX *idx, const ZEROTAPE_HEADER *zh, LPCWSTR tarPath);
+void IndexSetBlocks(TAPE_INDEX *idx, DWORD index, ULONGLONG metaBlock, ULONGLONG dataBlock);
+INDEX_ARCHIVE* IndexArchive(const TAPE_INDEX *idx, DWORD index);
+void IndexPrintTOC(const TAPE_INDEX *idx, DWORD index, FILE *fout, TAR_MEMBER_SINK sink, void *ctx);
+
+#endif
@@ -0,0 +1,167 @@
+#include "ring.h"
+
+/* --------------------------------------
+Buffer ring
+-------------------------------------- */
+/* page aligned buffers: tape drivers DMA straight from them */
+static BYTE* RingAlloc(DWORD size)
+{
+    return (BYTE*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+BOOL RingCreate(BUF_RING *r, DWORD count, DWORD bufSize)
+{
+    ZeroMemory(r, sizeof(*r));
+    InitializeCriticalSection(&r->lock);
+    r->semFree = CreateSemaphoreW(NULL, 0, RING_MAX_BUFFERS, NULL);
+    r->semFull = CreateSemaphoreW(NULL, 0, RING_MAX_BUFFERS, NULL);
+    if (!r->semFree || !r->semFull)
+    {
+        RingDestroy(r);
+        return FALSE;
+    }
+
+    if (count < 1) count = 1;
+    if (!RingResize(r, count, bufSize) || r->count == 0)
+    {
+        RingDestroy(r);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void RingDestroy(BUF_RING *r)
+{
+    DWORD i;
+
+    for (i = 0; i < RING_MAX_BUFFERS; i++)
+        if (r->store[i].data) VirtualFree(r->store[i].data, 0, MEM_RELEASE);
+
+    if (r->semFree) CloseHandle(r->semFree);
+    if (r->semFull) CloseHandle(r->semFull);
+    DeleteCriticalSection(&r->lock);
+    ZeroMemory(r, sizeof(*r));
+}
+
+/* grows at once; shrinking and new size are applied by producer */
+BOOL RingResize(BUF_RING *r, DWORD count, DWORD bufSize)
+{
+    DWORD   i;
+    LONG    added = 0;
+    BOOL    ok = TRUE;
+
+    if (count < 1) count = 1;
+    if (count > RING_MAX_BUFFERS) count = RING_MAX_BUFFERS;
+
+    EnterCriticalSection(&r->lock);
+    r->target = count;
+    r->bufSize = bufSize;
+    for (i = 0; i < RING_MAX_BUFFERS && r->count < count; i++)
+    {
+        if (r->store[i].data) continue;
+
+        r->store[i].data = RingAlloc(bufSize);
+        if (!r->store[i].data)
+        {
+            ok = FALSE;
+            break;
+        }
+        r->store[i].size = bufSize;
+        r->pool[r->poolCount++] = &r->store[i];
+        r->count++;
+        added++;
+    }
+    LeaveCriticalSection(&r->lock);
+
+    if (added) ReleaseSemaphore(r->semFree, added, NULL);
+    return ok;
+}
+
+BYTE* RingGetFree(BUF_RING *r)
+{
+    RING_BUF    *b;
+    DWORD       want;
+    BYTE        *data;
+    double      t0;
+
+    for (;;)
+    {
+        t0 = TimerSeconds();
+        WaitForSingleObject(r->semFree, INFINITE);
+        r->prodWait += TimerSeconds() - t0;
+        if (r->aborted) return NULL;
+
+        EnterCriticalSection(&r->lock);
+        b = r->pool[--r->poolCount];
+        if (r->count > r->target)
+        {
+            /* surplus buffer: its permit goes away with it */
+            VirtualFree(b->data, 0, MEM_RELEASE);
+            b->data = NULL;
+            b->size = 0;
+            r->count--;
+            LeaveCriticalSection(&r->lock);
+            continue;
+        }
+        want = r->bufSize;
+        LeaveCriticalSection(&r->lock);
+
+        if (b->size != want)
+        {
+            data = RingAlloc(want);
+            if (data)
+            {
+                VirtualFree(b->data, 0, MEM_RELEASE);
+                b->data = data;
+                b->size = want;
+            }
+        }
+
+        r->prodBuf = b;
+        r->prodSize = b->size;
+        return b->data;
+    }
+}
+
+void RingPut(BUF_RING *r, DWORD len)
+{
+    r->slots[r->head] = r->prodBuf;
+    r->lens[r->head] = len;
+    r->head = (r->head + 1) % RING_MAX_BUFFERS;
+    ReleaseSemaphore(r->semFull, 1, NULL);
+}
+
+BYTE* RingGetFull(BUF_RING *r, DWORD *len)
+{
+    double t0;
+
+    t0 = TimerSeconds();
+    WaitForSingleObject(r->semFull, INFINITE);
+    r->consWait += TimerSeconds() - t0;
+    if (r->aborted) return NULL;
+
+    r->consBuf = r->slots[r->tail];
+    *len = r->lens[r->tail];
+    r->consBytes += *len;
+    return r->consBuf->data;
+}
+
+void RingRelease(BUF_RING *r)
+{
+    r->tail = (r->tail + 1) % RING_MAX_BUFFERS;
+
+    EnterCriticalSection(&r->lock);
+    r->pool[r->poolCount++] = r->consBuf;
+    LeaveCriticalSection(&r->lock);
+    ReleaseSemaphore(r->semFree, 1, NULL);
+}
+
+/* each side blocks on at most one wait, one extra permit wakes it */
+void RingAbort(BUF_RING *r)
+{
+    InterlockedExchange(&r->aborted, 1);
+    ReleaseSemaphore(r->semFree, 1, NULL);
+    ReleaseSemaphore(r->semFull, 1, NULL);
+}
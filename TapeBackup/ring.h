@@ -0,0 +1,58 @@
+#ifndef __TAPE_BACKUP_RING
+#define __TAPE_BACKUP_RING
+
+#include "common.h"
+#include "utils.h"
+
+/* --------------------------------------
+Buffer ring between one producer thread and one consumer thread.
+Producer: RingGetFree - fill up to prodSize bytes - RingPut;
+consumer: RingGetFull - use - RingRelease.
+RingPut with length 0 marks end of stream; RingAbort wakes up both sides,
+after it Get* return NULL.
+Buffers live in a pool, so RingResize can change their number and size
+while data is in flight: new size applies when producer takes a buffer,
+surplus buffers are freed by producer.
+-------------------------------------- */
+#define RING_MAX_BUFFERS    64
+
+typedef struct _RING_BUF {
+    BYTE    *data;      /* NULL - entry unused */
+    DWORD   size;
+} RING_BUF;
+
+typedef struct _BUF_RING {
+    RING_BUF            store[RING_MAX_BUFFERS];
+    RING_BUF            *pool[RING_MAX_BUFFERS];    /* free buffers */
+    DWORD               poolCount;
+    RING_BUF            *slots[RING_MAX_BUFFERS];   /* filled buffers in order */
+    DWORD               lens[RING_MAX_BUFFERS];
+    DWORD               head;       /* next slot for producer */
+    DWORD               tail;       /* next slot for consumer */
+    DWORD               count;      /* allocated buffers */
+    DWORD               target;     /* wanted buffers */
+    DWORD               bufSize;    /* wanted buffer size */
+    RING_BUF            *prodBuf;
+    DWORD               prodSize;   /* size of buffer held by producer */
+    RING_BUF            *consBuf;
+    CRITICAL_SECTION    lock;
+    HANDLE              semFree;
+    HANDLE              semFull;
+    volatile LONG       aborted;
+
+    /* tuning stats, each written by one side only */
+    double              prodWait;   /* seconds producer waited for free buffer */
+    double              consWait;   /* seconds consumer waited for data */
+    ULONGLONG           consBytes;
+} BUF_RING;
+
+BOOL RingCreate(BUF_RING *r, DWORD count, DWORD bufSize);
+void RingDestroy(BUF_RING *r);
+BOOL RingResize(BUF_RING *r, DWORD count, DWORD bufSize);
+BYTE* RingGetFree(BUF_RING *r);
+void RingPut(BUF_RING *r, DWORD len);
+BYTE* RingGetFull(BUF_RING *r, DWORD *len);
+void RingRelease(BUF_RING *r);
+void RingAbort(BUF_RING *r);
+
+#endif
@@ -0,0 +1,722 @@
+#include "scheduler.h"
+
+static const char *g_schedOps[SCHED_OP_COUNT] = {
+    "backup", "append", "verify", "restore", "toc", "clone", "verify-image"
+};
+
+static SCHED_WORKER         g_schedWorkers[SCHED_MAX_WORKERS];
+static DWORD                g_schedWorkerCount = 0;
+static SCHED_JOB            g_schedJobs[SCHED_MAX_JOBS];
+static SCHED_JOB            *g_schedShared[SCHED_MAX_JOBS];     /* cartridge and homeless jobs */
+static DWORD                g_schedSharedCount = 0;
+static DWORD                g_schedNextId = 1;
+static DWORD                g_schedSeq = 0;
+static CRITICAL_SECTION     g_schedLock;
+static BOOL                 g_schedReady = FALSE;
+static volatile LONG        g_schedStop = 0;
+static CHANGER              *g_schedChanger = NULL;
+
+/* --------------------------------------
+Queues (caller holds g_schedLock)
+-------------------------------------- */
+static BOOL SchedBefore(const SCHED_JOB *a, const SCHED_JOB *b)
+{
+    if (a->priority != b->priority) return (a->priority > b->priority);
+    return (a->seq < b->seq);
+}
+
+static void SchedQueueInsert(SCHED_JOB **queue, DWORD *count, SCHED_JOB *j)
+{
+    DWORD i = *count;
+
+    while (i > 0 && SchedBefore(j, queue[i - 1]))
+    {
+        queue[i] = queue[i - 1];
+        i--;
+    }
+    queue[i] = j;
+    (*count)++;
+}
+
+static void SchedQueueRemove(SCHED_JOB **queue, DWORD *count, DWORD at)
+{
+    (*count)--;
+    memmove(&queue[at], &queue[at + 1], (*count - at) * sizeof(SCHED_JOB*));
+}
+
+/* job's own queue: worker's, or shared */
+static void SchedRequeue(SCHED_JOB *j)
+{
+    if (j->worker < 0)
+        SchedQueueInsert(g_schedShared, &g_schedSharedCount, j);
+    else
+        SchedQueueInsert(g_schedWorkers[j->worker].queue, &g_schedWorkers[j->worker].count, j);
+}
+
+static SCHED_WORKER* SchedFindWorker(LPCWSTR devicePath)
+{
+    DWORD i;
+
+    for (i = 0; i < g_schedWorkerCount; i++)
+        if (_wcsicmp(g_schedWorkers[i].devicePath, devicePath) == 0) return &g_schedWorkers[i];
+    return NULL;
+}
+
+static BOOL SchedIsAgnostic(const SCHED_JOB *j)
+{
+    return (!j->devicePath[0] && !j->cartridge[0]);
+}
+
+/* shared jobs without cartridge go to any drive; cartridge is name or barcode */
+static BOOL SchedCartridgeFits(const SCHED_WORKER *w, const SCHED_JOB *j)
+{
+    if (!j->cartridge[0]) return TRUE;
+    return ((w->cartridge[0] && strcmp(w->cartridge, j->cartridge) == 0) ||
+        (w->barcode[0] && strcmp(w->barcode, j->cartridge) == 0));
+}
+
+/* clone needs its target drive idle, its cartridge name not being read */
+static BOOL SchedCanStart(const SCHED_JOB *j)
+{
+    SCHED_WORKER *t;
+
+    if (j->held) return FALSE;
+    if (j->op != SCHED_OP_CLONE) return TRUE;
+
+    t = SchedFindWorker(j->target);
+    return (t && !t->running && !t->lentTo && !t->reading);
+}
+
+/* j just queued: a less urgent verify in its way stops */
+static void SchedPreempt(SCHED_WORKER *w, const SCHED_JOB *j)
+{
+    if (w->running && w->running->op == SCHED_OP_VERIFY && j->priority > w->running->priority)
+        InterlockedExchange(&w->running->cancel, 1);
+}
+
+static SCHED_JOB* SchedPick(SCHED_WORKER *w)
+{
+    SCHED_JOB       **queue = NULL;
+    DWORD           *count = NULL;
+    DWORD           at = 0;
+    SCHED_JOB       *best = NULL;
+    SCHED_WORKER    *v;
+    SCHED_WORKER    *victim = NULL;
+    DWORD           i, k;
+
+    if (w->lentTo || w->loading[0]) return NULL;
+
+    for (i = 0; i < w->count && !best; i++)
+    {
+        if (SchedCanStart(w->queue[i]))
+        {
+            best = w->queue[i];
+            queue = w->queue;
+            count = &w->count;
+            at = i;
+        }
+    }
+
+    for (i = 0; i < g_schedSharedCount; i++)
+    {
+        if (SchedCartridgeFits(w, g_schedShared[i]) && SchedCanStart(g_schedShared[i]))
+        {
+            if (!best || SchedBefore(g_schedShared[i], best))
+            {
+                best = g_schedShared[i];
+                queue = g_schedShared;
+                count = &g_schedSharedCount;
+                at = i;
+            }
+            break;
+        }
+    }
+
+    /* nothing here: steal from the longest queue that has agnostic jobs */
+    for (i = 0; !best && i < g_schedWorkerCount; i++)
+    {
+        v = &g_schedWorkers[i];
+        if (v == w || (victim && v->count <= victim->count)) continue;
+
+        for (k = 0; k < v->count; k++)
+        {
+            if (SchedIsAgnostic(v->queue[k]) && !v->queue[k]->held)
+            {
+                victim = v;
+                at = k;
+                break;
+            }
+        }
+    }
+
+    if (!best && victim)
+    {
+        best = victim->queue[at];
+        queue = victim->queue;
+        count = &victim->count;
+    }
+
+    if (!best) return NULL;
+
+    SchedQueueRemove(queue, count, at);
+    if (queue != g_schedShared) best->worker = (int)(w - g_schedWorkers);
+    if (best->op == SCHED_OP_CLONE) SchedFindWorker(best->target)->lentTo = best;
+    return best;
+}
+
+static void SchedWakeAll(void)
+{
+    DWORD i;
+
+    for (i = 0; i < g_schedWorkerCount; i++) SetEvent(g_schedWorkers[i].wake);
+}
+
+/* --------------------------------------
+Changer (caller holds g_schedLock)
+-------------------------------------- */
+static void SchedPrefetch(void);
+
+static void SchedChangerDrive(const SCHED_WORKER *w, CHANGER_ELEMENT_INFO *out)
+{
+    EnterCriticalSection(&g_schedChanger->lock);
+    *out = g_schedChanger->drives[w->changerDrive];
+    LeaveCriticalSection(&g_schedChanger->lock);
+}
+
+/* a queued job wants the cartridge w has */
+static BOOL SchedNeeded(const SCHED_WORKER *w)
+{
+    DWORD i;
+
+    if (w->count) return TRUE;
+    for (i = 0; i < g_schedSharedCount; i++)
+        if (g_schedShared[i]->cartridge[0] && SchedCartridgeFits(w, g_schedShared[i])) return TRUE;
+    return FALSE;
+}
+
+/* mover thread; ctx - worker on the last move of a fetch, NULL before */
+static void SchedMoveDone(void *ctx, BOOL ok)
+{
+    SCHED_WORKER            *w = (SCHED_WORKER*)ctx;
+    CHANGER_ELEMENT_INFO    e;
+    DWORD                   i;
+
+    if (!ok && GetLastError() != ERROR_CANCELLED)
+        PrintLastErrorW(L"Cartridge move failed", 0);
+    if (!w) return;
+
+    EnterCriticalSection(&g_schedLock);
+    for (i = 0; i < g_schedSharedCount && !ok; i++)
+        if (strcmp(g_schedShared[i]->cartridge, w->loading) == 0) g_schedShared[i]->fetchFailed = TRUE;
+
+    SchedChangerDrive(w, &e);
+    strcpy(w->barcode, e.full ? e.barcode : "");
+    w->cartridge[0] = 0;
+    w->loading[0] = 0;
+    SchedWakeAll();
+    SchedPrefetch();
+    LeaveCriticalSection(&g_schedLock);
+}
+
+/* most urgent shared job whose cartridge is in a slot goes to an idle
+   changer drive, empty drives first */
+static void SchedPrefetch(void)
+{
+    CHANGER_MOVE            moves[2];
+    CHANGER_ELEMENT_INFO    e;
+    SCHED_WORKER            *w;
+    SCHED_WORKER            *best = NULL;
+    BOOL                    bestFull = TRUE;
+    SCHED_JOB               *j = NULL;
+    DWORD                   kind, slot = 0;
+    DWORD                   n = 0;
+    int                     home;
+    DWORD                   i, k;
+
+    if (!g_schedChanger || g_schedStop) return;
+    for (i = 0; i < g_schedWorkerCount; i++)
+        if (g_schedWorkers[i].loading[0]) return;
+
+    for (i = 0; i < g_schedSharedCount && !j; i++)
+    {
+        j = g_schedShared[i];
+        if (!j->cartridge[0] || j->held || j->fetchFailed)
+            j = NULL;
+        for (k = 0; k < g_schedWorkerCount && j; k++)
+            if (SchedCartridgeFits(&g_schedWorkers[k], j)) j = NULL;
+        if (j && (!ChangerFind(g_schedChanger, j->cartridge, &kind, &slot) || kind != CHANGER_SLOT))
+            j = NULL;
+    }
+    if (!j) return;
+
+    for (i = 0; i < g_schedWorkerCount && bestFull; i++)
+    {
+        w = &g_schedWorkers[i];
+        if (w->changerDrive < 0 || w->running || w->lentTo || w->reading || SchedNeeded(w))
+            continue;
+
+        SchedChangerDrive(w, &e);
+        if (!best || !e.full)
+        {
+            best = w;
+            bestFull = e.full;
+        }
+    }
+    if (!best) return;
+
+    ZeroMemory(moves, sizeof(moves));
+    if (bestFull)
+    {
+        SchedChangerDrive(best, &e);
+        home = ChangerFreeSlot(g_schedChanger, e.home);
+        if (home < 0) return;
+
+        moves[n].fromKind = CHANGER_DRIVE;
+        moves[n].from = (DWORD)best->changerDrive;
+        moves[n].toKind = CHANGER_SLOT;
+        moves[n].to = (DWORD)home;
+        moves[n].done = SchedMoveDone;
+        n++;
+    }
+
+    moves[n].fromKind = CHANGER_SLOT;
+    moves[n].from = slot;
+    moves[n].toKind = CHANGER_DRIVE;
+    moves[n].to = (DWORD)best->changerDrive;
+    moves[n].done = SchedMoveDone;
+    moves[n].ctx = best;
+    n++;
+
+    strcpy(best->loading, j->cartridge);
+    if (!ChangerPost(g_schedChanger, moves, n))
+        best->loading[0] = 0;
+}
+
+/* --------------------------------------
+Workers
+-------------------------------------- */
+/* without moving tape: header cached by the session, else cartridge memory */
+static void SchedReadCartridge(SCHED_WORKER *w)
+{
+    ZEROTAPE_HEADER zh;
+    MAM_RECORD      rec;
+    HANDLE          h;
+    char            name[32];
+    CHANGER_ELEMENT_INFO    e;
+
+    /* a clone is writing to it, or the changer is swapping its cartridge */
+    EnterCriticalSection(&g_schedLock);
+    w->reading = !w->lentTo && !w->loading[0];
+    LeaveCriticalSection(&g_schedLock);
+    if (!w->reading) return;
+
+    name[0] = 0;
+    h = TapeOpen(w->devicePath);
+    if (h != INVALID_HANDLE_VALUE)
+    {
+        if (SessionGetHeader(h, 0, &zh))
+            strncpy(name, zh.name, 31);
+        else if (MamRead(h, &rec))
+            strncpy(name, rec.zh.name, 31);
+        name[31] = 0;
+        TapeClose(h);
+    }
+
+    EnterCriticalSection(&g_schedLock);
+    strcpy(w->cartridge, name);
+    if (w->changerDrive >= 0)
+    {
+        SchedChangerDrive(w, &e);
+        strcpy(w->barcode, e.full ? e.barcode : "");
+    }
+    w->reading = FALSE;
+    LeaveCriticalSection(&g_schedLock);
+    SchedWakeAll();     /* a clone may be waiting for this drive */
+}
+
+static void SchedProgress(void *ctx, unsigned percent, ULONGLONG done, ULONGLONG total)
+{
+    SCHED_JOB *j = (SCHED_JOB*)ctx;
+
+    j->done = done;
+    j->total = total;
+    if (percent == j->percent && done != total) return;
+
+    j->percent = percent;
+    j->notify(j, SCHED_EVENT_PROGRESS, j->ctx);
+}
+
+static BOOL SchedRunJob(SCHED_WORKER *w, SCHED_JOB *j)
+{
+    LPCWSTR dev = w->devicePath;
+    LPCWSTR log = j->logPath[0] ? j->logPath : NULL;
+    LPCWSTR image = j->path;
+
+    switch (j->op)
+    {
+        case SCHED_OP_BACKUP:
+            return JobMakeBackup(dev, j->path, j->name, j->flags);
+        case SCHED_OP_APPEND:
+            return JobAppendBackup(dev, j->path, j->name, j->flags);
+        case SCHED_OP_VERIFY:
+            return JobVerifyArchive(dev, j->archive, log);
+        case SCHED_OP_RESTORE:
+            return JobRestoreArchive(dev, j->archive, j->path, j->flags,
+                j->outPath, MAX_PATH * 2);
+        case SCHED_OP_TOC:
+            return JobReadArchiveTOC(dev, j->archive, j->path[0] ? j->path : NULL);
+        case SCHED_OP_CLONE:
+            return JobCloneTape(dev, j->target, j->flags);
+        case SCHED_OP_VERIFY_IMAGE:
+            return JobVerifyImages(&image, 1, log);
+    }
+
+    return FALSE;
+}
+
+static DWORD WINAPI SchedWorkerThread(LPVOID param)
+{
+    SCHED_WORKER    *w = (SCHED_WORKER*)param;
+    SCHED_WORKER    *t;
+    SCHED_JOB       *j;
+    PROGRESS_HOOK   hook;
+    BOOL            ok;
+    BOOL            preempted;
+    BOOL            stopped;
+
+    TraceThreadName("sched worker");
+    if (!SessionOpen(w->devicePath) && w->changerDrive < 0)
+        PrintLastErrorW(L"Cannot keep tape drive open, every job will open it", 0);
+    SchedReadCartridge(w);
+
+    for (;;)
+    {
+        EnterCriticalSection(&g_schedLock);
+        j = g_schedStop ? NULL : SchedPick(w);
+        if (j)
+        {
+            j->state = SCHED_RUNNING;
+            wcscpy(j->drive, w->devicePath);
+            j->runs++;
+            j->percent = 0;
+            InterlockedExchange(&j->cancel, 0);
+            w->running = j;
+        }
+        LeaveCriticalSection(&g_schedLock);
+
+        if (!j)
+        {
+            if (g_schedStop) break;
+            if (WaitForSingleObject(w->wake, SCHED_IDLE_MS) == WAIT_TIMEOUT && g_schedSharedCount)
+                SchedReadCartridge(w);
+            continue;
+        }
+
+        /* changer may have swapped the cartridge, closing the session */
+        SessionOpen(w->devicePath);
+        j->notify(j, SCHED_EVENT_STARTED, j->ctx);
+        hook.draw = SchedProgress;
+        hook.ctx = j;
+        hook.cancel = &j->cancel;
+        ProgressHookSet(&hook);
+        TRACE_BEGIN("sched job", j->op);
+        ok = SchedRunJob(w, j);
+        TRACE_END("sched job", ok);
+        ProgressHookSet(NULL);
+
+        EnterCriticalSection(&g_schedLock);
+        t = (j->op == SCHED_OP_CLONE) ? SchedFindWorker(j->target) : NULL;
+        if (t) t->lentTo = NULL;
+        preempted = (!ok && j->cancel && !g_schedStop);
+        LeaveCriticalSection(&g_schedLock);
+
+        /* failed job may have left drive somewhere unknown: fresh session */
+        if (!ok)
+        {
+            SessionClose(w->devicePath);
+            SessionOpen(w->devicePath);
+        }
+        SchedReadCartridge(w);
+
+        j->ok = ok;
+        j->notify(j, preempted ? SCHED_EVENT_PREEMPTED : SCHED_EVENT_FINISHED, j->ctx);
+
+        /* slot may be reused once DONE: nothing touches j after this.
+           Drive counts as busy until here, so the changer leaves it alone */
+        EnterCriticalSection(&g_schedLock);
+        w->running = NULL;
+        stopped = (preempted && g_schedStop);
+        if (preempted && !stopped)
+        {
+            j->state = SCHED_QUEUED;
+            j->drive[0] = 0;
+            SchedRequeue(j);
+        }
+        else if (!preempted)
+            j->state = SCHED_DONE;
+        SchedWakeAll();
+        SchedPrefetch();
+        LeaveCriticalSection(&g_schedLock);
+
+        /* stop came while it was being preempted: no queue to go back to */
+        if (stopped)
+        {
+            j->notify(j, SCHED_EVENT_FINISHED, j->ctx);
+            j->state = SCHED_DONE;
+        }
+    }
+
+    SessionClose(w->devicePath);
+    return 0;
+}
+
+/* --------------------------------------
+Interface
+-------------------------------------- */
+BOOL SchedStart(void)
+{
+    if (!g_schedReady)
+    {
+        InitializeCriticalSection(&g_schedLock);
+        g_schedReady = TRUE;
+    }
+
+    return ProgressHookInit();
+}
+
+/* TRUE also if devicePath has a worker already */
+static BOOL SchedAddWorker(LPCWSTR devicePath, int changerDrive)
+{
+    SCHED_WORKER    *w;
+    BOOL            ok = TRUE;
+
+    EnterCriticalSection(&g_schedLock);
+    w = SchedFindWorker(devicePath);
+    if (w && changerDrive >= 0)
+        w->changerDrive = changerDrive;
+    else if (!w)
+    {
+        w = &g_schedWorkers[g_schedWorkerCount];
+        ok = (g_schedWorkerCount < SCHED_MAX_WORKERS);
+        if (ok)
+        {
+            ZeroMemory(w, sizeof(*w));
+            wcsncpy(w->devicePath, devicePath, MAX_PATH - 1);
+            w->changerDrive = changerDrive;
+            w->wake = CreateEventW(NULL, FALSE, FALSE, NULL);
+            w->thread = w->wake ? CreateThread(NULL, 0, SchedWorkerThread, w, 0, NULL) : NULL;
+            ok = (w->thread != NULL);
+            if (ok)
+                g_schedWorkerCount++;
+            else if (w->wake)
+                CloseHandle(w->wake);
+        }
+    }
+    LeaveCriticalSection(&g_schedLock);
+    return ok;
+}
+
+BOOL SchedAddDrive(LPCWSTR devicePath)
+{
+    return SchedAddWorker(devicePath, -1);
+}
+
+/* before SchedAddDrive for drives in it; c stays open until SchedStop */
+BOOL SchedSetChanger(CHANGER *c)
+{
+    DWORD   i;
+    BOOL    ok = TRUE;
+
+    EnterCriticalSection(&g_schedLock);
+    g_schedChanger = c;
+    for (i = 0; i < c->driveCount && ok; i++)
+        if (c->drives[i].devicePath[0]) ok = SchedAddWorker(c->drives[i].devicePath, (int)i);
+    LeaveCriticalSection(&g_schedLock);
+    return ok;
+}
+
+int SchedDefaultPriority(DWORD op)
+{
+    switch (op)
+    {
+        case SCHED_OP_RESTORE:      return 3;
+        case SCHED_OP_BACKUP:
+        case SCHED_OP_APPEND:
+        case SCHED_OP_CLONE:
+        case SCHED_OP_TOC:          return 2;
+        case SCHED_OP_VERIFY:       return 1;
+        default:                    return 0;
+    }
+}
+
+const char* SchedOpName(DWORD op)
+{
+    return (op < SCHED_OP_COUNT) ? g_schedOps[op] : "?";
+}
+
+/* job is copied; 0 - refused, *error says why */
+DWORD SchedSubmit(const SCHED_JOB *job, const char **error)
+{
+    SCHED_JOB       *j = NULL;
+    SCHED_WORKER    *w = NULL;
+    DWORD           best = 0;
+    DWORD           id;
+    BOOL            stopped;
+    DWORD           i;
+
+    *error = NULL;
+    if (job->op >= SCHED_OP_COUNT)
+        *error = "unknown op";
+    else if (job->op != SCHED_OP_VERIFY_IMAGE && !job->devicePath[0] && !job->cartridge[0])
+        *error = "job needs a device or a cartridge";
+    else if (job->op == SCHED_OP_CLONE && (!job->devicePath[0] || !job->target[0]))
+        *error = "clone needs device and target";
+    else if (job->op == SCHED_OP_CLONE && _wcsicmp(job->devicePath, job->target) == 0)
+        *error = "clone needs two drives";
+    else if ((job->devicePath[0] && !SchedAddDrive(job->devicePath)) ||
+        (job->op == SCHED_OP_CLONE && !SchedAddDrive(job->target)))
+        *error = "too many drives";
+    if (*error) return 0;
+
+    EnterCriticalSection(&g_schedLock);
+    for (i = 0; i < SCHED_MAX_JOBS && !j; i++)
+        if (g_schedJobs[i].state == SCHED_FREE || g_schedJobs[i].state == SCHED_DONE)
+            j = &g_schedJobs[i];
+
+    if (g_schedStop)
+        *error = "scheduler is stopping";
+    else if (!j)
+        *error = "too many jobs";
+
+    if (*error)
+    {
+        LeaveCriticalSection(&g_schedLock);
+        return 0;
+    }
+
+    *j = *job;
+    id = j->id = g_schedNextId++;
+    j->seq = g_schedSeq++;
+    j->state = SCHED_QUEUED;
+    j->held = TRUE;
+    j->fetchFailed = FALSE;
+    j->drive[0] = 0;
+    j->runs = 0;
+    j->cancel = 0;
+    j->percent = 0;
+    j->done = j->total = 0;
+    j->ok = FALSE;
+    j->outPath[0] = 0;
+
+    if (j->devicePath[0])
+        w = SchedFindWorker(j->devicePath);
+    else if (SchedIsAgnostic(j))
+    {
+        /* shortest queue, counting its running job */
+        for (i = 0; i < g_schedWorkerCount; i++)
+        {
+            if (!w || g_schedWorkers[i].count + (g_schedWorkers[i].running ? 1 : 0) < best)
+            {
+                w = &g_schedWorkers[i];
+                best = w->count + (w->running ? 1 : 0);
+            }
+        }
+    }
+
+    j->worker = w ? (int)(w - g_schedWorkers) : -1;
+    SchedRequeue(j);
+    if (w && !SchedIsAgnostic(j))
+        SchedPreempt(w, j);
+    else if (j->cartridge[0])
+    {
+        for (i = 0; i < g_schedWorkerCount; i++)
+            if (SchedCartridgeFits(&g_schedWorkers[i], j)) SchedPreempt(&g_schedWorkers[i], j);
+    }
+    LeaveCriticalSection(&g_schedLock);
+
+    /* QUEUED goes out before a worker can start the job */
+    j->notify(j, SCHED_EVENT_QUEUED, j->ctx);
+
+    /* SchedStop came in between and skipped it: finished here. Decided
+       under the lock, a SchedStop after this takes it since it is not held */
+    EnterCriticalSection(&g_schedLock);
+    j->held = FALSE;
+    stopped = g_schedStop && j->state == SCHED_QUEUED;
+    SchedWakeAll();
+    SchedPrefetch();
+    LeaveCriticalSection(&g_schedLock);
+
+    if (stopped)
+    {
+        j->notify(j, SCHED_EVENT_FINISHED, j->ctx);
+        j->state = SCHED_DONE;
+    }
+    return id;
+}
+
+DWORD SchedList(SCHED_JOB_INFO *out, DWORD max)
+{
+    SCHED_JOB   *j;
+    DWORD       n = 0;
+    DWORD       i;
+
+    EnterCriticalSection(&g_schedLock);
+    for (i = 0; i < SCHED_MAX_JOBS && n < max; i++)
+    {
+        j = &g_schedJobs[i];
+        if (j->state == SCHED_FREE) continue;
+
+        out[n].id = j->id;
+        out[n].op = j->op;
+        out[n].state = j->state;
+        out[n].priority = j->priority;
+        out[n].runs = j->runs;
+        out[n].percent = j->percent;
+        out[n].ok = j->ok;
+        wcscpy(out[n].devicePath, j->drive[0] ? j->drive : j->devicePath);
+        n++;
+    }
+    LeaveCriticalSection(&g_schedLock);
+    return n;
+}
+
+/* queued jobs finish as failed, running ones are waited for */
+void SchedStop(void)
+{
+    SCHED_JOB   *dropped[SCHED_MAX_JOBS];
+    HANDLE      threads[SCHED_MAX_WORKERS];
+    DWORD       count = 0;
+    DWORD       workers;
+    DWORD       i;
+
+    if (!g_schedReady) return;
+
+    EnterCriticalSection(&g_schedLock);
+    InterlockedExchange(&g_schedStop, 1);
+    for (i = 0; i < SCHED_MAX_JOBS; i++)
+        if (g_schedJobs[i].state == SCHED_QUEUED && !g_schedJobs[i].held) dropped[count++] = &g_schedJobs[i];
+    for (i = 0; i < g_schedWorkerCount; i++)
+    {
+        g_schedWorkers[i].count = 0;
+        threads[i] = g_schedWorkers[i].thread;
+    }
+    g_schedSharedCount = 0;
+    workers = g_schedWorkerCount;
+    SchedWakeAll();
+    LeaveCriticalSection(&g_schedLock);
+
+    for (i = 0; i < count; i++)
+    {
+        dropped[i]->ok = FALSE;
+        dropped[i]->notify(dropped[i], SCHED_EVENT_FINISHED, dropped[i]->ctx);
+        dropped[i]->state = SCHED_DONE;
+    }
+
+    if (workers) WaitForMultipleObjects(workers, threads, TRUE, INFINITE);
+    if (g_schedChanger) ChangerWait(g_schedChanger, INFINITE);
+    for (i = 0; i < workers; i++)
+    {
+        CloseHandle(g_schedWorkers[i].thread);
+        CloseHandle(g_schedWorkers[i].wake);
+    }
+}
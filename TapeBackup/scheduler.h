@@ -0,0 +1,138 @@
+#ifndef __TAPE_BACKUP_SCHEDULER
+#define __TAPE_BACKUP_SCHEDULER
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "session.h"
+#include "jobs.h"
+#include "mam.h"
+#include "changer.h"
+#include "trace.h"
+
+/* --------------------------------------
+Job scheduler: one worker thread per drive, each with its own tape
+session (see session.h) instead of the menu's selection. Jobs wait in
+priority queues, most urgent first, same priority in submit order.
+An idle worker takes the most urgent job of:
+    - its own queue: jobs for its drive, and drive-agnostic jobs
+      (image verify) dealt to the shortest queue on submit;
+    - the shared queue: jobs for a cartridge by name, no drive given,
+      once that cartridge is in its drive (name from session header
+      cache or cartridge memory);
+    - when both are empty, agnostic jobs stolen from the longest queue.
+A clone starts on its source drive only when the target drive is idle,
+and the target takes nothing else until the clone is done.
+A job more urgent than a running verify on the same drive preempts it:
+the verify stops at its next block, goes back into the queue and later
+runs again from the start.
+With a changer (SchedSetChanger) a job's cartridge may also be its
+barcode. While other drives write or verify, the next cartridge the
+shared queue waits for is fetched from its slot into an idle changer
+drive whose own cartridge nothing queued needs; that one goes back to
+its home slot first. One fetch at a time; a cartridge that failed to
+load is not tried again for the jobs that asked for it.
+-------------------------------------- */
+#define SCHED_MAX_WORKERS       TAPE_KEPT_MAX
+#define SCHED_MAX_JOBS          64
+#define SCHED_IDLE_MS           5000    /* idle worker looks at its cartridge again */
+
+typedef enum _SCHED_OP {
+    SCHED_OP_BACKUP = 0,
+    SCHED_OP_APPEND,
+    SCHED_OP_VERIFY,
+    SCHED_OP_RESTORE,
+    SCHED_OP_TOC,
+    SCHED_OP_CLONE,
+    SCHED_OP_VERIFY_IMAGE,
+    SCHED_OP_COUNT
+} SCHED_OP;
+
+typedef enum _SCHED_STATE {
+    SCHED_FREE = 0,
+    SCHED_QUEUED,
+    SCHED_RUNNING,
+    SCHED_DONE
+} SCHED_STATE;
+
+typedef enum _SCHED_EVENT {
+    SCHED_EVENT_QUEUED = 1,     /* from SchedSubmit, before any other event */
+    SCHED_EVENT_STARTED,
+    SCHED_EVENT_PROGRESS,       /* percent changed */
+    SCHED_EVENT_PREEMPTED,      /* back in queue */
+    SCHED_EVENT_FINISHED
+} SCHED_EVENT;
+
+typedef struct _SCHED_JOB SCHED_JOB;
+typedef void (*SCHED_NOTIFY)(const SCHED_JOB *j, SCHED_EVENT event, void *ctx);
+
+struct _SCHED_JOB {
+    /* filled by submitter */
+    DWORD           op;
+    int             priority;       /* higher first, SchedDefaultPriority(op) */
+    WCHAR           devicePath[MAX_PATH];   /* "" - any drive with cartridge, or agnostic */
+    WCHAR           target[MAX_PATH];       /* clone */
+    char            cartridge[32];  /* "" - any */
+    WCHAR           path[MAX_PATH * 2];     /* TAR, destination dir, TOC file or image */
+    WCHAR           logPath[MAX_PATH * 2];  /* verify, image verify; "" - none */
+    char            name[32];       /* backup, append */
+    DWORD           archive;        /* from 0 */
+    DWORD           flags;          /* JOB_FLAG_OVERWRITE, never interactive */
+    SCHED_NOTIFY    notify;         /* called from worker threads */
+    void            *ctx;
+    DWORD           tag;            /* submitter's, e.g. request id */
+
+    /* scheduler's */
+    DWORD           id;             /* from 1 */
+    DWORD           state;
+    DWORD           seq;            /* submit order, kept when preempted */
+    BOOL            held;           /* QUEUED event not delivered yet */
+    BOOL            fetchFailed;    /* changer couldn't load its cartridge */
+    int             worker;         /* queue it is in or came from, -1 shared */
+    WCHAR           drive[MAX_PATH];        /* drive running it, "" - not started */
+    DWORD           runs;
+    volatile LONG   cancel;
+    unsigned        percent;
+    ULONGLONG       done;
+    ULONGLONG       total;
+    BOOL            ok;
+    WCHAR           outPath[MAX_PATH * 2];  /* restore: file written */
+};
+
+typedef struct _SCHED_WORKER {
+    WCHAR           devicePath[MAX_PATH];
+    HANDLE          thread;
+    HANDLE          wake;           /* auto-reset: new job, drive freed, stop */
+    SCHED_JOB       *queue[SCHED_MAX_JOBS];     /* most urgent first */
+    DWORD           count;
+    SCHED_JOB       *running;
+    SCHED_JOB       *lentTo;        /* clone writing to this drive */
+    char            cartridge[32];  /* name of loaded cartridge, "" - unknown */
+    int             changerDrive;   /* drive element in changer, -1 not in one */
+    char            barcode[CHANGER_BARCODE_MAX];   /* of loaded cartridge, "" - unknown */
+    char            loading[CHANGER_BARCODE_MAX];   /* being fetched, "" - not moving */
+    BOOL            reading;        /* cartridge name being read */
+} SCHED_WORKER;
+
+/* short copy for listings */
+typedef struct _SCHED_JOB_INFO {
+    DWORD           id;
+    DWORD           op;
+    DWORD           state;
+    int             priority;
+    DWORD           runs;
+    unsigned        percent;
+    BOOL            ok;
+    WCHAR           devicePath[MAX_PATH];   /* drive running it, or asked for */
+} SCHED_JOB_INFO;
+
+BOOL SchedStart(void);
+BOOL SchedAddDrive(LPCWSTR devicePath);
+BOOL SchedSetChanger(CHANGER *c);
+int SchedDefaultPriority(DWORD op);
+const char* SchedOpName(DWORD op);
+DWORD SchedSubmit(const SCHED_JOB *job, const char **error);
+DWORD SchedList(SCHED_JOB_INFO *out, DWORD max);
+void SchedStop(void);
+
+#endif
@@ -0,0 +1,248 @@
+#include "session.h"
+
+static TAPE_SESSION         g_sessions[TAPE_KEPT_MAX];
+static CRITICAL_SECTION     g_sessionLock;
+static volatile LONG        g_sessionLockInit = 0;
+
+static void SessionLockInit(void)
+{
+    if (InterlockedCompareExchange(&g_sessionLockInit, 1, 0) == 0)
+    {
+        InitializeCriticalSection(&g_sessionLock);
+        InterlockedExchange(&g_sessionLockInit, 2);
+        return;
+    }
+
+    while (g_sessionLockInit != 2) Sleep(0);
+}
+
+static void SessionForgetBlocks(TAPE_SESSION *s)
+{
+    DWORD i;
+
+    for (i = 0; i < SESSION_MAX_FILES; i++)
+        s->fileBlock[i] = SESSION_NO_BLOCK;
+    s->fileBlock[0] = 0;
+    s->file = 0;
+    s->block = SESSION_NO_BLOCK;
+}
+
+static void SessionForget(TAPE_SESSION *s)
+{
+    SessionForgetBlocks(s);
+    ZeroMemory(s->haveHeader, sizeof(s->haveHeader));
+}
+
+/* session of h, emptied if tape contents changed since last use.
+   Only the thread that has the drive uses its session: no lock */
+static TAPE_SESSION* SessionFor(HANDLE h)
+{
+    TAPE_SESSION    *s = NULL;
+    int             i;
+
+    if (h == INVALID_HANDLE_VALUE || h == NULL) return NULL;
+    for (i = 0; i < TAPE_KEPT_MAX && !s; i++)
+        if (g_sessions[i].h == h) s = &g_sessions[i];
+
+    if (s && TapeKeptChanged(h)) SessionForget(s);
+    return s;
+}
+
+/* FALSE - drive can't tell; block is SESSION_NO_BLOCK outside partition of counted files */
+static BOOL SessionWhere(TAPE_SESSION *s, ULONGLONG *block)
+{
+    DWORD   part;
+    DWORD   err;
+
+    if (!s->canLocate) return FALSE;
+    if (!TapeGetPosition(s->h, &part, block))
+    {
+        err = GetLastError();
+        if (err == ERROR_INVALID_FUNCTION || err == ERROR_NOT_SUPPORTED)
+            s->canLocate = FALSE;
+        return FALSE;
+    }
+
+    /* partitioned tape: files are counted in the first partition, like from BOT */
+    if ((part ? 1 : 0) != s->part)
+    {
+        SessionForgetBlocks(s);
+        s->part = part ? 1 : 0;
+    }
+
+    if (part != s->part) *block = SESSION_NO_BLOCK;
+    return TRUE;
+}
+
+/* one session per drive; TRUE also if devicePath already has one */
+BOOL SessionOpen(LPCWSTR devicePath)
+{
+    TAPE_SESSION    *s = NULL;
+    HANDLE          h;
+    int             i;
+
+    SessionLockInit();
+    EnterCriticalSection(&g_sessionLock);
+    for (i = 0; i < TAPE_KEPT_MAX; i++)
+    {
+        if (g_sessions[i].h && _wcsicmp(g_sessions[i].devicePath, devicePath) == 0)
+        {
+            LeaveCriticalSection(&g_sessionLock);
+            return TRUE;
+        }
+        if (!g_sessions[i].h && !s) s = &g_sessions[i];
+    }
+
+    h = s ? TapeOpen(devicePath) : INVALID_HANDLE_VALUE;
+    if (!s) SetLastError(ERROR_TOO_MANY_OPEN_FILES);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        LeaveCriticalSection(&g_sessionLock);
+        return FALSE;
+    }
+
+    if (!TapeKeepOpen(h, devicePath))
+    {
+        TapeClose(h);
+        LeaveCriticalSection(&g_sessionLock);
+        SetLastError(ERROR_TOO_MANY_OPEN_FILES);
+        return FALSE;
+    }
+
+    ZeroMemory(s, sizeof(*s));
+    wcsncpy(s->devicePath, devicePath, MAX_PATH - 1);
+    s->canLocate = TRUE;
+    SessionForget(s);
+    s->h = h;
+    LeaveCriticalSection(&g_sessionLock);
+    return TRUE;
+}
+
+/* nothing to do if devicePath has no session */
+void SessionClose(LPCWSTR devicePath)
+{
+    HANDLE  h = NULL;
+    int     i;
+
+    SessionLockInit();
+    EnterCriticalSection(&g_sessionLock);
+    for (i = 0; i < TAPE_KEPT_MAX && !h; i++)
+    {
+        if (g_sessions[i].h && _wcsicmp(g_sessions[i].devicePath, devicePath) == 0)
+        {
+            h = g_sessions[i].h;
+            g_sessions[i].h = NULL;
+        }
+    }
+    LeaveCriticalSection(&g_sessionLock);
+    if (!h) return;
+
+    TapeKeepOpen(h, NULL);
+    TapeClose(h);
+}
+
+BOOL SessionOwns(HANDLE h)
+{
+    return (SessionFor(h) != NULL);
+}
+
+/* without positions: rewind and space from BOT */
+static BOOL SessionRewindAndSpace(TAPE_SESSION *s, DWORD file)
+{
+    wprintf(L"Please wait until tape rewound...\r\n");
+    if (!TapeRewind(s->h))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        return FALSE;
+    }
+
+    if (file > 0 && !TapeSpaceFilemarks(s->h, (LONG)file))
+    {
+        PrintLastErrorW(L"Failed to position tape", 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* start of file (from 0), from the nearest point the session knows */
+BOOL SessionSeekFile(HANDLE h, DWORD file)
+{
+    TAPE_SESSION    *s = SessionFor(h);
+    ULONGLONG       cur;
+    DWORD           from;
+    BOOL            ok = TRUE;
+
+    if (!s) return FALSE;
+    if (file >= SESSION_MAX_FILES || !SessionWhere(s, &cur))
+        return SessionRewindAndSpace(s, file);
+
+    /* nearest remembered start at or before target, file 0 always is */
+    for (from = file; s->fileBlock[from] == SESSION_NO_BLOCK; from--) ;
+
+    if (cur == SESSION_NO_BLOCK || cur != s->fileBlock[from])
+    {
+        if (cur != SESSION_NO_BLOCK && cur == s->block && s->file >= from && s->file < file)
+            from = s->file;     /* still inside a file before target: space on from here */
+        else
+        {
+            wprintf(L"Please wait until tape positioned...\r\n");
+            if (from == 0 && s->part == 0)
+                ok = TapeRewind(h);
+            else
+                ok = TapeLocate(h, s->part, s->fileBlock[from]);
+        }
+    }
+
+    if (ok && file > from)
+        ok = TapeSpaceFilemarks(h, (LONG)(file - from));
+
+    if (!ok)
+    {
+        PrintLastErrorW(L"Failed to position tape", 0);
+        SessionForgetBlocks(s);
+        return FALSE;
+    }
+
+    if (SessionWhere(s, &cur) && cur != SESSION_NO_BLOCK)
+    {
+        s->fileBlock[file] = cur;
+        s->file = file;
+        s->block = cur;
+    }
+
+    return TRUE;
+}
+
+/* tape was read inside file, nothing else moved it since */
+void SessionNoteFile(HANDLE h, DWORD file)
+{
+    TAPE_SESSION    *s = SessionFor(h);
+    ULONGLONG       cur;
+
+    if (!s || !SessionWhere(s, &cur)) return;
+
+    s->file = file;
+    s->block = cur;
+}
+
+BOOL SessionGetHeader(HANDLE h, DWORD index, ZEROTAPE_HEADER *zh)
+{
+    TAPE_SESSION *s = SessionFor(h);
+
+    if (!s || index >= SESSION_MAX_ARCHIVES || !s->haveHeader[index]) return FALSE;
+
+    memcpy(zh, &s->headers[index], sizeof(*zh));
+    return TRUE;
+}
+
+/* header known to be on tape: just read, or just written by a job */
+void SessionPutHeader(HANDLE h, DWORD index, const ZEROTAPE_HEADER *zh)
+{
+    TAPE_SESSION *s = SessionFor(h);
+
+    if (!s || index >= SESSION_MAX_ARCHIVES) return;
+
+    memcpy(&s->headers[index], zh, sizeof(*zh));
+    s->haveHeader[index] = TRUE;
+}
@@ -0,0 +1,48 @@
+#ifndef __TAPE_BACKUP_SESSION
+#define __TAPE_BACKUP_SESSION
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+
+/* --------------------------------------
+Tape session: handle of a drive stays open from selection to exit
+(menu) or for the life of its scheduler worker (see scheduler.h), so
+position and headers survive between actions. One session per drive,
+used only by the thread that has the drive at the time.
+Files (sections between filemarks) are counted from BOT of the first
+partition. Session remembers the logical block where each file starts
+and where the tape was left, and reaches a file by locate to the
+nearest known start (or relative space from there / from the current
+file) instead of rewind and space from BOT. Headers read from tape are
+cached per archive. Writes, erases, partitioning, unload or a cartridge
+swap on the handle drop everything.
+Drives without logical positions and virtual tapes rewind as before,
+only the header cache applies to them.
+-------------------------------------- */
+#define SESSION_MAX_FILES       64      /* file starts remembered per cartridge */
+#define SESSION_MAX_ARCHIVES    (SESSION_MAX_FILES / 2)
+#define SESSION_NO_BLOCK        ((ULONGLONG)-1)
+
+typedef struct _TAPE_SESSION {
+    WCHAR           devicePath[MAX_PATH];
+    HANDLE          h;                              /* NULL - free slot */
+    BOOL            canLocate;
+    DWORD           part;                           /* partition of counted files, 0 = not partitioned */
+    ULONGLONG       fileBlock[SESSION_MAX_FILES];   /* start of file n, SESSION_NO_BLOCK = not seen */
+    DWORD           file;                           /* tape was left inside this file */
+    ULONGLONG       block;                          /* at this block, SESSION_NO_BLOCK = unknown */
+    BOOL            haveHeader[SESSION_MAX_ARCHIVES];
+    ZEROTAPE_HEADER headers[SESSION_MAX_ARCHIVES];
+} TAPE_SESSION;
+
+BOOL SessionOpen(LPCWSTR devicePath);
+void SessionClose(LPCWSTR devicePath);
+BOOL SessionOwns(HANDLE h);
+BOOL SessionSeekFile(HANDLE h, DWORD file);
+void SessionNoteFile(HANDLE h, DWORD file);
+BOOL SessionGetHeader(HANDLE h, DWORD index, ZEROTAPE_HEADER *zh);
+void SessionPutHeader(HANDLE h, DWORD index, const ZEROTAPE_HEADER *zh);
+
+#endif
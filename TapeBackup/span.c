@@ -0,0 +1,293 @@
+#include "span.h"
+#include "jobs.h"
+
+/* --------------------------------------
+Drive list
+-------------------------------------- */
+static void SpanReset(SPAN_SET *s, DWORD flags)
+{
+    DWORD i;
+
+    ZeroMemory(s, sizeof(*s));
+    for (i = 0; i < SPAN_MAX_DRIVES; i++) s->tapes[i] = INVALID_HANDLE_VALUE;
+    s->span.ctx = s;
+    s->flags = flags;
+}
+
+void SpanClose(SPAN_SET *s)
+{
+    DWORD i;
+
+    for (i = 0; i < s->count; i++)
+    {
+        if (s->tapes[i] != INVALID_HANDLE_VALUE) TapeClose(s->tapes[i]);
+        s->tapes[i] = INVALID_HANDLE_VALUE;
+    }
+}
+
+/* asks operator where volume is; empty answer - same drive after cartridge swap */
+static BOOL SpanAskDrive(SPAN_SET *s, WORD volume, BOOL blank)
+{
+    WCHAR line[MAX_PATH];
+
+    if (!(s->flags & JOB_FLAG_INTERACTIVE))
+    {
+        wprintf(L"No drive for volume %u.\r\n", (unsigned)volume);
+        return FALSE;
+    }
+
+    if (s->tapes[s->cur] != INVALID_HANDLE_VALUE)
+    {
+        TapeUnload(s->tapes[s->cur]);
+        TapeClose(s->tapes[s->cur]);
+        s->tapes[s->cur] = INVALID_HANDLE_VALUE;
+    }
+
+    wprintf(L"Load %s volume %u into %s and press Enter,\r\n\
+or enter another drive ID or virtual tape path: ",
+        blank ? L"blank cartridge for" : L"cartridge with", (unsigned)volume, s->paths[s->cur]);
+    if (!ReadLineW(line, MAX_PATH)) return FALSE;
+    if (line[0]) JobDevicePathFromInput(line, s->paths[s->cur], MAX_PATH);
+
+    s->tapes[s->cur] = JobOpenTape(s->paths[s->cur]);
+    s->volumes[s->cur] = 0;
+    return s->tapes[s->cur] != INVALID_HANDLE_VALUE;
+}
+
+/* --------------------------------------
+Writing
+-------------------------------------- */
+static BOOL SpanPrepareWrite(SPAN_SET *s, DWORD i, TAPE_IO_PROFILE *prof)
+{
+    TAPE_IO_PROFILE p;
+
+    TapeSetCompression(s->tapes[i], FALSE);
+    if (ProfileLoadForTape(s->tapes[i], &p) && !TapeSetVariableBlockSize(s->tapes[i]))
+    {
+        PrintLastErrorW(L"Failed to set variable block size, using default profile", 0);
+        TapeDefaultProfile(&p);
+    }
+
+    /* block size is fixed for the whole archive, the smallest one fits all drives */
+    if (prof && p.blockSize < prof->blockSize) prof->blockSize = p.blockSize;
+    return JobConfirmOverwrite(s->tapes[i], s->flags);
+}
+
+static HANDLE SpanNextWrite(TAPE_SPAN *span, HANDLE current, ULONGLONG offset)
+{
+    SPAN_SET *s = (SPAN_SET*)span->ctx;
+
+    UNREFERENCED_PARAMETER(current);
+    wprintf(L"\r\nEnd of media on volume %u after %I64u bytes.\r\n",
+        (unsigned)ZeroTapeVolume(&s->zh), offset);
+    if (!SpanEndVolume(s, offset)) return INVALID_HANDLE_VALUE;
+
+    if (s->cur + 1 < s->count)
+    {
+        TapeClose(s->tapes[s->cur]);
+        s->tapes[s->cur] = INVALID_HANDLE_VALUE;
+        s->cur++;
+    }
+    else if (!SpanAskDrive(s, (WORD)(ZeroTapeVolume(&s->zh) + 1), TRUE) ||
+        !SpanPrepareWrite(s, s->cur, NULL))
+        return INVALID_HANDLE_VALUE;
+
+    if (!SpanBeginVolume(s, offset)) return INVALID_HANDLE_VALUE;
+    return s->tapes[s->cur];
+}
+
+/* opens all drives and asks about overwriting up front, so switching
+   volumes later never stops the stream for questions */
+BOOL SpanOpenForWrite(SPAN_SET *s, LPCWSTR *devicePaths, DWORD count,
+    DWORD flags, TAPE_IO_PROFILE *prof)
+{
+    DWORD i;
+
+    SpanReset(s, flags);
+    s->span.next = SpanNextWrite;
+    if (count < 1 || count > SPAN_MAX_DRIVES)
+    {
+        wprintf(L"Spanned set needs 1 to %d drives.\r\n", SPAN_MAX_DRIVES);
+        return FALSE;
+    }
+
+    TapeDefaultProfile(prof);
+    prof->blockSize = TAPE_MAX_BLOCK;
+    for (i = 0; i < count; i++)
+    {
+        _snwprintf(s->paths[i], MAX_PATH, L"%s", devicePaths[i]);
+        s->paths[i][MAX_PATH - 1] = 0;
+        s->count = i + 1;
+
+        wprintf(L"Drive %s:\r\n", s->paths[i]);
+        s->tapes[i] = JobOpenTape(s->paths[i]);
+        if (s->tapes[i] == INVALID_HANDLE_VALUE || !SpanPrepareWrite(s, i, prof))
+        {
+            SpanClose(s);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* s->zh holds archive header; writes volume header at BOT of current drive */
+BOOL SpanBeginVolume(SPAN_SET *s, ULONGLONG offset)
+{
+    HANDLE h = s->tapes[s->cur];
+
+    ZeroTapeSetVolume(&s->zh, (WORD)(ZeroTapeVolume(&s->zh) + 1));
+    PutLE64(s->zh.volstart, offset);
+    PutLE64(s->zh.volbytes, 0);
+
+    wprintf(L"Writing volume %u to %s...\r\n", (unsigned)ZeroTapeVolume(&s->zh), s->paths[s->cur]);
+    if (!TapeRewind(h))
+    {
+        PrintLastErrorW(L"Failed to rewind", 0);
+        return FALSE;
+    }
+
+    MamClear(h);
+    return WriteMetadataSection(h, &s->zh);
+}
+
+/* filemark after data, then trailer: same header with volbytes filled */
+BOOL SpanEndVolume(SPAN_SET *s, ULONGLONG offset)
+{
+    HANDLE h = s->tapes[s->cur];
+
+    if (!TapeWriteFilemark(h) && GetLastError() != ERROR_END_OF_MEDIA)
+    {
+        PrintLastErrorW(L"Failed to write filemark at end of section #2", 0);
+        return FALSE;
+    }
+
+    PutLE64(s->zh.volbytes, offset - GetLE64(s->zh.volstart));
+    if (!WriteMetadataSection(h, &s->zh)) return FALSE;
+
+    /* volume is complete, cartridge memory gets the trailer (not the header at BOT) */
+    JobStoreMam(h, &s->zh, 1, 0, GetLE64(s->zh.volbytes), 0);
+    return TRUE;
+}
+
+/* --------------------------------------
+Reading
+-------------------------------------- */
+/* finds volume among opened drives or asks for it, checks and positions it */
+static BOOL SpanLoadVolume(SPAN_SET *s, WORD volume, ULONGLONG offset)
+{
+    ZEROTAPE_HEADER zh;
+    DWORD           i;
+
+    for (;;)
+    {
+        for (i = 0; i < s->count; i++)
+        {
+            if (s->tapes[i] != INVALID_HANDLE_VALUE && s->volumes[i] == volume)
+                break;
+        }
+
+        if (i < s->count)
+        {
+            s->cur = i;
+            break;
+        }
+
+        if (s->count == 0 || !SpanAskDrive(s, volume, FALSE)) return FALSE;
+        if (JobReadHeader(s->tapes[s->cur], &zh) &&
+            memcmp(zh.setid, s->zh.setid, 8) == 0)
+            s->volumes[s->cur] = ZeroTapeVolume(&zh);
+        else
+            wprintf(L"Cartridge does not belong to this archive.\r\n");
+    }
+
+    if (!JobReadHeader(s->tapes[s->cur], &zh) ||
+        memcmp(zh.setid, s->zh.setid, 8) != 0 || GetLE64(zh.volstart) != offset)
+    {
+        wprintf(L"Volume %u does not continue the archive at %I64u bytes.\r\n",
+            (unsigned)volume, offset);
+        return FALSE;
+    }
+
+    s->zh = zh;
+    wprintf(L"Reading volume %u from %s...\r\n", (unsigned)volume, s->paths[s->cur]);
+    return PositionToSecondSection(s->tapes[s->cur]);
+}
+
+static HANDLE SpanNextRead(TAPE_SPAN *span, HANDLE current, ULONGLONG offset)
+{
+    SPAN_SET        *s = (SPAN_SET*)span->ctx;
+    ZEROTAPE_HEADER tr;
+    WORD            volume = ZeroTapeVolume(&s->zh);
+
+    if (!ReadMetadataSection(current, &tr) ||
+        memcmp(tr.setid, s->zh.setid, 8) != 0 || ZeroTapeVolume(&tr) != volume ||
+        GetLE64(tr.volstart) + GetLE64(tr.volbytes) != offset)
+    {
+        wprintf(L"\r\nVolume %u ended at %I64u bytes, its trailer does not match.\r\n",
+            (unsigned)volume, offset);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    wprintf(L"\r\nVolume %u done.\r\n", (unsigned)volume);
+    TapeClose(s->tapes[s->cur]);
+    s->tapes[s->cur] = INVALID_HANDLE_VALUE;
+    s->volumes[s->cur] = 0;
+
+    if (!SpanLoadVolume(s, (WORD)(volume + 1), offset)) return INVALID_HANDLE_VALUE;
+    return s->tapes[s->cur];
+}
+
+/* reads headers of all given drives, first volume ends up in s->zh
+   and its drive is positioned to section #2 */
+BOOL SpanOpenForRead(SPAN_SET *s, LPCWSTR *devicePaths, DWORD count, DWORD flags)
+{
+    ZEROTAPE_HEADER zh;
+    BOOL            haveSet = FALSE;
+    DWORD           i;
+
+    SpanReset(s, flags);
+    s->span.next = SpanNextRead;
+    if (count < 1 || count > SPAN_MAX_DRIVES)
+    {
+        wprintf(L"Spanned set needs 1 to %d drives.\r\n", SPAN_MAX_DRIVES);
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        _snwprintf(s->paths[i], MAX_PATH, L"%s", devicePaths[i]);
+        s->paths[i][MAX_PATH - 1] = 0;
+        s->count = i + 1;
+
+        wprintf(L"Drive %s:\r\n", s->paths[i]);
+        s->tapes[i] = JobOpenTape(s->paths[i]);
+        if (s->tapes[i] == INVALID_HANDLE_VALUE) continue;
+
+        if (!JobReadHeader(s->tapes[i], &zh) || ZeroTapeVolume(&zh) == 0 ||
+            (haveSet && memcmp(zh.setid, s->zh.setid, 8) != 0))
+        {
+            wprintf(L"Not a volume of this spanned archive, skipped.\r\n");
+            continue;
+        }
+
+        if (!haveSet) s->zh = zh;
+        haveSet = TRUE;
+        s->volumes[i] = ZeroTapeVolume(&zh);
+    }
+
+    if (!haveSet)
+    {
+        wprintf(L"No volumes of spanned archive found.\r\n");
+        SpanClose(s);
+        return FALSE;
+    }
+
+    if (!SpanLoadVolume(s, 1, 0))
+    {
+        SpanClose(s);
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,37 @@
+#ifndef __TAPE_BACKUP_SPAN
+#define __TAPE_BACKUP_SPAN
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+
+/* --------------------------------------
+Spanned (multi-volume) archive. Every volume holds:
+  header (volseq, volstart) FM data FM trailer (header + volbytes) FM
+Volume switch happens inside section #2 pipeline (see TAPE_SPAN):
+on early warning when writing, on filemark when reading. Drives given
+up front are used in order without waiting; after them the operator
+is asked for another cartridge or drive (interactive jobs only).
+-------------------------------------- */
+#define SPAN_MAX_DRIVES     16
+
+typedef struct _SPAN_SET {
+    TAPE_SPAN       span;
+    WCHAR           paths[SPAN_MAX_DRIVES][MAX_PATH];
+    HANDLE          tapes[SPAN_MAX_DRIVES];
+    WORD            volumes[SPAN_MAX_DRIVES];   /* read: volume loaded in drive */
+    DWORD           count;
+    DWORD           cur;                        /* drive of current volume */
+    DWORD           flags;                      /* JOB_FLAG_* */
+    ZEROTAPE_HEADER zh;                         /* header of current volume */
+} SPAN_SET;
+
+BOOL SpanOpenForWrite(SPAN_SET *s, LPCWSTR *devicePaths, DWORD count,
+    DWORD flags, TAPE_IO_PROFILE *prof);
+BOOL SpanBeginVolume(SPAN_SET *s, ULONGLONG offset);
+BOOL SpanEndVolume(SPAN_SET *s, ULONGLONG offset);
+BOOL SpanOpenForRead(SPAN_SET *s, LPCWSTR *devicePaths, DWORD count, DWORD flags);
+void SpanClose(SPAN_SET *s);
+
+#endif
@@ -0,0 +1,293 @@
+#include "spool.h"
+
+/* --------------------------------------
+Spool settings (command line)
+-------------------------------------- */
+static WCHAR        g_spoolDir[MAX_PATH];
+static ULONGLONG    g_spoolHwm = SPOOL_DEFAULT_HWM;
+static volatile LONG g_spoolJobs = 0;
+
+void SpoolSetDefaults(LPCWSTR dir, ULONGLONG hwm)
+{
+    _snwprintf(g_spoolDir, MAX_PATH, L"%s", dir ? dir : L"");
+    g_spoolDir[MAX_PATH - 1] = 0;
+    g_spoolHwm = hwm;
+}
+
+BOOL SpoolEnabled(void)
+{
+    return g_spoolDir[0] != 0;
+}
+
+static void SpoolExtentPath(const SPOOL *s, DWORD extent, LPWSTR out)
+{
+    WCHAR name[64];
+
+    _snwprintf(name, 64, L"tbspool_%lu_%lu_%lu.tmp", (unsigned long)GetCurrentProcessId(),
+        (unsigned long)s->id, (unsigned long)extent);
+    name[63] = 0;
+    JoinPath2W(out, MAX_PATH * 2, s->dir, name);
+}
+
+/* --------------------------------------
+Stager: source -> extents
+-------------------------------------- */
+static DWORD WINAPI SpoolStagerThread(LPVOID param)
+{
+    SPOOL       *s = (SPOOL*)param;
+    WCHAR       path[MAX_PATH * 2];
+    HANDLE      ext = INVALID_HANDLE_VALUE;
+    BYTE        *buf;
+    ULONGLONG   staged = 0;
+    ULONGLONG   ahead;
+    DWORD       n, got = 0, written = 0;
+    DWORD       err = NO_ERROR;
+
+    TraceThreadName("spool stager");
+    buf = (BYTE*)VirtualAlloc(NULL, SPOOL_IO, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buf) err = ERROR_NOT_ENOUGH_MEMORY;
+
+    while (err == NO_ERROR && staged < s->total && !s->aborted)
+    {
+        /* spool directory holds at most limit bytes */
+        EnterCriticalSection(&s->lock);
+        ahead = s->staged - s->destaged;
+        LeaveCriticalSection(&s->lock);
+        if (ahead + SPOOL_IO > s->limit)
+        {
+            WaitForSingleObject(s->evSpace, INFINITE);
+            continue;
+        }
+
+        n = SPOOL_EXTENT - (DWORD)(staged % SPOOL_EXTENT);
+        if (n > SPOOL_IO) n = SPOOL_IO;
+        if (n > s->total - staged) n = (DWORD)(s->total - staged);
+
+        TRACE_BEGIN("source read", 0);
+        if (!ReadFile(s->src, buf, n, &got, NULL)) err = GetLastError();
+        else if (got == 0) err = ERROR_HANDLE_EOF;
+        TRACE_END("source read", got);
+        if (err != NO_ERROR) break;
+
+        if (ext == INVALID_HANDLE_VALUE)
+        {
+            SpoolExtentPath(s, (DWORD)(staged / SPOOL_EXTENT), path);
+            ext = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+            if (ext == INVALID_HANDLE_VALUE)
+            {
+                err = GetLastError();
+                break;
+            }
+        }
+
+        TRACE_BEGIN("spool write", 0);
+        if (!WriteFile(ext, buf, got, &written, NULL) || written != got)
+            err = GetLastError() ? GetLastError() : ERROR_DISK_FULL;
+        TRACE_END("spool write", written);
+        if (err != NO_ERROR) break;
+
+        staged += got;
+        if (staged % SPOOL_EXTENT == 0)
+        {
+            CloseHandle(ext);
+            ext = INVALID_HANDLE_VALUE;
+        }
+
+        EnterCriticalSection(&s->lock);
+        s->staged = staged;
+        LeaveCriticalSection(&s->lock);
+        SetEvent(s->evData);
+    }
+
+    if (ext != INVALID_HANDLE_VALUE) CloseHandle(ext);
+    if (buf) VirtualFree(buf, 0, MEM_RELEASE);
+
+    EnterCriticalSection(&s->lock);
+    if (err != NO_ERROR)
+    {
+        s->failed = TRUE;
+        s->error = err;
+    }
+    LeaveCriticalSection(&s->lock);
+    SetEvent(s->evData);
+    return err == NO_ERROR ? 0 : 1;
+}
+
+/* --------------------------------------
+Spool API
+-------------------------------------- */
+BOOL SpoolOpen(SPOOL *s, HANDLE src, ULONGLONG total)
+{
+    WCHAR hwmW[64];
+
+    ZeroMemory(s, sizeof(*s));
+    if (!SpoolEnabled()) return FALSE;
+
+    if (!EnsureDirectoryExistsW(g_spoolDir))
+    {
+        PrintLastErrorW(L"Spool directory not accessible", 0);
+        return FALSE;
+    }
+
+    wcscpy(s->dir, g_spoolDir);
+    s->id = (DWORD)InterlockedIncrement(&g_spoolJobs);
+    s->src = src;
+    s->total = total;
+    s->hwm = (g_spoolHwm < total) ? g_spoolHwm : total;
+    s->limit = g_spoolHwm * SPOOL_LIMIT_FACTOR;
+    if (s->limit < SPOOL_IO * 2) s->limit = SPOOL_IO * 2;
+    s->rd = INVALID_HANDLE_VALUE;
+
+    InitializeCriticalSection(&s->lock);
+    s->evData = CreateEventW(NULL, FALSE, FALSE, NULL);
+    s->evSpace = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (s->evData && s->evSpace)
+        s->thread = CreateThread(NULL, 0, SpoolStagerThread, s, 0, NULL);
+
+    if (!s->thread)
+    {
+        PrintLastErrorW(L"Failed to start spool stager", 0);
+        if (s->evData) CloseHandle(s->evData);
+        if (s->evSpace) CloseHandle(s->evSpace);
+        DeleteCriticalSection(&s->lock);
+        return FALSE;
+    }
+
+    HumanSize(s->hwm, hwmW, 64);
+    wprintf(L"Staging to %s, tape starts at %s staged.\r\n", s->dir, hwmW);
+    return TRUE;
+}
+
+/* blocks until data can go to tape, stops at extent end */
+static BOOL SpoolReadExtent(SPOOL *s, BYTE *buf, DWORD n, DWORD *got)
+{
+    WCHAR       path[MAX_PATH * 2];
+    ULONGLONG   avail;
+    ULONGLONG   pos;
+    DWORD       take;
+    BOOL        ok;
+
+    *got = 0;
+    EnterCriticalSection(&s->lock);
+    for (;;)
+    {
+        if (s->destaged >= s->total)
+        {
+            LeaveCriticalSection(&s->lock);
+            return TRUE;
+        }
+
+        avail = s->staged - s->destaged;
+        if (!s->streaming && (avail >= s->hwm || s->staged == s->total))
+            s->streaming = TRUE;
+
+        if (s->streaming && avail > 0) break;
+
+        if (s->failed || s->aborted)
+        {
+            SetLastError(s->failed ? s->error : ERROR_OPERATION_ABORTED);
+            LeaveCriticalSection(&s->lock);
+            return FALSE;
+        }
+
+        /* underrun: drive waits for a full high-water mark again */
+        if (s->streaming)
+        {
+            s->streaming = FALSE;
+            s->pauses++;
+        }
+
+        LeaveCriticalSection(&s->lock);
+        TRACE_BEGIN("spool wait", 0);
+        WaitForSingleObject(s->evData, INFINITE);
+        TRACE_END("spool wait", 0);
+        EnterCriticalSection(&s->lock);
+    }
+    pos = s->destaged;
+    LeaveCriticalSection(&s->lock);
+
+    take = SPOOL_EXTENT - (DWORD)(pos % SPOOL_EXTENT);
+    if (take > n) take = n;
+    if (take > avail) take = (DWORD)avail;
+
+    if (s->rd == INVALID_HANDLE_VALUE)
+    {
+        s->rdExtent = (DWORD)(pos / SPOOL_EXTENT);
+        SpoolExtentPath(s, s->rdExtent, path);
+        s->rd = CreateFileW(path, GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (s->rd == INVALID_HANDLE_VALUE) return FALSE;
+    }
+
+    TRACE_BEGIN("spool read", 0);
+    ok = ReadFile(s->rd, buf, take, got, NULL) && *got == take;
+    TRACE_END("spool read", *got);
+    if (!ok)
+    {
+        if (GetLastError() == NO_ERROR) SetLastError(ERROR_HANDLE_EOF);
+        return FALSE;
+    }
+
+    /* extent is on its way to tape, disk space goes back to stager */
+    if ((pos + take) % SPOOL_EXTENT == 0 || pos + take == s->total)
+    {
+        CloseHandle(s->rd);
+        s->rd = INVALID_HANDLE_VALUE;
+        SpoolExtentPath(s, s->rdExtent, path);
+        DeleteFileW(path);
+    }
+
+    EnterCriticalSection(&s->lock);
+    s->destaged = pos + take;
+    LeaveCriticalSection(&s->lock);
+    SetEvent(s->evSpace);
+    return TRUE;
+}
+
+/* whole n bytes unless end of source or failure, like ReadFile */
+BOOL SpoolRead(SPOOL *s, void *buf, DWORD n, DWORD *got)
+{
+    DWORD part = 0;
+
+    for (*got = 0; *got < n; *got += part)
+    {
+        if (!SpoolReadExtent(s, (BYTE*)buf + *got, n - *got, &part)) return FALSE;
+        if (part == 0) break;
+    }
+
+    return TRUE;
+}
+
+void SpoolClose(SPOOL *s)
+{
+    WCHAR   path[MAX_PATH * 2];
+    DWORD   i;
+
+    if (!s->thread) return;
+
+    InterlockedExchange(&s->aborted, 1);
+    SetEvent(s->evSpace);
+    WaitForSingleObject(s->thread, INFINITE);
+    CloseHandle(s->thread);
+    s->thread = NULL;
+
+    if (s->rd != INVALID_HANDLE_VALUE) CloseHandle(s->rd);
+    s->rd = INVALID_HANDLE_VALUE;
+
+    /* extents left by a failed or aborted job */
+    for (i = (DWORD)(s->destaged / SPOOL_EXTENT); i <= (DWORD)(s->staged / SPOOL_EXTENT); i++)
+    {
+        SpoolExtentPath(s, i, path);
+        DeleteFileW(path);
+    }
+
+    if (s->pauses)
+        wprintf(L"Spool: source fell behind, tape waited for high-water mark %lu time(s).\r\n",
+            (unsigned long)s->pauses);
+
+    CloseHandle(s->evData);
+    CloseHandle(s->evSpace);
+    DeleteCriticalSection(&s->lock);
+}
@@ -0,0 +1,53 @@
+#ifndef __TAPE_BACKUP_SPOOL
+#define __TAPE_BACKUP_SPOOL
+
+#include "common.h"
+#include "utils.h"
+#include "trace.h"
+
+/* --------------------------------------
+Disk staging spool (disk-to-disk-to-tape) for slow sources.
+A stager thread copies the source into extent files in the spool
+directory as fast as the source allows. The tape side reads them back
+with SpoolRead, which holds the drive until the high-water mark is
+staged (or the whole source, if smaller) and again after every
+underrun, so the drive only moves when it can stream. Staging keeps
+going while the drive drains, up to SPOOL_LIMIT_FACTOR * high-water
+mark on disk. Each extent is deleted as soon as it is on tape.
+-------------------------------------- */
+#define SPOOL_EXTENT            (256 * 1024 * 1024)
+#define SPOOL_IO                (4 * 1024 * 1024)
+#define SPOOL_DEFAULT_HWM       (2048ULL * 1024 * 1024)
+#define SPOOL_LIMIT_FACTOR      2
+
+typedef struct _SPOOL {
+    WCHAR               dir[MAX_PATH];
+    DWORD               id;         /* keeps extent names unique per job */
+    HANDLE              src;
+    ULONGLONG           total;
+    ULONGLONG           hwm;
+    ULONGLONG           limit;      /* staged but not destaged bytes */
+
+    CRITICAL_SECTION    lock;
+    ULONGLONG           staged;     /* bytes in extents */
+    ULONGLONG           destaged;   /* bytes handed to tape side */
+    BOOL                streaming;  /* tape side may take data */
+    DWORD               pauses;     /* underruns after first start */
+    BOOL                failed;
+    DWORD               error;
+    volatile LONG       aborted;
+    HANDLE              evData;     /* staged grew or stager ended */
+    HANDLE              evSpace;    /* destaged grew */
+    HANDLE              thread;
+
+    HANDLE              rd;         /* extent being read */
+    DWORD               rdExtent;
+} SPOOL;
+
+void SpoolSetDefaults(LPCWSTR dir, ULONGLONG hwm);
+BOOL SpoolEnabled(void);
+BOOL SpoolOpen(SPOOL *s, HANDLE src, ULONGLONG total);
+BOOL SpoolRead(SPOOL *s, void *buf, DWORD n, DWORD *got);
+void SpoolClose(SPOOL *s);
+
+#endif
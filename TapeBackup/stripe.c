@@ -0,0 +1,402 @@
+#include "stripe.h"
+
+/* --------------------------------------
+Geometry
+-------------------------------------- */
+DWORD StripeUnitForBlock(DWORD blockSize)
+{
+    DWORD unit = blockSize;
+
+    while (unit < STRIPE_MIN_UNIT) unit += blockSize;
+    return unit;
+}
+
+static ULONGLONG StripeUnits(const STRIPE_SET *s)
+{
+    return (s->totalSize + s->unit - 1) / s->unit;
+}
+
+static DWORD StripeUnitLen(const STRIPE_SET *s, ULONGLONG k)
+{
+    ULONGLONG units = StripeUnits(s);
+
+    if (k + 1 < units) return s->unit;
+    return (DWORD)(s->totalSize - (units - 1) * s->unit);
+}
+
+/* bytes in section #2 of given tape, parity tape is as long as tape 0 */
+ULONGLONG StripeTapeSize(const STRIPE_SET *s, DWORD index)
+{
+    ULONGLONG   units = StripeUnits(s);
+    ULONGLONG   n, size;
+
+    if (units == 0) return 0;
+    if (index >= s->dataTapes) index = 0;
+
+    n = units / s->dataTapes + ((index < units % s->dataTapes) ? 1 : 0);
+    size = n * s->unit;
+    if ((units - 1) % s->dataTapes == index)
+        size -= s->unit - StripeUnitLen(s, units - 1);
+    return size;
+}
+
+static void XorInto(BYTE *dst, const BYTE *src, DWORD len)
+{
+    ULONG_PTR       *d = (ULONG_PTR*)dst;
+    const ULONG_PTR *w = (const ULONG_PTR*)src;
+    DWORD           words = len / sizeof(ULONG_PTR);
+    DWORD           i;
+
+    for (i = 0; i < words; i++) d[i] ^= w[i];
+    for (i *= sizeof(ULONG_PTR); i < len; i++) dst[i] ^= src[i];
+}
+
+/* --------------------------------------
+Per-tape worker threads
+-------------------------------------- */
+typedef struct _STRIPE_IO {
+    BUF_RING    ring;
+    HANDLE      h;
+    HANDLE      thread;
+    ULONGLONG   size;           /* section #2 bytes of this tape */
+    DWORD       blockSize;
+    volatile LONG failed;
+    DWORD       error;
+} STRIPE_IO;
+
+/* keeps draining after failure so the file reader never blocks */
+static DWORD WINAPI StripeWriterThread(LPVOID param)
+{
+    STRIPE_IO   *io = (STRIPE_IO*)param;
+    BYTE        *buf;
+    DWORD       len = 0;
+    DWORD       off, n;
+    DWORD       written = 0;
+
+    TraceThreadName("stripe writer");
+    for (;;)
+    {
+        buf = RingGetFull(&io->ring, &len);
+        if (!buf || len == 0) break;
+
+        for (off = 0; !io->failed && off < len; off += n)
+        {
+            n = (len - off > io->blockSize) ? io->blockSize : len - off;
+
+            TRACE_BEGIN("tape write", 0);
+            if (!TapeWrite(io->h, buf + off, n, &written) || written != n)
+            {
+                io->error = GetLastError();
+                InterlockedExchange(&io->failed, 1);
+                METRIC_ADD(io->h, METRIC_DEVICE_ERRORS, 1);
+            }
+            TRACE_END("tape write", written);
+            METRIC_ADD(io->h, METRIC_BYTES_WRITTEN, written);
+        }
+        RingRelease(&io->ring);
+    }
+
+    return 0;
+}
+
+/* one ring buffer - one stripe unit */
+static DWORD WINAPI StripeReaderThread(LPVOID param)
+{
+    STRIPE_IO   *io = (STRIPE_IO*)param;
+    ULONGLONG   done = 0;
+    BYTE        *buf;
+    DWORD       fill, toRead;
+    DWORD       got = 0;
+
+    TraceThreadName("stripe reader");
+    while (done < io->size)
+    {
+        buf = RingGetFree(&io->ring);
+        if (!buf) return 0;
+
+        for (fill = 0; done < io->size && fill < io->ring.prodSize; )
+        {
+            toRead = (io->size - done > io->blockSize) ? io->blockSize : (DWORD)(io->size - done);
+
+            TRACE_BEGIN("tape read", 0);
+            if (!TapeRead(io->h, buf + fill, toRead, &got) || got == 0)
+            {
+                TRACE_END("tape read", 0);
+                io->error = GetLastError();
+                InterlockedExchange(&io->failed, 1);
+                METRIC_ADD(io->h, METRIC_DEVICE_ERRORS, 1);
+                RingPut(&io->ring, 0);
+                return 1;
+            }
+            TRACE_END("tape read", got);
+            METRIC_ADD(io->h, METRIC_BYTES_READ, got);
+            fill += got;
+            done += got;
+        }
+
+        RingPut(&io->ring, fill);
+    }
+
+    if (RingGetFree(&io->ring)) RingPut(&io->ring, 0);
+    return 0;
+}
+
+static BOOL StripeStart(STRIPE_SET *s, STRIPE_IO *io, LPTHREAD_START_ROUTINE proc)
+{
+    DWORD i, tapes = s->dataTapes + s->parityTapes;
+
+    ZeroMemory(io, sizeof(STRIPE_IO) * STRIPE_MAX_TAPES);
+    for (i = 0; i < tapes; i++)
+    {
+        if (s->tapes[i] == INVALID_HANDLE_VALUE) continue;
+
+        io[i].h = s->tapes[i];
+        io[i].size = StripeTapeSize(s, i);
+        io[i].blockSize = s->blockSize;
+        if (!RingCreate(&io[i].ring, s->depth, s->unit))
+        {
+            wprintf(L"Out of memory.\r\n");
+            return FALSE;
+        }
+
+        io[i].thread = CreateThread(NULL, 0, proc, &io[i], 0, NULL);
+        if (!io[i].thread)
+        {
+            PrintLastErrorW(L"Failed to start I/O thread", 0);
+            RingDestroy(&io[i].ring);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void StripeStop(STRIPE_SET *s, STRIPE_IO *io, BOOL abort)
+{
+    DWORD i, tapes = s->dataTapes + s->parityTapes;
+
+    for (i = 0; i < tapes; i++)
+    {
+        if (!io[i].thread) continue;
+
+        if (abort) RingAbort(&io[i].ring);
+        WaitForSingleObject(io[i].thread, INFINITE);
+        CloseHandle(io[i].thread);
+        RingDestroy(&io[i].ring);
+    }
+}
+
+/* --------------------------------------
+Write: file -> N data tapes (+ parity)
+-------------------------------------- */
+BOOL StripeWrite(STRIPE_SET *s, HANDLE hf)
+{
+    STRIPE_IO   io[STRIPE_MAX_TAPES];
+    ULONGLONG   units = StripeUnits(s);
+    ULONGLONG   k = 0;
+    ULONGLONG   done = 0;
+    DWORD       i, len, got, rowLen;
+    DWORD       tapes = s->dataTapes + s->parityTapes;
+    BYTE        *buf, *pbuf = NULL;
+    BOOL        ok = TRUE;
+
+    if (!StripeStart(s, io, StripeWriterThread))
+    {
+        StripeStop(s, io, TRUE);
+        return FALSE;
+    }
+
+    while (ok && k < units)
+    {
+        rowLen = 0;
+        if (s->parityTapes)
+        {
+            pbuf = RingGetFree(&io[s->dataTapes].ring);
+            if (!pbuf) ok = FALSE;
+        }
+
+        for (i = 0; ok && i < s->dataTapes && k < units; i++, k++)
+        {
+            buf = RingGetFree(&io[i].ring);
+            if (!buf)
+            {
+                ok = FALSE;
+                break;
+            }
+
+            len = StripeUnitLen(s, k);
+            TRACE_BEGIN("source read", 0);
+            if (!ReadFile(hf, buf, len, &got, NULL) || got != len)
+            {
+                TRACE_END("source read", 0);
+                PrintLastErrorW(L"Failed to read source file", 0);
+                ok = FALSE;
+                break;
+            }
+            TRACE_END("source read", got);
+
+            if (pbuf)
+            {
+                TRACE_BEGIN("parity", len);
+                if (i == 0) memcpy(pbuf, buf, len);
+                else XorInto(pbuf, buf, len);
+                TRACE_END("parity", len);
+            }
+
+            if (i == 0) rowLen = len;
+            RingPut(&io[i].ring, len);
+            done += len;
+        }
+
+        if (pbuf && ok) RingPut(&io[s->dataTapes].ring, rowLen);
+
+        for (i = 0; i < tapes; i++)
+        {
+            if (io[i].failed)
+            {
+                SetLastError(io[i].error);
+                wprintf(L"\r\nTape %lu of stripe set: ", (unsigned long)i);
+                PrintLastErrorW(L"Failed to write to tape", 0);
+                ok = FALSE;
+            }
+        }
+
+        DrawProgressBar((unsigned)((done * 100ULL) / (s->totalSize ? s->totalSize : 1)),
+            done, s->totalSize);
+    }
+
+    /* end of stream for every writer, on failure rings are aborted instead */
+    for (i = 0; ok && i < tapes; i++)
+    {
+        buf = RingGetFree(&io[i].ring);
+        if (buf) RingPut(&io[i].ring, 0);
+    }
+
+    StripeStop(s, io, !ok);
+    for (i = 0; i < tapes; i++)
+        if (io[i].failed) ok = FALSE;
+
+    wprintf(L"\r\n");
+    return ok;
+}
+
+/* --------------------------------------
+Read: all tapes of the set -> file and/or sha1.
+One missing data tape is rebuilt from parity.
+-------------------------------------- */
+BOOL StripeRead(STRIPE_SET *s, HANDLE hf, unsigned char outSha1[20],
+    ULONGLONG *parityErrors)
+{
+    STRIPE_IO   io[STRIPE_MAX_TAPES];
+    BYTE        *row[STRIPE_MAX_TAPES];
+    DWORD       lens[STRIPE_MAX_TAPES];
+    ULONGLONG   units = StripeUnits(s);
+    ULONGLONG   k = 0;
+    ULONGLONG   done = 0;
+    DWORD       i, n, len, written;
+    DWORD       missing = STRIPE_MAX_TAPES;
+    DWORD       tapes = s->dataTapes + s->parityTapes;
+    BYTE        *scratch;
+    SHA1_CTX    ctx;
+    BOOL        ok = TRUE;
+
+    for (i = 0; i < s->dataTapes; i++)
+        if (s->tapes[i] == INVALID_HANDLE_VALUE) missing = i;
+
+    scratch = (BYTE*)VirtualAlloc(NULL, s->unit, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!scratch)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    if (!StripeStart(s, io, StripeReaderThread))
+    {
+        StripeStop(s, io, TRUE);
+        VirtualFree(scratch, 0, MEM_RELEASE);
+        return FALSE;
+    }
+
+    if (outSha1) sha1_init(&ctx);
+    if (parityErrors) *parityErrors = 0;
+    while (ok && k < units)
+    {
+        /* collect whole row first: rebuild needs all of it */
+        n = (units - k < s->dataTapes) ? (DWORD)(units - k) : s->dataTapes;
+        for (i = 0; i < tapes; i++)
+        {
+            row[i] = NULL;
+            lens[i] = 0;
+            if (i >= n && i < s->dataTapes) continue;
+            if (i == missing || s->tapes[i] == INVALID_HANDLE_VALUE) continue;
+
+            row[i] = RingGetFull(&io[i].ring, &lens[i]);
+            if (!row[i] || lens[i] != StripeUnitLen(s, k + (i < s->dataTapes ? i : 0)))
+            {
+                if (io[i].failed) SetLastError(io[i].error);
+                wprintf(L"\r\nTape %lu of stripe set: ", (unsigned long)i);
+                PrintLastErrorW(L"Read failed before reaching expected size", 0);
+                row[i] = NULL;
+                ok = FALSE;
+            }
+        }
+        if (!ok) break;
+
+        if (missing < n)
+        {
+            len = StripeUnitLen(s, k + missing);
+            TRACE_BEGIN("parity rebuild", len);
+            memcpy(scratch, row[s->dataTapes], len);
+            for (i = 0; i < n; i++)
+                if (i != missing) XorInto(scratch, row[i], (lens[i] < len) ? lens[i] : len);
+            TRACE_END("parity rebuild", len);
+            row[missing] = scratch;
+            lens[missing] = len;
+        }
+        else if (s->parityTapes && row[s->dataTapes] && parityErrors)
+        {
+            TRACE_BEGIN("parity check", lens[0]);
+            memcpy(scratch, row[s->dataTapes], lens[0]);
+            for (i = 0; i < n; i++) XorInto(scratch, row[i], lens[i]);
+            for (i = 0; i < lens[0] && scratch[i] == 0; i++);
+            if (i < lens[0]) (*parityErrors)++;
+            TRACE_END("parity check", lens[0]);
+        }
+
+        for (i = 0; ok && i < n; i++)
+        {
+            if (hf)
+            {
+                TRACE_BEGIN("file write", 0);
+                if (!WriteFile(hf, row[i], lens[i], &written, NULL) || written != lens[i])
+                {
+                    PrintLastErrorW(L"Failed to write destination file", 0);
+                    ok = FALSE;
+                }
+                TRACE_END("file write", written);
+            }
+
+            if (outSha1)
+            {
+                TRACE_BEGIN("sha1", lens[i]);
+                sha1_update(&ctx, row[i], lens[i]);
+                TRACE_END("sha1", lens[i]);
+            }
+            done += lens[i];
+        }
+
+        for (i = 0; i < tapes; i++)
+            if (row[i] && row[i] != scratch) RingRelease(&io[i].ring);
+
+        k += n;
+        DrawProgressBar((unsigned)((done * 100ULL) / (s->totalSize ? s->totalSize : 1)),
+            done, s->totalSize);
+    }
+
+    StripeStop(s, io, TRUE);
+    VirtualFree(scratch, 0, MEM_RELEASE);
+    if (outSha1 && ok) sha1_final(&ctx, outSha1);
+
+    wprintf(L"\r\n");
+    return ok;
+}
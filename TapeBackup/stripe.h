@@ -0,0 +1,36 @@
+#ifndef __TAPE_BACKUP_STRIPE
+#define __TAPE_BACKUP_STRIPE
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "ring.h"
+
+/* --------------------------------------
+Striped set (RAIT): section #2 is cut into units of fixed size,
+unit k goes to data tape k % N, optional parity tape holds XOR of
+every row of N units. All tapes are written and read in parallel,
+one thread per tape; the calling thread reads/writes the file.
+Every tape keeps its own ZEROTAPE header with set geometry,
+sizeofarchive and sha1 describe whole archive.
+-------------------------------------- */
+#define STRIPE_MAX_TAPES        16      /* data + parity */
+#define STRIPE_MIN_UNIT         (1024 * 1024)
+
+typedef struct _STRIPE_SET {
+    DWORD       dataTapes;
+    DWORD       parityTapes;    /* 0 or 1 */
+    DWORD       unit;           /* multiple of blockSize */
+    DWORD       blockSize;
+    DWORD       depth;          /* buffers per tape */
+    ULONGLONG   totalSize;
+    HANDLE      tapes[STRIPE_MAX_TAPES];    /* INVALID_HANDLE_VALUE - missing */
+} STRIPE_SET;
+
+DWORD StripeUnitForBlock(DWORD blockSize);
+ULONGLONG StripeTapeSize(const STRIPE_SET *s, DWORD index);
+BOOL StripeWrite(STRIPE_SET *s, HANDLE hf);
+BOOL StripeRead(STRIPE_SET *s, HANDLE hf, unsigned char outSha1[20],
+    ULONGLONG *parityErrors);
+
+#endif
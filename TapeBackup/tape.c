@@ -3,13 +3,411 @@
 /* --------------------------------------
 Tape low-level helpers
 -------------------------------------- */
+static DWORD   g_memBudget = TAPE_DEFAULT_BUDGET;
+static BOOL    g_autoTune = TRUE;
+
+void TapeDefaultProfile(TAPE_IO_PROFILE *p)
+{
+    p->blockSize = TAPE_IO_BUF;
+    p->depth = TAPE_DEFAULT_DEPTH;
+    p->memBudget = g_memBudget;
+    p->autoTune = g_autoTune;
+}
+
+/* from command line, applies to all following jobs */
+void TapeSetDefaultTuning(DWORD memBudget, BOOL autoTune)
+{
+    g_memBudget = memBudget;
+    g_autoTune = autoTune;
+}
+
+/* --------------------------------------
+Kept-open handles: tape sessions (see session.h), one per drive
+-------------------------------------- */
+typedef struct _TAPE_KEPT {
+    HANDLE          h;              /* NULL - free slot */
+    WCHAR           path[MAX_PATH];
+    volatile LONG   changed;
+} TAPE_KEPT;
+
+static TAPE_KEPT            g_kept[TAPE_KEPT_MAX];
+static CRITICAL_SECTION     g_keptLock;
+static volatile LONG        g_keptLockInit = 0;
+
+static void TapeKeptLockInit(void)
+{
+    if (InterlockedCompareExchange(&g_keptLockInit, 1, 0) == 0)
+    {
+        InitializeCriticalSection(&g_keptLock);
+        InterlockedExchange(&g_keptLockInit, 2);
+        return;
+    }
+
+    while (g_keptLockInit != 2) Sleep(0);
+}
+
+static TAPE_KEPT* TapeKeptFind(HANDLE h)
+{
+    int i;
+
+    if (h == INVALID_HANDLE_VALUE || h == NULL) return NULL;
+    for (i = 0; i < TAPE_KEPT_MAX; i++)
+        if (g_kept[i].h == h) return &g_kept[i];
+    return NULL;
+}
+
+/* TapeOpen of devicePath returns h and TapeClose leaves it open until
+   released with devicePath NULL; releaser closes it afterwards.
+   FALSE - all slots are taken, h is an ordinary handle */
+BOOL TapeKeepOpen(HANDLE h, LPCWSTR devicePath)
+{
+    TAPE_KEPT   *k;
+    BOOL        ok = TRUE;
+    int         i;
+
+    TapeKeptLockInit();
+    EnterCriticalSection(&g_keptLock);
+    k = TapeKeptFind(h);
+    if (!devicePath)
+    {
+        if (k) k->h = NULL;
+    }
+    else
+    {
+        for (i = 0; !k && i < TAPE_KEPT_MAX; i++)
+            if (!g_kept[i].h) k = &g_kept[i];
+
+        /* handle goes in last: TapeNoteChange looks without lock */
+        if (k)
+        {
+            wcsncpy(k->path, devicePath, MAX_PATH - 1);
+            k->path[MAX_PATH - 1] = 0;
+            InterlockedExchange(&k->changed, 0);
+            k->h = h;
+        }
+        else
+            ok = FALSE;
+    }
+    LeaveCriticalSection(&g_keptLock);
+    return ok;
+}
+
+BOOL TapeIsKept(HANDLE h)
+{
+    return (TapeKeptFind(h) != NULL);
+}
+
+/* kept handle was written, erased, partitioned or lost its cartridge
+   since previous call */
+BOOL TapeKeptChanged(HANDLE h)
+{
+    TAPE_KEPT *k = TapeKeptFind(h);
+
+    return (k && InterlockedExchange(&k->changed, 0) != 0);
+}
+
+/* cheap: called for every block written */
+static void TapeNoteChange(HANDLE h)
+{
+    TAPE_KEPT *k = TapeKeptFind(h);
+
+    if (k && !k->changed) InterlockedExchange(&k->changed, 1);
+}
+
+/* devicePath is \\.\TAPEn or path to virtual tape image (see vtape.h) */
+HANDLE TapeOpen(LPCWSTR devicePath)
+{
+    HANDLE  h = NULL;
+    int     i;
+
+    TapeKeptLockInit();
+    EnterCriticalSection(&g_keptLock);
+    for (i = 0; i < TAPE_KEPT_MAX && !h; i++)
+        if (g_kept[i].h && _wcsicmp(devicePath, g_kept[i].path) == 0) h = g_kept[i].h;
+    LeaveCriticalSection(&g_keptLock);
+    if (h) return h;
+
+    if (VTapeIsPath(devicePath))
+        h = VTapeOpen(devicePath);
+    else
+        h = CreateFileW(devicePath, GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+            OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE) return h;
+
+    MetricsBindHandle(h, devicePath);
+    return h;
+}
+
+void TapeClose(HANDLE h)
+{
+    if (TapeIsKept(h)) return;
+    MetricsUnbindHandle(h);
+    VTapeClose(h);
+    CloseHandle(h);
+}
+
+BOOL TapeRead(HANDLE h, void *buf, DWORD n, DWORD *got)
+{
+    VTAPE   *vt;
+    DWORD   result;
+
+    vt = VTapeFromHandle(h);
+    if (!vt) return ReadFile(h, buf, n, got, NULL);
+
+    result = VTapeRead(vt, buf, n, got);
+    SetLastError(result);
+    return (result == NO_ERROR);
+}
+
+BOOL TapeWrite(HANDLE h, const void *buf, DWORD n, DWORD *written)
+{
+    VTAPE   *vt;
+    DWORD   result;
+
+    TapeNoteChange(h);
+    vt = VTapeFromHandle(h);
+    if (!vt) return WriteFile(h, buf, n, written, NULL);
+
+    result = VTapeWrite(vt, buf, n, written);
+    SetLastError(result);
+    return (result == NO_ERROR);
+}
+
+/* count < 0 spaces backward */
+BOOL TapeSpaceFilemarks(HANDLE h, LONG count)
+{
+    VTAPE   *vt;
+    DWORD   result;
+
+    TRACE_BEGIN("tape space filemark", 0);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeSpaceFilemarks(vt, count);
+    else
+        result = SetTapePosition(h, TAPE_SPACE_FILEMARKS, 0, (DWORD)count,
+            (count < 0) ? 0xFFFFFFFF : 0, FALSE);
+    TRACE_END("tape space filemark", 0);
+    METRIC_ADD(h, METRIC_FILEMARK_OPS, 1);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+BOOL TapeSpaceEndOfData(HANDLE h)
+{
+    VTAPE   *vt;
+    DWORD   result;
+
+    TRACE_BEGIN("tape space eod", 0);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeSpaceEndOfData(vt);
+    else
+        result = SetTapePosition(h, TAPE_SPACE_END_OF_DATA, 0, 0, 0, FALSE);
+    TRACE_END("tape space eod", 0);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
 BOOL TapeRewind(HANDLE h)
 {
+    VTAPE *vt;
     DWORD result;
 
-    result = SetTapePosition(h, TAPE_REWIND, 0, 0, 0, FALSE);
+    TRACE_BEGIN("tape rewind", 0);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeRewind(vt);
+    else
+        result = SetTapePosition(h, TAPE_REWIND, 0, 0, 0, FALSE);
+    TRACE_END("tape rewind", 0);
+    METRIC_ADD(h, METRIC_REWINDS, 1);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* --------------------------------------
+Immediate commands (see tapecmd.h): drive accepts the command and
+returns, TapePollReady tells when it is done. Virtual tape completes
+them before returning.
+-------------------------------------- */
+static BOOL TapeImmediateResult(HANDLE h, DWORD result)
+{
     if (result != NO_ERROR)
     {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+BOOL TapeRewindImmediate(HANDLE h)
+{
+    VTAPE *vt;
+
+    METRIC_ADD(h, METRIC_REWINDS, 1);
+    vt = VTapeFromHandle(h);
+    return TapeImmediateResult(h, vt ? VTapeRewind(vt) :
+        SetTapePosition(h, TAPE_REWIND, 0, 0, 0, TRUE));
+}
+
+/* operation - TAPE_LOAD or TAPE_TENSION */
+BOOL TapeLoadImmediate(HANDLE h, DWORD operation)
+{
+    if (VTapeFromHandle(h)) return TapeImmediateResult(h, NO_ERROR);
+
+    TapeNoteChange(h);
+    return TapeImmediateResult(h, PrepareTape(h, operation, TRUE));
+}
+
+BOOL TapeEraseLongImmediate(HANDLE h)
+{
+    VTAPE *vt;
+
+    TapeNoteChange(h);
+    vt = VTapeFromHandle(h);
+    return TapeImmediateResult(h, vt ? VTapeErase(vt) :
+        EraseTape(h, TAPE_ERASE_LONG, TRUE));
+}
+
+/* FALSE - drive reports an error; ready - previous immediate command done */
+BOOL TapePollReady(HANDLE h, BOOL *ready)
+{
+    DWORD result;
+
+    *ready = FALSE;
+    result = VTapeFromHandle(h) ? NO_ERROR : GetTapeStatus(h);
+    switch (result)
+    {
+        case ERROR_NOT_READY:
+        case ERROR_BUSY:
+        case ERROR_BUS_RESET:
+            break;
+        case ERROR_MEDIA_CHANGED:   /* after load */
+            TapeNoteChange(h);
+            break;
+        case NO_ERROR:
+        case ERROR_BEGINNING_OF_MEDIA:
+        case ERROR_END_OF_MEDIA:
+        case ERROR_FILEMARK_DETECTED:
+        case ERROR_SETMARK_DETECTED:
+        case ERROR_NO_DATA_DETECTED:
+            *ready = TRUE;
+            break;
+        default:
+            return TapeImmediateResult(h, result);
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* logical block address from BOP, partitions numbered from 1 */
+BOOL TapeGetPosition(HANDLE h, DWORD *partition, ULONGLONG *block)
+{
+    DWORD   lo = 0, hi = 0;
+    DWORD   result;
+
+    *partition = 0;
+    *block = 0;
+    if (VTapeFromHandle(h))
+    {
+        SetLastError(ERROR_INVALID_FUNCTION);
+        return FALSE;
+    }
+
+    result = GetTapePosition(h, TAPE_LOGICAL_POSITION, partition, &lo, &hi);
+    if (result != NO_ERROR)
+    {
+        SetLastError(result);
+        return FALSE;
+    }
+
+    *block = ((ULONGLONG)hi << 32) | lo;
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* locate: drive goes to block at full speed, no filemark counting */
+BOOL TapeLocate(HANDLE h, DWORD partition, ULONGLONG block)
+{
+    DWORD result;
+
+    if (VTapeFromHandle(h))
+    {
+        SetLastError(ERROR_INVALID_FUNCTION);
+        return FALSE;
+    }
+
+    TRACE_BEGIN("tape locate", 0);
+    result = SetTapePosition(h, TAPE_LOGICAL_BLOCK, partition,
+        (DWORD)block, (DWORD)(block >> 32), FALSE);
+    TRACE_END("tape locate", 0);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* two partitions, first one firstMiB (drive rounds up); 0 = one partition */
+BOOL TapeCreatePartitions(HANDLE h, DWORD firstMiB)
+{
+    TAPE_GET_DRIVE_PARAMETERS   tapedp;
+    DWORD                       result;
+
+    ZeroMemory(&tapedp, sizeof(tapedp));
+    if (!TapeGetDriveInfo(h, &tapedp)) return FALSE;
+
+    /* virtual tape always has one partition */
+    if (VTapeFromHandle(h) && !firstMiB)
+    {
+        SetLastError(NO_ERROR);
+        return TRUE;
+    }
+
+    if (firstMiB && (!(tapedp.FeaturesLow & TAPE_DRIVE_INITIATOR) ||
+        tapedp.MaximumPartitionCount < 2))
+    {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+
+    TapeNoteChange(h);
+    TRACE_BEGIN("tape partition", firstMiB);
+    result = CreateTapePartition(h, TAPE_INITIATOR_PARTITIONS, firstMiB ? 2 : 1, firstMiB);
+    TRACE_END("tape partition", firstMiB);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
         SetLastError(result);
         return FALSE;
     }
@@ -24,11 +422,22 @@ BOOL TapeGetMediaInfo(HANDLE h, ULONGLONG *capBytes,
     DWORD                       tapempsize;
     TAPE_GET_MEDIA_PARAMETERS   tapemp;
     DWORD                       result;
+    VTAPE                       *vt;
 
     tapempsize = sizeof(TAPE_GET_MEDIA_PARAMETERS);
     ZeroMemory(&tapemp, sizeof(tapemp));
 
-    result = GetTapeParameters(h, GET_TAPE_MEDIA_INFORMATION, &tapempsize, &tapemp);
+    vt = VTapeFromHandle(h);
+    if (vt)
+    {
+        tapemp.Capacity.QuadPart = (LONGLONG)vt->capacity;
+        tapemp.Remaining.QuadPart = vt->capacity > vt->used ?
+            (LONGLONG)(vt->capacity - vt->used) : 0;
+        tapemp.PartitionCount = 1;
+        result = NO_ERROR;
+    }
+    else
+        result = GetTapeParameters(h, GET_TAPE_MEDIA_INFORMATION, &tapempsize, &tapemp);
 
     if (result != NO_ERROR)
     {
@@ -47,11 +456,54 @@ BOOL TapeGetMediaInfo(HANDLE h, ULONGLONG *capBytes,
     return TRUE;
 }
 
+/* space left from current position to end of media, 0 = unknown */
+BOOL TapeGetRemaining(HANDLE h, ULONGLONG *remaining)
+{
+    DWORD                       tapempsize;
+    TAPE_GET_MEDIA_PARAMETERS   tapemp;
+    DWORD                       result;
+    VTAPE                       *vt;
+
+    tapempsize = sizeof(TAPE_GET_MEDIA_PARAMETERS);
+    ZeroMemory(&tapemp, sizeof(tapemp));
+    *remaining = 0;
+
+    vt = VTapeFromHandle(h);
+    if (vt)
+    {
+        /* unlimited image: nothing to check against */
+        if (vt->capacity == 0) return TRUE;
+        *remaining = vt->capacity > vt->payload ? vt->capacity - vt->payload : 0;
+        return TRUE;
+    }
+
+    result = GetTapeParameters(h, GET_TAPE_MEDIA_INFORMATION, &tapempsize, &tapemp);
+    if (result != NO_ERROR)
+    {
+        SetLastError(result);
+        return FALSE;
+    }
+
+    *remaining = (ULONGLONG)tapemp.Remaining.QuadPart;
+    return TRUE;
+}
+
 BOOL TapeGetDriveInfo(HANDLE h, TAPE_GET_DRIVE_PARAMETERS *out)
 {
     DWORD tapedps;
     DWORD result;
 
+    if (VTapeFromHandle(h))
+    {
+        ZeroMemory(out, sizeof(*out));
+        out->MaximumBlockSize = VTAPE_MAX_BLOCK;
+        out->MinimumBlockSize = 1;
+        out->DefaultBlockSize = TAPE_IO_BUF;
+        out->MaximumPartitionCount = 1;
+        SetLastError(NO_ERROR);
+        return TRUE;
+    }
+
     tapedps = sizeof(TAPE_GET_DRIVE_PARAMETERS);
     result = GetTapeParameters(h, GET_TAPE_DRIVE_INFORMATION, &tapedps, out);
     if (result != NO_ERROR)
@@ -95,11 +547,46 @@ BOOL TapeSetCompression(HANDLE h, BOOL enable)
 
 BOOL TapeWriteFilemark(HANDLE h)
 {
+    VTAPE *vt;
     DWORD result;
 
-    result = WriteTapemark(h, TAPE_FILEMARKS, 1, FALSE);
+    TapeNoteChange(h);
+    TRACE_BEGIN("tape filemark", 0);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeWriteFilemark(vt);
+    else
+        result = WriteTapemark(h, TAPE_FILEMARKS, 1, FALSE);
+    TRACE_END("tape filemark", 0);
+    METRIC_ADD(h, METRIC_FILEMARK_OPS, 1);
     if (result != NO_ERROR)
     {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* zero filemarks: drive writes out its buffer, tape contents stay the same */
+BOOL TapeFlush(HANDLE h)
+{
+    DWORD result;
+
+    if (VTapeFromHandle(h))
+    {
+        SetLastError(NO_ERROR);
+        return TRUE;
+    }
+
+    TRACE_BEGIN("tape flush", 0);
+    result = WriteTapemark(h, TAPE_FILEMARKS, 0, FALSE);
+    TRACE_END("tape flush", 0);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
         SetLastError(result);
         return FALSE;
     }
@@ -110,11 +597,43 @@ BOOL TapeWriteFilemark(HANDLE h)
 
 BOOL TapeEraseLong(HANDLE h)
 {
+    VTAPE *vt;
+    DWORD result;
+
+    TapeNoteChange(h);
+    TRACE_BEGIN("tape erase", 0);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeErase(vt);
+    else
+        result = EraseTape(h, TAPE_ERASE_LONG, FALSE);
+    TRACE_END("tape erase", 0);
+    if (result != NO_ERROR)
+    {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
+        SetLastError(result);
+        return FALSE;
+    }
+
+    SetLastError(NO_ERROR);
+    return TRUE;
+}
+
+/* writes end of data at current position */
+BOOL TapeEraseShort(HANDLE h)
+{
+    VTAPE *vt;
     DWORD result;
 
-    result = EraseTape(h, TAPE_ERASE_LONG, FALSE);
+    TapeNoteChange(h);
+    vt = VTapeFromHandle(h);
+    if (vt)
+        result = VTapeEraseShort(vt);
+    else
+        result = EraseTape(h, TAPE_ERASE_SHORT, FALSE);
     if (result != NO_ERROR)
     {
+        METRIC_ADD(h, METRIC_DEVICE_ERRORS, 1);
         SetLastError(result);
         return FALSE;
     }
@@ -127,8 +646,16 @@ BOOL TapeIsMediaLoaded(HANDLE h)
 {
     DWORD result;
 
-    result = GetTapeStatus(h);
+    result = VTapeFromHandle(h) ? NO_ERROR : GetTapeStatus(h);
 
+    /* first status on a handle kept open across a cartridge swap */
+    if (result == ERROR_MEDIA_CHANGED)
+    {
+        TapeNoteChange(h);
+        result = GetTapeStatus(h);
+    }
+
+    if (result != NO_ERROR) TapeNoteChange(h);
     if (result == NO_ERROR)
     {
         SetLastError(NO_ERROR);
@@ -143,12 +670,27 @@ BOOL TapeIsMediaLoaded(HANDLE h)
     return FALSE;
 }
 
+/* ejects cartridge so operator can load next one, no-op on virtual tape */
+BOOL TapeUnload(HANDLE h)
+{
+    DWORD result;
+
+    if (VTapeFromHandle(h)) return TRUE;
+
+    TapeNoteChange(h);
+    result = PrepareTape(h, TAPE_UNLOAD, FALSE);
+    SetLastError(result);
+    return (result == NO_ERROR);
+}
+
 BOOL TapePrepareToWork(HANDLE h)
 {
     DWORD                       result = 0;
     TAPE_GET_DRIVE_PARAMETERS   gtdi;
     DWORD                       gtdi_size;
 
+    if (VTapeFromHandle(h)) return TRUE;
+
     memset(&gtdi, 0, sizeof(gtdi));
     gtdi_size = sizeof(TAPE_GET_DRIVE_PARAMETERS);
     result = GetTapeParameters(h, GET_TAPE_DRIVE_INFORMATION,
@@ -187,6 +729,8 @@ BOOL TapeSetVariableBlockSize(HANDLE h)
     DWORD                       result = 0;
     TAPE_SET_MEDIA_PARAMETERS   tsmp;
 
+    if (VTapeFromHandle(h)) return TRUE;
+
     memset(&tsmp, 0, sizeof(TAPE_SET_MEDIA_PARAMETERS));
     //Setting dynamic block size if this possible
     tsmp.BlockSize = 0;
@@ -201,10 +745,24 @@ BOOL TapeSetVariableBlockSize(HANDLE h)
     return TRUE;
 }
 
-void TapeReaderInit(TAPE_READER *tr, HANDLE h)
+BOOL TapeReaderInit(TAPE_READER *tr, HANDLE h)
 {
     ZeroMemory(tr, sizeof(*tr));
     tr->h = h;
+    tr->buf = (BYTE*)malloc(TAPE_MAX_BLOCK);
+    if (!tr->buf)
+    {
+        wprintf(L"Out of memory.\r\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void TapeReaderFree(TAPE_READER *tr)
+{
+    free(tr->buf);
+    tr->buf = NULL;
 }
 
 BOOL TapeReaderFill(TAPE_READER *tr)
@@ -215,7 +773,9 @@ BOOL TapeReaderFill(TAPE_READER *tr)
 
     if (tr->atFilemark) return FALSE;
 
-    result = ReadFile(tr->h, tr->buf, TAPE_IO_BUF, &retbytes, NULL);
+    TRACE_BEGIN("tape read", 0);
+    result = TapeRead(tr->h, tr->buf, TAPE_MAX_BLOCK, &retbytes);
+    TRACE_END("tape read", retbytes);
     if (!result)
     {
         resultcode = GetLastError();
@@ -227,10 +787,14 @@ BOOL TapeReaderFill(TAPE_READER *tr)
             tr->avail = 0;
             SetLastError(NO_ERROR);
         }
+        else
+            METRIC_ADD(tr->h, METRIC_DEVICE_ERRORS, 1);
 
         return FALSE;
     }
 
+    METRIC_ADD(tr->h, METRIC_BYTES_READ, retbytes);
+
     tr->pos = 0;
     tr->avail = retbytes;
 
@@ -257,5 +821,6 @@ DWORD TapeReaderGet(TAPE_READER *tr, BYTE *dst, DWORD need)
         need -= take;
     }
 
+    tr->offset += total;
     return total;
 }
@@ -2,35 +2,86 @@
 #define __TAPE_BACKUP_TAPE
 
 #include "common.h"
+#include "trace.h"
+#include "metrics.h"
+#include "vtape.h"
 
 #define TAPE_IO_BUF 64 * 1024
+#define TAPE_MAX_BLOCK          (1024 * 1024)   /* largest block we write, readers use it */
+#define TAPE_DEFAULT_DEPTH      1
+#define TAPE_DEFAULT_BUDGET     (64 * 1024 * 1024)  /* buffer memory per pipeline */
+
+/* --------------------------------------
+I/O profile: tape block size and buffers in flight
+between source/destination and tape (see calib.h),
+depth is starting point for auto-tuning (see autotune.h)
+-------------------------------------- */
+typedef struct _TAPE_IO_PROFILE {
+    DWORD   blockSize;
+    DWORD   depth;
+    DWORD   memBudget;      /* bytes, upper limit for buffers */
+    BOOL    autoTune;
+} TAPE_IO_PROFILE;
+
+void TapeDefaultProfile(TAPE_IO_PROFILE *p);
+void TapeSetDefaultTuning(DWORD memBudget, BOOL autoTune);
 
 /* --------------------------------------
 Tape low-level helpers
 -------------------------------------- */
+HANDLE TapeOpen(LPCWSTR devicePath);
+void TapeClose(HANDLE h);
+BOOL TapeRead(HANDLE h, void *buf, DWORD n, DWORD *got);
+BOOL TapeWrite(HANDLE h, const void *buf, DWORD n, DWORD *written);
+BOOL TapeSpaceFilemarks(HANDLE h, LONG count);
+BOOL TapeSpaceEndOfData(HANDLE h);
 BOOL TapeRewind(HANDLE h);
+BOOL TapeGetPosition(HANDLE h, DWORD *partition, ULONGLONG *block);
+BOOL TapeLocate(HANDLE h, DWORD partition, ULONGLONG block);
+BOOL TapeCreatePartitions(HANDLE h, DWORD firstMiB);
 BOOL TapeGetMediaInfo(HANDLE h, ULONGLONG *capBytes,
     DWORD *blockSize, BOOL *writeProtected);
+BOOL TapeGetRemaining(HANDLE h, ULONGLONG *remaining);
 BOOL TapeGetDriveInfo(HANDLE h, TAPE_GET_DRIVE_PARAMETERS *out);
 BOOL TapeSetCompression(HANDLE h, BOOL enable);
 BOOL TapeWriteFilemark(HANDLE h);
+BOOL TapeFlush(HANDLE h);
 BOOL TapeEraseLong(HANDLE h);
+BOOL TapeEraseShort(HANDLE h);
 BOOL TapeIsMediaLoaded(HANDLE h);
 BOOL TapePrepareToWork(HANDLE h);
+BOOL TapeUnload(HANDLE h);
 BOOL TapeSetVariableBlockSize(HANDLE h);
+BOOL TapeRewindImmediate(HANDLE h);
+BOOL TapeLoadImmediate(HANDLE h, DWORD operation);
+BOOL TapeEraseLongImmediate(HANDLE h);
+BOOL TapePollReady(HANDLE h, BOOL *ready);
+
+/* --------------------------------------
+Kept-open handles (see session.h): TapeOpen of the device
+returns it, TapeClose doesn't close it, changes of tape contents are
+flagged per handle
+-------------------------------------- */
+#define TAPE_KEPT_MAX           16
+
+BOOL TapeKeepOpen(HANDLE h, LPCWSTR devicePath);
+BOOL TapeIsKept(HANDLE h);
+BOOL TapeKeptChanged(HANDLE h);
 
 /* --------------------------------------
 Buffered tape reader (for TAR)
 -------------------------------------- */
 typedef struct _TAPE_READER {
     HANDLE  h;
-    BYTE    buf[TAPE_IO_BUF];
+    BYTE    *buf;           /* TAPE_MAX_BLOCK bytes: any block fits */
     DWORD   pos;
     DWORD   avail;
     BOOL    atFilemark;
+    ULONGLONG offset;       /* bytes returned since init */
 } TAPE_READER;
 
-void TapeReaderInit(TAPE_READER *tr, HANDLE h);
+BOOL TapeReaderInit(TAPE_READER *tr, HANDLE h);
+void TapeReaderFree(TAPE_READER *tr);
 BOOL TapeReaderFill(TAPE_READER *tr);
 DWORD TapeReaderGet(TAPE_READER *tr, BYTE *dst, DWORD need);
 
@@ -0,0 +1,202 @@
+#include "tapecmd.h"
+
+/* issues one immediate command and polls until drive is ready again */
+static BOOL TapeCmdIssue(TAPE_CMD_QUEUE *q, TAPE_CMD_KIND kind)
+{
+    BOOL    ok, ready = FALSE;
+
+    switch (kind)
+    {
+        case TAPE_CMD_REWIND:       ok = TapeRewindImmediate(q->h); break;
+        case TAPE_CMD_LOAD:         ok = TapeLoadImmediate(q->h, TAPE_LOAD); break;
+        case TAPE_CMD_TENSION:      ok = TapeLoadImmediate(q->h, TAPE_TENSION); break;
+        case TAPE_CMD_ERASE_LONG:   ok = TapeEraseLongImmediate(q->h); break;
+        default:
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return FALSE;
+    }
+
+    while (ok && !q->stop)
+    {
+        ok = TapePollReady(q->h, &ready);
+        if (!ok || ready) break;
+        Sleep(TAPE_CMD_POLL_MS);
+    }
+
+    return ok;
+}
+
+static BOOL TapeCmdExecute(TAPE_CMD_QUEUE *q, TAPE_CMD_KIND kind)
+{
+    TAPE_GET_DRIVE_PARAMETERS   tapedp;
+    BOOL                        ok = TRUE;
+
+    if (kind != TAPE_CMD_PREPARE) return TapeCmdIssue(q, kind);
+
+    /* as TapePrepareToWork */
+    if (VTapeFromHandle(q->h)) return TRUE;
+
+    ZeroMemory(&tapedp, sizeof(tapedp));
+    if (!TapeGetDriveInfo(q->h, &tapedp)) return FALSE;
+
+    if (tapedp.FeaturesHigh & TAPE_DRIVE_LOAD_UNLOAD)
+        ok = TapeCmdIssue(q, TAPE_CMD_LOAD);
+    if (ok && (tapedp.FeaturesHigh & TAPE_DRIVE_TENSION))
+        ok = TapeCmdIssue(q, TAPE_CMD_TENSION);
+    return ok;
+}
+
+static DWORD WINAPI TapeCmdThread(LPVOID param)
+{
+    TAPE_CMD_QUEUE  *q = (TAPE_CMD_QUEUE*)param;
+    TAPE_CMD_KIND   kind;
+    DWORD           result;
+
+    for (;;)
+    {
+        WaitForSingleObject(q->semPending, INFINITE);
+        if (q->stop) break;
+
+        EnterCriticalSection(&q->lock);
+        kind = q->cmds[q->head];
+        result = q->result;
+        LeaveCriticalSection(&q->lock);
+
+        TRACE_BEGIN("tape command", kind);
+        if (result == NO_ERROR && !TapeCmdExecute(q, kind))
+            result = GetLastError() ? GetLastError() : ERROR_GEN_FAILURE;
+        TRACE_END("tape command", kind);
+
+        EnterCriticalSection(&q->lock);
+        q->result = result;
+        q->head = (q->head + 1) % TAPE_CMD_MAX;
+        if (--q->count == 0) SetEvent(q->idle);
+        LeaveCriticalSection(&q->lock);
+    }
+
+    return 0;
+}
+
+BOOL TapeCmdInit(TAPE_CMD_QUEUE *q, HANDLE h)
+{
+    ZeroMemory(q, sizeof(*q));
+    q->h = h;
+    q->result = NO_ERROR;
+    InitializeCriticalSection(&q->lock);
+    q->semPending = CreateSemaphoreW(NULL, 0, TAPE_CMD_MAX, NULL);
+    q->idle = CreateEventW(NULL, TRUE, TRUE, NULL);
+    if (q->semPending && q->idle)
+        q->thread = CreateThread(NULL, 0, TapeCmdThread, q, 0, NULL);
+
+    if (!q->thread)
+    {
+        PrintLastErrorW(L"Failed to start tape command thread", 0);
+        TapeCmdFree(q);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* waits for posted commands, then stops the worker */
+void TapeCmdFree(TAPE_CMD_QUEUE *q)
+{
+    if (q->thread)
+    {
+        WaitForSingleObject(q->idle, INFINITE);
+        InterlockedExchange(&q->stop, 1);
+        ReleaseSemaphore(q->semPending, 1, NULL);
+        WaitForSingleObject(q->thread, INFINITE);
+        CloseHandle(q->thread);
+        q->thread = NULL;
+    }
+
+    if (q->semPending) CloseHandle(q->semPending);
+    if (q->idle) CloseHandle(q->idle);
+    q->semPending = NULL;
+    q->idle = NULL;
+    if (q->h)
+    {
+        DeleteCriticalSection(&q->lock);
+        q->h = NULL;
+    }
+}
+
+BOOL TapeCmdPost(TAPE_CMD_QUEUE *q, TAPE_CMD_KIND kind)
+{
+    EnterCriticalSection(&q->lock);
+    if (q->count == TAPE_CMD_MAX)
+    {
+        LeaveCriticalSection(&q->lock);
+        SetLastError(ERROR_BUSY);
+        return FALSE;
+    }
+
+    q->cmds[(q->head + q->count) % TAPE_CMD_MAX] = kind;
+    q->count++;
+    ResetEvent(q->idle);
+    LeaveCriticalSection(&q->lock);
+
+    ReleaseSemaphore(q->semPending, 1, NULL);
+    return TRUE;
+}
+
+/* TRUE - all posted commands done and succeeded; FALSE - GetLastError has
+   the first failure, or WAIT_TIMEOUT if commands are still running */
+BOOL TapeCmdWait(TAPE_CMD_QUEUE *q, DWORD timeoutMs)
+{
+    DWORD result;
+
+    if (WaitForSingleObject(q->idle, timeoutMs) != WAIT_OBJECT_0)
+    {
+        SetLastError(WAIT_TIMEOUT);
+        return FALSE;
+    }
+
+    EnterCriticalSection(&q->lock);
+    result = q->result;
+    q->result = NO_ERROR;
+    LeaveCriticalSection(&q->lock);
+
+    SetLastError(result);
+    return (result == NO_ERROR);
+}
+
+/* waits for posted commands, prints waitMsg only if they aren't done yet */
+BOOL TapeCmdFinish(TAPE_CMD_QUEUE *q, LPCWSTR waitMsg)
+{
+    if (TapeCmdWait(q, 0)) return TRUE;
+    if (GetLastError() != WAIT_TIMEOUT) return FALSE;
+
+    wprintf(L"%s\r\n", waitMsg);
+    return TapeCmdWait(q, INFINITE);
+}
+
+/* one command in background, console shows elapsed time meanwhile */
+BOOL TapeCmdRun(HANDLE h, TAPE_CMD_KIND kind, LPCWSTR what)
+{
+    TAPE_CMD_QUEUE  q;
+    DWORD           start = GetTickCount();
+    DWORD           err;
+    BOOL            ok;
+
+    if (!TapeCmdInit(&q, h)) return FALSE;
+
+    ok = TapeCmdPost(&q, kind);
+    while (ok && !TapeCmdWait(&q, 1000))
+    {
+        if (GetLastError() != WAIT_TIMEOUT)
+        {
+            ok = FALSE;
+            break;
+        }
+        wprintf(L"\r%s... %lu s", what, (unsigned long)((GetTickCount() - start) / 1000));
+    }
+    err = GetLastError();
+
+    wprintf(L"\r%s... %s (%lu s)\r\n", what, ok ? L"done" : L"failed",
+        (unsigned long)((GetTickCount() - start) / 1000));
+    TapeCmdFree(&q);
+    SetLastError(err);
+    return ok;
+}
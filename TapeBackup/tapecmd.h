@@ -0,0 +1,47 @@
+#ifndef __TAPE_BACKUP_TAPECMD
+#define __TAPE_BACKUP_TAPECMD
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+
+/* --------------------------------------
+Background tape commands: rewind, load, tension and long erase take
+minutes on a real drive. A worker thread issues them with the immediate
+flag and polls drive status until done, so the caller hashes, prompts
+or prints progress meanwhile. Commands posted to one queue run in order,
+after a failure the rest are skipped. Caller doesn't touch the tape
+handle between TapeCmdPost and a successful TapeCmdWait.
+-------------------------------------- */
+#define TAPE_CMD_MAX        8
+#define TAPE_CMD_POLL_MS    500
+
+typedef enum _TAPE_CMD_KIND {
+    TAPE_CMD_REWIND = 0,
+    TAPE_CMD_LOAD,
+    TAPE_CMD_TENSION,
+    TAPE_CMD_ERASE_LONG,
+    TAPE_CMD_PREPARE        /* load and tension, as far as drive supports them */
+} TAPE_CMD_KIND;
+
+typedef struct _TAPE_CMD_QUEUE {
+    HANDLE              h;
+    HANDLE              thread;
+    HANDLE              semPending;     /* one count per posted command */
+    HANDLE              idle;           /* manual reset: nothing posted or running */
+    CRITICAL_SECTION    lock;
+    TAPE_CMD_KIND       cmds[TAPE_CMD_MAX];
+    DWORD               head;
+    DWORD               count;          /* posted, not finished */
+    DWORD               result;         /* first failure since last wait */
+    volatile LONG       stop;
+} TAPE_CMD_QUEUE;
+
+BOOL TapeCmdInit(TAPE_CMD_QUEUE *q, HANDLE h);
+void TapeCmdFree(TAPE_CMD_QUEUE *q);
+BOOL TapeCmdPost(TAPE_CMD_QUEUE *q, TAPE_CMD_KIND kind);
+BOOL TapeCmdWait(TAPE_CMD_QUEUE *q, DWORD timeoutMs);
+BOOL TapeCmdFinish(TAPE_CMD_QUEUE *q, LPCWSTR waitMsg);
+BOOL TapeCmdRun(HANDLE h, TAPE_CMD_KIND kind, LPCWSTR what);
+
+#endif
@@ -0,0 +1,586 @@
+#include "toc.h"
+
+#define TOC_ALIGN8(n)           (((ULONGLONG)(n) + 7) & ~(ULONGLONG)7)
+#define TOC_ROW_BYTES           (4 * 8 + 6 * 4 + 2)     /* fixed columns */
+#define TOC_HEAP_INITIAL        (256 * 1024)
+
+static const char *g_tocFormatNames[] = { "v7", "ustar", "gnu", "pax" };
+
+static BOOL TocHasExt(LPCWSTR path, LPCWSTR ext)
+{
+    size_t n = wcslen(path), e = wcslen(ext);
+
+    return n > e && _wcsicmp(path + n - e, ext) == 0;
+}
+
+DWORD TocFormatOf(LPCWSTR path)
+{
+    if (!path) return TOC_FORMAT_TEXT;
+    if (TocHasExt(path, TOC_EXT_JSONL)) return TOC_FORMAT_JSONL;
+    if (TocHasExt(path, TOC_EXT_CSV)) return TOC_FORMAT_CSV;
+    if (TocHasExt(path, TOC_EXT_COLUMNS)) return TOC_FORMAT_COLUMNS;
+    return TOC_FORMAT_TEXT;
+}
+
+static const char* TocFormatName(char format)
+{
+    return ((unsigned char)format < 4) ? g_tocFormatNames[(unsigned char)format] : "";
+}
+
+/* --------------------------------------
+JSON Lines, CSV
+-------------------------------------- */
+static void TocJsonString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fputc('\\', f);
+            fputc(*s, f);
+        }
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned)(unsigned char)*s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void TocCsvString(FILE *f, const char *s)
+{
+    if (!strpbrk(s, ",\"\r\n"))
+    {
+        fputs(s, f);
+        return;
+    }
+
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"') fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void TocPutJson(FILE *f, const TAR_MEMBER *m)
+{
+    char type[2];
+
+    type[0] = m->type;
+    type[1] = 0;
+    fputs("{\"path\":", f);
+    TocJsonString(f, m->name);
+    fputs(",\"type\":", f);
+    TocJsonString(f, type);
+    fprintf(f, ",\"size\":%I64u,\"mtime\":%I64d,\"mode\":\"%04lo\",\"uid\":%lu,\"gid\":%lu,\"uname\":",
+        m->size, m->mtime, (unsigned long)m->mode, (unsigned long)m->uid, (unsigned long)m->gid);
+    TocJsonString(f, m->uname);
+    fputs(",\"gname\":", f);
+    TocJsonString(f, m->gname);
+    fputs(",\"link\":", f);
+    TocJsonString(f, m->link);
+    fprintf(f, ",\"devmajor\":%lu,\"devminor\":%lu,\"chksum\":%lu,\"format\":\"%s\","
+        "\"offset\":%I64u,\"data\":%I64u}\n",
+        (unsigned long)m->devmajor, (unsigned long)m->devminor, (unsigned long)m->chksum,
+        TocFormatName(m->format), m->offset, m->dataOffset);
+}
+
+static void TocPutCsv(FILE *f, const TAR_MEMBER *m)
+{
+    char type[2];
+
+    type[0] = m->type;
+    type[1] = 0;
+    TocCsvString(f, m->name);
+    fputc(',', f);
+    TocCsvString(f, type);
+    fprintf(f, ",%I64u,%I64d,%04lo,%lu,%lu,", m->size, m->mtime,
+        (unsigned long)m->mode, (unsigned long)m->uid, (unsigned long)m->gid);
+    TocCsvString(f, m->uname);
+    fputc(',', f);
+    TocCsvString(f, m->gname);
+    fputc(',', f);
+    TocCsvString(f, m->link);
+    fprintf(f, ",%lu,%lu,%lu,%s,%I64u,%I64u\r\n",
+        (unsigned long)m->devmajor, (unsigned long)m->devminor, (unsigned long)m->chksum,
+        TocFormatName(m->format), m->offset, m->dataOffset);
+}
+
+/* --------------------------------------
+Columns: one block at a time in memory
+-------------------------------------- */
+static BOOL TocWrite(TOC_WRITER *w, const void *data, ULONGLONG bytes)
+{
+    static const BYTE   zero[8] = { 0 };
+    DWORD               written = 0;
+    DWORD               pad = (DWORD)(TOC_ALIGN8(bytes) - bytes);
+
+    if (bytes > 0 && (!WriteFile(w->hf, data, (DWORD)bytes, &written, NULL) || written != bytes))
+        return FALSE;
+    if (pad > 0 && (!WriteFile(w->hf, zero, pad, &written, NULL) || written != pad))
+        return FALSE;
+
+    w->pos += bytes + pad;
+    return TRUE;
+}
+
+static BOOL TocAllocBlock(TOC_WRITER *w)
+{
+    BYTE    *p;
+    DWORD   i;
+
+    p = (BYTE*)malloc((size_t)TOC_BLOCK_ROWS * TOC_ROW_BYTES);
+    if (!p) return FALSE;
+
+    w->offset = (ULONGLONG*)p;      p += TOC_BLOCK_ROWS * 8;
+    w->dataOffset = (ULONGLONG*)p;  p += TOC_BLOCK_ROWS * 8;
+    w->size = (ULONGLONG*)p;        p += TOC_BLOCK_ROWS * 8;
+    w->mtime = (LONGLONG*)p;        p += TOC_BLOCK_ROWS * 8;
+    w->mode = (DWORD*)p;            p += TOC_BLOCK_ROWS * 4;
+    w->uid = (DWORD*)p;             p += TOC_BLOCK_ROWS * 4;
+    w->gid = (DWORD*)p;             p += TOC_BLOCK_ROWS * 4;
+    w->devmajor = (DWORD*)p;        p += TOC_BLOCK_ROWS * 4;
+    w->devminor = (DWORD*)p;        p += TOC_BLOCK_ROWS * 4;
+    w->chksum = (DWORD*)p;          p += TOC_BLOCK_ROWS * 4;
+    w->type = p;                    p += TOC_BLOCK_ROWS;
+    w->fmt = p;
+
+    for (i = 0; i < 4; i++)
+    {
+        w->heaps[i].offsets = (DWORD*)malloc((TOC_BLOCK_ROWS + 1) * sizeof(DWORD));
+        if (!w->heaps[i].offsets) return FALSE;
+        w->heaps[i].offsets[0] = 0;
+    }
+    return TRUE;
+}
+
+static void TocFreeBlock(TOC_WRITER *w)
+{
+    DWORD i;
+
+    free(w->offset);
+    w->offset = NULL;
+    for (i = 0; i < 4; i++)
+    {
+        free(w->heaps[i].offsets);
+        free(w->heaps[i].bytes);
+        ZeroMemory(&w->heaps[i], sizeof(w->heaps[i]));
+    }
+    free(w->blockAt);
+    w->blockAt = NULL;
+}
+
+static BOOL TocFlushBlock(TOC_WRITER *w)
+{
+    TOC_BLOCK_HEADER    bh;
+    ULONGLONG           *at;
+    DWORD               r = w->rows, i, cap;
+    BOOL                ok;
+
+    if (w->blocks == w->blocksCap)
+    {
+        cap = w->blocksCap ? w->blocksCap * 2 : 64;
+        at = (ULONGLONG*)realloc(w->blockAt, cap * sizeof(ULONGLONG));
+        if (!at) return FALSE;
+        w->blockAt = at;
+        w->blocksCap = cap;
+    }
+    w->blockAt[w->blocks++] = w->pos;
+
+    ZeroMemory(&bh, sizeof(bh));
+    PutLE32(bh.rows, r);
+    PutLE32(bh.nameBytes, w->heaps[0].used);
+    PutLE32(bh.linkBytes, w->heaps[1].used);
+    PutLE32(bh.unameBytes, w->heaps[2].used);
+    PutLE32(bh.gnameBytes, w->heaps[3].used);
+
+    ok = TocWrite(w, &bh, sizeof(bh)) &&
+        TocWrite(w, w->offset, (ULONGLONG)r * 8) &&
+        TocWrite(w, w->dataOffset, (ULONGLONG)r * 8) &&
+        TocWrite(w, w->size, (ULONGLONG)r * 8) &&
+        TocWrite(w, w->mtime, (ULONGLONG)r * 8) &&
+        TocWrite(w, w->mode, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->uid, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->gid, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->devmajor, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->devminor, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->chksum, (ULONGLONG)r * 4) &&
+        TocWrite(w, w->type, r) &&
+        TocWrite(w, w->fmt, r);
+    for (i = 0; ok && i < 4; i++)
+        ok = TocWrite(w, w->heaps[i].offsets, ((ULONGLONG)r + 1) * 4);
+    for (i = 0; ok && i < 4; i++)
+        ok = TocWrite(w, w->heaps[i].bytes, w->heaps[i].used);
+
+    w->rows = 0;
+    for (i = 0; i < 4; i++)
+        w->heaps[i].used = 0;
+    return ok;
+}
+
+static BOOL TocHeapFits(const TOC_HEAP *h, DWORD len)
+{
+    return h->used + len <= TOC_BLOCK_HEAP_MAX;
+}
+
+static BOOL TocHeapAdd(TOC_HEAP *h, DWORD row, const char *s, DWORD len)
+{
+    char    *bytes;
+    DWORD   cap;
+
+    if (h->used + len > h->cap)
+    {
+        cap = h->cap ? h->cap : TOC_HEAP_INITIAL;
+        while (cap < h->used + len) cap *= 2;
+        if (cap > TOC_BLOCK_HEAP_MAX) cap = TOC_BLOCK_HEAP_MAX;
+
+        bytes = (char*)realloc(h->bytes, cap);
+        if (!bytes) return FALSE;
+        h->bytes = bytes;
+        h->cap = cap;
+    }
+
+    if (len > 0) memcpy(h->bytes + h->used, s, len);
+    h->used += len;
+    h->offsets[row + 1] = h->used;
+    return TRUE;
+}
+
+static BOOL TocAddRow(TOC_WRITER *w, const TAR_MEMBER *m)
+{
+    const char  *s[4];
+    DWORD       len[4];
+    DWORD       i, r;
+    BOOL        fits = TRUE;
+
+    s[0] = m->name;
+    s[1] = m->link;
+    s[2] = m->uname;
+    s[3] = m->gname;
+    for (i = 0; i < 4; i++)
+    {
+        len[i] = (DWORD)strlen(s[i]);
+        if (!TocHeapFits(&w->heaps[i], len[i])) fits = FALSE;
+    }
+
+    if ((w->rows == TOC_BLOCK_ROWS || !fits) && !TocFlushBlock(w))
+        return FALSE;
+
+    r = w->rows;
+    for (i = 0; i < 4; i++)
+        if (!TocHeapAdd(&w->heaps[i], r, s[i], len[i])) return FALSE;
+
+    w->offset[r] = m->offset;
+    w->dataOffset[r] = m->dataOffset;
+    w->size[r] = m->size;
+    w->mtime[r] = m->mtime;
+    w->mode[r] = m->mode;
+    w->uid[r] = m->uid;
+    w->gid[r] = m->gid;
+    w->devmajor[r] = m->devmajor;
+    w->devminor[r] = m->devminor;
+    w->chksum[r] = m->chksum;
+    w->type[r] = (BYTE)m->type;
+    w->fmt[r] = (BYTE)m->format;
+    w->rows++;
+    return TRUE;
+}
+
+/* block offsets, then the header with its magic */
+static BOOL TocFinishColumns(TOC_WRITER *w)
+{
+    TOC_FILE_HEADER hdr;
+    unsigned char   le[8];
+    ULONGLONG       index;
+    LARGE_INTEGER   li;
+    FILETIME        ft;
+    DWORD           i, written = 0;
+
+    if (w->rows > 0 && !TocFlushBlock(w)) return FALSE;
+
+    index = w->pos;
+    for (i = 0; i < w->blocks; i++)
+    {
+        PutLE64(le, w->blockAt[i]);
+        if (!TocWrite(w, le, 8)) return FALSE;
+    }
+
+    ZeroMemory(&hdr, sizeof(hdr));
+    memcpy(hdr.magic, "ZTTOCCOL", 8);
+    PutLE32(hdr.blockRows, TOC_BLOCK_ROWS);
+    PutLE64(hdr.entries, w->entries);
+    PutLE32(hdr.blocks, w->blocks);
+    PutLE64(hdr.index, index);
+    memcpy(&hdr.zh, &w->zh, sizeof(hdr.zh));
+    GetSystemTimeAsFileTime(&ft);
+    PutLE64(hdr.written, ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime);
+
+    li.QuadPart = 0;
+    return SetFilePointerEx(w->hf, li, NULL, FILE_BEGIN) &&
+        WriteFile(w->hf, &hdr, sizeof(hdr), &written, NULL) && written == sizeof(hdr);
+}
+
+/* --------------------------------------
+Writer
+-------------------------------------- */
+BOOL TocOpen(TOC_WRITER *w, LPCWSTR path, DWORD format, const ZEROTAPE_HEADER *zh,
+    TAR_MEMBER_SINK next, void *nextCtx)
+{
+    TOC_FILE_HEADER blank;
+
+    ZeroMemory(w, sizeof(*w));
+    w->format = format;
+    w->hf = INVALID_HANDLE_VALUE;
+    w->next = next;
+    w->nextCtx = nextCtx;
+    memcpy(&w->zh, zh, sizeof(*zh));
+    _snwprintf(w->path, MAX_PATH * 2, L"%s", path);
+    w->path[MAX_PATH * 2 - 1] = 0;
+    _snwprintf(w->tmpPath, MAX_PATH * 2, L"%s.%lu.tmp", path, (unsigned long)GetCurrentThreadId());
+    w->tmpPath[MAX_PATH * 2 - 1] = 0;
+
+    if (format == TOC_FORMAT_COLUMNS)
+    {
+        if (!TocAllocBlock(w))
+        {
+            wprintf(L"Out of memory.\r\n");
+            TocFreeBlock(w);
+            return FALSE;
+        }
+
+        w->hf = CreateFileW(w->tmpPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        ZeroMemory(&blank, sizeof(blank));
+        if (w->hf == INVALID_HANDLE_VALUE || !TocWrite(w, &blank, sizeof(blank)))
+        {
+            PrintLastErrorW(L"Failed to create TOC file", 0);
+            if (w->hf != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(w->hf);
+                DeleteFileW(w->tmpPath);
+            }
+            TocFreeBlock(w);
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    w->f = _wfopen(w->tmpPath, L"wb");
+    if (!w->f)
+    {
+        PrintLastErrorW(L"Failed to create TOC file", 0);
+        return FALSE;
+    }
+
+    if (format == TOC_FORMAT_CSV)
+        fputs("path,type,size,mtime,mode,uid,gid,uname,gname,link,"
+            "devmajor,devminor,chksum,format,offset,data\r\n", w->f);
+    return TRUE;
+}
+
+void TocSink(void *ctx, const TAR_MEMBER *m)
+{
+    TOC_WRITER *w = (TOC_WRITER*)ctx;
+
+    if (w->next) w->next(w->nextCtx, m);
+    if (w->failed) return;
+
+    switch (w->format)
+    {
+        case TOC_FORMAT_JSONL:
+            TocPutJson(w->f, m);
+            break;
+        case TOC_FORMAT_CSV:
+            TocPutCsv(w->f, m);
+            break;
+        case TOC_FORMAT_COLUMNS:
+            if (!TocAddRow(w, m))
+            {
+                PrintLastErrorW(L"Failed to write TOC file", 0);
+                w->failed = TRUE;
+                return;
+            }
+            break;
+    }
+    w->entries++;
+}
+
+/* complete - every member was seen: the file replaces path;
+   otherwise it is dropped */
+BOOL TocClose(TOC_WRITER *w, BOOL complete)
+{
+    BOOL ok = complete && !w->failed;
+
+    TRACE_BEGIN("toc close", w->entries);
+    if (w->format == TOC_FORMAT_COLUMNS)
+    {
+        if (ok && !TocFinishColumns(w))
+        {
+            PrintLastErrorW(L"Failed to write TOC file", 0);
+            ok = FALSE;
+        }
+        CloseHandle(w->hf);
+        TocFreeBlock(w);
+    }
+    else
+    {
+        if (ok && (fflush(w->f) != 0 || ferror(w->f)))
+        {
+            wprintf(L"Failed to write TOC file.\r\n");
+            ok = FALSE;
+        }
+        fclose(w->f);
+    }
+
+    if (ok && !MoveFileExW(w->tmpPath, w->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        PrintLastErrorW(L"Failed to save TOC file", 0);
+        ok = FALSE;
+    }
+    if (!ok) DeleteFileW(w->tmpPath);
+    TRACE_END("toc close", w->entries);
+    return ok;
+}
+
+/* --------------------------------------
+Reader
+-------------------------------------- */
+void TocUnmap(TOC_VIEW *v)
+{
+    if (v->base) UnmapViewOfFile(v->base);
+    if (v->hmap) CloseHandle(v->hmap);
+    if (v->hf != INVALID_HANDLE_VALUE && v->hf) CloseHandle(v->hf);
+    ZeroMemory(v, sizeof(*v));
+}
+
+/* FALSE - can't open, or not a complete .ztoc (ERROR_INVALID_DATA) */
+BOOL TocMap(TOC_VIEW *v, LPCWSTR path)
+{
+    LARGE_INTEGER   size;
+    ULONGLONG       index;
+
+    ZeroMemory(v, sizeof(*v));
+    v->hf = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (v->hf == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (!GetFileSizeEx(v->hf, &size) || size.QuadPart < (LONGLONG)sizeof(TOC_FILE_HEADER))
+    {
+        TocUnmap(v);
+        SetLastError(ERROR_INVALID_DATA);
+        return FALSE;
+    }
+
+    v->hmap = CreateFileMappingW(v->hf, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (v->hmap) v->base = (const BYTE*)MapViewOfFile(v->hmap, FILE_MAP_READ, 0, 0, 0);
+    if (!v->base)
+    {
+        TocUnmap(v);
+        return FALSE;
+    }
+
+    v->bytes = (ULONGLONG)size.QuadPart;
+    v->hdr = (const TOC_FILE_HEADER*)v->base;
+    v->entries = GetLE64(v->hdr->entries);
+    v->blocks = GetLE32(v->hdr->blocks);
+    index = GetLE64(v->hdr->index);
+    if (memcmp(v->hdr->magic, "ZTTOCCOL", 8) != 0 || v->hdr->version != 0 ||
+        GetLE32(v->hdr->blockRows) == 0 || index > v->bytes ||
+        (ULONGLONG)v->blocks * 8 > v->bytes - index)
+    {
+        TocUnmap(v);
+        SetLastError(ERROR_INVALID_DATA);
+        return FALSE;
+    }
+
+    v->index = v->base + (size_t)index;
+    return TRUE;
+}
+
+/* string offsets start at 0, never go back and end at the heap's size */
+static BOOL TocCheckOffsets(const DWORD *o, DWORD rows, DWORD bytes)
+{
+    DWORD i;
+
+    if (o[0] != 0 || o[rows] != bytes) return FALSE;
+    for (i = 0; i < rows; i++)
+        if (o[i + 1] < o[i]) return FALSE;
+    return TRUE;
+}
+
+BOOL TocBlock(const TOC_VIEW *v, DWORD block, TOC_COLUMNS *c)
+{
+    const TOC_BLOCK_HEADER  *bh;
+    const BYTE              *p;
+    const DWORD             *offs[4];
+    const char              *heaps[4];
+    DWORD                   heapBytes[4];
+    ULONGLONG               at, need, r;
+    DWORD                   i;
+
+    ZeroMemory(c, sizeof(*c));
+    SetLastError(ERROR_INVALID_DATA);
+    if (block >= v->blocks) return FALSE;
+
+    at = GetLE64(v->index + (size_t)block * 8);
+    if ((at & 7) != 0 || at < sizeof(TOC_FILE_HEADER) || at > v->bytes - sizeof(TOC_BLOCK_HEADER))
+        return FALSE;
+
+    bh = (const TOC_BLOCK_HEADER*)(v->base + (size_t)at);
+    r = GetLE32(bh->rows);
+    heapBytes[0] = GetLE32(bh->nameBytes);
+    heapBytes[1] = GetLE32(bh->linkBytes);
+    heapBytes[2] = GetLE32(bh->unameBytes);
+    heapBytes[3] = GetLE32(bh->gnameBytes);
+    if (r > GetLE32(v->hdr->blockRows)) return FALSE;
+
+    need = sizeof(TOC_BLOCK_HEADER) + 4 * r * 8 + 6 * TOC_ALIGN8(r * 4) + 2 * TOC_ALIGN8(r) +
+        4 * TOC_ALIGN8((r + 1) * 4);
+    for (i = 0; i < 4; i++)
+        need += TOC_ALIGN8(heapBytes[i]);
+    if (need > v->bytes - at) return FALSE;
+
+    p = (const BYTE*)(bh + 1);
+    c->rows = (DWORD)r;
+    c->offset = (const ULONGLONG*)p;        p += (size_t)r * 8;
+    c->dataOffset = (const ULONGLONG*)p;    p += (size_t)r * 8;
+    c->size = (const ULONGLONG*)p;          p += (size_t)r * 8;
+    c->mtime = (const LONGLONG*)p;          p += (size_t)r * 8;
+    c->mode = (const DWORD*)p;              p += (size_t)TOC_ALIGN8(r * 4);
+    c->uid = (const DWORD*)p;               p += (size_t)TOC_ALIGN8(r * 4);
+    c->gid = (const DWORD*)p;               p += (size_t)TOC_ALIGN8(r * 4);
+    c->devmajor = (const DWORD*)p;          p += (size_t)TOC_ALIGN8(r * 4);
+    c->devminor = (const DWORD*)p;          p += (size_t)TOC_ALIGN8(r * 4);
+    c->chksum = (const DWORD*)p;            p += (size_t)TOC_ALIGN8(r * 4);
+    c->type = p;                            p += (size_t)TOC_ALIGN8(r);
+    c->format = p;                          p += (size_t)TOC_ALIGN8(r);
+    for (i = 0; i < 4; i++)
+    {
+        offs[i] = (const DWORD*)p;
+        p += (size_t)TOC_ALIGN8((r + 1) * 4);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        heaps[i] = (const char*)p;
+        p += (size_t)TOC_ALIGN8(heapBytes[i]);
+        if (!TocCheckOffsets(offs[i], (DWORD)r, heapBytes[i]))
+        {
+            ZeroMemory(c, sizeof(*c));
+            return FALSE;
+        }
+    }
+
+    c->name = offs[0];
+    c->link = offs[1];
+    c->uname = offs[2];
+    c->gname = offs[3];
+    c->names = heaps[0];
+    c->links = heaps[1];
+    c->unames = heaps[2];
+    c->gnames = heaps[3];
+    SetLastError(ERROR_SUCCESS);
+    return TRUE;
+}
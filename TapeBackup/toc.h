@@ -0,0 +1,147 @@
+#ifndef __TAPE_BACKUP_TOC
+#define __TAPE_BACKUP_TOC
+
+#include "common.h"
+#include "utils.h"
+#include "archive.h"
+#include "trace.h"
+
+/* --------------------------------------
+Machine-readable TOC export. Format follows the file extension:
+    .jsonl      one JSON object per member, UTF-8, no BOM
+    .csv        RFC 4180, header row first, UTF-8, no BOM
+    .ztoc       columnar, memory-mappable (below)
+    other       the text listing (one path per line)
+Every member gets its path, typeflag, size, mtime (seconds since 1970),
+mode, uid, gid, uname, gname, link target, device numbers, stored
+checksum, header format (TAR_FORMAT_*) and its offsets: first header
+and data, in section #2, i.e. in the .tar a restore writes. A partitioned
+tape's TOC comes from its index, which keeps no owners, links, device
+numbers, checksums or header formats: those are 0 or "", format
+TAR_FORMAT_UNKNOWN ("" in text). An index written before member types
+were kept (filever 0, see partition.h) has no data offsets, dates or
+modes either, and its types are TAR_TYPE_UNKNOWN: "" in text, 0 in
+columns - not '0', which means a regular file.
+The file is written to <path>.<thread>.tmp and renamed when complete.
+
+.ztoc layout, little-endian:
+    TOC_FILE_HEADER
+    block[blocks]       at 8-byte aligned offsets
+    index               64-bit file offsets of the blocks
+A block holds up to TOC_BLOCK_ROWS members, column after column, each
+column 8-byte aligned:
+    TOC_BLOCK_HEADER
+    64-bit  offset, dataOffset, size, mtime (signed)
+    32-bit  mode, uid, gid, devmajor, devminor, chksum
+    8-bit   type, format
+    32-bit  name, link, uname, gname: rows + 1 offsets into each heap,
+            string i is heap[o[i] .. o[i+1]), no NUL
+    heaps   name, link, uname, gname
+Loading is TocMap and one TocBlock per block: columns are pointers
+into the mapped file, nothing is parsed or copied.
+-------------------------------------- */
+#define TOC_EXT_JSONL           L".jsonl"
+#define TOC_EXT_CSV             L".csv"
+#define TOC_EXT_COLUMNS         L".ztoc"
+#define TOC_BLOCK_ROWS          65536
+#define TOC_BLOCK_HEAP_MAX      (64 * 1024 * 1024)  /* each heap, block ends early */
+
+typedef enum _TOC_FORMAT {
+    TOC_FORMAT_TEXT = 0,
+    TOC_FORMAT_JSONL,
+    TOC_FORMAT_CSV,
+    TOC_FORMAT_COLUMNS
+} TOC_FORMAT;
+
+#pragma pack(push,1)
+typedef struct _TOC_FILE_HEADER {
+    char            magic[8];       /* "ZTTOCCOL", zero until complete */
+    unsigned char   version;        /* 0 */
+    unsigned char   reserved1[3];   /* must be zero */
+    unsigned char   blockRows[4];   /* little-endian 32-bit, TOC_BLOCK_ROWS */
+    unsigned char   entries[8];     /* little-endian 64-bit */
+    unsigned char   blocks[4];      /* little-endian 32-bit */
+    unsigned char   index[8];       /* little-endian 64-bit, file offset of block offsets */
+    ZEROTAPE_HEADER zh;             /* the archive */
+    unsigned char   written[8];     /* little-endian 64-bit, FILETIME (UTC) */
+    unsigned char   reserved[84];   /* must be zero */
+} TOC_FILE_HEADER;                  /* total 256 */
+
+typedef struct _TOC_BLOCK_HEADER {
+    unsigned char   rows[4];        /* little-endian 32-bit */
+    unsigned char   nameBytes[4];   /* little-endian 32-bit, heap sizes */
+    unsigned char   linkBytes[4];
+    unsigned char   unameBytes[4];
+    unsigned char   gnameBytes[4];
+    unsigned char   reserved[44];   /* must be zero */
+} TOC_BLOCK_HEADER;                 /* total 64 */
+#pragma pack(pop)
+
+/* one string column of the block being built */
+typedef struct _TOC_HEAP {
+    DWORD           *offsets;       /* TOC_BLOCK_ROWS + 1 */
+    char            *bytes;
+    DWORD           used;
+    DWORD           cap;
+} TOC_HEAP;
+
+/* TocSink is a TAR_MEMBER_SINK (see archive.h); members go on to
+   next, e.g. the catalog's sink */
+typedef struct _TOC_WRITER {
+    DWORD           format;
+    WCHAR           path[MAX_PATH * 2];
+    WCHAR           tmpPath[MAX_PATH * 2];
+    FILE            *f;             /* JSON Lines, CSV */
+    HANDLE          hf;             /* columns */
+    ZEROTAPE_HEADER zh;
+    ULONGLONG       pos;
+    ULONGLONG       entries;
+    BOOL            failed;
+    TAR_MEMBER_SINK next;
+    void            *nextCtx;
+
+    /* block being built */
+    DWORD           rows;
+    ULONGLONG       *offset, *dataOffset, *size;
+    LONGLONG        *mtime;
+    DWORD           *mode, *uid, *gid, *devmajor, *devminor, *chksum;
+    BYTE            *type, *fmt;
+    TOC_HEAP        heaps[4];       /* name, link, uname, gname */
+    ULONGLONG       *blockAt;
+    DWORD           blocks;
+    DWORD           blocksCap;
+} TOC_WRITER;
+
+/* mapped .ztoc */
+typedef struct _TOC_VIEW {
+    HANDLE                  hf;
+    HANDLE                  hmap;
+    const BYTE              *base;
+    ULONGLONG               bytes;
+    const TOC_FILE_HEADER   *hdr;
+    ULONGLONG               entries;
+    DWORD                   blocks;
+    const BYTE              *index;
+} TOC_VIEW;
+
+/* one block's columns, pointers into the view */
+typedef struct _TOC_COLUMNS {
+    DWORD           rows;
+    const ULONGLONG *offset, *dataOffset, *size;
+    const LONGLONG  *mtime;
+    const DWORD     *mode, *uid, *gid, *devmajor, *devminor, *chksum;
+    const BYTE      *type, *format;
+    const DWORD     *name, *link, *uname, *gname;   /* rows + 1 */
+    const char      *names, *links, *unames, *gnames;
+} TOC_COLUMNS;
+
+DWORD TocFormatOf(LPCWSTR path);
+BOOL TocOpen(TOC_WRITER *w, LPCWSTR path, DWORD format, const ZEROTAPE_HEADER *zh,
+    TAR_MEMBER_SINK next, void *nextCtx);
+void TocSink(void *ctx, const TAR_MEMBER *m);
+BOOL TocClose(TOC_WRITER *w, BOOL complete);
+BOOL TocMap(TOC_VIEW *v, LPCWSTR path);
+BOOL TocBlock(const TOC_VIEW *v, DWORD block, TOC_COLUMNS *c);
+void TocUnmap(TOC_VIEW *v);
+
+#endif
@@ -0,0 +1,237 @@
+#include "trace.h"
+
+/* --------------------------------------
+Pipeline tracing (Chrome/Perfetto trace-event JSON)
+-------------------------------------- */
+volatile BOOL       g_traceEnabled = FALSE;
+
+static DWORD            g_traceTls = TLS_OUT_OF_INDEXES;
+static CRITICAL_SECTION g_traceLock;
+static TRACE_RING       *g_traceRings = NULL;
+static TRACE_RETIRED    *g_traceRetired = NULL;
+static LONGLONG         g_traceT0;
+static LONGLONG         g_traceFreq;
+static WCHAR            g_tracePath[MAX_PATH * 2];
+
+BOOL TraceStart(LPCWSTR path)
+{
+    LARGE_INTEGER li;
+
+    if (g_traceEnabled) return TRUE;
+
+    if (!QueryPerformanceFrequency(&li) || li.QuadPart == 0)
+        return FALSE;
+    g_traceFreq = li.QuadPart;
+    QueryPerformanceCounter(&li);
+    g_traceT0 = li.QuadPart;
+
+    g_traceTls = TlsAlloc();
+    if (g_traceTls == TLS_OUT_OF_INDEXES) return FALSE;
+
+    InitializeCriticalSection(&g_traceLock);
+    wcsncpy(g_tracePath, path, MAX_PATH * 2 - 1);
+    g_tracePath[MAX_PATH * 2 - 1] = 0;
+
+    g_traceEnabled = TRUE;
+    TraceThreadName("main");
+    return TRUE;
+}
+
+/* Caller must hold g_traceLock. Copies events of an ended thread
+   out of its ring; FALSE - no memory, ring must not be reused */
+static BOOL TraceRetire(const TRACE_RING *ring)
+{
+    TRACE_RETIRED   *r;
+    ULONGLONG       i, first;
+    DWORD           n;
+
+    first = (ring->count > TRACE_RING_EVENTS) ? ring->count - TRACE_RING_EVENTS : 0;
+    n = (DWORD)(ring->count - first);
+    if (n == 0 && !ring->threadName) return TRUE;
+
+    r = (TRACE_RETIRED*)malloc(sizeof(TRACE_RETIRED) + (n ? n - 1 : 0) * sizeof(TRACE_EVENT));
+    if (!r) return FALSE;
+
+    r->tid = ring->tid;
+    r->threadName = ring->threadName;
+    r->count = n;
+    for (i = first; i < ring->count; i++)
+        r->ev[i - first] = ring->ev[i % TRACE_RING_EVENTS];
+
+    r->next = g_traceRetired;
+    g_traceRetired = r;
+    return TRUE;
+}
+
+/* Caller must hold g_traceLock */
+static TRACE_RING* TraceReuseRing(void)
+{
+    TRACE_RING *ring;
+
+    for (ring = g_traceRings; ring; ring = ring->next)
+        if (ring->thread && WaitForSingleObject(ring->thread, 0) == WAIT_OBJECT_0)
+        {
+            if (!TraceRetire(ring)) return NULL;
+            CloseHandle(ring->thread);
+            return ring;
+        }
+
+    return NULL;
+}
+
+static TRACE_RING* TraceGetRing(void)
+{
+    TRACE_RING  *ring;
+    BOOL        reused;
+    DWORD       tid = GetCurrentThreadId();
+
+    ring = (TRACE_RING*)TlsGetValue(g_traceTls);
+    if (ring) return ring;
+
+    EnterCriticalSection(&g_traceLock);
+    ring = TraceReuseRing();
+    reused = ring != NULL;
+    if (!ring) ring = (TRACE_RING*)malloc(sizeof(TRACE_RING));
+    if (ring)
+    {
+        /* without a handle the ring is never reused, as before */
+        ring->thread = OpenThread(SYNCHRONIZE, FALSE, tid);
+        ring->tid = tid;
+        ring->threadName = NULL;
+        ring->count = 0;
+        if (!reused)
+        {
+            ring->next = g_traceRings;
+            g_traceRings = ring;
+        }
+    }
+    LeaveCriticalSection(&g_traceLock);
+    if (!ring) return NULL;
+
+    TlsSetValue(g_traceTls, ring);
+    return ring;
+}
+
+void TraceThreadName(const char *name)
+{
+    TRACE_RING *ring;
+
+    if (!g_traceEnabled) return;
+
+    ring = TraceGetRing();
+    if (ring) ring->threadName = name;
+}
+
+void TraceEvent(char phase, const char *stage, ULONGLONG bytes)
+{
+    TRACE_RING      *ring;
+    TRACE_EVENT     *ev;
+    LARGE_INTEGER   li;
+
+    ring = TraceGetRing();
+    if (!ring) return;
+
+    QueryPerformanceCounter(&li);
+    ev = &ring->ev[ring->count % TRACE_RING_EVENTS];
+    ev->ts = li.QuadPart;
+    ev->stage = stage;
+    ev->bytes = bytes;
+    ev->phase = phase;
+    ring->count++;
+}
+
+/* events [first, count) of one thread, ev[i % size] */
+static void TraceWriteThread(FILE *f, DWORD pid, DWORD tid, const char *threadName,
+    const TRACE_EVENT *events, ULONGLONG first, ULONGLONG count, DWORD size, BOOL *comma)
+{
+    const TRACE_EVENT   *ev;
+    ULONGLONG           i;
+    double              us;
+
+    if (threadName)
+    {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,"
+            "\"args\":{\"name\":\"%s\"}}", *comma ? ",\n" : "",
+            (unsigned long)pid, (unsigned long)tid, threadName);
+        *comma = TRUE;
+    }
+
+    for (i = first; i < count; i++)
+    {
+        ev = &events[i % size];
+        us = (double)(ev->ts - g_traceT0) * 1000000.0 / (double)g_traceFreq;
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"tapebackup\",\"ph\":\"%c\","
+            "\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{\"bytes\":%I64u}}",
+            *comma ? ",\n" : "", ev->stage, ev->phase, us,
+            (unsigned long)pid, (unsigned long)tid, ev->bytes);
+        *comma = TRUE;
+    }
+}
+
+/* Must be called when no traced work is in flight (e.g. between actions) */
+BOOL TraceFlush(void)
+{
+    FILE            *f;
+    TRACE_RING      *ring;
+    TRACE_RETIRED   *r;
+    ULONGLONG       first;
+    DWORD           pid;
+    BOOL            comma = FALSE;
+
+    if (!g_traceEnabled) return FALSE;
+
+    f = _wfopen(g_tracePath, L"wb");
+    if (!f) return FALSE;
+
+    pid = GetCurrentProcessId();
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    EnterCriticalSection(&g_traceLock);
+    for (r = g_traceRetired; r; r = r->next)
+        TraceWriteThread(f, pid, r->tid, r->threadName, r->ev, 0, r->count,
+            r->count ? r->count : 1, &comma);
+
+    for (ring = g_traceRings; ring; ring = ring->next)
+    {
+        first = (ring->count > TRACE_RING_EVENTS) ?
+            ring->count - TRACE_RING_EVENTS : 0;
+        TraceWriteThread(f, pid, ring->tid, ring->threadName, ring->ev, first, ring->count,
+            TRACE_RING_EVENTS, &comma);
+    }
+    LeaveCriticalSection(&g_traceLock);
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return TRUE;
+}
+
+void TraceStop(void)
+{
+    TRACE_RING      *ring, *next;
+    TRACE_RETIRED   *r, *rnext;
+
+    if (!g_traceEnabled) return;
+
+    TraceFlush();
+    g_traceEnabled = FALSE;
+
+    EnterCriticalSection(&g_traceLock);
+    for (ring = g_traceRings; ring; ring = next)
+    {
+        next = ring->next;
+        if (ring->thread) CloseHandle(ring->thread);
+        free(ring);
+    }
+    g_traceRings = NULL;
+    for (r = g_traceRetired; r; r = rnext)
+    {
+        rnext = r->next;
+        free(r);
+    }
+    g_traceRetired = NULL;
+    LeaveCriticalSection(&g_traceLock);
+
+    DeleteCriticalSection(&g_traceLock);
+    TlsFree(g_traceTls);
+    g_traceTls = TLS_OUT_OF_INDEXES;
+}
@@ -0,0 +1,55 @@
+#ifndef __TAPE_BACKUP_TRACE
+#define __TAPE_BACKUP_TRACE
+
+#include "common.h"
+
+/* --------------------------------------
+Pipeline tracing (Chrome/Perfetto trace-event JSON)
+-------------------------------------- */
+#define TRACE_RING_EVENTS 32768 /* per thread, oldest events are overwritten */
+
+typedef struct _TRACE_EVENT {
+    LONGLONG    ts;     /* QueryPerformanceCounter ticks */
+    const char  *stage; /* must point to static string */
+    ULONGLONG   bytes;
+    char        phase;  /* 'B' - begin, 'E' - end */
+} TRACE_EVENT;
+
+/* a ring whose thread has ended is kept until a new thread takes it
+   over, so the daemon's short-lived threads need no more rings than ran
+   at the same time; its events then move to a TRACE_RETIRED and are
+   still flushed */
+typedef struct _TRACE_RING {
+    struct _TRACE_RING  *next;
+    HANDLE              thread; /* SYNCHRONIZE, signaled when thread ends */
+    DWORD               tid;
+    const char          *threadName;
+    ULONGLONG           count;  /* total events ever written by thread */
+    TRACE_EVENT         ev[TRACE_RING_EVENTS];
+} TRACE_RING;
+
+/* events of an ended thread whose ring was taken over, oldest first */
+typedef struct _TRACE_RETIRED {
+    struct _TRACE_RETIRED   *next;
+    DWORD                   tid;
+    const char              *threadName;
+    DWORD                   count;
+    TRACE_EVENT             ev[1];  /* count */
+} TRACE_RETIRED;
+
+extern volatile BOOL g_traceEnabled;
+
+BOOL TraceStart(LPCWSTR path);
+BOOL TraceFlush(void);
+void TraceStop(void);
+void TraceThreadName(const char *name);
+void TraceEvent(char phase, const char *stage, ULONGLONG bytes);
+
+/* Cheap when tracing is off: single global flag check */
+#define TRACE_BEGIN(stage, bytes) \
+    do { if (g_traceEnabled) TraceEvent('B', (stage), (ULONGLONG)(bytes)); } while (0)
+
+#define TRACE_END(stage, bytes) \
+    do { if (g_traceEnabled) TraceEvent('E', (stage), (ULONGLONG)(bytes)); } while (0)
+
+#endif
@@ -102,6 +102,22 @@ void HideConsoleCursor(VOID)
     SetConsoleCursorInfo(hconsole, &cursorinfo);
 }
 
+/* monotonic time in seconds (QueryPerformanceCounter) */
+double TimerSeconds(void)
+{
+    static LONGLONG freq = 0;
+    LARGE_INTEGER   li;
+
+    if (!freq)
+    {
+        QueryPerformanceFrequency(&li);
+        freq = li.QuadPart ? li.QuadPart : 1;
+    }
+
+    QueryPerformanceCounter(&li);
+    return (double)li.QuadPart / (double)freq;
+}
+
 void PrintLastErrorW(LPCWSTR prefix, DWORD code)
 {
     LPVOID msg = NULL;
@@ -219,13 +235,50 @@ void HumanSize(ULONGLONG bytes, WCHAR *out, size_t cch)
     _snwprintf(out, (int)cch, L"%.1f %s", v, u[i]);
 }
 
+static DWORD g_progressTls = TLS_OUT_OF_INDEXES;
+
+/* once, before threads that set hooks start */
+BOOL ProgressHookInit(void)
+{
+    if (g_progressTls == TLS_OUT_OF_INDEXES) g_progressTls = TlsAlloc();
+    return (g_progressTls != TLS_OUT_OF_INDEXES);
+}
+
+/* calling thread only; NULL - back to console */
+void ProgressHookSet(PROGRESS_HOOK *hook)
+{
+    if (g_progressTls != TLS_OUT_OF_INDEXES) TlsSetValue(g_progressTls, hook);
+}
+
+/* TRUE - caller stops with ERROR_CANCELLED set */
+BOOL ProgressCancelled(void)
+{
+    PROGRESS_HOOK *hook;
+
+    hook = (g_progressTls != TLS_OUT_OF_INDEXES) ?
+        (PROGRESS_HOOK*)TlsGetValue(g_progressTls) : NULL;
+    if (!hook || !hook->cancel || !*hook->cancel) return FALSE;
+
+    SetLastError(ERROR_CANCELLED);
+    return TRUE;
+}
+
 void DrawProgressBar(unsigned percent, ULONGLONG done, ULONGLONG total)
 {
-    WCHAR       done_humanized[64];
-    WCHAR       total_humanized[64];
-    const int   width = 30;
-    int         filled;
-    int         i;
+    WCHAR           done_humanized[64];
+    WCHAR           total_humanized[64];
+    const int       width = 30;
+    int             filled;
+    int             i;
+    PROGRESS_HOOK   *hook;
+
+    hook = (g_progressTls != TLS_OUT_OF_INDEXES) ?
+        (PROGRESS_HOOK*)TlsGetValue(g_progressTls) : NULL;
+    if (hook)
+    {
+        hook->draw(hook->ctx, percent, done, total);
+        return;
+    }
 
     wprintf(L"\r[");
     filled = (int)((percent * width) / 100);
@@ -377,25 +430,30 @@ BOOL QueryStorageStrings(HANDLE h, WCHAR *vendor,
     spq.PropertyId = StorageDeviceProperty;
     spq.QueryType = PropertyStandardQuery;
 
-    result = DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY,
-        &spq, sizeof(spq), NULL, 0, &bytes, NULL);
-
-    if (bytes == 0) bytes = 1024;
-    buf = (BYTE*)malloc(bytes);
-    if (!buf)
+    /* one request is enough unless descriptor is over 1 KiB */
+    for (tmp = 1024; ; )
     {
-        SetLastError(ERROR_NOACCESS);
-        return FALSE;
-    }
+        buf = (BYTE*)malloc(tmp);
+        if (!buf)
+        {
+            SetLastError(ERROR_NOACCESS);
+            return FALSE;
+        }
 
-    if (!DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY,
-        &spq, sizeof(spq), buf, bytes, &bytes, NULL))
-    {
+        result = DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY,
+            &spq, sizeof(spq), buf, (DWORD)tmp, &bytes, NULL);
+        sdd = (STORAGE_DEVICE_DESCRIPTOR*)buf;
+        if (!result)
+        {
+            free(buf);
+            return FALSE;
+        }
+
+        if (bytes < sizeof(STORAGE_DESCRIPTOR_HEADER) || sdd->Size <= tmp) break;
+        tmp = sdd->Size;
         free(buf);
-        return FALSE;
     }
 
-    sdd = (STORAGE_DEVICE_DESCRIPTOR*)buf;
     if (sdd->VendorIdOffset && sdd->VendorIdOffset < bytes)
         SafeCopyAnsiToWideField(vendor, cvendor, (const char*)(buf + sdd->VendorIdOffset));
 
@@ -541,6 +599,14 @@ ULONGLONG OctalToULL(const char *s, size_t n)
 {
     ULONGLONG v = 0;
     size_t i = 0;
+    /* GNU base-256 (sizes of 8 GiB and more): high bit set, big-endian */
+    if (n > 0 && ((unsigned char)s[0] & 0x80))
+    {
+        v = (unsigned char)s[0] & 0x3F;
+        for (i = 1; i < n; i++)
+            v = (v << 8) | (unsigned char)s[i];
+        return v;
+    }
     /* skipping starting spaces/zeroes/tabulations */
     while (i < n && (s[i] == ' ' || s[i] == '\t' || s[i] == '\0')) i++;
     for (; i < n; i++)
@@ -570,3 +636,17 @@ ULONGLONG GetLE64(const unsigned char in[8])
 
     return v;
 }
+
+void PutLE32(unsigned char out[4], DWORD v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        out[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
+}
+
+DWORD GetLE32(const unsigned char in[4])
+{
+    return (DWORD)in[0] | ((DWORD)in[1] << 8) |
+        ((DWORD)in[2] << 16) | ((DWORD)in[3] << 24);
+}
@@ -23,6 +23,7 @@ Utility helpers (UI, strings, errors)
 void ShowConsoleCursor(VOID);
 void HideConsoleCursor(VOID);
 void PrintLastErrorW(LPCWSTR prefix, DWORD code);
+double TimerSeconds(void);
 void TrimNewlineInPlace(WCHAR *s);
 BOOL ReadLineW(LPWSTR buf, size_t cch);
 BOOL AskYesNo(LPCWSTR q, BOOL defNo);
@@ -31,6 +32,18 @@ BOOL GetFileSize64W(LPCWSTR path, ULONGLONG *out);
 void HumanSize(ULONGLONG bytes, WCHAR *out, size_t cch);
 void DrawProgressBar(unsigned percent, ULONGLONG done, ULONGLONG total);
 
+/* progress of one thread goes to draw instead of console (daemon jobs);
+   long loops stop early once *cancel is set (scheduler preemption) */
+typedef struct _PROGRESS_HOOK {
+    void            (*draw)(void *ctx, unsigned percent, ULONGLONG done, ULONGLONG total);
+    void            *ctx;
+    volatile LONG   *cancel;        /* may be NULL */
+} PROGRESS_HOOK;
+
+BOOL ProgressHookInit(void);
+void ProgressHookSet(PROGRESS_HOOK *hook);
+BOOL ProgressCancelled(void);
+
 /* Paths & UTF-8 logging */
 BOOL GetExeDirectoryW(WCHAR *outDir, size_t cch);
 void JoinPath2W(WCHAR *out, size_t cch, LPCWSTR dir, LPCWSTR name);
@@ -78,5 +91,7 @@ ZEROTAPE helpers
 -------------------------------------- */
 void PutLE64(unsigned char out[8], ULONGLONG v);
 ULONGLONG GetLE64(const unsigned char in[8]);
+void PutLE32(unsigned char out[4], DWORD v);
+DWORD GetLE32(const unsigned char in[4]);
 
 #endif
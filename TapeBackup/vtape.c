@@ -0,0 +1,383 @@
+#include "vtape.h"
+#include "utils.h"
+
+/* --------------------------------------
+File-backed virtual tape
+Emulates Win32 tape semantics of variable block mode: one WriteFile - one
+block, ReadFile returns ERROR_FILEMARK_DETECTED after crossing filemark,
+ERROR_NO_DATA_DETECTED at end of data and ERROR_MORE_DATA when block
+does not fit into buffer. Writing truncates everything after position.
+-------------------------------------- */
+typedef struct _VTAPE_SLOT {
+    BOOL    used;
+    VTAPE   vt;
+} VTAPE_SLOT;
+
+static VTAPE_SLOT           g_vtSlots[VTAPE_MAX_OPEN];
+static CRITICAL_SECTION     g_vtLock;
+static volatile LONG        g_vtLockInit = 0;
+
+static void VTapeLockInit(void)
+{
+    if (InterlockedCompareExchange(&g_vtLockInit, 1, 0) == 0)
+    {
+        InitializeCriticalSection(&g_vtLock);
+        InterlockedExchange(&g_vtLockInit, 2);
+        return;
+    }
+
+    while (g_vtLockInit != 2) Sleep(0);
+}
+
+static BOOL VTapeSeek(VTAPE *vt, ULONGLONG offset)
+{
+    LARGE_INTEGER li;
+
+    li.QuadPart = (LONGLONG)offset;
+    return SetFilePointerEx(vt->hf, li, NULL, FILE_BEGIN);
+}
+
+static BOOL VTapeReadRecord(VTAPE *vt, ULONGLONG offset,
+    DWORD *type, DWORD *length)
+{
+    VTAPE_RECORD    rec;
+    DWORD           got = 0;
+
+    if (!VTapeSeek(vt, offset)) return FALSE;
+    if (!ReadFile(vt->hf, &rec, sizeof(rec), &got, NULL) || got != sizeof(rec))
+        return FALSE;
+
+    *type = (DWORD)rec.type[0] | ((DWORD)rec.type[1] << 8) |
+        ((DWORD)rec.type[2] << 16) | ((DWORD)rec.type[3] << 24);
+    *length = (DWORD)rec.length[0] | ((DWORD)rec.length[1] << 8) |
+        ((DWORD)rec.length[2] << 16) | ((DWORD)rec.length[3] << 24);
+
+    if (*type == VTAPE_REC_FILEMARK) *length = 0;
+    return (*type == VTAPE_REC_BLOCK || *type == VTAPE_REC_FILEMARK) &&
+        *length <= VTAPE_MAX_BLOCK;
+}
+
+static BOOL VTapeWriteRecord(VTAPE *vt, DWORD type, const void *data, DWORD length)
+{
+    VTAPE_RECORD    rec;
+    DWORD           wr = 0;
+    int             i;
+
+    for (i = 0; i < 4; i++)
+    {
+        rec.type[i] = (unsigned char)(type >> (8 * i));
+        rec.length[i] = (unsigned char)(length >> (8 * i));
+    }
+
+    if (!VTapeSeek(vt, vt->offset)) return FALSE;
+
+    /* tape semantics: anything after write position is lost */
+    if (vt->offset < vt->fileEnd)
+    {
+        if (!SetEndOfFile(vt->hf)) return FALSE;
+        vt->fileEnd = vt->offset;
+        vt->used = vt->payload;
+    }
+
+    if (!WriteFile(vt->hf, &rec, sizeof(rec), &wr, NULL) || wr != sizeof(rec))
+        return FALSE;
+
+    if (length && (!WriteFile(vt->hf, data, length, &wr, NULL) || wr != length))
+        return FALSE;
+
+    vt->offset += sizeof(rec) + length;
+    vt->fileEnd = vt->offset;
+    vt->payload += length;
+    vt->used = vt->payload;
+    vt->block++;
+    return TRUE;
+}
+
+BOOL VTapeIsPath(LPCWSTR path)
+{
+    return path && wcsncmp(path, L"\\\\.\\", 4) != 0;
+}
+
+BOOL VTapeCreate(LPCWSTR path, ULONGLONG capacity)
+{
+    HANDLE              hf;
+    VTAPE_FILE_HEADER   fh;
+    DWORD               wr = 0;
+    BOOL                ok;
+
+    hf = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) return FALSE;
+
+    ZeroMemory(&fh, sizeof(fh));
+    memcpy(fh.magic, VTAPE_MAGIC, sizeof(VTAPE_MAGIC));
+    fh.version = VTAPE_VERSION;
+    PutLE64(fh.capacity, capacity);
+
+    ok = WriteFile(hf, &fh, sizeof(fh), &wr, NULL) && wr == sizeof(fh);
+    CloseHandle(hf);
+    return ok;
+}
+
+HANDLE VTapeOpen(LPCWSTR path)
+{
+    HANDLE              hf;
+    VTAPE_FILE_HEADER   fh;
+    DWORD               got = 0;
+    VTAPE               vt;
+    DWORD               type, length;
+    LARGE_INTEGER       size;
+    int                 i;
+
+    hf = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) return hf;
+
+    if (!ReadFile(hf, &fh, sizeof(fh), &got, NULL) || got != sizeof(fh) ||
+        memcmp(fh.magic, VTAPE_MAGIC, sizeof(VTAPE_MAGIC)) != 0 ||
+        fh.version != VTAPE_VERSION || !GetFileSizeEx(hf, &size))
+    {
+        CloseHandle(hf);
+        SetLastError(ERROR_BAD_FORMAT);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    ZeroMemory(&vt, sizeof(vt));
+    vt.hf = hf;
+    vt.capacity = GetLE64(fh.capacity);
+    _snwprintf(vt.path, MAX_PATH, L"%s", path);
+    vt.path[MAX_PATH - 1] = 0;
+
+    /* walk records once to find end of data and used payload */
+    vt.offset = sizeof(fh);
+    while (vt.offset + sizeof(VTAPE_RECORD) <= (ULONGLONG)size.QuadPart &&
+        VTapeReadRecord(&vt, vt.offset, &type, &length))
+    {
+        if (vt.offset + sizeof(VTAPE_RECORD) + length > (ULONGLONG)size.QuadPart)
+            break; /* torn tail record */
+        vt.offset += sizeof(VTAPE_RECORD) + length;
+        vt.used += length;
+    }
+    vt.fileEnd = vt.offset;
+    vt.offset = sizeof(fh);
+
+    VTapeLockInit();
+    EnterCriticalSection(&g_vtLock);
+    for (i = 0; i < VTAPE_MAX_OPEN; i++)
+        if (!g_vtSlots[i].used)
+        {
+            g_vtSlots[i].used = TRUE;
+            g_vtSlots[i].vt = vt;
+            break;
+        }
+    LeaveCriticalSection(&g_vtLock);
+
+    if (i == VTAPE_MAX_OPEN)
+    {
+        CloseHandle(hf);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return hf;
+}
+
+VTAPE* VTapeFromHandle(HANDLE h)
+{
+    VTAPE   *vt = NULL;
+    int     i;
+
+    if (g_vtLockInit != 2) return NULL;
+
+    EnterCriticalSection(&g_vtLock);
+    for (i = 0; i < VTAPE_MAX_OPEN; i++)
+        if (g_vtSlots[i].used && g_vtSlots[i].vt.hf == h)
+        {
+            vt = &g_vtSlots[i].vt;
+            break;
+        }
+    LeaveCriticalSection(&g_vtLock);
+
+    return vt;
+}
+
+void VTapeClose(HANDLE h)
+{
+    int i;
+
+    if (g_vtLockInit != 2) return;
+
+    EnterCriticalSection(&g_vtLock);
+    for (i = 0; i < VTAPE_MAX_OPEN; i++)
+        if (g_vtSlots[i].used && g_vtSlots[i].vt.hf == h)
+            g_vtSlots[i].used = FALSE;
+    LeaveCriticalSection(&g_vtLock);
+}
+
+DWORD VTapeRewind(VTAPE *vt)
+{
+    vt->offset = sizeof(VTAPE_FILE_HEADER);
+    vt->payload = 0;
+    vt->block = 0;
+    return NO_ERROR;
+}
+
+DWORD VTapeRead(VTAPE *vt, void *buf, DWORD n, DWORD *got)
+{
+    DWORD type, length, take;
+
+    *got = 0;
+    if (vt->offset >= vt->fileEnd) return ERROR_NO_DATA_DETECTED;
+
+    if (!VTapeReadRecord(vt, vt->offset, &type, &length))
+        return ERROR_CRC;
+
+    vt->offset += sizeof(VTAPE_RECORD) + length;
+    vt->payload += length;
+    vt->block++;
+
+    if (type == VTAPE_REC_FILEMARK)
+        return ERROR_FILEMARK_DETECTED;
+
+    take = (length > n) ? n : length;
+    if (take && (!ReadFile(vt->hf, buf, take, got, NULL) || *got != take))
+        return ERROR_CRC;
+
+    return (length > n) ? ERROR_MORE_DATA : NO_ERROR;
+}
+
+DWORD VTapeWrite(VTAPE *vt, const void *buf, DWORD n, DWORD *written)
+{
+    ULONGLONG ewZone;
+
+    *written = 0;
+    if (n > VTAPE_MAX_BLOCK) return ERROR_INVALID_BLOCK_LENGTH;
+
+    if (vt->capacity && vt->payload + n > vt->capacity)
+        return ERROR_END_OF_MEDIA;
+
+    if (!VTapeWriteRecord(vt, VTAPE_REC_BLOCK, buf, n))
+        return GetLastError() ? GetLastError() : ERROR_IO_DEVICE;
+    *written = n;
+
+    /* early warning zone: write succeeds but caller is told media is ending */
+    ewZone = vt->capacity / 64;
+    if (ewZone < 1024 * 1024) ewZone = 1024 * 1024;
+    if (vt->capacity && vt->payload + ewZone > vt->capacity)
+        return ERROR_END_OF_MEDIA;
+
+    return NO_ERROR;
+}
+
+DWORD VTapeWriteFilemark(VTAPE *vt)
+{
+    if (!VTapeWriteRecord(vt, VTAPE_REC_FILEMARK, NULL, 0))
+        return GetLastError() ? GetLastError() : ERROR_IO_DEVICE;
+
+    return NO_ERROR;
+}
+
+DWORD VTapeSpaceFilemarks(VTAPE *vt, LONG count)
+{
+    DWORD       type, length;
+    ULONGLONG   offset, payload, block;
+    ULONGLONG   *marks;
+    LONG        found = 0, cap = 64;
+
+    while (count > 0)
+    {
+        if (vt->offset >= vt->fileEnd) return ERROR_NO_DATA_DETECTED;
+        if (!VTapeReadRecord(vt, vt->offset, &type, &length)) return ERROR_CRC;
+
+        vt->offset += sizeof(VTAPE_RECORD) + length;
+        vt->payload += length;
+        vt->block++;
+        if (type == VTAPE_REC_FILEMARK) count--;
+    }
+
+    if (count == 0) return NO_ERROR;
+
+    /* backward: collect filemarks before position, stop on BOT side of target */
+    marks = (ULONGLONG*)malloc(sizeof(ULONGLONG) * 3 * cap);
+    if (!marks) return ERROR_NOT_ENOUGH_MEMORY;
+
+    offset = sizeof(VTAPE_FILE_HEADER);
+    payload = 0;
+    block = 0;
+    while (offset < vt->offset && VTapeReadRecord(vt, offset, &type, &length))
+    {
+        if (type == VTAPE_REC_FILEMARK)
+        {
+            if (found == cap)
+            {
+                ULONGLONG *grown;
+
+                cap *= 2;
+                grown = (ULONGLONG*)realloc(marks, sizeof(ULONGLONG) * 3 * cap);
+                if (!grown)
+                {
+                    free(marks);
+                    return ERROR_NOT_ENOUGH_MEMORY;
+                }
+                marks = grown;
+            }
+            marks[3 * found] = offset;
+            marks[3 * found + 1] = payload;
+            marks[3 * found + 2] = block;
+            found++;
+        }
+        offset += sizeof(VTAPE_RECORD) + length;
+        payload += length;
+        block++;
+    }
+
+    if (found < -count)
+    {
+        free(marks);
+        VTapeRewind(vt);
+        return ERROR_BEGINNING_OF_MEDIA;
+    }
+
+    found += count;
+    vt->offset = marks[3 * found];
+    vt->payload = marks[3 * found + 1];
+    vt->block = marks[3 * found + 2];
+    free(marks);
+    return NO_ERROR;
+}
+
+DWORD VTapeSpaceEndOfData(VTAPE *vt)
+{
+    DWORD type, length;
+
+    while (vt->offset < vt->fileEnd)
+    {
+        if (!VTapeReadRecord(vt, vt->offset, &type, &length)) return ERROR_CRC;
+        vt->offset += sizeof(VTAPE_RECORD) + length;
+        vt->payload += length;
+        vt->block++;
+    }
+
+    return NO_ERROR;
+}
+
+DWORD VTapeErase(VTAPE *vt)
+{
+    VTapeRewind(vt);
+    if (!VTapeSeek(vt, vt->offset) || !SetEndOfFile(vt->hf))
+        return GetLastError();
+
+    vt->fileEnd = vt->offset;
+    vt->used = 0;
+    return NO_ERROR;
+}
+
+DWORD VTapeEraseShort(VTAPE *vt)
+{
+    if (!VTapeSeek(vt, vt->offset) || !SetEndOfFile(vt->hf))
+        return GetLastError();
+
+    vt->fileEnd = vt->offset;
+    vt->used = vt->payload;
+    return NO_ERROR;
+}
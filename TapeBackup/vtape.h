@@ -0,0 +1,62 @@
+#ifndef __TAPE_BACKUP_VTAPE
+#define __TAPE_BACKUP_VTAPE
+
+#include "common.h"
+
+/* --------------------------------------
+File-backed virtual tape (tape stand-in for benchmarks and tests)
+
+Image layout:
+  VTAPE_FILE_HEADER (32 bytes)
+  records: VTAPE_RECORD (8 bytes) + payload (data blocks only)
+  end of file = end of data
+-------------------------------------- */
+#define VTAPE_MAGIC             "ZTVTAPE"
+#define VTAPE_VERSION           1
+#define VTAPE_REC_BLOCK         1
+#define VTAPE_REC_FILEMARK      2
+#define VTAPE_MAX_BLOCK         (16 * 1024 * 1024)
+#define VTAPE_MAX_OPEN          16
+
+#pragma pack(push,1)
+typedef struct _VTAPE_FILE_HEADER {
+    char            magic[8];       /* "ZTVTAPE\0" */
+    unsigned char   version;        /* 1 */
+    unsigned char   reserved1[7];
+    unsigned char   capacity[8];    /* little-endian 64-bit, 0 = unlimited */
+    unsigned char   reserved2[8];
+} VTAPE_FILE_HEADER;                /* total 32 */
+
+typedef struct _VTAPE_RECORD {
+    unsigned char   type[4];        /* little-endian, VTAPE_REC_* */
+    unsigned char   length[4];      /* little-endian, payload bytes */
+} VTAPE_RECORD;                     /* total 8 */
+#pragma pack(pop)
+
+typedef struct _VTAPE {
+    HANDLE      hf;
+    ULONGLONG   offset;     /* file offset of next record */
+    ULONGLONG   fileEnd;    /* file offset of end of data */
+    ULONGLONG   payload;    /* payload bytes before offset */
+    ULONGLONG   block;      /* logical position: blocks + filemarks from BOT */
+    ULONGLONG   capacity;   /* bytes of payload, 0 = unlimited */
+    ULONGLONG   used;       /* payload bytes up to end of data */
+    WCHAR       path[MAX_PATH]; /* image file, sidecar files are named after it */
+} VTAPE;
+
+BOOL VTapeIsPath(LPCWSTR path);
+BOOL VTapeCreate(LPCWSTR path, ULONGLONG capacity);
+HANDLE VTapeOpen(LPCWSTR path);
+VTAPE* VTapeFromHandle(HANDLE h);
+void VTapeClose(HANDLE h);
+
+DWORD VTapeRewind(VTAPE *vt);
+DWORD VTapeRead(VTAPE *vt, void *buf, DWORD n, DWORD *got);
+DWORD VTapeWrite(VTAPE *vt, const void *buf, DWORD n, DWORD *written);
+DWORD VTapeWriteFilemark(VTAPE *vt);
+DWORD VTapeSpaceFilemarks(VTAPE *vt, LONG count);
+DWORD VTapeSpaceEndOfData(VTAPE *vt);
+DWORD VTapeErase(VTAPE *vt);
+DWORD VTapeEraseShort(VTAPE *vt);
+
+#endif
@@ -0,0 +1,568 @@
+#include "bench.h"
+
+/* --------------------------------------
+Timing & synthetic data helpers
+-------------------------------------- */
+static LONGLONG g_benchFreq = 0;
+static volatile ULONGLONG g_benchSink = 0; /* defeats dead code elimination */
+
+void BenchRngInit(BENCH_RNG *r, ULONGLONG seed)
+{
+    r->s = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+ULONGLONG BenchRngNext(BENCH_RNG *r)
+{
+    r->s ^= r->s >> 12;
+    r->s ^= r->s << 25;
+    r->s ^= r->s >> 27;
+    return r->s * 0x2545F4914F6CDD1DULL;
+}
+
+void BenchRngFill(BENCH_RNG *r, BYTE *dst, size_t n)
+{
+    ULONGLONG   v;
+    size_t      i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        v = BenchRngNext(r);
+        memcpy(dst + i, &v, 8);
+    }
+
+    v = BenchRngNext(r);
+    for (; i < n; i++, v >>= 8)
+        dst[i] = (BYTE)v;
+}
+
+LONGLONG BenchNow(void)
+{
+    LARGE_INTEGER li;
+
+    if (!g_benchFreq)
+    {
+        QueryPerformanceFrequency(&li);
+        g_benchFreq = li.QuadPart;
+    }
+
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
+double BenchSeconds(LONGLONG ticks)
+{
+    if (!g_benchFreq) BenchNow();
+    return (double)ticks / (double)g_benchFreq;
+}
+
+void BenchPrintRow(const char *kernel, const char *input,
+    ULONGLONG ops, double seconds, ULONGLONG bytes)
+{
+    double nsop = ops ? seconds * 1e9 / (double)ops : 0.0;
+    double gbs = (seconds > 0.0) ? (double)bytes / seconds / 1e9 : 0.0;
+
+    wprintf(L"BENCH\t%S\t%S\t%I64u\t%.2f\t%.3f\r\n", kernel, input, ops, nsop, gbs);
+    fflush(stdout);
+}
+
+static BOOL BenchSelected(const BENCH_OPTIONS *opt, const char *kernel)
+{
+    WCHAR wk[64];
+
+    if (!opt->filter || !opt->filter[0]) return TRUE;
+
+    MultiByteToWideChar(CP_ACP, 0, kernel, -1, wk, 64);
+    return wcsstr(wk, opt->filter) != NULL;
+}
+
+static BOOL BenchDone(const BENCH_OPTIONS *opt, LONGLONG start)
+{
+    return BenchSeconds(BenchNow() - start) * 1000.0 >= (double)opt->minTimeMs;
+}
+
+/* "Архив/文件/" - mixed 2 and 3 byte UTF-8 sequences */
+static const char g_utf8Segment[] =
+    "\xD0\x90\xD1\x80\xD1\x85\xD0\xB8\xD0\xB2/\xE6\x96\x87\xE4\xBB\xB6/";
+
+static size_t BuildLongUtf8Name(char *out, size_t outsz)
+{
+    size_t seg = sizeof(g_utf8Segment) - 1;
+    size_t n = 0;
+
+    while (n + seg + 16 < outsz)
+    {
+        memcpy(out + n, g_utf8Segment, seg);
+        n += seg;
+    }
+    memcpy(out + n, "file.bin", 8);
+    n += 8;
+    out[n] = 0;
+    return n;
+}
+
+/* --------------------------------------
+Kernels
+-------------------------------------- */
+static void BenchSha1(const BENCH_OPTIONS *opt, DWORD chunk, const char *input)
+{
+    BYTE            *buf;
+    BENCH_RNG       rng;
+    SHA1_CTX        ctx;
+    unsigned char   digest[20];
+    ULONGLONG       ops = 0;
+    LONGLONG        start;
+    int             i;
+
+    buf = (BYTE*)malloc(chunk);
+    if (!buf) return;
+
+    BenchRngInit(&rng, 1);
+    BenchRngFill(&rng, buf, chunk);
+
+    sha1_init(&ctx);
+    start = BenchNow();
+    do
+    {
+        for (i = 0; i < 16; i++)
+            sha1_update(&ctx, buf, chunk);
+        ops += 16;
+    } while (!BenchDone(opt, start));
+    BenchPrintRow("sha1_update", input, ops, BenchSeconds(BenchNow() - start),
+        ops * chunk);
+
+    sha1_final(&ctx, digest);
+    g_benchSink += digest[0];
+    free(buf);
+}
+
+#define BENCH_HEADERS 4096
+
+static TAR_HDR_FULL* BuildHeaders(void)
+{
+    TAR_HDR_FULL    *hdrs;
+    BENCH_RNG       rng;
+    char            name[100];
+    int             i;
+
+    hdrs = (TAR_HDR_FULL*)malloc(sizeof(TAR_HDR_FULL) * BENCH_HEADERS);
+    if (!hdrs) return NULL;
+
+    BenchRngInit(&rng, 2);
+    for (i = 0; i < BENCH_HEADERS; i++)
+    {
+        _snprintf(name, sizeof(name), "dir%03d/small_file_%06d.txt", i % 97, i);
+        name[sizeof(name) - 1] = 0;
+        TarInitHeader(&hdrs[i], name, BenchRngNext(&rng) % 8192);
+    }
+
+    return hdrs;
+}
+
+static void BenchTarChecksum(const BENCH_OPTIONS *opt)
+{
+    TAR_HDR_FULL    *hdrs;
+    ULONGLONG       ops = 0;
+    ULONGLONG       sum = 0;
+    LONGLONG        start;
+    int             i;
+
+    hdrs = BuildHeaders();
+    if (!hdrs) return;
+
+    start = BenchNow();
+    do
+    {
+        for (i = 0; i < BENCH_HEADERS; i++)
+            sum += TarChecksum((const TAR_HDR*)&hdrs[i]);
+        ops += BENCH_HEADERS;
+    } while (!BenchDone(opt, start));
+    BenchPrintRow("TarChecksum", "many-small-file-headers", ops,
+        BenchSeconds(BenchNow() - start), ops * 512);
+
+    g_benchSink += sum;
+    free(hdrs);
+}
+
+static void BenchOctalToULL(const BENCH_OPTIONS *opt)
+{
+    TAR_HDR_FULL    *hdrs;
+    ULONGLONG       ops = 0;
+    ULONGLONG       sum = 0;
+    LONGLONG        start;
+    int             i;
+
+    hdrs = BuildHeaders();
+    if (!hdrs) return;
+
+    start = BenchNow();
+    do
+    {
+        for (i = 0; i < BENCH_HEADERS; i++)
+            sum += OctalToULL(hdrs[i].size, sizeof(hdrs[i].size));
+        ops += BENCH_HEADERS;
+    } while (!BenchDone(opt, start));
+    BenchPrintRow("OctalToULL", "tar-size-field", ops,
+        BenchSeconds(BenchNow() - start), ops * sizeof(hdrs[0].size));
+
+    g_benchSink += sum;
+    free(hdrs);
+}
+
+/* Large PAX block: many xattr records, "path" is the last record */
+static void BenchParsePax(const BENCH_OPTIONS *opt)
+{
+    const DWORD     cap = 64 * 1024;
+    BYTE            *pax;
+    DWORD           len = 0;
+    char            rec[256];
+    char            value[64];
+    char            name[512];
+    char            out[4096];
+    int             n, total, k = 0;
+    ULONGLONG       ops = 0;
+    LONGLONG        start;
+    int             i;
+
+    pax = (BYTE*)malloc(cap);
+    if (!pax) return;
+
+    BuildLongUtf8Name(name, 200);
+    for (;;)
+    {
+        _snprintf(value, sizeof(value), "SCHILY.xattr.user.key%05d=value%05d", k, k);
+        value[sizeof(value) - 1] = 0;
+        n = (int)strlen(value) + 2; /* ' ' and '\n' */
+        total = n + 1;
+        while (total != n + (int)strlen(_itoa(total, rec, 10))) total++;
+        if (len + total + 1024 > cap) break;
+        _snprintf(rec, sizeof(rec), "%d %s\n", total, value);
+        memcpy(pax + len, rec, total);
+        len += total;
+        k++;
+    }
+
+    n = (int)strlen(name) + 7; /* "path=" + ' ' + '\n' */
+    total = n + 1;
+    while (total != n + (int)strlen(_itoa(total, rec, 10))) total++;
+    len += _snprintf((char*)pax + len, cap - len, "%d path=%s\n", total, name);
+
+    start = BenchNow();
+    do
+    {
+        for (i = 0; i < 16; i++)
+            g_benchSink += ParsePaxAndGet(pax, len, "path", out, sizeof(out));
+        ops += 16;
+    } while (!BenchDone(opt, start));
+    BenchPrintRow("ParsePaxAndGet", "large-pax-block-64KiB", ops,
+        BenchSeconds(BenchNow() - start), ops * len);
+
+    free(pax);
+}
+
+static void BenchUtf8(const BENCH_OPTIONS *opt)
+{
+    char            name[1024];
+    char            acp[1024];
+    WCHAR           out[1024];
+    size_t          n, i;
+    ULONGLONG       ops;
+    LONGLONG        start;
+    int             j;
+
+    n = BuildLongUtf8Name(name, sizeof(name));
+
+    if (BenchSelected(opt, "Utf8ToWide"))
+    {
+        ops = 0;
+        start = BenchNow();
+        do
+        {
+            for (j = 0; j < 64; j++)
+                g_benchSink += Utf8ToWide(name, n, out, 1024);
+            ops += 64;
+        } while (!BenchDone(opt, start));
+        BenchPrintRow("Utf8ToWide", "long-utf8-name", ops,
+            BenchSeconds(BenchNow() - start), ops * n);
+    }
+
+    if (BenchSelected(opt, "MultiByteGuessToWide"))
+    {
+        ops = 0;
+        start = BenchNow();
+        do
+        {
+            for (j = 0; j < 64; j++)
+                g_benchSink += MultiByteGuessToWide(name, n, out, 1024);
+            ops += 64;
+        } while (!BenchDone(opt, start));
+        BenchPrintRow("MultiByteGuessToWide", "long-utf8-name", ops,
+            BenchSeconds(BenchNow() - start), ops * n);
+
+        /* single-byte codepage name: strict UTF-8 fails, falls back to ACP */
+        for (i = 0; i < n; i++)
+            acp[i] = (char)(0xC0 + (i % 32));
+        acp[n] = 0;
+
+        ops = 0;
+        start = BenchNow();
+        do
+        {
+            for (j = 0; j < 64; j++)
+                g_benchSink += MultiByteGuessToWide(acp, n, out, 1024);
+            ops += 64;
+        } while (!BenchDone(opt, start));
+        BenchPrintRow("MultiByteGuessToWide", "long-acp-name-fallback", ops,
+            BenchSeconds(BenchNow() - start), ops * n);
+    }
+}
+
+static void BenchFPrintLine(const BENCH_OPTIONS *opt)
+{
+    char            name[1024];
+    WCHAR           line[1024];
+    FILE            *f;
+    size_t          n;
+    ULONGLONG       ops = 0;
+    LONGLONG        start;
+    int             j;
+
+    n = BuildLongUtf8Name(name, sizeof(name));
+    Utf8ToWide(name, n, line, 1024);
+
+    f = _wfopen(L"NUL", L"wb");
+    if (!f) return;
+
+    start = BenchNow();
+    do
+    {
+        for (j = 0; j < 64; j++)
+            FPrintLineUtf8(f, line);
+        ops += 64;
+    } while (!BenchDone(opt, start));
+    BenchPrintRow("FPrintLineUtf8", "long-utf8-name", ops,
+        BenchSeconds(BenchNow() - start), ops * (n + 2));
+
+    fclose(f);
+}
+
+/* TapeReaderGet over a cached temp file: measures reader overhead, not media */
+static void BenchTapeReader(const BENCH_OPTIONS *opt, DWORD step, const char *input)
+{
+    const DWORD     fileSize = 32 * 1024 * 1024;
+    WCHAR           dir[MAX_PATH];
+    WCHAR           path[MAX_PATH];
+    HANDLE          h;
+    BYTE            *buf;
+    BENCH_RNG       rng;
+    DWORD           done, wr;
+    TAPE_READER     *tr;
+    ULONGLONG       ops = 0;
+    LONGLONG        start;
+    DWORD           got;
+
+    if (!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"tbb", 0, path))
+        return;
+
+    h = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+
+    buf = (BYTE*)malloc(TAPE_IO_BUF);
+    tr = (TAPE_READER*)malloc(sizeof(TAPE_READER));
+    if (!buf || !tr)
+    {
+        free(buf);
+        free(tr);
+        CloseHandle(h);
+        return;
+    }
+
+    BenchRngInit(&rng, 3);
+    for (done = 0; done < fileSize; done += TAPE_IO_BUF)
+    {
+        BenchRngFill(&rng, buf, TAPE_IO_BUF);
+        WriteFile(h, buf, TAPE_IO_BUF, &wr, NULL);
+    }
+
+    SetFilePointer(h, 0, NULL, FILE_BEGIN);
+    if (!TapeReaderInit(tr, h))
+    {
+        free(tr);
+        free(buf);
+        CloseHandle(h);
+        return;
+    }
+    start = BenchNow();
+    do
+    {
+        got = TapeReaderGet(tr, buf, step);
+        if (got < step)
+        {
+            SetFilePointer(h, 0, NULL, FILE_BEGIN);
+            tr->pos = 0;
+            tr->avail = 0;
+            tr->atFilemark = FALSE;
+            continue;
+        }
+        ops++;
+    } while ((ops & 1023) || !BenchDone(opt, start));
+    BenchPrintRow("TapeReaderGet", input, ops,
+        BenchSeconds(BenchNow() - start), ops * step);
+
+    TapeReaderFree(tr);
+    free(tr);
+    free(buf);
+    CloseHandle(h);
+}
+
+int BenchMicro(const BENCH_OPTIONS *opt)
+{
+    wprintf(L"# TapeBench micro format=%d min-time=%lums\r\n",
+        BENCH_FORMAT_VERSION, (unsigned long)opt->minTimeMs);
+    wprintf(L"# BENCH\tkernel\tinput\tops\tns/op\tGB/s\r\n");
+
+    if (BenchSelected(opt, "sha1_update"))
+    {
+        BenchSha1(opt, 64 * 1024, "random-64KiB");
+        BenchSha1(opt, 512, "random-512B");
+    }
+    if (BenchSelected(opt, "TarChecksum")) BenchTarChecksum(opt);
+    if (BenchSelected(opt, "OctalToULL")) BenchOctalToULL(opt);
+    if (BenchSelected(opt, "ParsePaxAndGet")) BenchParsePax(opt);
+    BenchUtf8(opt);
+    if (BenchSelected(opt, "FPrintLineUtf8")) BenchFPrintLine(opt);
+    if (BenchSelected(opt, "TapeReaderGet"))
+    {
+        BenchTapeReader(opt, 512, "file-512B-gets");
+        BenchTapeReader(opt, TAPE_IO_BUF, "file-64KiB-gets");
+    }
+
+    return 0;
+}
+
+/* --------------------------------------
+Entry point
+TapeBench [micro] [/filter:<kernel>] [/min-time:<ms>]
+TapeBench gen <out.tar> [/profile:<name>] [/files:<n>] [/size:<bytes>] [/seed:<n>]
+TapeBench e2e <in.tar> [/work:<dir>] [/keep]
+TapeBench library <in.tar> [/work:<dir>] [/cartridges:<n>] [/move-ms:<ms>] [/keep]
+-------------------------------------- */
+static int BenchUsage(void)
+{
+    wprintf(L"Usage: TapeBench [micro] [/filter:<kernel>] [/min-time:<ms>]\r\n");
+    wprintf(L"       TapeBench gen <out.tar> [/profile:tiny|large|deep|unicode|mixed]\r\n");
+    wprintf(L"                 [/files:<n>] [/size:<bytes>] [/seed:<n>]\r\n");
+    wprintf(L"       TapeBench e2e <in.tar> [/work:<dir>] [/keep]\r\n");
+    wprintf(L"       TapeBench library <in.tar> [/work:<dir>] [/cartridges:<n>]\r\n");
+    wprintf(L"                 [/move-ms:<ms>] [/keep]\r\n");
+    return 2;
+}
+
+static int BenchGenMain(int argc, WCHAR **argv)
+{
+    TARGEN_OPTIONS  opt;
+    int             i;
+
+    if (argc < 3) return BenchUsage();
+
+    ZeroMemory(&opt, sizeof(opt));
+    opt.profile = TARGEN_PROFILE_MIXED;
+    opt.seed = 1;
+
+    for (i = 3; i < argc; i++)
+    {
+        if (_wcsnicmp(argv[i], L"/profile:", 9) == 0)
+        {
+            opt.profile = TarGenProfileFromName(argv[i] + 9);
+            if (opt.profile < 0) return BenchUsage();
+        }
+        else if (_wcsnicmp(argv[i], L"/files:", 7) == 0)
+            opt.files = _wcstoui64(argv[i] + 7, NULL, 10);
+        else if (_wcsnicmp(argv[i], L"/size:", 6) == 0)
+            opt.size = _wcstoui64(argv[i] + 6, NULL, 10);
+        else if (_wcsnicmp(argv[i], L"/seed:", 6) == 0)
+            opt.seed = _wcstoui64(argv[i] + 6, NULL, 10);
+        else
+            return BenchUsage();
+    }
+
+    return BenchGenerate(argv[2], &opt);
+}
+
+static int BenchE2EMain(int argc, WCHAR **argv)
+{
+    LPCWSTR workDir = L"e2e_work";
+    BOOL    keep = FALSE;
+    int     i;
+
+    if (argc < 3) return BenchUsage();
+
+    for (i = 3; i < argc; i++)
+    {
+        if (_wcsnicmp(argv[i], L"/work:", 6) == 0)
+            workDir = argv[i] + 6;
+        else if (_wcsicmp(argv[i], L"/keep") == 0)
+            keep = TRUE;
+        else
+            return BenchUsage();
+    }
+
+    return BenchEndToEnd(argv[2], workDir, keep);
+}
+
+static int BenchLibraryMain(int argc, WCHAR **argv)
+{
+    LPCWSTR workDir = L"e2e_work";
+    DWORD   cartridges = LIBRARY_DEFAULT_CARTRIDGES;
+    DWORD   moveMs = LIBRARY_DEFAULT_MOVE_MS;
+    BOOL    keep = FALSE;
+    int     i;
+
+    if (argc < 3) return BenchUsage();
+
+    for (i = 3; i < argc; i++)
+    {
+        if (_wcsnicmp(argv[i], L"/work:", 6) == 0)
+            workDir = argv[i] + 6;
+        else if (_wcsnicmp(argv[i], L"/cartridges:", 12) == 0)
+            cartridges = (DWORD)_wtoi(argv[i] + 12);
+        else if (_wcsnicmp(argv[i], L"/move-ms:", 9) == 0)
+            moveMs = (DWORD)_wtoi(argv[i] + 9);
+        else if (_wcsicmp(argv[i], L"/keep") == 0)
+            keep = TRUE;
+        else
+            return BenchUsage();
+    }
+
+    /* a job per cartridge and step must fit the scheduler */
+    if (cartridges < 1 || cartridges > SCHED_MAX_JOBS / 2) return BenchUsage();
+    return BenchLibrary(argv[2], workDir, cartridges, moveMs, keep);
+}
+
+int wmain(int argc, WCHAR **argv)
+{
+    BENCH_OPTIONS   opt;
+    int             i;
+
+    if (argc > 1 && _wcsicmp(argv[1], L"gen") == 0)
+        return BenchGenMain(argc, argv);
+    if (argc > 1 && _wcsicmp(argv[1], L"e2e") == 0)
+        return BenchE2EMain(argc, argv);
+    if (argc > 1 && _wcsicmp(argv[1], L"library") == 0)
+        return BenchLibraryMain(argc, argv);
+
+    ZeroMemory(&opt, sizeof(opt));
+    opt.minTimeMs = BENCH_DEFAULT_MIN_MS;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (_wcsnicmp(argv[i], L"/filter:", 8) == 0)
+            opt.filter = argv[i] + 8;
+        else if (_wcsnicmp(argv[i], L"/min-time:", 10) == 0)
+            opt.minTimeMs = (DWORD)_wtoi(argv[i] + 10);
+        else if (_wcsicmp(argv[i], L"micro") != 0)
+            return BenchUsage();
+    }
+
+    return BenchMicro(&opt);
+}
@@ -0,0 +1,82 @@
+#ifndef __TAPE_BENCH
+#define __TAPE_BENCH
+
+#include "common.h"
+#include "utils.h"
+#include "tape.h"
+#include "archive.h"
+#include "jobs.h"
+#include "changer.h"
+#include "scheduler.h"
+#include "catalog.h"
+#include "toc.h"
+
+/* --------------------------------------
+Output format (stable, tab separated, one row per measurement):
+BENCH <kernel> <input> <ops> <ns/op> <GB/s>
+Lines starting with '#' are comments.
+-------------------------------------- */
+#define BENCH_FORMAT_VERSION    1
+#define BENCH_DEFAULT_MIN_MS    500
+
+typedef struct _BENCH_OPTIONS {
+    DWORD       minTimeMs;      /* minimum measured time per kernel */
+    const WCHAR *filter;        /* run only kernels containing this substring */
+} BENCH_OPTIONS;
+
+/* Deterministic xorshift64* generator: same seed - same synthetic data */
+typedef struct _BENCH_RNG {
+    ULONGLONG s;
+} BENCH_RNG;
+
+void BenchRngInit(BENCH_RNG *r, ULONGLONG seed);
+ULONGLONG BenchRngNext(BENCH_RNG *r);
+void BenchRngFill(BENCH_RNG *r, BYTE *dst, size_t n);
+
+LONGLONG BenchNow(void);
+double BenchSeconds(LONGLONG ticks);
+void BenchPrintRow(const char *kernel, const char *input,
+    ULONGLONG ops, double seconds, ULONGLONG bytes);
+
+int BenchMicro(const BENCH_OPTIONS *opt);
+
+/* --------------------------------------
+Synthetic tar corpus (targen.c)
+Same profile, file count, size and seed - byte-identical archive.
+-------------------------------------- */
+#define TARGEN_PROFILE_TINY     0   /* many tiny files, short ustar names */
+#define TARGEN_PROFILE_LARGE    1   /* few huge files (base-256 size + PAX size) */
+#define TARGEN_PROFILE_DEEP     2   /* deep paths via GNU longname and PAX path */
+#define TARGEN_PROFILE_UNICODE  3   /* non-ASCII UTF-8 names */
+#define TARGEN_PROFILE_MIXED    4   /* all of the above interleaved */
+
+typedef struct _TARGEN_OPTIONS {
+    int         profile;        /* TARGEN_PROFILE_* */
+    ULONGLONG   files;          /* 0 = profile default */
+    ULONGLONG   size;           /* max file size, 0 = profile default */
+    ULONGLONG   seed;
+} TARGEN_OPTIONS;
+
+int TarGenProfileFromName(LPCWSTR name);
+int BenchGenerate(LPCWSTR outPath, const TARGEN_OPTIONS *opt);
+
+/* --------------------------------------
+End-to-end pipeline (e2e.c), on a virtual tape file:
+E2E <stage> <bytes> <wall_s> <MB/s> <cpu_s> <peak_rss_MiB>
+peak_rss_MiB is the process peak so far, not per stage.
+-------------------------------------- */
+int BenchEndToEnd(LPCWSTR tarPath, LPCWSTR workDir, BOOL keep);
+
+/* --------------------------------------
+Tape library (e2e.c): virtual changer with LIBRARY_DRIVES drives and one
+blank cartridge per slot, backup then verify of each cartridge through
+the scheduler by barcode. One E2E row "library", bytes written + read;
+wall time shows how much robot time hid behind the other drive.
+-------------------------------------- */
+#define LIBRARY_DRIVES              2
+#define LIBRARY_DEFAULT_CARTRIDGES  4
+#define LIBRARY_DEFAULT_MOVE_MS     2000
+
+int BenchLibrary(LPCWSTR tarPath, LPCWSTR workDir, DWORD cartridges, DWORD moveMs, BOOL keep);
+
+#endif
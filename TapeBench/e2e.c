@@ -0,0 +1,320 @@
+#include "bench.h"
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+/* --------------------------------------
+Per-stage resource sampling
+-------------------------------------- */
+typedef struct _E2E_SAMPLE {
+    LONGLONG    wall;
+    ULONGLONG   cpu100ns;   /* user + kernel */
+} E2E_SAMPLE;
+
+static ULONGLONG FileTimeToU64(const FILETIME *ft)
+{
+    return ((ULONGLONG)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+}
+
+static void E2ESample(E2E_SAMPLE *s)
+{
+    FILETIME c, e, k, u;
+
+    s->wall = BenchNow();
+    s->cpu100ns = 0;
+    if (GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u))
+        s->cpu100ns = FileTimeToU64(&k) + FileTimeToU64(&u);
+}
+
+static void E2EPrintRow(const char *stage, ULONGLONG bytes,
+    const E2E_SAMPLE *a, const E2E_SAMPLE *b, BOOL ok)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    double                  wall = BenchSeconds(b->wall - a->wall);
+    double                  cpu = (double)(b->cpu100ns - a->cpu100ns) / 1e7;
+    double                  peak = 0.0;
+
+    ZeroMemory(&pmc, sizeof(pmc));
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        peak = (double)pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+
+    wprintf(L"E2E\t%S%S\t%I64u\t%.3f\t%.1f\t%.3f\t%.1f\r\n", stage, ok ? "" : "(failed)",
+        bytes, wall, (wall > 0.0) ? (double)bytes / wall / 1e6 : 0.0, cpu, peak);
+    fflush(stdout);
+}
+
+/* --------------------------------------
+Catalog lookups (see catalog.h)
+-------------------------------------- */
+#define E2E_PATH_MAX    4096
+
+static BOOL E2EFirstHit(void *ctx, const CATALOG_HIT *hit)
+{
+    a_strncpyz((char*)ctx, E2E_PATH_MAX, hit->path);
+    return FALSE;
+}
+
+static BOOL E2ECountHit(void *ctx, const CATALOG_HIT *hit)
+{
+    (void)ctx;
+    (void)hit;
+    return TRUE;
+}
+
+/* --------------------------------------
+Columnar TOC (see toc.h): map it and read every block's sizes
+-------------------------------------- */
+static BOOL E2ELoadToc(LPCWSTR path, ULONGLONG *entries)
+{
+    TOC_VIEW    v;
+    TOC_COLUMNS c;
+    DWORD       blk, i;
+    ULONGLONG   total = 0, bytes = 0;
+    BOOL        ok = TRUE;
+
+    if (!TocMap(&v, path)) return FALSE;
+    for (blk = 0; blk < v.blocks && ok; blk++)
+    {
+        ok = TocBlock(&v, blk, &c);
+        for (i = 0; ok && i < c.rows; i++)
+            bytes += c.size[i];
+        total += c.rows;
+    }
+    ok = ok && total == v.entries;
+    TocUnmap(&v);
+
+    *entries = total;
+    return ok && (bytes > 0 || total == 0);
+}
+
+/* --------------------------------------
+Make -> Verify -> TOC -> Restore -> catalog lookup on a virtual tape file
+-------------------------------------- */
+int BenchEndToEnd(LPCWSTR tarPath, LPCWSTR workDir, BOOL keep)
+{
+    WCHAR       vtapePath[MAX_PATH * 2];
+    WCHAR       logPath[MAX_PATH * 2];
+    WCHAR       tocPath[MAX_PATH * 2];
+    WCHAR       columnsPath[MAX_PATH * 2];
+    WCHAR       restoreDir[MAX_PATH * 2];
+    WCHAR       restored[MAX_PATH * 2];
+    WCHAR       catalogDir[MAX_PATH];
+    char        path[E2E_PATH_MAX];
+    DWORD       found = 0;
+    ULONGLONG   fsz = 0;
+    ULONGLONG   entries = 0;
+    ULONGLONG   csz = 0;
+    E2E_SAMPLE  a, b;
+    BOOL        ok;
+    BOOL        all = TRUE;
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return 1;
+    }
+
+    if (!EnsureDirectoryExistsW(workDir))
+    {
+        wprintf(L"Work directory not accessible.\r\n");
+        return 1;
+    }
+
+    JoinPath2W(vtapePath, MAX_PATH * 2, workDir, L"e2e.vtape");
+    JoinPath2W(logPath, MAX_PATH * 2, workDir, L"verify_log.txt");
+    JoinPath2W(tocPath, MAX_PATH * 2, workDir, L"toc.txt");
+    JoinPath2W(columnsPath, MAX_PATH * 2, workDir, L"toc.ztoc");
+    JoinPath2W(restoreDir, MAX_PATH * 2, workDir, L"restore");
+    JoinPath2W(catalogDir, MAX_PATH, workDir, L"catalog");
+    CatalogSetDir(catalogDir);
+    restored[0] = 0;
+
+    if (!VTapeCreate(vtapePath, 0))
+    {
+        PrintLastErrorW(L"Cannot create virtual tape", 0);
+        return 1;
+    }
+
+    wprintf(L"# TapeBench e2e format=%d archive=%I64u bytes\r\n",
+        BENCH_FORMAT_VERSION, fsz);
+    wprintf(L"# E2E\tstage\tbytes\twall_s\tMB/s\tcpu_s\tpeak_rss_MiB\r\n");
+
+    E2ESample(&a);
+    ok = JobMakeBackup(vtapePath, tarPath, "e2e", JOB_FLAG_OVERWRITE);
+    E2ESample(&b);
+    E2EPrintRow("make", fsz, &a, &b, ok);
+    all = all && ok;
+
+    if (ok)
+    {
+        E2ESample(&a);
+        ok = JobVerifyBackup(vtapePath, logPath);
+        E2ESample(&b);
+        E2EPrintRow("verify", fsz, &a, &b, ok);
+        all = all && ok;
+
+        E2ESample(&a);
+        ok = JobReadTOC(vtapePath, tocPath);
+        E2ESample(&b);
+        E2EPrintRow("toc", fsz, &a, &b, ok);
+        all = all && ok;
+
+        E2ESample(&a);
+        ok = JobReadTOC(vtapePath, columnsPath);
+        E2ESample(&b);
+        E2EPrintRow("toc-columns", fsz, &a, &b, ok);
+        all = all && ok;
+
+        E2ESample(&a);
+        ok = ok && E2ELoadToc(columnsPath, &entries);
+        E2ESample(&b);
+        if (!GetFileSize64W(columnsPath, &csz)) csz = 0;
+        E2EPrintRow("toc-load", csz, &a, &b, ok);
+        all = all && ok;
+
+        E2ESample(&a);
+        ok = JobRestoreBackup(vtapePath, restoreDir, JOB_FLAG_OVERWRITE,
+            restored, MAX_PATH * 2);
+        E2ESample(&b);
+        E2EPrintRow("restore", fsz, &a, &b, ok);
+        all = all && ok;
+
+        /* make, verify and toc cataloged the archive: find one of its files again */
+        path[0] = 0;
+        CatalogQuery(CATALOG_QUERY_PREFIX, "", 1, E2EFirstHit, path, &found);
+        E2ESample(&a);
+        ok = path[0] && CatalogQuery(CATALOG_QUERY_PATH, path, 0, E2ECountHit, NULL, &found) &&
+            found > 0;
+        E2ESample(&b);
+        E2EPrintRow("catalog-query", 0, &a, &b, ok);
+        all = all && ok;
+    }
+
+    if (!keep)
+    {
+        if (restored[0]) DeleteFileW(restored);
+        DeleteFileW(vtapePath);
+    }
+
+    return all ? 0 : 1;
+}
+
+/* --------------------------------------
+Backup + verify of every cartridge in a virtual changer, jobs by barcode
+-------------------------------------- */
+typedef struct _LIBRARY_RUN {
+    volatile LONG   left;
+    volatile LONG   failed;
+    HANDLE          done;
+} LIBRARY_RUN;
+
+static void LibraryNotify(const SCHED_JOB *j, SCHED_EVENT event, void *ctx)
+{
+    LIBRARY_RUN *run = (LIBRARY_RUN*)ctx;
+
+    if (event != SCHED_EVENT_FINISHED) return;
+    if (!j->ok) InterlockedExchange(&run->failed, 1);
+    if (InterlockedDecrement(&run->left) == 0) SetEvent(run->done);
+}
+
+static void LibraryCleanup(LPCWSTR dir)
+{
+    WIN32_FIND_DATAW    fd;
+    HANDLE              hf;
+    WCHAR               path[MAX_PATH];
+
+    JoinPath2W(path, MAX_PATH, dir, L"*.vtape");
+    hf = FindFirstFileW(path, &fd);
+    if (hf != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            JoinPath2W(path, MAX_PATH, dir, fd.cFileName);
+            DeleteFileW(path);
+        } while (FindNextFileW(hf, &fd));
+        FindClose(hf);
+    }
+
+    JoinPath2W(path, MAX_PATH, dir, CHANGER_VIRTUAL_FILE);
+    DeleteFileW(path);
+}
+
+int BenchLibrary(LPCWSTR tarPath, LPCWSTR workDir, DWORD cartridges, DWORD moveMs, BOOL keep)
+{
+    static CHANGER  c;
+    WCHAR           dir[MAX_PATH];
+    SCHED_JOB       job;
+    LIBRARY_RUN     run;
+    const char      *error;
+    ULONGLONG       fsz = 0;
+    E2E_SAMPLE      a, b;
+    DWORD           i;
+    BOOL            ok = TRUE;
+
+    if (!GetFileSize64W(tarPath, &fsz))
+    {
+        PrintLastErrorW(L"Cannot access TAR file", 0);
+        return 1;
+    }
+
+    JoinPath2W(dir, MAX_PATH, workDir, L"catalog");
+    CatalogSetDir(dir);
+    JoinPath2W(dir, MAX_PATH, workDir, L"library");
+    if (!EnsureDirectoryExistsW(workDir) ||
+        !ChangerCreateVirtual(dir, LIBRARY_DRIVES, cartridges, 0) || !ChangerOpen(&c, dir))
+    {
+        PrintLastErrorW(L"Cannot create virtual changer", 0);
+        return 1;
+    }
+    c.moveMs = moveMs;
+
+    run.left = (LONG)cartridges * 2;
+    run.failed = 0;
+    run.done = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!run.done || !SchedStart() || !SchedSetChanger(&c))
+    {
+        PrintLastErrorW(L"Cannot start scheduler", 0);
+        ChangerClose(&c);
+        return 1;
+    }
+
+    wprintf(L"# TapeBench library format=%d archive=%I64u bytes drives=%d cartridges=%lu move-ms=%lu\r\n",
+        BENCH_FORMAT_VERSION, fsz, LIBRARY_DRIVES, (unsigned long)cartridges, (unsigned long)moveMs);
+    wprintf(L"# E2E\tstage\tbytes\twall_s\tMB/s\tcpu_s\tpeak_rss_MiB\r\n");
+
+    /* backups before verifies by priority; cartridges come from slots as drives free up */
+    E2ESample(&a);
+    for (i = 0; i < cartridges * 2 && ok; i++)
+    {
+        ZeroMemory(&job, sizeof(job));
+        job.op = (i < cartridges) ? SCHED_OP_BACKUP : SCHED_OP_VERIFY;
+        job.priority = SchedDefaultPriority(job.op);
+        _snprintf(job.cartridge, 32, "%s", c.slots[i % cartridges].barcode);
+        job.cartridge[31] = 0;
+        wcscpy(job.path, tarPath);
+        _snprintf(job.name, 32, "lib%lu", (unsigned long)(i % cartridges + 1));
+        job.flags = JOB_FLAG_OVERWRITE;
+        job.notify = LibraryNotify;
+        job.ctx = &run;
+        ok = (SchedSubmit(&job, &error) != 0);
+        if (!ok)
+        {
+            wprintf(L"Submit failed: %S\r\n", error);
+            InterlockedExchangeAdd(&run.left, -(LONG)(cartridges * 2 - i));
+        }
+    }
+
+    if (run.left > 0) WaitForSingleObject(run.done, INFINITE);
+    E2ESample(&b);
+    ok = ok && !run.failed;
+    E2EPrintRow("library", fsz * cartridges * 2, &a, &b, ok);
+
+    SchedStop();
+    ChangerPrint(&c);
+    ChangerClose(&c);
+    CloseHandle(run.done);
+    if (!keep) LibraryCleanup(dir);
+
+    return ok ? 0 : 1;
+}
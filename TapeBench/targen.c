@@ -0,0 +1,347 @@
+#include "bench.h"
+
+/* --------------------------------------
+Buffered output
+-------------------------------------- */
+#define TARGEN_BUF      (1024 * 1024)
+#define TARGEN_PATTERN  (1024 * 1024)
+#define TARGEN_GNU_MAX  077777777777ULL     /* largest size in 11 octal digits */
+
+typedef struct _TARGEN_WRITER {
+    HANDLE      hf;
+    BYTE        *buf;
+    DWORD       used;
+    ULONGLONG   total;
+    BOOL        ok;
+} TARGEN_WRITER;
+
+static void GenFlush(TARGEN_WRITER *w)
+{
+    DWORD wr = 0;
+
+    if (w->ok && w->used)
+    {
+        if (!WriteFile(w->hf, w->buf, w->used, &wr, NULL) || wr != w->used)
+        {
+            PrintLastErrorW(L"Failed to write generated archive", 0);
+            w->ok = FALSE;
+        }
+    }
+    w->used = 0;
+}
+
+static void GenPut(TARGEN_WRITER *w, const void *p, size_t n)
+{
+    const BYTE  *src = (const BYTE*)p;
+    size_t      step;
+
+    while (n > 0 && w->ok)
+    {
+        step = TARGEN_BUF - w->used;
+        if (step > n) step = n;
+        memcpy(w->buf + w->used, src, step);
+        w->used += (DWORD)step;
+        w->total += step;
+        src += step;
+        n -= step;
+        if (w->used == TARGEN_BUF) GenFlush(w);
+    }
+}
+
+static void GenPad(TARGEN_WRITER *w, ULONGLONG size)
+{
+    static const BYTE zeros[512] = { 0 };
+    size_t pad = (size_t)(((size + 511ULL) & ~511ULL) - size);
+
+    if (pad) GenPut(w, zeros, pad);
+}
+
+/* --------------------------------------
+Headers
+-------------------------------------- */
+static void GenHeader(TARGEN_WRITER *w, const char *name, ULONGLONG size, char type)
+{
+    TAR_HDR_FULL    hdr;
+    unsigned        sum;
+    int             i;
+
+    TarInitHeader(&hdr, name, (size > TARGEN_GNU_MAX) ? 0 : size);
+    hdr.typeflag = type;
+    if (size > TARGEN_GNU_MAX)
+    {
+        /* GNU base-256: 0x80 marker, big-endian value in the rest */
+        memset(hdr.size, 0, sizeof(hdr.size));
+        hdr.size[0] = (char)0x80;
+        for (i = 11; i >= 4; i--, size >>= 8)
+            hdr.size[i] = (char)(size & 0xFF);
+    }
+    memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+    sum = TarChecksum512(&hdr);
+    U64ToOctal(sum, hdr.chksum, sizeof(hdr.chksum));
+    GenPut(w, &hdr, 512);
+}
+
+/* GNU 'L' record: full name in payload, truncated name in the next header */
+static void GenLongName(TARGEN_WRITER *w, const char *name, size_t len)
+{
+    GenHeader(w, "././@LongLink", len + 1, 'L');
+    GenPut(w, name, len + 1);
+    GenPad(w, len + 1);
+}
+
+/* PAX record "<len> <key>=<value>\n", len counts itself */
+static size_t GenPaxRecord(char *out, size_t outsz, const char *key, const char *value)
+{
+    size_t base = strlen(key) + strlen(value) + 3;
+    size_t len = base + 1;
+    char   digits[24];
+
+    for (;;)
+    {
+        _snprintf(digits, sizeof(digits), "%u", (unsigned)len);
+        digits[sizeof(digits) - 1] = 0;
+        if (base + strlen(digits) == len) break;
+        len = base + strlen(digits);
+    }
+
+    _snprintf(out, outsz, "%u %s=%s\n", (unsigned)len, key, value);
+    out[outsz - 1] = 0;
+    return len;
+}
+
+static void GenPax(TARGEN_WRITER *w, ULONGLONG index, const char *path, ULONGLONG size)
+{
+    char    payload[8192];
+    char    value[32];
+    char    name[100];
+    size_t  n = 0;
+
+    if (path)
+        n += GenPaxRecord(payload + n, sizeof(payload) - n, "path", path);
+    if (size > TARGEN_GNU_MAX)
+    {
+        _snprintf(value, sizeof(value), "%I64u", size);
+        value[sizeof(value) - 1] = 0;
+        n += GenPaxRecord(payload + n, sizeof(payload) - n, "size", value);
+    }
+
+    _snprintf(name, sizeof(name), "PaxHeaders/%I64u", index);
+    name[sizeof(name) - 1] = 0;
+    GenHeader(w, name, n, 'x');
+    GenPut(w, payload, n);
+    GenPad(w, n);
+}
+
+/* --------------------------------------
+Names
+-------------------------------------- */
+static const char *g_genWords[] = {
+    "\xD0\x90\xD1\x80\xD1\x85\xD0\xB8\xD0\xB2",                 /* Архив */
+    "\xE6\x96\x87\xE4\xBB\xB6",                                 /* 文件 */
+    "donn\xC3\xA9" "es",                                        /* données */
+    "\xCE\x95\xCE\xBB\xCE\xBB\xCE\xB7\xCE\xBD\xCE\xB9\xCE\xBA\xCE\xAC", /* Ελληνικά */
+    "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E",                     /* 日本語 */
+    "M\xC3\xBC" "ller"                                          /* Müller */
+};
+#define GEN_WORDS (sizeof(g_genWords) / sizeof(g_genWords[0]))
+
+static size_t GenNameTiny(char *out, size_t outsz, ULONGLONG i)
+{
+    _snprintf(out, outsz, "tiny/d%03u/f%07I64u.dat", (unsigned)(i % 1000), i);
+    out[outsz - 1] = 0;
+    return strlen(out);
+}
+
+static size_t GenNameDeep(char *out, size_t outsz, BENCH_RNG *r, ULONGLONG i)
+{
+    unsigned    depth = 12 + (unsigned)(BenchRngNext(r) % 40);
+    unsigned    d;
+    size_t      n;
+
+    n = (size_t)_snprintf(out, outsz, "deep/");
+    for (d = 0; d < depth && n + 32 < outsz; d++)
+        n += (size_t)_snprintf(out + n, outsz - n, "level%02u_%c/", d, 'a' + (int)(i % 26));
+    n += (size_t)_snprintf(out + n, outsz - n, "leaf%07I64u.bin", i);
+    out[outsz - 1] = 0;
+    return strlen(out);
+}
+
+static size_t GenNameUnicode(char *out, size_t outsz, BENCH_RNG *r, ULONGLONG i)
+{
+    unsigned    parts = 1 + (unsigned)(BenchRngNext(r) % 8);
+    unsigned    d;
+    size_t      n;
+
+    n = (size_t)_snprintf(out, outsz, "unicode/");
+    for (d = 0; d < parts && n + 40 < outsz; d++)
+        n += (size_t)_snprintf(out + n, outsz - n, "%s/",
+            g_genWords[(size_t)(BenchRngNext(r) % GEN_WORDS)]);
+    /* "файл" */
+    n += (size_t)_snprintf(out + n, outsz - n,
+        "\xD1\x84\xD0\xB0\xD0\xB9\xD0\xBB_%06I64u.txt", i);
+    out[outsz - 1] = 0;
+    return strlen(out);
+}
+
+/* --------------------------------------
+Members
+-------------------------------------- */
+static void GenContent(TARGEN_WRITER *w, const BYTE *pattern, ULONGLONG i, ULONGLONG size)
+{
+    size_t      off = (size_t)((i * 4099ULL) % TARGEN_PATTERN);
+    size_t      step;
+    ULONGLONG   left = size;
+
+    while (left > 0 && w->ok)
+    {
+        step = TARGEN_PATTERN - off;
+        if (step > left) step = (size_t)left;
+        GenPut(w, pattern + off, step);
+        left -= step;
+        off = 0;
+    }
+    GenPad(w, size);
+}
+
+/* name longer than ustar allows: GNU longname on even members, PAX on odd */
+static void GenMember(TARGEN_WRITER *w, const BYTE *pattern, ULONGLONG i,
+    const char *name, size_t len, ULONGLONG size)
+{
+    char short_[100];
+
+    if (len < sizeof(short_) && size <= TARGEN_GNU_MAX)
+    {
+        GenHeader(w, name, size, '0');
+    }
+    else
+    {
+        if (len >= sizeof(short_) && !(i & 1))
+            GenLongName(w, name, len);
+        else
+            GenPax(w, i, (len >= sizeof(short_)) ? name : NULL, size);
+
+        memcpy(short_, name, (len < sizeof(short_)) ? len : sizeof(short_) - 1);
+        short_[(len < sizeof(short_)) ? len : sizeof(short_) - 1] = 0;
+        GenHeader(w, short_, size, '0');
+    }
+
+    GenContent(w, pattern, i, size);
+}
+
+int TarGenProfileFromName(LPCWSTR name)
+{
+    if (_wcsicmp(name, L"tiny") == 0) return TARGEN_PROFILE_TINY;
+    if (_wcsicmp(name, L"large") == 0) return TARGEN_PROFILE_LARGE;
+    if (_wcsicmp(name, L"deep") == 0) return TARGEN_PROFILE_DEEP;
+    if (_wcsicmp(name, L"unicode") == 0) return TARGEN_PROFILE_UNICODE;
+    if (_wcsicmp(name, L"mixed") == 0) return TARGEN_PROFILE_MIXED;
+    return -1;
+}
+
+int BenchGenerate(LPCWSTR outPath, const TARGEN_OPTIONS *opt)
+{
+    static const char   *profiles[] = { "tiny", "large", "deep", "unicode", "mixed" };
+    static const BYTE   zeros[1024] = { 0 };
+    TARGEN_WRITER       w;
+    BENCH_RNG           rng;
+    BYTE                *pattern;
+    char                name[4096];
+    size_t              len;
+    ULONGLONG           files, maxSize, size, i;
+    int                 kind;
+    LONGLONG            start;
+    double              secs;
+
+    switch (opt->profile)
+    {
+    case TARGEN_PROFILE_TINY:   files = 1000000; maxSize = 4096; break;
+    case TARGEN_PROFILE_LARGE:  files = 3; maxSize = 100ULL * 1024 * 1024 * 1024; break;
+    case TARGEN_PROFILE_DEEP:   files = 100000; maxSize = 16384; break;
+    case TARGEN_PROFILE_UNICODE: files = 100000; maxSize = 16384; break;
+    default:                    files = 200000; maxSize = 64ULL * 1024 * 1024; break;
+    }
+    if (opt->files) files = opt->files;
+    if (opt->size) maxSize = opt->size;
+
+    ZeroMemory(&w, sizeof(w));
+    w.buf = (BYTE*)malloc(TARGEN_BUF);
+    pattern = (BYTE*)malloc(TARGEN_PATTERN);
+    if (!w.buf || !pattern)
+    {
+        wprintf(L"Out of memory.\r\n");
+        free(w.buf);
+        free(pattern);
+        return 1;
+    }
+
+    w.hf = CreateFileW(outPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (w.hf == INVALID_HANDLE_VALUE)
+    {
+        PrintLastErrorW(L"Cannot create output file", 0);
+        free(w.buf);
+        free(pattern);
+        return 1;
+    }
+    w.ok = TRUE;
+
+    BenchRngInit(&rng, opt->seed);
+    BenchRngFill(&rng, pattern, TARGEN_PATTERN);
+
+    wprintf(L"# TapeBench gen profile=%S files=%I64u size=%I64u seed=%I64u\r\n",
+        profiles[opt->profile], files, maxSize, opt->seed);
+
+    start = BenchNow();
+    for (i = 0; i < files && w.ok; i++)
+    {
+        kind = opt->profile;
+        if (kind == TARGEN_PROFILE_MIXED)
+        {
+            /* 1% big, 9% deep, 10% unicode, rest tiny */
+            kind = (int)(i % 100);
+            kind = (kind == 0) ? TARGEN_PROFILE_LARGE :
+                (kind < 10) ? TARGEN_PROFILE_DEEP :
+                (kind < 20) ? TARGEN_PROFILE_UNICODE : TARGEN_PROFILE_TINY;
+        }
+
+        switch (kind)
+        {
+        case TARGEN_PROFILE_LARGE:
+            len = (size_t)_snprintf(name, sizeof(name), "large/blob%03I64u.bin", i);
+            size = maxSize;
+            break;
+        case TARGEN_PROFILE_DEEP:
+            len = GenNameDeep(name, sizeof(name), &rng, i);
+            size = BenchRngNext(&rng) % (maxSize + 1);
+            break;
+        case TARGEN_PROFILE_UNICODE:
+            len = GenNameUnicode(name, sizeof(name), &rng, i);
+            size = BenchRngNext(&rng) % (maxSize + 1);
+            break;
+        default:
+            len = GenNameTiny(name, sizeof(name), i);
+            size = BenchRngNext(&rng) % (((opt->profile == TARGEN_PROFILE_MIXED) ? 4096 : maxSize) + 1);
+            break;
+        }
+
+        GenMember(&w, pattern, i, name, len, size);
+    }
+
+    /* end of archive: two zero blocks, then pad to a 10 KiB record */
+    GenPut(&w, zeros, sizeof(zeros));
+    while (w.ok && (w.total % 10240))
+        GenPut(&w, zeros, (size_t)((10240 - w.total % 10240) > sizeof(zeros) ?
+            sizeof(zeros) : 10240 - w.total % 10240));
+    GenFlush(&w);
+
+    secs = BenchSeconds(BenchNow() - start);
+    CloseHandle(w.hf);
+    free(w.buf);
+    free(pattern);
+
+    if (!w.ok) return 1;
+
+    wprintf(L"# generated %I64u members, %I64u bytes in %.1f s (%.1f MB/s)\r\n",
+        files, w.total, secs, (secs > 0.0) ? (double)w.total / secs / 1e6 : 0.0);
+    return 0;
+}